@@ -0,0 +1,22 @@
+@echo off
+rem Performance regression gate - builds, runs the bench suite and compares it
+rem against the baseline of this machine, failing on a regression. The first
+rem run, or a run with --update, stores the results as the new baseline.
+
+call build.bat
+
+if not exist "baselines" mkdir baselines
+set baseline=baselines\%COMPUTERNAME%.json
+set results=build\bench_suite.json
+
+if "%1"=="--update" goto store
+if not exist "%baseline%" goto store
+
+build\bench.exe --suite --json %results% --baseline %baseline%
+exit /b %errorlevel%
+
+:store
+build\bench.exe --suite --json %results%
+if errorlevel 1 exit /b 1
+copy /y %results% %baseline% >nul
+echo Stored %baseline% as the baseline
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Performance regression gate - builds, runs the bench suite and compares it
+# against the baseline of this machine, failing on a regression. The first
+# run, or a run with --update, stores the results as the new baseline.
+#
+#   ./bench.sh [--update] [bench options, e.g. --samples 31 --threshold 5]
+set -e
+
+update=0
+if [ "$1" = "--update" ]; then
+  update=1
+  shift
+fi
+
+./build.sh
+
+baseline=${BENCH_BASELINE:-baselines/$(hostname).json}
+mkdir -p "$(dirname "$baseline")"
+results=build/bench_suite.json
+
+if [ $update -eq 1 ] || [ ! -f "$baseline" ]; then
+  ./build/bench --suite --json "$results" "$@"
+  cp "$results" "$baseline"
+  echo "Stored $baseline as the baseline"
+else
+  ./build/bench --suite --json "$results" --baseline "$baseline" "$@"
+fi
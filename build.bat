@@ -8,12 +8,32 @@ if not exist "build" mkdir build
 
 pushd build
 
-%compiler_dir% /EHsc /Zi^
+%compiler_dir% /EHsc /Zi /O2 /std:c++17^
+  /Fe:"shadercompiler.exe"^
+  ../src/shadercompiler.cpp^
+  /link d3dcompiler.lib
+
+rem main.exe defines _DEBUG, the archive is built with the same flags
+shadercompiler.exe --debug shaders.bin
+
+%compiler_dir% /EHsc /Zi /std:c++17^
   /Fe:"main.exe"^
   ../src/main.cpp^
   /I"../lib/DirectX-Headers-main/include/directx/"^
   /link User32.lib Shell32.lib dxguid.lib d3d12.lib d3dcompiler.lib dxgi.lib
 
+%compiler_dir% /EHsc /Zi /O2 /std:c++17^
+  /Fe:"headless.exe"^
+  ../src/headless.cpp
+
+%compiler_dir% /EHsc /Zi /O2 /std:c++17^
+  /Fe:"bench.exe"^
+  ../src/bench.cpp
+
+%compiler_dir% /EHsc /Zi /O2 /std:c++17^
+  /Fe:"packer.exe"^
+  ../src/packer.cpp
+
 echo "Done building!"
 
 popd build
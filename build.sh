@@ -0,0 +1,26 @@
+#!/bin/sh
+# Linux build - the platform-neutral executables only, the D3D12 one is built by build.bat
+set -e
+
+compiler=${CXX:-g++}
+
+echo "Building..."
+echo "Creating build directory..."
+
+mkdir -p build
+
+cd build
+
+$compiler -std=c++17 -O2 -g -Wall -Wextra -pthread \
+  -o headless \
+  ../src/headless.cpp
+
+$compiler -std=c++17 -O2 -g -Wall -Wextra -pthread \
+  -o bench \
+  ../src/bench.cpp
+
+$compiler -std=c++17 -O2 -g -Wall -Wextra -pthread \
+  -o packer \
+  ../src/packer.cpp
+
+echo "Done building!"
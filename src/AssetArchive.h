@@ -0,0 +1,335 @@
+#ifndef _H_ASSET_ARCHIVE
+#define _H_ASSET_ARCHIVE
+
+// Packed asset archive. One file holds every asset so startup opens one
+// file instead of hundreds:
+//
+//   header | payloads, 64-byte aligned | entries | hash buckets | paths
+//
+// The archive is mapped, never read. Opening checks the header and the
+// table bounds, and a lookup hashes the path and probes an open-addressing
+// table that was built by the packer, so neither depends on the number of
+// assets. Stored payloads come back as views into the mapping. Compressed
+// ones (LZ4 block format, see Compression.h) are decompressed by the caller
+// into its own memory.
+//
+// Paths are stored with forward slashes. The path strings are kept so a
+// hash collision can never return the wrong asset.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Compression.h"
+#include "Helpers.h"
+#include "MappedFile.h"
+
+const uint32_t g_AssetArchiveMagic = 0x4B415048; // "HPAK"
+const uint32_t g_AssetArchiveVersion = 1;
+const uint32_t g_AssetArchiveAlignment = 64;
+const uint32_t g_AssetEntryCompressed = 1;
+
+struct AssetArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t bucketCount; // Power of two
+  uint64_t entriesOffset;
+  uint64_t bucketsOffset;
+  uint64_t pathsOffset;
+  uint64_t fileSize;
+};
+
+static_assert(sizeof(AssetArchiveHeader) == 48, "AssetArchiveHeader is part of the file format");
+
+struct AssetArchiveEntry {
+  uint64_t pathHash;
+  uint64_t offset;
+  uint64_t storedSize; // In the file
+  uint64_t size;       // Decompressed
+  uint64_t contentHash; // HashBytes of the decompressed bytes
+  uint32_t pathOffset;  // From pathsOffset
+  uint32_t pathLength;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(AssetArchiveEntry) == 56, "AssetArchiveEntry is part of the file format");
+
+// An asset in the mapped archive. Uncompressed data can be used in place.
+struct AssetView {
+  const uint8_t* data;
+  size_t storedSize;
+  size_t size;
+  bool compressed;
+};
+
+inline char NormalizeAssetPathChar(char c) {
+  return c == '\\' ? '/' : c;
+}
+
+// HashBytes of the path with forward slashes, without building the string
+inline uint64_t AssetPathHash(const char* path) {
+  uint64_t hash = HashBytes(nullptr, 0);
+  for (; *path; ++path) {
+    char c = NormalizeAssetPathChar(*path);
+    hash = HashBytes(&c, 1, hash);
+  }
+  return hash;
+}
+
+// Lays out an archive. Compression is kept only where it saves at least an
+// eighth of the asset.
+struct AssetArchiveWriter {
+  struct Asset {
+    std::string path;
+    std::vector<uint8_t> stored;
+    uint64_t size;
+    uint64_t contentHash;
+    bool compressed;
+  };
+
+  std::vector<Asset> assets;
+
+  // False if the path is already in the archive
+  bool Add(const char* path, const void* data, size_t size, bool compress) {
+    Asset asset;
+    asset.path = path;
+    std::replace(asset.path.begin(), asset.path.end(), '\\', '/');
+    for (const Asset& other : assets) {
+      if (other.path == asset.path) {
+        return false;
+      }
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    asset.size = size;
+    asset.contentHash = HashBytes(bytes, size);
+    asset.compressed = false;
+    if (compress && size > 0) {
+      asset.stored.resize(LzCompressBound(size));
+      size_t compressedSize = LzCompress(bytes, size, asset.stored.data());
+      asset.compressed = compressedSize <= size - size / 8;
+      asset.stored.resize(compressedSize);
+    }
+    if (!asset.compressed) {
+      asset.stored.assign(bytes, bytes + size);
+    }
+
+    assets.push_back(std::move(asset));
+    return true;
+  }
+
+  void Serialize(std::vector<uint8_t>& out) const {
+    AssetArchiveHeader header = {};
+    header.magic = g_AssetArchiveMagic;
+    header.version = g_AssetArchiveVersion;
+    header.entryCount = static_cast<uint32_t>(assets.size());
+    header.bucketCount = 1;
+    while (header.bucketCount < assets.size() * 2) {
+      header.bucketCount *= 2;
+    }
+
+    std::vector<AssetArchiveEntry> entries(assets.size());
+    std::string paths;
+    out.assign(sizeof(header), 0);
+    for (size_t i = 0; i < assets.size(); ++i) {
+      const Asset& asset = assets[i];
+      out.resize(AlignUpArchive(out.size()));
+
+      AssetArchiveEntry& entry = entries[i];
+      entry.pathHash = AssetPathHash(asset.path.c_str());
+      entry.offset = out.size();
+      entry.storedSize = asset.stored.size();
+      entry.size = asset.size;
+      entry.contentHash = asset.contentHash;
+      entry.pathOffset = static_cast<uint32_t>(paths.size());
+      entry.pathLength = static_cast<uint32_t>(asset.path.size());
+      entry.flags = asset.compressed ? g_AssetEntryCompressed : 0;
+      out.insert(out.end(), asset.stored.begin(), asset.stored.end());
+      paths += asset.path;
+    }
+
+    // Linear probing, an empty bucket holds 0 and the others entry + 1
+    std::vector<uint32_t> buckets(header.bucketCount, 0);
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+      uint32_t bucket = static_cast<uint32_t>(entries[i].pathHash) & (header.bucketCount - 1);
+      while (buckets[bucket] != 0) {
+        bucket = (bucket + 1) & (header.bucketCount - 1);
+      }
+      buckets[bucket] = i + 1;
+    }
+
+    out.resize(AlignUpArchive(out.size()));
+    header.entriesOffset = out.size();
+    AppendBytes(out, entries.data(), entries.size() * sizeof(AssetArchiveEntry));
+    header.bucketsOffset = out.size();
+    AppendBytes(out, buckets.data(), buckets.size() * sizeof(uint32_t));
+    header.pathsOffset = out.size();
+    AppendBytes(out, paths.data(), paths.size());
+    header.fileSize = out.size();
+    std::memcpy(out.data(), &header, sizeof(header));
+  }
+
+  bool Write(const char* path) const {
+    std::vector<uint8_t> bytes;
+    Serialize(bytes);
+    return WriteWholeFile(path, bytes.data(), bytes.size());
+  }
+
+private:
+  static size_t AlignUpArchive(size_t offset) {
+    return (offset + g_AssetArchiveAlignment - 1) & ~static_cast<size_t>(g_AssetArchiveAlignment - 1);
+  }
+
+  static void AppendBytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+    out.insert(out.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+  }
+};
+
+struct AssetArchive {
+  MappedFile file;
+  const AssetArchiveHeader* header = nullptr;
+  const AssetArchiveEntry* entries = nullptr;
+  const uint32_t* buckets = nullptr;
+  const char* paths = nullptr;
+
+  bool IsOpen() const {
+    return header != nullptr;
+  }
+
+  void Close() {
+    file.Close();
+    header = nullptr;
+    entries = nullptr;
+    buckets = nullptr;
+    paths = nullptr;
+  }
+
+  // False if the file is missing, damaged or of another version. Checks
+  // the layout, not the payloads - Verify() hashes those.
+  bool Open(const char* path) {
+    Close();
+    if (!file.Open(path) || file.size < sizeof(AssetArchiveHeader)) {
+      Close();
+      return false;
+    }
+
+    const AssetArchiveHeader* candidate = reinterpret_cast<const AssetArchiveHeader*>(file.data);
+    uint64_t size = file.size;
+    bool ok = candidate->magic == g_AssetArchiveMagic && candidate->version == g_AssetArchiveVersion &&
+      candidate->fileSize == size && candidate->bucketCount != 0 && (candidate->bucketCount & (candidate->bucketCount - 1)) == 0 &&
+      candidate->bucketCount >= candidate->entryCount &&
+      candidate->entriesOffset % alignof(AssetArchiveEntry) == 0 && candidate->entriesOffset <= size &&
+      (size - candidate->entriesOffset) / sizeof(AssetArchiveEntry) >= candidate->entryCount &&
+      candidate->bucketsOffset == candidate->entriesOffset + static_cast<uint64_t>(candidate->entryCount) * sizeof(AssetArchiveEntry) &&
+      candidate->pathsOffset == candidate->bucketsOffset + static_cast<uint64_t>(candidate->bucketCount) * sizeof(uint32_t) &&
+      candidate->pathsOffset <= size;
+    if (!ok) {
+      Close();
+      return false;
+    }
+
+    header = candidate;
+    entries = reinterpret_cast<const AssetArchiveEntry*>(file.data + header->entriesOffset);
+    buckets = reinterpret_cast<const uint32_t*>(file.data + header->bucketsOffset);
+    paths = reinterpret_cast<const char*>(file.data + header->pathsOffset);
+    return true;
+  }
+
+  uint32_t EntryCount() const {
+    return header ? header->entryCount : 0;
+  }
+
+  // Index of the asset's entry, or UINT32_MAX
+  uint32_t FindEntry(const char* path) const {
+    if (!header) {
+      return UINT32_MAX;
+    }
+
+    uint64_t hash = AssetPathHash(path);
+    uint32_t mask = header->bucketCount - 1;
+    for (uint32_t bucket = static_cast<uint32_t>(hash) & mask, probes = 0; probes <= mask; bucket = (bucket + 1) & mask, ++probes) {
+      uint32_t slot = buckets[bucket];
+      if (slot == 0 || slot > header->entryCount) {
+        return UINT32_MAX;
+      }
+
+      const AssetArchiveEntry& entry = entries[slot - 1];
+      if (entry.pathHash == hash && EntryPathMatches(entry, path)) {
+        return slot - 1;
+      }
+    }
+    return UINT32_MAX;
+  }
+
+  // False if the asset is missing or its entry points outside the file
+  bool View(uint32_t index, AssetView& view) const {
+    if (index >= EntryCount()) {
+      return false;
+    }
+
+    const AssetArchiveEntry& entry = entries[index];
+    if (entry.offset > header->entriesOffset || entry.storedSize > header->entriesOffset - entry.offset) {
+      return false;
+    }
+
+    bool compressed = (entry.flags & g_AssetEntryCompressed) != 0;
+    if (!compressed && entry.storedSize != entry.size) {
+      return false;
+    }
+    view = {file.data + entry.offset, static_cast<size_t>(entry.storedSize), static_cast<size_t>(entry.size), compressed};
+    return true;
+  }
+
+  bool Find(const char* path, AssetView& view) const {
+    return View(FindEntry(path), view);
+  }
+
+  // Decompressed bytes of a view, into out[0, view.size). Copies if the
+  // view is stored uncompressed.
+  static bool Read(const AssetView& view, uint8_t* out) {
+    if (!view.compressed) {
+      std::memcpy(out, view.data, view.size);
+      return true;
+    }
+    return LzDecompress(view.data, view.storedSize, out, view.size);
+  }
+
+  // Decompresses and hashes every asset. Slow, for tools and tests.
+  bool Verify() const {
+    std::vector<uint8_t> bytes;
+    for (uint32_t i = 0; i < EntryCount(); ++i) {
+      AssetView view;
+      if (!View(i, view)) {
+        return false;
+      }
+      bytes.resize(view.size);
+      if (!Read(view, bytes.data()) || HashBytes(bytes.data(), bytes.size()) != entries[i].contentHash) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  bool EntryPathMatches(const AssetArchiveEntry& entry, const char* path) const {
+    uint64_t pathsSize = header->fileSize - header->pathsOffset;
+    if (entry.pathOffset > pathsSize || entry.pathLength > pathsSize - entry.pathOffset) {
+      return false;
+    }
+
+    const char* stored = paths + entry.pathOffset;
+    for (uint32_t i = 0; i < entry.pathLength; ++i) {
+      if (path[i] == '\0' || NormalizeAssetPathChar(path[i]) != stored[i]) {
+        return false;
+      }
+    }
+    return path[entry.pathLength] == '\0';
+  }
+};
+
+#endif // _H_ASSET_ARCHIVE
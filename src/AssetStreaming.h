@@ -0,0 +1,630 @@
+#ifndef _H_ASSET_STREAMING
+#define _H_ASSET_STREAMING
+
+// Background asset streaming. Requests go to a few I/O threads that map the
+// file, decode it and write the result straight into staging memory, which
+// on D3D12 is a persistently mapped upload buffer. The staging memory is cut
+// into fixed slots; a thread that finds no free slot waits, so a burst of
+// requests can never outgrow the staging budget.
+//
+// Pump() runs once per frame on the render thread. It hands decoded assets
+// to an upload sink, which records the copies on its own queue and signals
+// its own fence, and retires uploads whose fence value completed: their slot
+// goes back to the I/O threads and the asset is reported ready. The render
+// thread only polls the fence, it never waits on the copy queue, and a
+// per-frame byte budget keeps a burst of loads from showing up as a hitch.
+//
+// Textures are binary PPM files decoded to RGBA8 with a full box-filtered
+// mip chain. Buffers are the file bytes as they are. Paths are looked up in
+// the asset archive first, if there is one, and in loose files after that.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AssetArchive.h"
+#include "Helpers.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+
+const uint32_t g_AssetMaxMips = 16;
+
+enum class AssetKind : uint8_t {
+  Texture,
+  Buffer,
+};
+
+enum class AssetStatus : uint8_t {
+  Queued,    // Waiting for or being decoded by an I/O thread
+  Uploading, // Copy submitted, fence not reached yet
+  Ready,
+  Failed,    // Missing, unreadable or larger than a staging slot
+};
+
+struct AssetMip {
+  uint64_t offset; // From the start of the asset's staging data
+  uint32_t width;
+  uint32_t height;
+  uint32_t rowPitch;
+};
+
+// Staging layout of an RGBA8 texture and its mips. Rows and mips are
+// aligned the way the copy queue wants to read them.
+struct AssetTextureLayout {
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipCount;
+  AssetMip mips[g_AssetMaxMips];
+  uint64_t size;
+};
+
+inline uint64_t AlignAssetOffset(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Full mip chain down to 1x1
+inline bool ComputeTextureLayout(uint32_t width, uint32_t height, uint32_t rowPitchAlignment, uint32_t placementAlignment, AssetTextureLayout& layout) {
+  if (width == 0 || height == 0 || width > (1u << (g_AssetMaxMips - 1)) || height > (1u << (g_AssetMaxMips - 1))) {
+    return false;
+  }
+
+  layout = {};
+  layout.width = width;
+  layout.height = height;
+
+  uint64_t offset = 0;
+  for (;;) {
+    AssetMip& mip = layout.mips[layout.mipCount++];
+    mip.offset = AlignAssetOffset(offset, placementAlignment);
+    mip.width = width;
+    mip.height = height;
+    mip.rowPitch = static_cast<uint32_t>(AlignAssetOffset(static_cast<uint64_t>(width) * 4, rowPitchAlignment));
+    offset = mip.offset + static_cast<uint64_t>(mip.rowPitch) * height;
+
+    if (width == 1 && height == 1) {
+      break;
+    }
+    width = std::max(1u, width / 2);
+    height = std::max(1u, height / 2);
+  }
+
+  layout.size = offset;
+  return true;
+}
+
+// Binary PPM ("P6", 8-bit). Finds the size and where the RGB pixels start.
+inline bool ParsePpmHeader(const uint8_t* data, size_t size, uint32_t& width, uint32_t& height, size_t& pixelOffset) {
+  if (size < 2 || data[0] != 'P' || data[1] != '6') {
+    return false;
+  }
+
+  size_t at = 2;
+  uint32_t values[3] = {};
+  for (uint32_t& value : values) {
+    // Whitespace and comments between the fields
+    while (at < size && (data[at] == ' ' || data[at] == '\t' || data[at] == '\r' || data[at] == '\n' || data[at] == '#')) {
+      if (data[at] == '#') {
+        while (at < size && data[at] != '\n') {
+          at++;
+        }
+      }
+      else {
+        at++;
+      }
+    }
+
+    size_t digits = 0;
+    while (at < size && data[at] >= '0' && data[at] <= '9' && digits < 6) {
+      value = value * 10 + (data[at++] - '0');
+      digits++;
+    }
+    if (digits == 0 || (at < size && data[at] >= '0' && data[at] <= '9')) {
+      return false;
+    }
+  }
+
+  // A single whitespace byte ends the header
+  if (at >= size || values[2] != 255) {
+    return false;
+  }
+
+  width = values[0];
+  height = values[1];
+  pixelOffset = at + 1;
+  return width > 0 && height > 0 && (size - pixelOffset) / 3 / width >= height;
+}
+
+inline bool WritePpm(const char* path, uint32_t width, uint32_t height, const uint8_t* rgb) {
+  std::FILE* file = std::fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok = std::fprintf(file, "P6\n%u %u\n255\n", width, height) > 0;
+  ok = ok && std::fwrite(rgb, static_cast<size_t>(width) * height * 3, 1, file) == 1;
+  return (std::fclose(file) == 0) && ok;
+}
+
+// Four 8-bit channels in 16-bit lanes, so four pixels add up without carries
+inline uint64_t SpreadRgba8(const uint8_t* pixel) {
+  uint32_t value;
+  std::memcpy(&value, pixel, 4);
+  uint64_t wide = value;
+  wide = (wide | (wide << 16)) & 0x0000FFFF0000FFFFull;
+  return (wide | (wide << 8)) & 0x00FF00FF00FF00FFull;
+}
+
+inline void StoreRgba8(uint64_t lanes, uint8_t* pixel) {
+  lanes &= 0x00FF00FF00FF00FFull;
+  lanes = (lanes | (lanes >> 8)) & 0x0000FFFF0000FFFFull;
+  uint32_t value = static_cast<uint32_t>(lanes | (lanes >> 16));
+  std::memcpy(pixel, &value, 4);
+}
+
+// Expands the RGB pixels to RGBA and builds the mips in scratch memory, then
+// writes every level to staging in order. Staging is write-combined upload
+// memory on D3D12 - it is written once, front to back, and never read.
+inline void DecodePpmTexture(const uint8_t* rgb, const AssetTextureLayout& layout, uint8_t* staging,
+    std::vector<uint8_t>& scratch, std::vector<uint8_t>& nextScratch) {
+  size_t pixelCount = static_cast<size_t>(layout.width) * layout.height;
+  scratch.resize(pixelCount * 4);
+  uint8_t* out = scratch.data();
+  for (size_t i = 0; i < pixelCount; ++i) {
+    uint32_t value = rgb[i * 3] | (rgb[i * 3 + 1] << 8) | (rgb[i * 3 + 2] << 16) | 0xFF000000u;
+    std::memcpy(out + i * 4, &value, 4);
+  }
+
+  for (uint32_t level = 0; level < layout.mipCount; ++level) {
+    const AssetMip& mip = layout.mips[level];
+    for (uint32_t y = 0; y < mip.height; ++y) {
+      std::memcpy(staging + mip.offset + static_cast<size_t>(y) * mip.rowPitch, scratch.data() + static_cast<size_t>(y) * mip.width * 4, mip.width * 4);
+    }
+
+    if (level + 1 == layout.mipCount) {
+      break;
+    }
+
+    // 2x2 box filter, odd edges repeat their last row or column
+    const AssetMip& next = layout.mips[level + 1];
+    nextScratch.resize(static_cast<size_t>(next.width) * next.height * 4);
+    for (uint32_t y = 0; y < next.height; ++y) {
+      const uint8_t* row0 = scratch.data() + static_cast<size_t>(std::min(2 * y, mip.height - 1)) * mip.width * 4;
+      const uint8_t* row1 = scratch.data() + static_cast<size_t>(std::min(2 * y + 1, mip.height - 1)) * mip.width * 4;
+      uint8_t* nextRow = nextScratch.data() + static_cast<size_t>(y) * next.width * 4;
+      for (uint32_t x = 0; x < next.width; ++x) {
+        uint32_t x0 = std::min(2 * x, mip.width - 1) * 4;
+        uint32_t x1 = std::min(2 * x + 1, mip.width - 1) * 4;
+        uint64_t sum = SpreadRgba8(row0 + x0) + SpreadRgba8(row0 + x1) + SpreadRgba8(row1 + x0) + SpreadRgba8(row1 + x1);
+        StoreRgba8((sum + 0x0002000200020002ull) >> 2, nextRow + x * 4);
+      }
+    }
+    scratch.swap(nextScratch);
+  }
+}
+
+// Where decoded assets go. The D3D12 sink records copies on a copy queue
+// with its own fence; the mock copies into CPU memory.
+struct AssetUploadSink {
+  virtual ~AssetUploadSink() = default;
+
+  // Records the copy of a decoded asset out of staging
+  virtual void CopyTexture(uint32_t asset, const AssetTextureLayout& layout, size_t stagingOffset) = 0;
+  virtual void CopyBuffer(uint32_t asset, size_t size, size_t stagingOffset) = 0;
+  // Submits what was recorded, returns the fence value that completes it
+  virtual uint64_t Submit() = 0;
+  virtual uint64_t GetCompletedValue() = 0;
+};
+
+// Upload sink without a GPU. Copies run when the owner completes their
+// fence value, which stands in for the copy queue working between frames.
+// They read staging only then, so a slot reused too early shows up as
+// wrong data.
+struct MockUploadSink : AssetUploadSink {
+  struct Copy {
+    uint32_t asset;
+    bool texture;
+    size_t size;
+    size_t stagingOffset;
+    AssetTextureLayout layout;
+    uint64_t fenceValue;
+  };
+
+  const uint8_t* staging = nullptr;
+  std::vector<std::vector<uint8_t>> resources; // By asset, texture mips tightly packed
+  std::vector<Copy> copies;                    // Recorded or submitted, not completed
+  uint64_t submittedValue = 0;
+  uint64_t completedValue = 0;
+  uint64_t bytesCopied = 0;
+
+  void CopyTexture(uint32_t asset, const AssetTextureLayout& layout, size_t stagingOffset) override {
+    copies.push_back({asset, true, 0, stagingOffset, layout, 0});
+  }
+
+  void CopyBuffer(uint32_t asset, size_t size, size_t stagingOffset) override {
+    Copy copy = {};
+    copy.asset = asset;
+    copy.size = size;
+    copy.stagingOffset = stagingOffset;
+    copies.push_back(copy);
+  }
+
+  uint64_t Submit() override {
+    submittedValue++;
+    for (Copy& copy : copies) {
+      copy.fenceValue = copy.fenceValue ? copy.fenceValue : submittedValue;
+    }
+    return submittedValue;
+  }
+
+  uint64_t GetCompletedValue() override {
+    return completedValue;
+  }
+
+  // Runs the copies submitted up to fenceValue
+  void Complete(uint64_t fenceValue) {
+    size_t kept = 0;
+    for (const Copy& copy : copies) {
+      if (copy.fenceValue == 0 || copy.fenceValue > fenceValue) {
+        copies[kept++] = copy;
+        continue;
+      }
+
+      if (resources.size() <= copy.asset) {
+        resources.resize(copy.asset + 1);
+      }
+      std::vector<uint8_t>& resource = resources[copy.asset];
+      const uint8_t* source = staging + copy.stagingOffset;
+      resource.clear();
+      if (copy.texture) {
+        for (uint32_t level = 0; level < copy.layout.mipCount; ++level) {
+          const AssetMip& mip = copy.layout.mips[level];
+          for (uint32_t y = 0; y < mip.height; ++y) {
+            const uint8_t* row = source + mip.offset + static_cast<size_t>(y) * mip.rowPitch;
+            resource.insert(resource.end(), row, row + mip.width * 4);
+          }
+        }
+      }
+      else {
+        resource.assign(source, source + copy.size);
+      }
+      bytesCopied += resource.size();
+    }
+    copies.resize(kept);
+    completedValue = std::max(completedValue, fenceValue);
+  }
+};
+
+struct AssetRecord {
+  std::string path;
+  AssetKind kind;
+  AssetStatus status;
+  AssetTextureLayout layout; // Textures only
+  uint64_t size;             // Bytes in staging
+  uint64_t fileBytes;        // Read from the file or archive, compressed size if it was
+  uint32_t slot;
+  bool loadFailed;           // Set by the I/O thread, reported by Pump()
+  uint64_t fenceValue;
+  std::chrono::steady_clock::time_point requested;
+  float latencyMilliseconds; // Request to ready
+};
+
+struct AssetStreamStats {
+  uint64_t requested = 0;
+  uint64_t ready = 0;
+  uint64_t failed = 0;
+  uint64_t bytesRead = 0;     // File bytes
+  uint64_t bytesStaged = 0;   // Decoded bytes, row and mip padding included
+  uint64_t bytesUploaded = 0;
+  double loadSeconds = 0.0;   // Map, decode and stage, summed over the I/O threads
+  uint64_t slotWaits = 0;     // Decodes that waited for a free staging slot
+  uint32_t uploading = 0;
+  double averageLatencyMilliseconds = 0.0;
+  double maxLatencyMilliseconds = 0.0;
+  uint64_t pumps = 0;
+  double averagePumpMicroseconds = 0.0;
+  double maxPumpMicroseconds = 0.0;
+};
+
+struct AssetStreamer {
+  uint8_t* staging = nullptr;
+  size_t slotSize = 0;
+  uint32_t slotCount = 0;
+  uint32_t rowPitchAlignment = 256;
+  uint32_t placementAlignment = 512;
+  size_t uploadBudget = 16u << 20; // Bytes handed to the sink per Pump(), at least one asset
+  const AssetArchive* archive = nullptr; // Set before Start(), read by the I/O threads
+
+  std::deque<AssetRecord> assets; // Handles index this, records never move
+  std::vector<uint32_t> readyThisPump;
+  AssetStreamStats stats;
+
+  AssetStreamer() = default;
+  AssetStreamer(const AssetStreamer&) = delete;
+  AssetStreamer& operator=(const AssetStreamer&) = delete;
+
+  ~AssetStreamer() {
+    Stop();
+  }
+
+  // Cuts stagingSize bytes of staging memory into slots of slotBytes and
+  // starts the I/O threads. The alignments are those of the copy queue.
+  void Start(uint32_t ioThreads, uint8_t* stagingMemory, size_t stagingSize, size_t slotBytes,
+      uint32_t rowAlignment = 256, uint32_t mipAlignment = 512) {
+    Stop();
+
+    staging = stagingMemory;
+    slotSize = slotBytes / mipAlignment * mipAlignment;
+    slotCount = slotSize ? static_cast<uint32_t>(stagingSize / slotSize) : 0;
+    rowPitchAlignment = rowAlignment;
+    placementAlignment = mipAlignment;
+
+    freeSlots.clear();
+    for (uint32_t slot = 0; slot < slotCount; ++slot) {
+      freeSlots.push_back(slotCount - 1 - slot);
+    }
+
+    stopping = false;
+    for (uint32_t i = 0; i < std::max(1u, ioThreads); ++i) {
+      threads.emplace_back([this]() { IoThreadMain(); });
+    }
+  }
+
+  // Joins the I/O threads. Assets still queued stay queued.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+  }
+
+  uint32_t Request(const char* path, AssetKind kind) {
+    uint32_t handle = static_cast<uint32_t>(assets.size());
+    assets.push_back({});
+    AssetRecord& asset = assets.back();
+    asset.path = path;
+    asset.kind = kind;
+    asset.status = AssetStatus::Queued;
+    asset.slot = UINT32_MAX;
+    asset.requested = std::chrono::steady_clock::now();
+    stats.requested++;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      requests.push_back({handle, &asset});
+    }
+    wake.notify_all(); // Threads waiting for a slot share the condition
+
+    return handle;
+  }
+
+  AssetStatus Status(uint32_t handle) const {
+    return assets[handle].status;
+  }
+
+  bool IsIdle() const {
+    return stats.ready + stats.failed == stats.requested;
+  }
+
+  // Once per frame. Retires completed uploads, then submits decoded assets
+  // up to the byte budget. Never waits on the sink's fence.
+  void Pump(AssetUploadSink& sink) {
+    PROFILE_ZONE("AssetStreamer::Pump");
+    auto t0 = std::chrono::steady_clock::now();
+    readyThisPump.clear();
+
+    uint64_t completed = sink.GetCompletedValue();
+    size_t retired = 0;
+    while (retired < uploading.size() && assets[uploading[retired]].fenceValue <= completed) {
+      uint32_t handle = uploading[retired++];
+      AssetRecord& asset = assets[handle];
+      asset.status = AssetStatus::Ready;
+      std::chrono::duration<float, std::milli> latency = t0 - asset.requested;
+      asset.latencyMilliseconds = latency.count();
+
+      stats.ready++;
+      stats.bytesUploaded += asset.size;
+      stats.averageLatencyMilliseconds += (asset.latencyMilliseconds - stats.averageLatencyMilliseconds) / stats.ready;
+      stats.maxLatencyMilliseconds = std::max<double>(stats.maxLatencyMilliseconds, asset.latencyMilliseconds);
+      readyThisPump.push_back(handle);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t i = 0; i < retired; ++i) {
+        freeSlots.push_back(assets[uploading[i]].slot);
+      }
+
+      size_t budget = 0;
+      while (!decoded.empty() && (pending.empty() || budget + assets[decoded.front()].size <= uploadBudget)) {
+        uint32_t handle = decoded.front();
+        decoded.pop_front();
+        AssetRecord& asset = assets[handle];
+        if (asset.loadFailed) {
+          asset.status = AssetStatus::Failed;
+          stats.failed++;
+          continue;
+        }
+
+        size_t stagingOffset = static_cast<size_t>(asset.slot) * slotSize;
+        if (asset.kind == AssetKind::Texture) {
+          sink.CopyTexture(handle, asset.layout, stagingOffset);
+        }
+        else {
+          sink.CopyBuffer(handle, static_cast<size_t>(asset.size), stagingOffset);
+        }
+        asset.status = AssetStatus::Uploading;
+        budget += static_cast<size_t>(asset.size);
+        pending.push_back(handle);
+      }
+
+      stats.bytesRead = io.bytesRead;
+      stats.bytesStaged = io.bytesStaged;
+      stats.loadSeconds = io.loadSeconds;
+      stats.slotWaits = io.slotWaits;
+    }
+    if (retired > 0) {
+      wake.notify_all();
+    }
+
+    uploading.erase(uploading.begin(), uploading.begin() + retired);
+    if (!pending.empty()) {
+      uint64_t fenceValue = sink.Submit();
+      for (uint32_t handle : pending) {
+        assets[handle].fenceValue = fenceValue;
+        uploading.push_back(handle);
+      }
+      pending.clear();
+    }
+    stats.uploading = static_cast<uint32_t>(uploading.size());
+
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - t0;
+    stats.pumps++;
+    stats.averagePumpMicroseconds += (elapsed.count() - stats.averagePumpMicroseconds) / stats.pumps;
+    stats.maxPumpMicroseconds = std::max(stats.maxPumpMicroseconds, elapsed.count());
+  }
+
+private:
+  struct IoStats {
+    uint64_t bytesRead = 0;
+    uint64_t bytesStaged = 0;
+    double loadSeconds = 0.0;
+    uint64_t slotWaits = 0;
+  };
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake; // Requests queued, slots freed or stopping
+  bool stopping = false;
+
+  // Guarded by the mutex. The I/O threads get record pointers, the assets
+  // deque itself belongs to the render thread.
+  std::deque<std::pair<uint32_t, AssetRecord*>> requests;
+  std::deque<uint32_t> decoded; // Failed ones too, the render thread reports them
+  std::vector<uint32_t> freeSlots;
+  IoStats io;
+
+  // Render thread only
+  std::vector<uint32_t> uploading; // In submit order, so fence values only grow
+  std::vector<uint32_t> pending;
+
+  // The asset's bytes - in place from the archive or a mapped loose file,
+  // or decompressed into `packed`
+  bool OpenSource(const char* path, MappedFile& file, std::vector<uint8_t>& packed, const uint8_t*& source, size_t& size, uint64_t& readBytes) {
+    AssetView view;
+    if (archive && archive->Find(path, view)) {
+      readBytes = view.storedSize;
+      size = view.size;
+      if (!view.compressed) {
+        source = view.data;
+        return true;
+      }
+      packed.resize(view.size);
+      source = packed.data();
+      return AssetArchive::Read(view, packed.data());
+    }
+
+    readBytes = 0;
+    size = 0;
+    if (!file.Open(path)) {
+      return false;
+    }
+    readBytes = file.size;
+    size = file.size;
+    source = file.data;
+    return true;
+  }
+
+  void IoThreadMain() {
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> nextScratch;
+    std::vector<uint8_t> packed; // Decompressed archive entries
+
+    for (;;) {
+      uint32_t handle = 0;
+      AssetRecord* asset = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+        if (stopping) {
+          return;
+        }
+        handle = requests.front().first;
+        asset = requests.front().second;
+        requests.pop_front();
+      }
+
+      // The layout is known from the header, before anything is decoded
+      auto t0 = std::chrono::steady_clock::now();
+      MappedFile file;
+      const uint8_t* source = nullptr;
+      size_t sourceSize = 0;
+      size_t pixelOffset = 0;
+      bool ok = OpenSource(asset->path.c_str(), file, packed, source, sourceSize, asset->fileBytes);
+      if (ok && asset->kind == AssetKind::Texture) {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        ok = ParsePpmHeader(source, sourceSize, width, height, pixelOffset) &&
+          ComputeTextureLayout(width, height, rowPitchAlignment, placementAlignment, asset->layout);
+        asset->size = asset->layout.size;
+      }
+      else {
+        asset->size = sourceSize;
+      }
+      asset->loadFailed = !ok || asset->size > slotSize;
+      std::chrono::duration<double> openTime = std::chrono::steady_clock::now() - t0;
+
+      if (asset->loadFailed) {
+        std::lock_guard<std::mutex> lock(mutex);
+        io.loadSeconds += openTime.count();
+        decoded.push_back(handle);
+        continue;
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (freeSlots.empty()) {
+          io.slotWaits++;
+          wake.wait(lock, [this]() { return stopping || !freeSlots.empty(); });
+        }
+        if (stopping) {
+          return;
+        }
+        asset->slot = freeSlots.back();
+        freeSlots.pop_back();
+      }
+
+      PROFILE_ZONE("LoadAsset");
+      auto t1 = std::chrono::steady_clock::now();
+      uint8_t* destination = staging + static_cast<size_t>(asset->slot) * slotSize;
+      if (asset->kind == AssetKind::Texture) {
+        DecodePpmTexture(source + pixelOffset, asset->layout, destination, scratch, nextScratch);
+      }
+      else {
+        std::memcpy(destination, source, sourceSize);
+      }
+      std::chrono::duration<double> decodeTime = std::chrono::steady_clock::now() - t1;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      io.bytesRead += asset->fileBytes;
+      io.bytesStaged += asset->size;
+      io.loadSeconds += openTime.count() + decodeTime.count();
+      decoded.push_back(handle);
+    }
+  }
+};
+
+#endif // _H_ASSET_STREAMING
@@ -0,0 +1,230 @@
+#ifndef _H_BENCH
+#define _H_BENCH
+
+// Minimal timing harness for the benchmark executable, and the statistics
+// and baseline files of the regression suite
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Helpers.h"
+#include "MappedFile.h"
+
+struct BenchTimer {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  void Reset() {
+    start = std::chrono::steady_clock::now();
+  }
+
+  double ElapsedSeconds() const {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  }
+
+  double ElapsedNanoseconds() const {
+    return ElapsedSeconds() * 1e9;
+  }
+};
+
+// Results are funneled through here so the optimizer cannot drop the work
+inline volatile double g_BenchSink = 0.0;
+
+inline void DoNotOptimize(double value) {
+  g_BenchSink = g_BenchSink + value;
+}
+
+inline void BenchReport(const char* scenario, const char* metric, double value, const char* unit) {
+  std::printf("%-16s %-36s %14.3f %s\n", scenario, metric, value, unit);
+  std::fflush(stdout);
+}
+
+// Summary of repeated timings of one case. The median and the median
+// absolute deviation are used for comparisons since a sample that got
+// preempted moves neither of them.
+struct BenchStats {
+  double median = 0.0;
+  double mad = 0.0; // Scaled by 1.4826, the standard deviation for normal noise
+  double mean = 0.0;
+  double min = 0.0;
+  double max = 0.0;
+  uint32_t samples = 0;
+};
+
+inline double BenchMedian(std::vector<double> values) {
+  if (values.empty()) {
+    return 0.0;
+  }
+
+  std::sort(values.begin(), values.end());
+  size_t half = values.size() / 2;
+  return values.size() % 2 ? values[half] : 0.5 * (values[half - 1] + values[half]);
+}
+
+inline BenchStats ComputeBenchStats(const std::vector<double>& samples) {
+  BenchStats stats;
+  if (samples.empty()) {
+    return stats;
+  }
+
+  stats.samples = static_cast<uint32_t>(samples.size());
+  stats.median = BenchMedian(samples);
+  std::vector<double> deviations(samples.size());
+  for (size_t i = 0; i < samples.size(); ++i) {
+    deviations[i] = std::fabs(samples[i] - stats.median);
+  }
+  stats.mad = 1.4826 * BenchMedian(deviations);
+
+  stats.min = stats.max = samples[0];
+  double sum = 0.0;
+  for (double sample : samples) {
+    stats.min = std::min(stats.min, sample);
+    stats.max = std::max(stats.max, sample);
+    sum += sample;
+  }
+  stats.mean = sum / samples.size();
+  return stats;
+}
+
+struct BenchResult {
+  std::string name;
+  std::string unit; // Of a time, lower is better
+  BenchStats stats;
+  std::vector<double> samples;
+  uint64_t checksum = 0; // Of what the case computed, 0 if it has none
+};
+
+// A suite run, or a baseline read back: what it ran on and its cases.
+// Timings are only comparable between runs on the same SIMD level and
+// number of job system workers.
+struct BenchRun {
+  std::string simd;
+  uint32_t threads = 0;
+  std::vector<BenchResult> results;
+};
+
+// Writes a run as JSON, one case per line so the baseline reader below
+// gets away without a JSON parser. Checksums are hex strings, JSON numbers
+// do not hold 64 bits.
+inline bool WriteBenchJson(const char* path, const BenchRun& run) {
+  std::string json;
+  char buffer[256];
+  std::snprintf(buffer, sizeof(buffer), "{\n  \"version\": 1,\n  \"simd\": \"%s\",\n  \"threads\": %u,\n  \"cases\": [\n", run.simd.c_str(), run.threads);
+  json += buffer;
+
+  for (size_t i = 0; i < run.results.size(); ++i) {
+    const BenchResult& result = run.results[i];
+    const BenchStats& stats = result.stats;
+    std::snprintf(buffer, sizeof(buffer),
+        "    {\"name\": \"%s\", \"unit\": \"%s\", \"checksum\": \"%016llx\", \"median\": %.6g, \"mad\": %.6g, \"mean\": %.6g, \"min\": %.6g, \"max\": %.6g, \"samples\": [",
+        result.name.c_str(), result.unit.c_str(), static_cast<unsigned long long>(result.checksum), stats.median, stats.mad, stats.mean, stats.min, stats.max);
+    json += buffer;
+    for (size_t j = 0; j < result.samples.size(); ++j) {
+      std::snprintf(buffer, sizeof(buffer), j ? ", %.6g" : "%.6g", result.samples[j]);
+      json += buffer;
+    }
+    json += i + 1 < run.results.size() ? "]},\n" : "]}\n";
+  }
+  json += "  ]\n}\n";
+
+  return WriteWholeFile(path, json.data(), json.size());
+}
+
+inline double BenchJsonNumber(const std::string& line, const char* key) {
+  size_t found = line.find(key);
+  return found != std::string::npos ? std::strtod(line.c_str() + found + std::strlen(key), nullptr) : 0.0;
+}
+
+// Value of a string field of the line, empty if it has none
+inline std::string BenchJsonString(const std::string& line, const char* key) {
+  size_t begin = line.find(key);
+  if (begin == std::string::npos) {
+    return std::string();
+  }
+  begin += std::strlen(key);
+  size_t end = line.find('"', begin);
+  return end != std::string::npos ? line.substr(begin, end - begin) : std::string();
+}
+
+// Reads a file written by WriteBenchJson: the SIMD level and thread count,
+// and every case with its median, MAD, sample count and checksum. False if
+// the file is missing or has no cases.
+inline bool ReadBenchBaseline(const char* path, BenchRun& run) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+
+  std::string text(reinterpret_cast<const char*>(file.data), file.size);
+  run = BenchRun();
+  size_t lineStart = 0;
+  while (lineStart < text.size()) {
+    size_t lineEnd = text.find('\n', lineStart);
+    lineEnd = lineEnd == std::string::npos ? text.size() : lineEnd;
+    std::string line = text.substr(lineStart, lineEnd - lineStart);
+    lineStart = lineEnd + 1;
+
+    if (line.find("\"simd\": \"") != std::string::npos) {
+      run.simd = BenchJsonString(line, "\"simd\": \"");
+      continue;
+    }
+    if (line.find("\"threads\": ") != std::string::npos) {
+      run.threads = static_cast<uint32_t>(BenchJsonNumber(line, "\"threads\": "));
+      continue;
+    }
+
+    BenchResult result;
+    result.name = BenchJsonString(line, "\"name\": \"");
+    if (result.name.empty()) {
+      continue;
+    }
+    result.checksum = std::strtoull(BenchJsonString(line, "\"checksum\": \"").c_str(), nullptr, 16);
+    result.stats.median = BenchJsonNumber(line, "\"median\": ");
+    result.stats.mad = BenchJsonNumber(line, "\"mad\": ");
+    size_t samples = line.find("\"samples\": [");
+    if (samples != std::string::npos) {
+      result.stats.samples = 1 + static_cast<uint32_t>(std::count(line.begin() + samples, line.end(), ','));
+    }
+    run.results.push_back(result);
+  }
+  return !run.results.empty();
+}
+
+enum class BenchVerdict {
+  Same,
+  Faster,
+  Slower,
+  NoBaseline
+};
+
+// A case regressed if its median is more than `threshold` (a fraction)
+// above the baseline's and the difference is also beyond three standard
+// errors of the two medians, so neither noisy cases nor tiny real changes
+// fail the gate. Faster is decided the same way.
+inline BenchVerdict CompareBench(const BenchStats& current, const BenchStats& baseline, double threshold) {
+  if (baseline.samples == 0 || baseline.median <= 0.0) {
+    return BenchVerdict::NoBaseline;
+  }
+
+  // Standard error of a median is about 1.25 standard deviations / sqrt(n)
+  double currentError = 1.2533 * current.mad / std::sqrt(static_cast<double>(std::max(current.samples, 1u)));
+  double baselineError = 1.2533 * baseline.mad / std::sqrt(static_cast<double>(baseline.samples));
+  double noise = 3.0 * std::sqrt(currentError * currentError + baselineError * baselineError);
+
+  double difference = current.median - baseline.median;
+  if (difference > baseline.median * threshold && difference > noise) {
+    return BenchVerdict::Slower;
+  }
+  if (-difference > baseline.median * threshold && -difference > noise) {
+    return BenchVerdict::Faster;
+  }
+  return BenchVerdict::Same;
+}
+
+#endif // _H_BENCH
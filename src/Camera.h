@@ -0,0 +1,108 @@
+#ifndef _H_CAMERA
+#define _H_CAMERA
+
+// Platform-neutral camera math. Matrices are row-major and transform row
+// vectors (clip = p * M), the DirectXMath convention - transpose them before
+// handing them to HLSL's default column-major constant buffers. Left-handed,
+// y up, depth 0..1.
+
+#include <cmath>
+
+struct Vec3 {
+  float x;
+  float y;
+  float z;
+};
+
+inline Vec3 operator+(Vec3 a, Vec3 b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Vec3 operator-(Vec3 a, Vec3 b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Vec3 operator*(Vec3 a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+
+inline float Dot(Vec3 a, Vec3 b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec3 Cross(Vec3 a, Vec3 b) {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+inline Vec3 Normalize(Vec3 a) {
+  float length = std::sqrt(Dot(a, a));
+  return length > 0.0f ? a * (1.0f / length) : a;
+}
+
+struct Camera {
+  Vec3 eye = {0.0f, 10.0f, -10.0f};
+  Vec3 target = {0.0f, 0.0f, 0.0f};
+  float fovY = 0.785398163f; // Radians
+  float aspect = 16.0f / 9.0f;
+  float nearZ = 0.1f;
+  float farZ = 1000.0f;
+};
+
+inline void MultiplyMatrix(const float a[16], const float b[16], float out[16]) {
+  for (int row = 0; row < 4; ++row) {
+    for (int col = 0; col < 4; ++col) {
+      out[row * 4 + col] = a[row * 4 + 0] * b[0 * 4 + col] + a[row * 4 + 1] * b[1 * 4 + col] +
+          a[row * 4 + 2] * b[2 * 4 + col] + a[row * 4 + 3] * b[3 * 4 + col];
+    }
+  }
+}
+
+// Same results as XMMatrixLookAtLH(eye, target, up) * XMMatrixPerspectiveFovLH(...)
+inline void ComputeViewProjection(const Camera& camera, float out[16]) {
+  Vec3 zAxis = Normalize(camera.target - camera.eye);
+  Vec3 xAxis = Normalize(Cross({0.0f, 1.0f, 0.0f}, zAxis));
+  Vec3 yAxis = Cross(zAxis, xAxis);
+
+  const float view[16] = {
+    xAxis.x, yAxis.x, zAxis.x, 0.0f,
+    xAxis.y, yAxis.y, zAxis.y, 0.0f,
+    xAxis.z, yAxis.z, zAxis.z, 0.0f,
+    -Dot(xAxis, camera.eye), -Dot(yAxis, camera.eye), -Dot(zAxis, camera.eye), 1.0f
+  };
+
+  float h = 1.0f / std::tan(camera.fovY * 0.5f);
+  float w = h / camera.aspect;
+  float range = camera.farZ / (camera.farZ - camera.nearZ);
+  const float projection[16] = {
+    w, 0.0f, 0.0f, 0.0f,
+    0.0f, h, 0.0f, 0.0f,
+    0.0f, 0.0f, range, 1.0f,
+    0.0f, 0.0f, -range * camera.nearZ, 0.0f
+  };
+
+  MultiplyMatrix(view, projection, out);
+}
+
+// Planes as (a, b, c, d) with a point inside when a*x + b*y + c*z + d >= 0,
+// normals unit length so d is a distance
+struct Frustum {
+  float planes[6][4]; // Left, right, bottom, top, near, far
+};
+
+// Gribb/Hartmann extraction from a row-vector view-projection matrix
+inline Frustum ExtractFrustum(const float m[16]) {
+  auto column = [&](int c, int row) { return m[row * 4 + c]; };
+
+  Frustum frustum;
+  for (int row = 0; row < 4; ++row) {
+    frustum.planes[0][row] = column(3, row) + column(0, row);
+    frustum.planes[1][row] = column(3, row) - column(0, row);
+    frustum.planes[2][row] = column(3, row) + column(1, row);
+    frustum.planes[3][row] = column(3, row) - column(1, row);
+    frustum.planes[4][row] = column(2, row);
+    frustum.planes[5][row] = column(3, row) - column(2, row);
+  }
+
+  for (float* plane : frustum.planes) {
+    float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+    for (int i = 0; i < 4; ++i) {
+      plane[i] /= length;
+    }
+  }
+
+  return frustum;
+}
+
+#endif // _H_CAMERA
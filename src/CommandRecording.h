@@ -0,0 +1,308 @@
+#ifndef _H_COMMAND_RECORDING
+#define _H_COMMAND_RECORDING
+
+// Parallel command recording. A frame is a list of passes in submission
+// order, and every pass is split into pieces that each record one command
+// list. List indices are handed out in pass order when the passes are
+// added, so the lists are recorded by whichever worker picks them up and
+// still go to the GPU in the same order in a single Execute().
+//
+// Every worker has its own pool of allocators per back buffer slot. A list
+// takes the top allocator of the recording thread's pool and gives it back
+// when it closes, so one thread's lists share an allocator (D3D12 allows
+// that as long as only one of them is open). Going deeper in the pool is
+// only needed when a record function runs jobs and the thread picks up
+// another list while waiting. The pools of a slot are reset when the slot
+// comes around again, which is after the frame pacer waited for its fence.
+//
+// The API work sits behind CommandBackend. NullCommandBackend checks the
+// D3D12 rules for allocators and lists against a simulated GPU fence.
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "FramePacing.h"
+#include "Helpers.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+const uint32_t g_CommandPoolDepth = 4;  // Allocators per worker and slot, the deepest nesting of open lists on a thread
+const uint32_t g_MaxCommandLists = 64;  // Per frame
+
+struct CommandBackend {
+  virtual ~CommandBackend() = default;
+
+  // Called once, indices below these counts are valid from then on
+  virtual void Reserve(uint32_t allocatorCount, uint32_t listCount) = 0;
+  // The GPU is done with every list recorded on the allocator
+  virtual void ResetAllocator(uint32_t allocator) = 0;
+  // Opens a list on an allocator, creating either on first use. Runs on the
+  // recording thread.
+  virtual void BeginList(uint32_t list, uint32_t allocator) = 0;
+  virtual void EndList(uint32_t list) = 0;
+  // One submission of closed lists, in this order
+  virtual void Execute(const uint32_t* lists, uint32_t count) = 0;
+};
+
+// Records piece `piece` of `pieceCount` of a pass into an open list
+typedef void (*CommandRecordFunction)(void* data, uint32_t list, uint32_t piece, uint32_t pieceCount);
+
+// Piece of [0, count) split into pieceCount nearly equal ranges
+inline void CommandPieceRange(uint32_t count, uint32_t piece, uint32_t pieceCount, uint32_t& begin, uint32_t& end) {
+  begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * piece / pieceCount);
+  end = static_cast<uint32_t>(static_cast<uint64_t>(count) * (piece + 1) / pieceCount);
+}
+
+struct CommandPass {
+  CommandRecordFunction function;
+  void* data;
+  uint32_t firstList;
+  uint32_t pieceCount;
+};
+
+// Written by one worker at a time, padded so neighbors do not share a line
+struct alignas(64) CommandAllocatorPool {
+  uint32_t first = 0; // Allocator index of the pool's bottom
+  uint32_t open = 0;  // Allocators held by open lists
+  uint32_t used = 0;  // Allocators used since the last reset
+  uint32_t highWater = 0;
+};
+
+struct CommandRecordStats {
+  uint64_t frames = 0;
+  uint32_t lists = 0;   // Last frame
+  uint32_t threads = 0; // Workers that recorded in the last frame
+  uint32_t listsHighWater = 0;
+  uint64_t allocatorResets = 0;
+  uint64_t droppedPasses = 0; // Passes that did not fit in g_MaxCommandLists
+  double lastRecordMicroseconds = 0.0;
+  double totalRecordMicroseconds = 0.0;
+  double maxRecordMicroseconds = 0.0;
+};
+
+struct CommandRecorder {
+  CommandBackend* backend = nullptr;
+  uint32_t slotCount = 0;
+  uint32_t workerCount = 0;
+  uint32_t slot = 0;
+  std::vector<CommandAllocatorPool> pools; // Slot major
+  std::vector<CommandPass> passes;
+  uint32_t listPasses[g_MaxCommandLists] = {}; // Pass of every list
+  uint32_t order[g_MaxCommandLists] = {};
+  uint32_t listCount = 0;
+  CommandRecordStats stats;
+
+  void Init(CommandBackend* commandBackend, uint32_t slots, uint32_t workers) {
+    backend = commandBackend;
+    slotCount = slots > 0 ? slots : 1;
+    workerCount = workers > 0 ? workers : 1;
+    slot = 0;
+    pools.assign(slotCount * workerCount, CommandAllocatorPool());
+    for (uint32_t i = 0; i < pools.size(); ++i) {
+      pools[i].first = i * g_CommandPoolDepth;
+    }
+    for (uint32_t i = 0; i < g_MaxCommandLists; ++i) {
+      order[i] = i;
+    }
+    passes.clear();
+    listCount = 0;
+    stats = {};
+
+    backend->Reserve(static_cast<uint32_t>(pools.size()) * g_CommandPoolDepth, g_MaxCommandLists);
+  }
+
+  // Start of a frame on a back buffer slot whose last frame the GPU finished
+  void BeginFrame(uint32_t frameSlot) {
+    assert(frameSlot < slotCount);
+    slot = frameSlot;
+
+    for (uint32_t worker = 0; worker < workerCount; ++worker) {
+      CommandAllocatorPool& pool = pools[slot * workerCount + worker];
+      assert(pool.open == 0 && "A list of the slot's last frame was never closed");
+      for (uint32_t i = 0; i < pool.used; ++i) {
+        backend->ResetAllocator(pool.first + i);
+      }
+      stats.allocatorResets += pool.used;
+      pool.used = 0;
+    }
+
+    passes.clear();
+    listCount = 0;
+  }
+
+  // Adds a pass behind the ones already added. False if its lists do not
+  // fit, the pass is dropped then.
+  bool AddPass(CommandRecordFunction function, void* data, uint32_t pieceCount = 1) {
+    pieceCount = pieceCount > 0 ? pieceCount : 1;
+    if (listCount + pieceCount > g_MaxCommandLists) {
+      stats.droppedPasses++;
+      return false;
+    }
+
+    for (uint32_t i = 0; i < pieceCount; ++i) {
+      listPasses[listCount + i] = static_cast<uint32_t>(passes.size());
+    }
+    passes.push_back({function, data, listCount, pieceCount});
+    listCount += pieceCount;
+    return true;
+  }
+
+  // Records every list of the frame on the job system and returns when all
+  // of them are closed
+  void Record(JobSystem& jobs) {
+    PROFILE_ZONE("RecordCommands");
+
+    auto t0 = std::chrono::steady_clock::now();
+    jobs.ParallelFor(0, listCount, 1, [this](uint32_t begin, uint32_t end) {
+      for (uint32_t list = begin; list < end; ++list) {
+        RecordList(list);
+      }
+    });
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - t0;
+
+    stats.lastRecordMicroseconds = elapsed.count();
+    stats.totalRecordMicroseconds += elapsed.count();
+    stats.maxRecordMicroseconds = std::max(stats.maxRecordMicroseconds, elapsed.count());
+  }
+
+  // Submits the frame's lists in pass order
+  void Submit() {
+    if (listCount > 0) {
+      backend->Execute(order, listCount);
+    }
+
+    uint32_t threads = 0;
+    for (uint32_t worker = 0; worker < workerCount; ++worker) {
+      threads += pools[slot * workerCount + worker].used > 0 ? 1 : 0;
+    }
+
+    stats.frames++;
+    stats.lists = listCount;
+    stats.threads = threads;
+    stats.listsHighWater = std::max(stats.listsHighWater, listCount);
+  }
+
+  // Allocators ever used, the rest of the reservation was never created
+  uint32_t AllocatorCount() const {
+    uint32_t count = 0;
+    for (const CommandAllocatorPool& pool : pools) {
+      count += pool.highWater;
+    }
+    return count;
+  }
+
+private:
+  void RecordList(uint32_t list) {
+    const CommandPass& pass = passes[listPasses[list]];
+    CommandAllocatorPool& pool = pools[slot * workerCount + t_JobWorkerIndex % workerCount];
+    assert(pool.open < g_CommandPoolDepth && "Lists nested deeper than the allocator pool");
+
+    uint32_t allocator = pool.first + pool.open++;
+    pool.used = std::max(pool.used, pool.open);
+    pool.highWater = std::max(pool.highWater, pool.used);
+
+    backend->BeginList(list, allocator);
+    pass.function(pass.data, list, list - pass.firstList, pass.pieceCount);
+    backend->EndList(list);
+
+    pool.open--;
+  }
+};
+
+// Backend without an API. Lists keep a hash of the commands recorded into
+// them and every execution chains those in submission order, so two runs
+// can be compared. Misuse that D3D12 would reject, or that would corrupt a
+// frame on the GPU, is counted in errors: resetting an allocator the GPU may
+// still read, two open lists on one allocator, executing an open list.
+struct NullCommandBackend : CommandBackend {
+  struct Allocator {
+    bool created;
+    uint32_t openLists;
+    uint64_t fenceValue; // Signaled after the last execution of its lists
+  };
+
+  struct List {
+    bool created;
+    bool open;
+    uint32_t allocator;
+    uint32_t commands;
+    uint64_t hash;
+  };
+
+  SimulatedGpuFence* fence = nullptr; // Without one every execution counts as complete
+  std::vector<Allocator> allocators;
+  std::vector<List> lists;
+  uint64_t submittedHash = HashBytes(nullptr, 0);
+  uint64_t executions = 0;
+  uint64_t commands = 0;
+  std::atomic<uint64_t> errors{0};
+
+  void Reserve(uint32_t allocatorCount, uint32_t listCount) override {
+    allocators.assign(allocatorCount, Allocator());
+    lists.assign(listCount, List());
+  }
+
+  void ResetAllocator(uint32_t index) override {
+    Allocator& allocator = allocators[index];
+    if (!allocator.created || allocator.openLists > 0 || (fence && fence->GetCompletedValue() < allocator.fenceValue)) {
+      errors++;
+    }
+  }
+
+  void BeginList(uint32_t index, uint32_t allocatorIndex) override {
+    Allocator& allocator = allocators[allocatorIndex];
+    List& list = lists[index];
+    if (list.open || allocator.openLists > 0) {
+      errors++;
+    }
+
+    allocator.created = true;
+    allocator.openLists++;
+    list = {true, true, allocatorIndex, 0, HashBytes(nullptr, 0)};
+  }
+
+  void EndList(uint32_t index) override {
+    List& list = lists[index];
+    if (!list.open) {
+      errors++;
+      return;
+    }
+
+    list.open = false;
+    allocators[list.allocator].openLists--;
+  }
+
+  void Execute(const uint32_t* indices, uint32_t count) override {
+    uint64_t fenceValue = fence ? fence->signaledValue + 1 : 0; // The frame signals right after
+    for (uint32_t i = 0; i < count; ++i) {
+      const List& list = lists[indices[i]];
+      if (!list.created || list.open) {
+        errors++;
+        continue;
+      }
+
+      allocators[list.allocator].fenceValue = fenceValue;
+      submittedHash = HashBytes(&list.hash, sizeof(list.hash), submittedHash);
+      commands += list.commands;
+    }
+    executions++;
+  }
+
+  // Stand-in for a command, recorded into an open list
+  void Command(uint32_t index, uint64_t value) {
+    List& list = lists[index];
+    if (!list.open) {
+      errors++;
+      return;
+    }
+
+    list.commands++;
+    list.hash = HashBytes(&value, sizeof(value), list.hash);
+  }
+};
+
+#endif // _H_COMMAND_RECORDING
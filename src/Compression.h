@@ -0,0 +1,220 @@
+#ifndef _H_COMPRESSION
+#define _H_COMPRESSION
+
+// Byte-oriented LZ compression in the LZ4 block format: sequences of a
+// token (literal count and match length in 4 bits each, longer ones continue
+// in 255-valued bytes), the literals, and a 16-bit back offset. There is no
+// entropy coding, so decompression is mostly memcpy and runs at several GB/s.
+// The compressor is a greedy single-probe hash matcher - fast and simple,
+// it leaves a little ratio on the table.
+//
+// Blocks follow the LZ4 end-of-block rules (the last 5 bytes are literals,
+// no match starts in the last 12), so they decode with any LZ4 block
+// decoder. The decoder here checks every length against both buffers and
+// fails on corrupt input instead of reading or writing out of bounds.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+const uint32_t g_LzMinMatch = 4;
+const uint32_t g_LzHashBits = 14;
+const size_t g_LzLastLiterals = 5;
+const size_t g_LzMatchLimit = 12; // No match may start closer than this to the end
+
+// Worst case output size for size input bytes - incompressible data grows a
+// little from the literal length bytes
+inline size_t LzCompressBound(size_t size) {
+  return size + size / 255 + 16;
+}
+
+inline uint32_t LzRead32(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, 4);
+  return value;
+}
+
+inline uint32_t LzHash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - g_LzHashBits);
+}
+
+inline uint8_t* LzWriteLength(uint8_t* out, size_t length) {
+  while (length >= 255) {
+    *out++ = 255;
+    length -= 255;
+  }
+  *out++ = static_cast<uint8_t>(length);
+  return out;
+}
+
+// Compresses into out, which must hold LzCompressBound(size) bytes. Returns
+// the compressed size.
+inline size_t LzCompress(const uint8_t* in, size_t size, uint8_t* out) {
+  uint8_t* op = out;
+  const uint8_t* anchor = in; // Start of the pending literals
+
+  if (size > g_LzMatchLimit) {
+    std::vector<uint32_t> table(size_t(1) << g_LzHashBits, 0); // Position + 1, 0 is empty
+    const uint8_t* ip = in;
+    const uint8_t* matchLimit = in + size - g_LzMatchLimit;
+    const uint8_t* matchEnd = in + size - g_LzLastLiterals;
+    uint32_t misses = 0;
+
+    while (ip < matchLimit) {
+      uint32_t sequence = LzRead32(ip);
+      uint32_t& slot = table[LzHash(sequence)];
+      const uint8_t* candidate = slot ? in + slot - 1 : nullptr;
+      slot = static_cast<uint32_t>(ip - in) + 1;
+
+      if (!candidate || ip - candidate > 65535 || LzRead32(candidate) != sequence) {
+        // Step faster through data that does not match
+        ip += 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+
+      // Extend backwards over pending literals, then forwards
+      while (ip > anchor && candidate > in && ip[-1] == candidate[-1]) {
+        ip--;
+        candidate--;
+      }
+      const uint8_t* matchStart = ip;
+      ip += g_LzMinMatch;
+      candidate += g_LzMinMatch;
+      while (ip < matchEnd && *ip == *candidate) {
+        ip++;
+        candidate++;
+      }
+
+      size_t literals = static_cast<size_t>(matchStart - anchor);
+      size_t matchLength = static_cast<size_t>(ip - matchStart) - g_LzMinMatch;
+      uint8_t* token = op++;
+      *token = static_cast<uint8_t>((literals >= 15 ? 15 : literals) << 4);
+      if (literals >= 15) {
+        op = LzWriteLength(op, literals - 15);
+      }
+      std::memcpy(op, anchor, literals);
+      op += literals;
+
+      uint16_t offset = static_cast<uint16_t>(matchStart - (candidate - (ip - matchStart)));
+      std::memcpy(op, &offset, 2);
+      op += 2;
+
+      *token |= static_cast<uint8_t>(matchLength >= 15 ? 15 : matchLength);
+      if (matchLength >= 15) {
+        op = LzWriteLength(op, matchLength - 15);
+      }
+      anchor = ip;
+    }
+  }
+
+  // The rest is literals
+  size_t literals = static_cast<size_t>(in + size - anchor);
+  *op++ = static_cast<uint8_t>((literals >= 15 ? 15 : literals) << 4);
+  if (literals >= 15) {
+    op = LzWriteLength(op, literals - 15);
+  }
+  std::memcpy(op, anchor, literals);
+  op += literals;
+
+  return static_cast<size_t>(op - out);
+}
+
+// Decompresses exactly outSize bytes. False if the block is corrupt or does
+// not decode to exactly that size.
+inline bool LzDecompress(const uint8_t* in, size_t size, uint8_t* out, size_t outSize) {
+  const uint8_t* ip = in;
+  const uint8_t* inEnd = in + size;
+  uint8_t* op = out;
+  uint8_t* outEnd = out + outSize;
+
+  for (;;) {
+    if (ip >= inEnd) {
+      return false;
+    }
+    uint8_t token = *ip++;
+
+    size_t literals = token >> 4;
+    if (literals == 15) {
+      uint8_t extra;
+      do {
+        if (ip >= inEnd) {
+          return false;
+        }
+        extra = *ip++;
+        literals += extra;
+      } while (extra == 255);
+    }
+    if (literals > static_cast<size_t>(inEnd - ip) || literals > static_cast<size_t>(outEnd - op)) {
+      return false;
+    }
+    // Short runs are the common case, one fixed-size copy when both sides have room
+    if (literals <= 16 && inEnd - ip >= 16 && outEnd - op >= 16) {
+      std::memcpy(op, ip, 16);
+    }
+    else {
+      std::memcpy(op, ip, literals);
+    }
+    ip += literals;
+    op += literals;
+
+    if (ip == inEnd) {
+      return op == outEnd; // The last sequence has no match
+    }
+
+    if (inEnd - ip < 2) {
+      return false;
+    }
+    uint16_t offset;
+    std::memcpy(&offset, ip, 2);
+    ip += 2;
+    if (offset == 0 || offset > op - out) {
+      return false;
+    }
+
+    size_t matchLength = token & 15;
+    if (matchLength == 15) {
+      uint8_t extra;
+      do {
+        if (ip >= inEnd) {
+          return false;
+        }
+        extra = *ip++;
+        matchLength += extra;
+      } while (extra == 255);
+    }
+    matchLength += g_LzMinMatch;
+    if (matchLength > static_cast<size_t>(outEnd - op)) {
+      return false;
+    }
+
+    // A match repeats the last `offset` bytes. Once the first 8 bytes are
+    // written, a source at the smallest multiple of offset that is at least
+    // 8 back holds the same bytes and 8-byte copies never overlap.
+    const uint8_t* match = op - offset;
+    uint8_t* end = op + matchLength;
+    if (static_cast<size_t>(outEnd - op) < matchLength + 8) {
+      while (op < end) {
+        *op++ = *match++;
+      }
+      continue;
+    }
+
+    if (offset < 8) {
+      for (int i = 0; i < 8; ++i) {
+        op[i] = match[i];
+      }
+      op += 8;
+      match = op - (offset * ((8 + offset - 1) / offset));
+    }
+    while (op < end) {
+      std::memcpy(op, match, 8);
+      op += 8;
+      match += 8;
+    }
+    op = end;
+  }
+}
+
+#endif // _H_COMPRESSION
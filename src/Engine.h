@@ -0,0 +1,547 @@
+#ifndef _H_ENGINE
+#define _H_ENGINE
+
+// Platform-neutral engine core. Nothing in here may include windows.h or
+// d3d12.h - both the D3D12 executable and the headless build use it.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "AssetStreaming.h"
+#include "Camera.h"
+#include "CommandRecording.h"
+#include "FrameMemory.h"
+#include "FramePacing.h"
+#include "GameLoop.h"
+#include "Helpers.h"
+#include "HexCulling.h"
+#include "HexGrid.h"
+#include "HexLod.h"
+#include "HexMesh.h"
+#include "HexPicking.h"
+#include "HexRemesh.h"
+#include "HexWater.h"
+#include "InputRecording.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+// Engine variables
+const uint8_t g_NumFrames = 3; // Triple buffering
+inline bool g_UseWarp = false; // Use WARP adapter (software rendering)
+const float g_ClearColor[4] = {0.4f, 0.6f, 0.9f, 1.0f}; // Sky behind the grid
+inline int g_ScreenWidth = 1280;
+inline int g_ScreenHeight = 720;
+inline uint64_t g_MaxFrames = 0; // Quit after this many frames, 0 runs until asked to quit
+inline uint32_t g_WorkerThreads = 0; // Job system size, 0 uses every hardware thread
+inline double g_TickRate = 60.0; // Simulation ticks per second
+inline bool g_SimulationThread = false; // Run the simulation on its own thread. The water does not follow it, see StepWater()
+inline bool g_MaxSpeed = false; // Simulate as fast as possible instead of in real time
+inline std::string g_TracePath; // Chrome trace written on exit, if set
+inline bool g_ColdStart = false; // Ignore the shader archive and pipeline cache, to time a first launch
+inline bool g_VSync = true;
+
+// Input - events are recorded to g_InputRecordPath if set, a replay of
+// g_InputReplayPath takes the place of the window
+inline std::string g_InputRecordPath;
+inline std::string g_InputReplayPath;
+inline InputRecorder g_InputRecorder;
+
+// Hex picking - layout of the grid in client-area pixels and the hex under the cursor
+inline HexLayout g_HexLayout = {32.0f, 0.0f, 0.0f};
+inline HexAxial g_HoveredHex = {};
+
+inline GameLoop g_GameLoop;
+
+// Demo world
+inline uint32_t g_HexGridSize = 256; // Tiles along each side
+inline HexGrid g_HexGrid;
+inline HexDrawOrigin g_HexDrawOrigin;
+inline HexChunkBvh g_HexBvh;
+inline HexLodPyramid g_HexLod;
+inline float g_HexLodDistance = 128.0f; // Distance where coarse hexes start, 0 draws everything at full detail
+inline Camera g_Camera;
+inline HexRemesher g_HexRemesher; // Chunk meshes, rebuilt incrementally from dirty chunks
+inline HexWater g_HexWater; // Marks the chunks its ticks change in g_HexRemesher.dirty
+inline HexWaterParams g_HexWaterParams;
+inline float g_HexSeaLevel = 2.5f;
+inline uint64_t g_HexWaterDroppedTicks = 0; // Simulation ticks the water skipped to catch up
+
+// Culling results of the last frame
+inline HexCullStats g_HexCullStats;
+inline double g_HexCullMicroseconds = 0.0;
+
+// Frame synchronization state
+inline uint32_t g_CurrentBackBufferIndex = 0;
+inline uint64_t g_FenceValue = 0;
+inline uint64_t g_FrameFenceValues[g_NumFrames] = {};
+inline uint64_t g_FrameIndex = 0; // Frames submitted since startup
+inline uint32_t g_MaxFramesInFlight = 2; // Frames the CPU may queue ahead of the GPU, at most g_NumFrames
+inline FramePacer g_FramePacer;
+
+// Command lists are recorded in parallel into per-worker allocator pools,
+// the backend is the renderer's
+inline CommandRecorder g_CommandRecorder;
+inline uint32_t g_HexDrawsPerList = 32; // Fewest hex grid draws worth a list of their own
+
+// Transient frame memory
+inline size_t g_FrameArenaSize = 4u << 20;
+inline size_t g_UploadRingSize = 16u << 20;
+inline LinearArena g_FrameArenas[g_NumFrames]; // One per back buffer slot, like the command allocators
+inline UploadRing g_UploadRing; // Backed by the renderer's persistently mapped upload buffer
+
+// Asset streaming - staging memory is the renderer's, like the upload ring's
+inline uint32_t g_IoThreads = 2;
+inline size_t g_AssetStagingSize = 32u << 20;
+inline size_t g_AssetSlotSize = 8u << 20; // Fits a 1024x1024 texture and its mips
+inline AssetStreamer g_AssetStreamer;
+inline AssetArchive g_AssetArchive;
+inline std::string g_AssetArchivePath = "assets.pak"; // Optional, loose files are used without it
+inline std::vector<std::string> g_StartupTextures; // --texture, requested at startup
+
+// Records the fence value signaled for the frame that was just submitted and
+// moves on to the next back buffer. Returns the fence value that has to be
+// reached before the new back buffer (and its command allocator) can be reused.
+inline uint64_t AdvanceFrame(uint64_t signaledFenceValue, uint32_t nextBackBufferIndex) {
+  g_FrameFenceValues[g_CurrentBackBufferIndex] = signaledFenceValue;
+  g_CurrentBackBufferIndex = nextBackBufferIndex;
+  g_FrameIndex++;
+
+  return g_FrameFenceValues[g_CurrentBackBufferIndex];
+}
+
+// Start of a frame - waits until the current back buffer slot may be reused,
+// then recycles the slot's arena and whatever upload memory the GPU is done with
+inline void BeginFrame() {
+  g_FramePacer.BeginFrame(g_FrameFenceValues[g_CurrentBackBufferIndex]);
+
+  g_FrameArenas[g_CurrentBackBufferIndex].Reset();
+  g_UploadRing.Retire(g_FramePacer.fence->GetCompletedValue());
+}
+
+// End of a frame - signals the fence, tags the frame's upload memory with it
+// and moves on to the next back buffer
+inline void EndFrame(uint32_t nextBackBufferIndex) {
+  uint64_t fenceValue = g_FramePacer.EndFrame();
+  g_UploadRing.EndFrame(fenceValue);
+
+  AdvanceFrame(fenceValue, nextBackBufferIndex);
+}
+
+// Opens the asset archive, starts the I/O threads on the renderer's staging
+// memory and requests the startup textures
+inline void StartAssetStreaming(uint8_t* stagingMemory) {
+  g_AssetStreamer.archive = g_AssetArchive.Open(g_AssetArchivePath.c_str()) ? &g_AssetArchive : nullptr;
+  g_AssetStreamer.Start(g_IoThreads, stagingMemory, g_AssetStagingSize, g_AssetSlotSize);
+  for (const std::string& path : g_StartupTextures) {
+    g_AssetStreamer.Request(path.c_str(), AssetKind::Texture);
+  }
+}
+
+inline void FormatAssetStats(char* buffer, size_t size) {
+  const AssetStreamStats& stats = g_AssetStreamer.stats;
+  std::snprintf(buffer, size, "Assets: %llu of %llu ready, %llu failed, %.1f MB read at %.1f MB/s per I/O thread, %.1f MB uploaded, latency avg %.3f max %.3f ms, pump avg %.3f max %.3f us, %llu slot waits\n",
+      static_cast<unsigned long long>(stats.ready), static_cast<unsigned long long>(stats.requested), static_cast<unsigned long long>(stats.failed),
+      stats.bytesRead / 1e6, stats.loadSeconds > 0.0 ? stats.bytesRead / 1e6 / stats.loadSeconds : 0.0, stats.bytesUploaded / 1e6,
+      stats.averageLatencyMilliseconds, stats.maxLatencyMilliseconds, stats.averagePumpMicroseconds, stats.maxPumpMicroseconds, static_cast<unsigned long long>(stats.slotWaits));
+}
+
+inline void FormatCommandStats(char* buffer, size_t size) {
+  const CommandRecordStats& stats = g_CommandRecorder.stats;
+  std::snprintf(buffer, size, "Commands: %u lists per frame (high water %u) recorded on %u threads, %u allocators, record avg %.3f max %.3f us, %llu dropped passes\n",
+      stats.lists, stats.listsHighWater, stats.threads, g_CommandRecorder.AllocatorCount(),
+      stats.frames ? stats.totalRecordMicroseconds / stats.frames : 0.0, stats.maxRecordMicroseconds,
+      static_cast<unsigned long long>(stats.droppedPasses));
+}
+
+inline void FormatRemeshStats(char* buffer, size_t size) {
+  const HexRemeshStats& stats = g_HexRemesher.stats;
+  std::snprintf(buffer, size, "Remesh: %llu chunks in %llu batches, %.3f us per chunk, batch max %.3f ms, update max %.3f ms, %u pending, %llu stalls, pool %u of %u blocks (high water %u)\n",
+      static_cast<unsigned long long>(stats.chunksRemeshed), static_cast<unsigned long long>(stats.batches),
+      stats.chunkMicroseconds, stats.maxBatchMilliseconds, stats.maxPublishMilliseconds, stats.pendingChunks,
+      static_cast<unsigned long long>(stats.stalls), g_HexRemesher.pool.usedBlocks, g_HexRemesher.pool.CapacityBlocks(),
+      g_HexRemesher.pool.highWater);
+}
+
+inline void FormatFrameMemoryStats(char* buffer, size_t size) {
+  size_t arenaHighWater = 0;
+  uint64_t arenaFailures = 0;
+  for (const LinearArena& arena : g_FrameArenas) {
+    arenaHighWater = arena.highWater > arenaHighWater ? arena.highWater : arenaHighWater;
+    arenaFailures += arena.failedAllocations;
+  }
+
+  std::snprintf(buffer, size, "Frame memory: arena high water %zu of %zu bytes, upload ring frame high water %zu, in flight high water %zu of %zu bytes, %llu failed allocations\n",
+      arenaHighWater, g_FrameArenaSize, g_UploadRing.frameHighWater, g_UploadRing.inFlightHighWater, g_UploadRing.capacity,
+      static_cast<unsigned long long>(arenaFailures + g_UploadRing.failedAllocations));
+}
+
+// Rolling terrain with material bands by height - water, sand, grass, rock
+inline void CreateDemoWorld() {
+  g_HexGrid = HexGrid(g_HexGridSize, g_HexGridSize);
+
+  Random random(1);
+  g_HexGrid.ForEachTile([&](uint32_t index, HexOffset coord) {
+    float x = coord.col * 0.11f;
+    float y = coord.row * 0.13f;
+    float height = 4.0f + 2.5f * std::sin(x) * std::cos(y) + 1.5f * std::sin(x * 0.37f + y * 0.23f) + random.NextFloat() * 0.5f;
+
+    g_HexGrid.heights[index] = height > 0.0f ? height : 0.0f;
+    g_HexGrid.materials[index] = height < 2.5f ? 0 : (height < 3.2f ? 1 : (height < 6.0f ? 2 : 3));
+  });
+
+  g_HexDrawOrigin = MakeHexDrawOrigin(g_HexGrid);
+
+  std::vector<float> maxHeights(g_HexGrid.ChunkCount());
+  for (uint32_t chunk = 0; chunk < g_HexGrid.ChunkCount(); ++chunk) {
+    maxHeights[chunk] = HexChunkMaxHeight(g_HexGrid, chunk);
+  }
+  g_HexBvh.Build(g_HexGrid, g_HexDrawOrigin, maxHeights.data());
+  g_HexLod.Build(g_HexGrid);
+
+  g_HexWater.Init(g_HexGrid);
+  g_HexWater.Flood(g_HexSeaLevel);
+  g_HexWater.dirtyChunks = &g_HexRemesher.dirty;
+  g_HexRemesher.Init(g_HexGrid, &g_HexWater, g_HexDrawOrigin.hex);
+
+  // Looking north across the map from south of its center
+  g_Camera.eye = {0.0f, 60.0f, -110.0f};
+  g_Camera.target = {0.0f, 0.0f, 0.0f};
+  g_Camera.farZ = 2000.0f;
+}
+
+// Raises (or with a negative delta lowers) the terrain around a tile and
+// marks the touched chunks for remeshing. The water flows over the new
+// ground from the next tick on.
+inline void EditTerrain(HexOffset center, int32_t radius, float delta) {
+  HexSpiral(OffsetToAxial(center), radius, [&](HexAxial hex) {
+    HexOffset tile = AxialToOffset(hex);
+    if (g_HexGrid.Contains(tile)) {
+      float& height = g_HexGrid.heights[g_HexGrid.Index(tile)];
+      height = height + delta > 0.0f ? height + delta : 0.0f;
+      g_HexWater.terrain[g_HexGrid.Index(tile)] = height;
+      g_HexRemesher.dirty.MarkTile(g_HexGrid, tile);
+    }
+  });
+}
+
+// The hex grid draws of one frame. All instances are in one upload
+// allocation, the full detail ones first.
+struct HexFrameDraws {
+  UploadAllocation instances;
+  uint32_t instanceCount;
+  HexInstanceBatches batches;              // Full detail, one per material
+  HexLodBatch lodBatches[g_HexMaxLod + 1]; // Coarse hexes, one per LOD
+  uint32_t lodBatchCount;
+};
+
+inline uint32_t HexDrawCount(const HexFrameDraws& draws) {
+  return draws.batches.batchCount + draws.lodBatchCount;
+}
+
+// Pieces the hex grid pass is recorded in - one per worker, but a list
+// below g_HexDrawsPerList draws costs more to open and submit than it saves
+inline uint32_t HexDrawPieceCount(const HexFrameDraws& draws) {
+  uint32_t pieces = HexDrawCount(draws) / g_HexDrawsPerList;
+  return std::max(1u, std::min(g_JobSystem.WorkerCount(), pieces));
+}
+
+// Culls the grid against the camera and packs the instances of what is
+// visible into the upload ring. The draw list lives in the frame's arena.
+// Instance coordinates are relative to g_HexDrawOrigin. Returns null if frame
+// memory ran out.
+inline const HexFrameDraws* PackFrameInstances() {
+  PROFILE_ZONE("PackFrameInstances");
+
+  // Last frame's remeshed chunks go live before anything looks at the meshes
+  g_HexRemesher.Update(g_HexGrid, &g_HexWater, g_HexDrawOrigin, g_HexBvh, g_HexLod, g_JobSystem);
+
+  LinearArena& arena = g_FrameArenas[g_CurrentBackBufferIndex];
+  uint32_t chunkCount = g_HexGrid.ChunkCount();
+  HexLodRegion* regions = arena.Allocate<HexLodRegion>(chunkCount);
+  uint32_t* chunks = arena.Allocate<uint32_t>(chunkCount);
+  void* drawMemory = arena.Allocate(sizeof(HexFrameDraws), alignof(HexFrameDraws));
+  if (!regions || !chunks || !drawMemory) {
+    return nullptr;
+  }
+
+  float viewProjection[16];
+  g_Camera.aspect = static_cast<float>(g_ScreenWidth) / g_ScreenHeight;
+  ComputeViewProjection(g_Camera, viewProjection);
+
+  HexCullParams params;
+  params.eye = g_Camera.eye;
+  params.lodDistance = g_HexLodDistance;
+  params.maxLod = static_cast<uint32_t>(g_HexLod.levels.size() - 1);
+
+  uint32_t regionCount = 0;
+  {
+    PROFILE_ZONE("CullHexGrid");
+    auto t0 = std::chrono::steady_clock::now();
+    regionCount = g_HexBvh.Cull(ExtractFrustum(viewProjection), params, regions, g_HexCullStats);
+    std::chrono::duration<double, std::micro> cullTime = std::chrono::steady_clock::now() - t0;
+    g_HexCullMicroseconds = cullTime.count();
+  }
+
+  PROFILE_COUNTER("Visible chunks", g_HexCullStats.chunksVisible);
+  PROFILE_COUNTER("Culled chunks", g_HexCullStats.chunksCulled);
+  PROFILE_COUNTER("Cull us", g_HexCullMicroseconds);
+
+  // Full detail chunks go to the chunk list, coarse regions are compacted in place
+  uint32_t detailCount = 0;
+  uint32_t coarseCount = 0;
+  for (uint32_t i = 0; i < regionCount; ++i) {
+    if (regions[i].lod == 0) {
+      chunks[detailCount++] = regions[i].chunkY * g_HexGrid.chunksX + regions[i].chunkX;
+    }
+    else {
+      regions[coarseCount++] = regions[i];
+    }
+  }
+
+  size_t detailCapacity = static_cast<size_t>(detailCount) * g_HexChunkTiles;
+  size_t capacity = detailCapacity + g_HexLod.CountInstances(g_HexGrid, regions, coarseCount);
+  UploadAllocation instances = g_UploadRing.Allocate((capacity > 0 ? capacity : 1) * sizeof(HexInstance), sizeof(HexInstance));
+  if (!instances.cpu) {
+    return nullptr;
+  }
+
+  HexFrameDraws* draws = new (drawMemory) HexFrameDraws;
+  draws->instances = instances;
+
+  HexInstance* out = reinterpret_cast<HexInstance*>(instances.cpu);
+  PackHexChunkMeshes(g_HexRemesher, chunks, detailCount, out, detailCapacity, draws->batches);
+
+  uint32_t detailInstances = draws->batches.instanceCount;
+  draws->lodBatchCount = g_HexLod.PackInstances(g_HexGrid, regions, coarseCount, g_HexDrawOrigin.hex, out + detailInstances, draws->lodBatches);
+  draws->instanceCount = detailInstances;
+  for (uint32_t i = 0; i < draws->lodBatchCount; ++i) {
+    draws->lodBatches[i].firstInstance += detailInstances;
+    draws->instanceCount += draws->lodBatches[i].instanceCount;
+  }
+
+  PROFILE_COUNTER("Hex instances", draws->instanceCount);
+
+  return draws;
+}
+
+// What an input event asks of the platform layer - the engine cannot do
+// these itself
+struct InputActions {
+  bool quit = false;
+  bool toggleFullscreen = false;
+  bool dumpProfile = false;
+  bool resize = false;
+  int width = 0;
+  int height = 0;
+};
+
+// Records an event of the current frame and reacts to it. The window
+// procedure and input replays both come through here.
+inline InputActions HandleInput(const InputEvent& event) {
+  g_InputRecorder.Record(event, g_FrameIndex);
+
+  InputActions actions;
+  switch (event.type) {
+    case InputEventType::KeyDown:
+      g_FramePacer.NoteInput();
+      switch (event.key) {
+        case 'V':
+          g_VSync = !g_VSync;
+          break;
+        case 'P':
+          actions.dumpProfile = true;
+          break;
+        case InputKeyEscape:
+          actions.quit = true;
+          break;
+        case InputKeyEnter:
+          actions.toggleFullscreen = (event.modifiers & InputModifierAlt) != 0;
+          break;
+        case InputKeyF11:
+          actions.toggleFullscreen = true;
+          break;
+      }
+      break;
+    case InputEventType::MouseMove:
+      g_FramePacer.NoteInput();
+      g_HoveredHex = PixelToHex(g_HexLayout, static_cast<float>(event.x), static_cast<float>(event.y));
+      break;
+    case InputEventType::Resize:
+      actions.resize = true;
+      actions.width = event.x;
+      actions.height = event.y;
+      break;
+    case InputEventType::Quit:
+      actions.quit = true;
+      break;
+    default:
+      break;
+  }
+
+  return actions;
+}
+
+inline InputLogHeader MakeInputLogHeader() {
+  InputLogHeader header = {};
+  header.screenWidth = g_ScreenWidth;
+  header.screenHeight = g_ScreenHeight;
+  header.gridSize = g_HexGridSize;
+  header.tickRate = g_TickRate;
+  header.simulationTicks = g_GameLoop.current.tick;
+  return header;
+}
+
+// Takes over the recorded settings, before the world is created
+inline void ApplyInputLogHeader(const InputLogHeader& header) {
+  g_ScreenWidth = header.screenWidth;
+  g_ScreenHeight = header.screenHeight;
+  g_HexGridSize = header.gridSize;
+  g_TickRate = header.tickRate;
+}
+
+// Runs the water for the simulation ticks of the frame. It steps on the
+// frame thread even with --sim-thread, so the remesher's chunk snapshots
+// never race it. A frame catches up at most maxTicksPerFrame ticks. The
+// rest are dropped and counted, which only happens when the simulation
+// thread runs ahead, so the water then lags behind the simulation's tick.
+inline void StepWater(uint32_t ticks) {
+  PROFILE_ZONE("StepWater");
+
+  uint32_t stepped = std::min(ticks, g_GameLoop.timestep.maxTicksPerFrame);
+  g_HexWaterDroppedTicks += ticks - stepped;
+  ticks = stepped;
+  float dt = static_cast<float>(g_GameLoop.timestep.step);
+  for (uint32_t i = 0; i < ticks; ++i) {
+    g_HexWater.Step(dt, g_HexWaterParams, g_JobSystem);
+  }
+}
+
+// Advances the frame by a frame time, measured or replayed - feeds it to
+// the game loop and the profiler, prints frame time percentiles once a
+// second
+inline void UpdateFrame(std::chrono::nanoseconds frameTime) {
+  PROFILE_ZONE("Update");
+
+  static double elapsedSeconds = 0.0;
+  double seconds = std::chrono::duration<double>(frameTime).count();
+
+  InputEvent frame;
+  frame.frameNanoseconds = static_cast<uint64_t>(frameTime.count());
+  g_InputRecorder.Record(frame, g_FrameIndex);
+
+  g_Profiler.RecordFrame(seconds);
+  g_GameLoop.Frame(seconds);
+  StepWater(g_GameLoop.ticksLastFrame);
+
+  elapsedSeconds += seconds;
+  if (elapsedSeconds > 1.0) {
+    char buffer[500];
+    FrameTimeStats stats = g_Profiler.GetFrameTimeStats();
+    std::snprintf(buffer, sizeof(buffer), "Frame ms p50 %.3f p99 %.3f max %.3f (FPS %.1f)\n",
+        stats.p50, stats.p99, stats.max, stats.average > 0.0 ? 1e3 / stats.average : 0.0);
+    DebugOutput(buffer);
+
+    elapsedSeconds = 0.0;
+  }
+}
+
+// Update function from tutorial - one frame with the wall time since the
+// last one
+inline void Update() {
+  static auto t0 = std::chrono::steady_clock::now();
+
+  auto t1 = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds deltaTime = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0);
+  t0 = t1;
+
+  UpdateFrame(deltaTime);
+}
+
+// Command line parsing shared by every executable. Arguments this function
+// does not know about are left for the caller. Strings are copied, the
+// caller's argv does not have to outlive the call.
+inline void ParseCommandLineArguments(int argc, const char* const* argv) {
+  for (int i = 0; i < argc; ++i) {
+    bool hasValue = i + 1 < argc;
+
+    if ((std::strcmp(argv[i], "-w") == 0 || std::strcmp(argv[i], "--width") == 0) && hasValue) {
+      g_ScreenWidth = std::strtol(argv[++i], nullptr, 10);
+    }
+    else if ((std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--height") == 0) && hasValue) {
+      g_ScreenHeight = std::strtol(argv[++i], nullptr, 10);
+    }
+    else if ((std::strcmp(argv[i], "-f") == 0 || std::strcmp(argv[i], "--frames") == 0) && hasValue) {
+      g_MaxFrames = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if ((std::strcmp(argv[i], "-j") == 0 || std::strcmp(argv[i], "--threads") == 0) && hasValue) {
+      g_WorkerThreads = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    }
+    else if (std::strcmp(argv[i], "--tick-rate") == 0 && hasValue) {
+      g_TickRate = std::strtod(argv[++i], nullptr);
+      g_TickRate = g_TickRate > 0.0 ? g_TickRate : 60.0;
+    }
+    else if (std::strcmp(argv[i], "--frames-in-flight") == 0 && hasValue) {
+      uint32_t framesInFlight = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      g_MaxFramesInFlight = framesInFlight < 1 ? 1 : (framesInFlight > g_NumFrames ? g_NumFrames : framesInFlight);
+    }
+    else if (std::strcmp(argv[i], "--grid") == 0 && hasValue) {
+      g_HexGridSize = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      g_HexGridSize = g_HexGridSize > 0 ? g_HexGridSize : 256;
+    }
+    else if (std::strcmp(argv[i], "--lod-distance") == 0 && hasValue) {
+      g_HexLodDistance = std::strtof(argv[++i], nullptr);
+    }
+    else if (std::strcmp(argv[i], "--remesh-chunks") == 0 && hasValue) {
+      g_HexRemesher.budget.maxChunks = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    }
+    else if (std::strcmp(argv[i], "--remesh-ms") == 0 && hasValue) {
+      g_HexRemesher.budget.maxMilliseconds = std::strtod(argv[++i], nullptr);
+    }
+    else if (std::strcmp(argv[i], "--draws-per-list") == 0 && hasValue) {
+      g_HexDrawsPerList = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      g_HexDrawsPerList = g_HexDrawsPerList > 0 ? g_HexDrawsPerList : 1;
+    }
+    else if (std::strcmp(argv[i], "--trace") == 0 && hasValue) {
+      g_TracePath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--sim-thread") == 0) {
+      g_SimulationThread = true;
+    }
+    else if (std::strcmp(argv[i], "--max-speed") == 0) {
+      g_MaxSpeed = true;
+    }
+    else if (std::strcmp(argv[i], "--texture") == 0 && hasValue) {
+      g_StartupTextures.push_back(argv[++i]);
+    }
+    else if (std::strcmp(argv[i], "--archive") == 0 && hasValue) {
+      g_AssetArchivePath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--io-threads") == 0 && hasValue) {
+      g_IoThreads = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      g_IoThreads = g_IoThreads > 0 ? g_IoThreads : 1;
+    }
+    else if (std::strcmp(argv[i], "--record") == 0 && hasValue) {
+      g_InputRecordPath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--replay") == 0 && hasValue) {
+      g_InputReplayPath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--cold-start") == 0) {
+      g_ColdStart = true;
+    }
+    else if (std::strcmp(argv[i], "-warp") == 0 || std::strcmp(argv[i], "--warp") == 0) {
+      g_UseWarp = true;
+    }
+  }
+}
+
+#endif // _H_ENGINE
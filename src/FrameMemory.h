@@ -0,0 +1,172 @@
+#ifndef _H_FRAME_MEMORY
+#define _H_FRAME_MEMORY
+
+// Transient per-frame memory.
+//
+// LinearArena is a bump allocator. There is one per back buffer slot and it
+// is reset when the slot comes around again, which is after the frame pacer
+// has waited for the slot's fence - so anything the GPU might still read from
+// it is done.
+//
+// UploadRing sub-allocates a persistently mapped upload buffer. Every frame's
+// allocations are tagged with the frame's fence value and the space is
+// reclaimed once that value completes. The ring only does bookkeeping on a
+// CPU pointer and a GPU base address, so any memory can back it.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Helpers.h"
+
+inline size_t AlignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+struct LinearArena {
+  uint8_t* base = nullptr;
+  size_t capacity = 0;
+  size_t offset = 0;
+  size_t lastFrameBytes = 0; // Used by the frame before the last reset
+  size_t highWater = 0;      // Most ever used by one frame
+  uint64_t failedAllocations = 0;
+
+  LinearArena() = default;
+  LinearArena(const LinearArena&) = delete;
+  LinearArena& operator=(const LinearArena&) = delete;
+
+  ~LinearArena() {
+    if (base) {
+      AlignedFree(base);
+    }
+  }
+
+  void Init(size_t size) {
+    if (base) {
+      AlignedFree(base);
+    }
+
+    base = static_cast<uint8_t*>(AlignedAlloc(size));
+    capacity = size;
+    offset = 0;
+  }
+
+  // Null when the arena is full - callers decide whether that is fatal
+  void* Allocate(size_t size, size_t alignment = 16) {
+    size_t start = AlignUp(offset, alignment);
+    if (start + size > capacity) {
+      failedAllocations++;
+      return nullptr;
+    }
+
+    offset = start + size;
+    highWater = offset > highWater ? offset : highWater;
+
+    return base + start;
+  }
+
+  template <typename T>
+  T* Allocate(size_t count) {
+    return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void Reset() {
+    lastFrameBytes = offset;
+    offset = 0;
+  }
+};
+
+struct UploadAllocation {
+  uint8_t* cpu;  // Null if the ring is full
+  uint64_t gpu;  // GPU virtual address
+  size_t offset; // From the start of the buffer
+};
+
+struct UploadRing {
+  static const uint32_t MaxFramesInFlight = 16;
+
+  uint8_t* cpuBase = nullptr;
+  uint64_t gpuBase = 0;
+  size_t capacity = 0;
+
+  // Monotonic byte counters, the buffer offset is the counter modulo capacity
+  uint64_t head = 0; // Next free byte
+  uint64_t tail = 0; // Oldest byte still in use by the GPU
+
+  // End of every frame that has not retired yet
+  struct Frame {
+    uint64_t fenceValue;
+    uint64_t end;
+  };
+  Frame frames[MaxFramesInFlight] = {};
+  uint32_t firstFrame = 0;
+  uint32_t frameCount = 0;
+  uint64_t frameStart = 0;
+
+  // Statistics
+  size_t lastFrameBytes = 0;
+  size_t frameHighWater = 0;    // Most bytes one frame allocated, padding included
+  size_t inFlightHighWater = 0; // Most bytes ever in use at once
+  uint64_t failedAllocations = 0;
+
+  void Init(uint8_t* cpu, uint64_t gpu, size_t size) {
+    cpuBase = cpu;
+    gpuBase = gpu;
+    capacity = size;
+    head = tail = frameStart = 0;
+    firstFrame = frameCount = 0;
+  }
+
+  UploadAllocation Allocate(size_t size, size_t alignment = 256) {
+    if (size > capacity) {
+      failedAllocations++;
+      return {nullptr, 0, 0};
+    }
+
+    size_t offset = static_cast<size_t>(head % capacity);
+    size_t aligned = AlignUp(offset, alignment);
+
+    // Allocations never straddle the end of the buffer, skip to the start
+    if (aligned + size > capacity) {
+      aligned = 0;
+    }
+    uint64_t newHead = head + (aligned >= offset ? aligned - offset : capacity - offset) + size;
+
+    if (newHead - tail > capacity) {
+      failedAllocations++;
+      return {nullptr, 0, 0};
+    }
+
+    head = newHead;
+    size_t inFlight = static_cast<size_t>(head - tail);
+    inFlightHighWater = inFlight > inFlightHighWater ? inFlight : inFlightHighWater;
+
+    return {cpuBase + aligned, gpuBase + aligned, aligned};
+  }
+
+  // Tags everything allocated since the last call with the frame's fence
+  void EndFrame(uint64_t fenceValue) {
+    lastFrameBytes = static_cast<size_t>(head - frameStart);
+    frameHighWater = lastFrameBytes > frameHighWater ? lastFrameBytes : frameHighWater;
+    frameStart = head;
+
+    if (frameCount == MaxFramesInFlight) {
+      // More frames in flight than tracked, fold the oldest into the next
+      firstFrame = (firstFrame + 1) % MaxFramesInFlight;
+      frameCount--;
+    }
+
+    frames[(firstFrame + frameCount) % MaxFramesInFlight] = {fenceValue, head};
+    frameCount++;
+  }
+
+  // Frees the space of every frame whose fence value has completed
+  void Retire(uint64_t completedFenceValue) {
+    while (frameCount > 0 && frames[firstFrame].fenceValue <= completedFenceValue) {
+      tail = frames[firstFrame].end;
+      firstFrame = (firstFrame + 1) % MaxFramesInFlight;
+      frameCount--;
+    }
+  }
+};
+
+#endif // _H_FRAME_MEMORY
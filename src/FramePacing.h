@@ -0,0 +1,179 @@
+#ifndef _H_FRAME_PACING
+#define _H_FRAME_PACING
+
+// Frame pacing - decides when the CPU has to wait for the GPU.
+//
+// The CPU waits at the start of a frame, and only if it is genuinely ahead:
+// either the back buffer slot it is about to reuse is still in use, or more
+// than maxFramesInFlight frames would be queued. The fence sits behind an
+// interface so the queue-depth logic runs the same against D3D12, the null
+// renderer and a simulated GPU.
+//
+// Input-to-present latency is measured from the first input event a frame
+// consumes to the Present() of that frame.
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "Profiler.h"
+
+struct FrameFence {
+  virtual ~FrameFence() = default;
+
+  // Signals the next fence value after all submitted work, returns it
+  virtual uint64_t Signal() = 0;
+  virtual uint64_t GetCompletedValue() = 0;
+  // Blocks until the completed value reaches fenceValue
+  virtual void WaitForValue(uint64_t fenceValue) = 0;
+};
+
+// Fence for a GPU that takes gpuFrameTime per signaled frame and works on
+// them one after another. A zero frame time completes on signal, which is
+// the null renderer's fence.
+struct SimulatedGpuFence : FrameFence {
+  typedef std::chrono::steady_clock Clock;
+  static const uint32_t History = 64;
+
+  Clock::duration gpuFrameTime = Clock::duration::zero();
+  uint64_t signaledValue = 0;
+  Clock::time_point completionTimes[History] = {}; // Indexed by fence value
+
+  uint64_t Signal() override {
+    Clock::time_point start = Clock::now();
+    if (signaledValue > 0) {
+      Clock::time_point previous = completionTimes[signaledValue % History];
+      start = previous > start ? previous : start;
+    }
+
+    signaledValue++;
+    completionTimes[signaledValue % History] = start + gpuFrameTime;
+
+    return signaledValue;
+  }
+
+  uint64_t GetCompletedValue() override {
+    Clock::time_point now = Clock::now();
+    uint64_t completed = signaledValue;
+    while (completed > 0 && signaledValue - completed < History - 1 && completionTimes[completed % History] > now) {
+      completed--;
+    }
+
+    return completed;
+  }
+
+  void WaitForValue(uint64_t fenceValue) override {
+    // Values that fell out of the history count as completed, like in GetCompletedValue()
+    if (fenceValue > 0 && fenceValue <= signaledValue && signaledValue - fenceValue < History - 1) {
+      std::this_thread::sleep_until(completionTimes[fenceValue % History]);
+    }
+  }
+};
+
+struct FramePacingStats {
+  uint64_t frames = 0;
+  uint64_t waits = 0;           // Frames that had to wait for the GPU
+  double lastWaitMicroseconds = 0.0;
+  double totalWaitMicroseconds = 0.0;
+  double maxWaitMicroseconds = 0.0;
+  uint32_t framesInFlight = 0;  // Queued frames at the start of the last frame
+};
+
+struct FramePacer {
+  static const uint32_t LatencyHistory = 1024;
+
+  FrameFence* fence = nullptr;
+  uint32_t maxFramesInFlight = 2;
+  uint64_t lastSignaled = 0;
+  FramePacingStats stats;
+
+  // Input latency
+  std::chrono::steady_clock::time_point pendingInput;  // Oldest input not yet seen by a frame
+  std::chrono::steady_clock::time_point frameInput;    // Oldest input the current frame consumed
+  bool hasPendingInput = false;
+  bool hasFrameInput = false;
+  float inputLatencies[LatencyHistory] = {}; // Milliseconds
+  uint64_t inputLatencyCount = 0;
+
+  void Init(FrameFence* frameFence, uint32_t framesInFlight) {
+    fence = frameFence;
+    maxFramesInFlight = framesInFlight > 0 ? framesInFlight : 1;
+    lastSignaled = frameFence->GetCompletedValue();
+    stats = {};
+  }
+
+  // Fence value the GPU has to reach before a frame that reuses a slot last
+  // signaled with slotFenceValue may start recording
+  uint64_t RequiredFenceValue(uint64_t slotFenceValue) const {
+    uint64_t latencyFenceValue = lastSignaled >= maxFramesInFlight ? lastSignaled - (maxFramesInFlight - 1) : 0;
+    return slotFenceValue > latencyFenceValue ? slotFenceValue : latencyFenceValue;
+  }
+
+  // Start of a frame - also marks the input gathered so far as consumed
+  void BeginFrame(uint64_t slotFenceValue) {
+    uint64_t required = RequiredFenceValue(slotFenceValue);
+    uint64_t completed = fence->GetCompletedValue();
+    stats.framesInFlight = static_cast<uint32_t>(lastSignaled - completed);
+
+    if (completed < required) {
+      PROFILE_ZONE("FramePacer::Wait");
+
+      auto t0 = std::chrono::steady_clock::now();
+      fence->WaitForValue(required);
+      std::chrono::duration<double, std::micro> waited = std::chrono::steady_clock::now() - t0;
+
+      stats.waits++;
+      stats.lastWaitMicroseconds = waited.count();
+      stats.totalWaitMicroseconds += waited.count();
+      stats.maxWaitMicroseconds = waited.count() > stats.maxWaitMicroseconds ? waited.count() : stats.maxWaitMicroseconds;
+    }
+    else {
+      stats.lastWaitMicroseconds = 0.0;
+    }
+
+    if (hasPendingInput && !hasFrameInput) {
+      frameInput = pendingInput;
+      hasFrameInput = true;
+    }
+    hasPendingInput = false;
+  }
+
+  // Right after Present() - closes the input-to-present measurement
+  void Presented() {
+    if (hasFrameInput) {
+      std::chrono::duration<float, std::milli> latency = std::chrono::steady_clock::now() - frameInput;
+      inputLatencies[inputLatencyCount % LatencyHistory] = latency.count();
+      inputLatencyCount++;
+      hasFrameInput = false;
+    }
+  }
+
+  // End of a frame - signals the fence and returns the frame's fence value
+  uint64_t EndFrame() {
+    lastSignaled = fence->Signal();
+    stats.frames++;
+
+    return lastSignaled;
+  }
+
+  // Waits for everything submitted so far, without signaling again
+  void WaitForIdle() {
+    if (fence->GetCompletedValue() < lastSignaled) {
+      fence->WaitForValue(lastSignaled);
+    }
+  }
+
+  void NoteInput() {
+    if (!hasPendingInput) {
+      pendingInput = std::chrono::steady_clock::now();
+      hasPendingInput = true;
+    }
+  }
+
+  // Input-to-present latency over the last LatencyHistory inputs, in milliseconds
+  FrameTimeStats GetInputLatencyStats() const {
+    return ComputeFrameTimeStats(inputLatencies, static_cast<size_t>(inputLatencyCount < LatencyHistory ? inputLatencyCount : LatencyHistory));
+  }
+};
+
+#endif // _H_FRAME_PACING
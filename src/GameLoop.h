@@ -0,0 +1,157 @@
+#ifndef _H_GAME_LOOP
+#define _H_GAME_LOOP
+
+// Game loop - fixed-timestep simulation decoupled from variable-rate
+// rendering. Frame time goes into an accumulator that is drained in whole
+// ticks, the leftover fraction is the interpolation alpha between the last
+// two simulation states. Optionally the simulation runs on its own thread
+// and the frame just samples the latest published states.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "Profiler.h"
+#include "Simulation.h"
+
+struct FixedTimestep {
+  double step = 1.0 / 60.0;
+  double accumulator = 0.0;
+  uint32_t maxTicksPerFrame = 8; // Drop time instead of spiraling after a long stall
+
+  // Adds a frame's worth of time, returns the number of ticks to run
+  uint32_t Advance(double frameSeconds) {
+    accumulator += frameSeconds;
+
+    uint32_t ticks = 0;
+    while (accumulator >= step && ticks < maxTicksPerFrame) {
+      accumulator -= step;
+      ticks++;
+    }
+
+    if (ticks == maxTicksPerFrame && accumulator >= step) {
+      accumulator = 0.0;
+    }
+
+    return ticks;
+  }
+
+  double Alpha() const {
+    return accumulator / step;
+  }
+};
+
+struct GameLoop {
+  FixedTimestep timestep;
+  bool maxSpeed = false; // Tick back to back, ignoring wall time
+
+  // Owned by whoever runs the ticks
+  SimulationState previous;
+  SimulationState current;
+
+  // What the renderer sees - the two states to interpolate between
+  SimulationState renderPrevious;
+  SimulationState renderCurrent;
+  double alpha = 0.0;
+  uint32_t ticksLastFrame = 0;
+
+  // Simulation thread
+  std::thread thread;
+  std::atomic<bool> running{false};
+  std::mutex publishMutex;
+  std::chrono::steady_clock::time_point lastTickTime;
+
+  GameLoop() = default;
+  GameLoop(const GameLoop&) = delete;
+  GameLoop& operator=(const GameLoop&) = delete;
+
+  ~GameLoop() {
+    Stop();
+  }
+
+  void Start(double tickRate, bool threaded, bool runAtMaxSpeed) {
+    Stop();
+
+    timestep = {};
+    timestep.step = 1.0 / tickRate;
+    maxSpeed = runAtMaxSpeed;
+    previous = current = {};
+    renderPrevious = renderCurrent = {};
+    lastTickTime = std::chrono::steady_clock::now();
+
+    if (threaded) {
+      running = true;
+      thread = std::thread([this]() { SimulationThreadMain(); });
+    }
+  }
+
+  void Stop() {
+    running = false;
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  bool IsThreaded() const {
+    return thread.joinable();
+  }
+
+  void Tick() {
+    PROFILE_ZONE("SimulationTick");
+
+    previous = current;
+    SimulationTick(current, timestep.step);
+  }
+
+  // Called once per rendered frame with the wall time since the last one
+  void Frame(double frameSeconds) {
+    if (IsThreaded()) {
+      std::lock_guard<std::mutex> lock(publishMutex);
+      ticksLastFrame = static_cast<uint32_t>(renderCurrent.tick == current.tick ? 0 : current.tick - renderCurrent.tick);
+      renderPrevious = previous;
+      renderCurrent = current;
+
+      std::chrono::duration<double> sinceTick = std::chrono::steady_clock::now() - lastTickTime;
+      alpha = maxSpeed ? 1.0 : sinceTick.count() / timestep.step;
+      alpha = alpha < 1.0 ? alpha : 1.0;
+      return;
+    }
+
+    ticksLastFrame = maxSpeed ? 1 : timestep.Advance(frameSeconds);
+    for (uint32_t i = 0; i < ticksLastFrame; ++i) {
+      Tick();
+    }
+
+    renderPrevious = previous;
+    renderCurrent = current;
+    alpha = maxSpeed ? 1.0 : timestep.Alpha();
+  }
+
+  void SimulationThreadMain() {
+    auto nextTick = std::chrono::steady_clock::now();
+    auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timestep.step));
+
+    while (running.load(std::memory_order_relaxed)) {
+      if (!maxSpeed) {
+        std::this_thread::sleep_until(nextTick);
+        nextTick += step;
+      }
+
+      PROFILE_ZONE("SimulationTick");
+
+      // Tick on copies so the lock is only held for the publish
+      SimulationState tickPrevious = current;
+      SimulationState tickCurrent = current;
+      SimulationTick(tickCurrent, timestep.step);
+
+      std::lock_guard<std::mutex> lock(publishMutex);
+      previous = tickPrevious;
+      current = tickCurrent;
+      lastTickTime = std::chrono::steady_clock::now();
+    }
+  }
+};
+
+#endif // _H_GAME_LOOP
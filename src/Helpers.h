@@ -1,7 +1,16 @@
 #ifndef _H_HELPERS
 #define _H_HELPERS
 
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <new>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
+#endif
 #include <Windows.h>
 
 inline void ThrowIfFailed(HRESULT hr)
@@ -11,6 +20,92 @@ inline void ThrowIfFailed(HRESULT hr)
     throw std::exception();
   }
 }
+#endif
+
+// Debug text output - debugger output window on Windows, stderr everywhere else
+inline void DebugOutput(const char* message) {
+#if defined(_WIN32)
+  ::OutputDebugStringA(message);
+#else
+  std::fputs(message, stderr);
+#endif
+}
+
+const size_t g_CacheLineSize = 64;
+
+// Aligned heap allocation - cache-line aligned unless asked otherwise
+inline void* AlignedAlloc(size_t size, size_t alignment = g_CacheLineSize) {
+  return ::operator new(size, std::align_val_t(alignment));
+}
+
+inline void AlignedFree(void* pointer, size_t alignment = g_CacheLineSize) {
+  ::operator delete(pointer, std::align_val_t(alignment));
+}
+
+// Small deterministic random number generator (xorshift64*), same sequence on
+// every platform for a given seed
+struct Random {
+  uint64_t state;
+
+  explicit Random(uint64_t seed = 0x9E3779B97F4A7C15ull) : state(seed ? seed : 1) {}
+
+  uint64_t Next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
+  }
+
+  // Uniform in [0, bound)
+  uint32_t NextBelow(uint32_t bound) {
+    return static_cast<uint32_t>(((Next() >> 32) * bound) >> 32);
+  }
+
+  // Uniform in [0, 1)
+  float NextFloat() {
+    return static_cast<float>(Next() >> 40) * (1.0f / 16777216.0f);
+  }
+};
+
+// 64-bit FNV-1a. Content keys for files and caches that outlive a run, so it
+// has to give the same value on every platform. Pass a previous hash to
+// continue it over more bytes.
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ull) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+// Writes a whole file through a temporary next to it, so readers never see
+// a half written file and a failed write keeps the old one
+inline bool WriteWholeFile(const char* path, const void* data, size_t size) {
+  char temporaryPath[1024];
+  if (std::snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path) >= static_cast<int>(sizeof(temporaryPath))) {
+    return false;
+  }
+
+  std::FILE* file = std::fopen(temporaryPath, "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok = size == 0 || std::fwrite(data, size, 1, file) == 1;
+  ok = (std::fclose(file) == 0) && ok;
+
+  // Both replace an existing file in one step, rename() only does that on POSIX
+#if defined(_WIN32)
+  ok = ok && MoveFileExA(temporaryPath, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  ok = ok && std::rename(temporaryPath, path) == 0;
+#endif
+  if (!ok) {
+    std::remove(temporaryPath);
+  }
+
+  return ok;
+}
 
 
 #endif // _H_HELPERS
@@ -0,0 +1,418 @@
+#ifndef _H_HEX_CULLING
+#define _H_HEX_CULLING
+
+// Chunk-level frustum culling and LOD selection for the hex grid.
+//
+// The chunks are the leaves of a 4-wide bounding volume hierarchy that
+// splits the chunk rectangle into quadrants. Every node stores the boxes of
+// its four children as SoA lanes, so one SSE2 pass tests all four against a
+// plane. Subtrees fully inside the frustum skip the plane tests, subtrees
+// outside are never visited - the cost follows what is visible, not the map
+// size.
+//
+// LOD is picked from the distance to the closest point of a box: level L
+// draws one coarse hex per 2^L x 2^L tiles. Once a whole subtree is far
+// enough to be a single coarse hex it is emitted as one merged region
+// instead of its chunks.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Camera.h"
+#include "HexGrid.h"
+#include "HexMesh.h"
+#include "HexPicking.h"
+#include "Simd.h"
+
+const uint32_t g_HexBvhLeaf = 0x80000000u;
+const uint32_t g_HexMaxLod = 15;
+const float g_HexMinWorldHeight = 0.05f; // Flat tiles are still drawn as a thin prism
+
+// World placement shared with the hex shader. Hexes have size 1 and
+// positions are relative to the tile at the center of the map, so floats
+// keep their precision on large maps.
+struct HexDrawOrigin {
+  HexAxial hex;
+  float x;
+  float z;
+};
+
+inline HexDrawOrigin MakeHexDrawOrigin(const HexGrid& grid) {
+  HexDrawOrigin origin;
+  origin.hex = OffsetToAxial({static_cast<int32_t>(grid.width / 2), static_cast<int32_t>(grid.height / 2)});
+  HexToPixel(HexLayout{}, origin.hex, origin.x, origin.z);
+
+  return origin;
+}
+
+// Axis-aligned box of one chunk's prisms
+inline void HexChunkWorldBounds(const HexGrid& grid, const HexDrawOrigin& origin, uint32_t chunk, float maxHeight, float boxMin[3], float boxMax[3]) {
+  HexChunkBounds bounds = grid.ChunkBounds(chunk);
+  float halfWidth = g_Sqrt3 * 0.5f;
+  float oddRowShift = bounds.rows > 1 || (bounds.row0 & 1) ? halfWidth : 0.0f;
+
+  boxMin[0] = g_Sqrt3 * bounds.col0 - halfWidth - origin.x;
+  boxMax[0] = g_Sqrt3 * (bounds.col0 + bounds.cols - 1) + halfWidth + oddRowShift - origin.x;
+  boxMin[1] = 0.0f;
+  boxMax[1] = maxHeight + 0.5f / g_HexHeightScale; // Instance heights are rounded to the nearest step
+  boxMax[1] = boxMax[1] > g_HexMinWorldHeight ? boxMax[1] : g_HexMinWorldHeight;
+  boxMin[2] = 1.5f * bounds.row0 - 1.0f - origin.z;
+  boxMax[2] = 1.5f * (bounds.row0 + bounds.rows - 1) + 1.0f - origin.z;
+}
+
+// A square block of chunks drawn at one LOD - a single chunk, or a merged
+// subtree drawn as one coarse hex
+struct HexLodRegion {
+  uint16_t chunkX;
+  uint16_t chunkY;
+  uint16_t chunkSpan; // Power of two, may reach past the map edge
+  uint16_t lod;
+};
+
+struct HexCullParams {
+  Vec3 eye;
+  float lodDistance = 64.0f; // Distance where LOD 1 starts, doubling per level. 0 disables LOD
+  uint32_t maxLod = g_HexMaxLod;
+};
+
+struct HexCullStats {
+  uint32_t nodesVisited = 0;
+  uint32_t chunksVisible = 0;
+  uint32_t chunksCulled = 0;
+  uint32_t regions = 0;
+  uint32_t mergedRegions = 0; // Regions covering more than one chunk
+};
+
+struct alignas(64) HexBvhNode {
+  // Child boxes, one lane per child
+  float minX[4];
+  float minY[4];
+  float minZ[4];
+  float maxX[4];
+  float maxY[4];
+  float maxZ[4];
+
+  uint32_t children[4];   // Node index, or g_HexBvhLeaf | chunk
+  uint32_t chunkCount[4]; // Map chunks under each child
+  uint16_t chunkX[4];
+  uint16_t chunkY[4];
+  uint16_t chunkSpan[4];
+  uint32_t validMask;     // Children that exist - quadrants past the map edge do not
+  uint32_t parent;        // Node index and child slot of this node in its parent
+  uint32_t parentSlot;
+};
+
+// Result of testing a node's four children
+struct HexCullClass {
+  uint32_t outsideMask;
+  uint32_t insideMask;
+  uint32_t lods[4];
+};
+
+inline uint32_t HexLodFromDistanceSquared(float distanceSquared, const float* thresholdsSquared, uint32_t maxLod) {
+  uint32_t lod = 0;
+  while (lod < maxLod && distanceSquared >= thresholdsSquared[lod]) {
+    lod++;
+  }
+
+  return lod;
+}
+
+inline HexCullClass ClassifyHexBvhChildrenScalar(const HexBvhNode& node, const Frustum& frustum, bool testPlanes,
+    Vec3 eye, const float* thresholdsSquared, uint32_t maxLod) {
+  HexCullClass result = {0, 0, {}};
+
+  for (int i = 0; i < 4; ++i) {
+    bool outside = false;
+    bool inside = true;
+    for (int p = 0; testPlanes && p < 6; ++p) {
+      const float* plane = frustum.planes[p];
+      // Box corner furthest along the plane normal, and the one furthest against it
+      float px = plane[0] >= 0.0f ? node.maxX[i] : node.minX[i];
+      float py = plane[1] >= 0.0f ? node.maxY[i] : node.minY[i];
+      float pz = plane[2] >= 0.0f ? node.maxZ[i] : node.minZ[i];
+      float nx = plane[0] >= 0.0f ? node.minX[i] : node.maxX[i];
+      float ny = plane[1] >= 0.0f ? node.minY[i] : node.maxY[i];
+      float nz = plane[2] >= 0.0f ? node.minZ[i] : node.maxZ[i];
+
+      outside |= plane[0] * px + plane[1] * py + plane[2] * pz + plane[3] < 0.0f;
+      inside &= plane[0] * nx + plane[1] * ny + plane[2] * nz + plane[3] >= 0.0f;
+    }
+
+    float dx = node.minX[i] - eye.x > eye.x - node.maxX[i] ? node.minX[i] - eye.x : eye.x - node.maxX[i];
+    float dy = node.minY[i] - eye.y > eye.y - node.maxY[i] ? node.minY[i] - eye.y : eye.y - node.maxY[i];
+    float dz = node.minZ[i] - eye.z > eye.z - node.maxZ[i] ? node.minZ[i] - eye.z : eye.z - node.maxZ[i];
+    dx = dx > 0.0f ? dx : 0.0f;
+    dy = dy > 0.0f ? dy : 0.0f;
+    dz = dz > 0.0f ? dz : 0.0f;
+
+    result.outsideMask |= static_cast<uint32_t>(outside) << i;
+    result.insideMask |= static_cast<uint32_t>(testPlanes ? inside : true) << i;
+    result.lods[i] = HexLodFromDistanceSquared(dx * dx + dy * dy + dz * dz, thresholdsSquared, maxLod);
+  }
+
+  result.outsideMask &= node.validMask;
+  result.insideMask &= node.validMask;
+
+  return result;
+}
+
+#if SIMD_X86
+// Same operations in the same order as the scalar version, so both pick the
+// same regions bit for bit
+inline HexCullClass ClassifyHexBvhChildrenSSE2(const HexBvhNode& node, const Frustum& frustum, bool testPlanes,
+    Vec3 eye, const float* thresholdsSquared, uint32_t maxLod) {
+  __m128 minX = _mm_load_ps(node.minX);
+  __m128 minY = _mm_load_ps(node.minY);
+  __m128 minZ = _mm_load_ps(node.minZ);
+  __m128 maxX = _mm_load_ps(node.maxX);
+  __m128 maxY = _mm_load_ps(node.maxY);
+  __m128 maxZ = _mm_load_ps(node.maxZ);
+  __m128 zero = _mm_setzero_ps();
+
+  __m128 outside = zero;
+  __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  for (int p = 0; testPlanes && p < 6; ++p) {
+    const float* plane = frustum.planes[p];
+    __m128 a = _mm_set1_ps(plane[0]);
+    __m128 b = _mm_set1_ps(plane[1]);
+    __m128 c = _mm_set1_ps(plane[2]);
+    __m128 d = _mm_set1_ps(plane[3]);
+
+    // The plane is the same for all lanes, so the corner choice is a scalar select
+    __m128 px = plane[0] >= 0.0f ? maxX : minX;
+    __m128 py = plane[1] >= 0.0f ? maxY : minY;
+    __m128 pz = plane[2] >= 0.0f ? maxZ : minZ;
+    __m128 nx = plane[0] >= 0.0f ? minX : maxX;
+    __m128 ny = plane[1] >= 0.0f ? minY : maxY;
+    __m128 nz = plane[2] >= 0.0f ? minZ : maxZ;
+
+    __m128 positive = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, px), _mm_mul_ps(b, py)), _mm_mul_ps(c, pz)), d);
+    __m128 negative = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, nx), _mm_mul_ps(b, ny)), _mm_mul_ps(c, nz)), d);
+    outside = _mm_or_ps(outside, _mm_cmplt_ps(positive, zero));
+    inside = _mm_and_ps(inside, _mm_cmpge_ps(negative, zero));
+  }
+
+  __m128 ex = _mm_set1_ps(eye.x);
+  __m128 ey = _mm_set1_ps(eye.y);
+  __m128 ez = _mm_set1_ps(eye.z);
+  __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, ex), _mm_sub_ps(ex, maxX)), zero);
+  __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, ey), _mm_sub_ps(ey, maxY)), zero);
+  __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, ez), _mm_sub_ps(ez, maxZ)), zero);
+  __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+  // LOD is the number of thresholds the distance reaches
+  __m128i lods = _mm_setzero_si128();
+  for (uint32_t lod = 0; lod < maxLod; ++lod) {
+    __m128i reached = _mm_castps_si128(_mm_cmpge_ps(distanceSquared, _mm_set1_ps(thresholdsSquared[lod])));
+    if (_mm_movemask_epi8(reached) == 0) {
+      break;
+    }
+    lods = _mm_sub_epi32(lods, reached);
+  }
+
+  HexCullClass result;
+  result.outsideMask = static_cast<uint32_t>(_mm_movemask_ps(outside)) & node.validMask;
+  result.insideMask = static_cast<uint32_t>(_mm_movemask_ps(inside)) & node.validMask;
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(result.lods), lods);
+
+  return result;
+}
+#endif
+
+struct HexChunkBvh {
+  std::vector<HexBvhNode> nodes; // Root first
+  std::vector<uint32_t> leafNodes; // Per chunk: node index << 2 | child slot
+  uint32_t rootSpan = 0;
+
+  // Builds the hierarchy over every chunk of the grid. maxHeights holds the
+  // highest tile of each chunk, in world units.
+  void Build(const HexGrid& grid, const HexDrawOrigin& origin, const float* maxHeights) {
+    nodes.clear();
+    leafNodes.assign(grid.ChunkCount(), 0);
+
+    rootSpan = 2;
+    while (rootSpan < grid.chunksX || rootSpan < grid.chunksY) {
+      rootSpan *= 2;
+    }
+
+    BuildNode(grid, origin, maxHeights, 0, 0, rootSpan, UINT32_MAX, 0);
+  }
+
+  // Refits the boxes above one chunk after its tile heights changed
+  void RefitChunk(const HexGrid& grid, const HexDrawOrigin& origin, uint32_t chunk, float maxHeight) {
+    uint32_t node = leafNodes[chunk] >> 2;
+    uint32_t slot = leafNodes[chunk] & 3;
+
+    float boxMin[3];
+    float boxMax[3];
+    HexChunkWorldBounds(grid, origin, chunk, maxHeight, boxMin, boxMax);
+    nodes[node].maxY[slot] = boxMax[1];
+
+    // Only the height changes, x and z are fixed by the layout
+    while (nodes[node].parent != UINT32_MAX) {
+      const HexBvhNode& child = nodes[node];
+      float top = 0.0f;
+      for (int i = 0; i < 4; ++i) {
+        top = (child.validMask >> i) & 1 && child.maxY[i] > top ? child.maxY[i] : top;
+      }
+
+      uint32_t parentSlot = child.parentSlot;
+      node = child.parent;
+      nodes[node].maxY[parentSlot] = top;
+    }
+  }
+
+  // Writes the visible regions to out, which needs room for one region per
+  // chunk. Returns the number of regions.
+  uint32_t Cull(const Frustum& frustum, const HexCullParams& params, HexLodRegion* out, HexCullStats& stats,
+      SimdLevel level = GetSimdLevel()) const {
+    stats = {};
+    if (nodes.empty()) {
+      return 0;
+    }
+
+    float thresholdsSquared[g_HexMaxLod];
+    uint32_t maxLod = params.lodDistance > 0.0f ? (params.maxLod < g_HexMaxLod ? params.maxLod : g_HexMaxLod) : 0;
+    for (uint32_t lod = 0; lod < maxLod; ++lod) {
+      float threshold = params.lodDistance * static_cast<float>(1u << lod);
+      thresholdsSquared[lod] = threshold * threshold;
+    }
+
+    struct StackEntry {
+      uint32_t node;
+      bool inside;
+    };
+    StackEntry stack[4 * 32];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = {0, false};
+
+    uint32_t regionCount = 0;
+    while (stackSize > 0) {
+      StackEntry entry = stack[--stackSize];
+      const HexBvhNode& node = nodes[entry.node];
+      stats.nodesVisited++;
+
+#if SIMD_X86
+      HexCullClass cull = level >= SimdLevel::SSE2 ?
+          ClassifyHexBvhChildrenSSE2(node, frustum, !entry.inside, params.eye, thresholdsSquared, maxLod) :
+          ClassifyHexBvhChildrenScalar(node, frustum, !entry.inside, params.eye, thresholdsSquared, maxLod);
+#else
+      (void)level;
+      HexCullClass cull = ClassifyHexBvhChildrenScalar(node, frustum, !entry.inside, params.eye, thresholdsSquared, maxLod);
+#endif
+
+      for (int i = 0; i < 4; ++i) {
+        if (!((node.validMask >> i) & 1)) {
+          continue;
+        }
+        if ((cull.outsideMask >> i) & 1) {
+          stats.chunksCulled += node.chunkCount[i];
+          continue;
+        }
+
+        // A subtree is merged once one coarse hex covers all of it
+        uint32_t span = node.chunkSpan[i];
+        uint32_t mergedLod = g_HexChunkShift;
+        while ((1u << (mergedLod - g_HexChunkShift)) < span) {
+          mergedLod++;
+        }
+
+        if (span == 1 || cull.lods[i] >= mergedLod) {
+          uint32_t lod = cull.lods[i] < mergedLod ? cull.lods[i] : mergedLod;
+          out[regionCount++] = {node.chunkX[i], node.chunkY[i], static_cast<uint16_t>(span), static_cast<uint16_t>(lod)};
+          stats.chunksVisible += node.chunkCount[i];
+          stats.mergedRegions += span > 1;
+        }
+        else {
+          stack[stackSize++] = {node.children[i], ((cull.insideMask >> i) & 1) != 0};
+        }
+      }
+    }
+
+    stats.regions = regionCount;
+
+    return regionCount;
+  }
+
+private:
+  uint32_t BuildNode(const HexGrid& grid, const HexDrawOrigin& origin, const float* maxHeights,
+      uint32_t chunkX, uint32_t chunkY, uint32_t span, uint32_t parent, uint32_t parentSlot) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    nodes[index].validMask = 0;
+    nodes[index].parent = parent;
+    nodes[index].parentSlot = parentSlot;
+
+    uint32_t half = span / 2;
+    for (uint32_t i = 0; i < 4; ++i) {
+      uint32_t x = chunkX + (i & 1) * half;
+      uint32_t y = chunkY + (i >> 1) * half;
+
+      float boxMin[3] = {0.0f, 0.0f, 0.0f};
+      float boxMax[3] = {0.0f, 0.0f, 0.0f};
+      uint32_t child = 0;
+      uint32_t chunkCount = 0;
+
+      if (x < grid.chunksX && y < grid.chunksY) {
+        if (half == 1) {
+          uint32_t chunk = y * grid.chunksX + x;
+          HexChunkWorldBounds(grid, origin, chunk, maxHeights[chunk], boxMin, boxMax);
+          child = g_HexBvhLeaf | chunk;
+          chunkCount = 1;
+          leafNodes[chunk] = index << 2 | i;
+        }
+        else {
+          child = BuildNode(grid, origin, maxHeights, x, y, half, index, i);
+
+          // The child's box is the union of its children
+          const HexBvhNode& node = nodes[child];
+          bool first = true;
+          for (int c = 0; c < 4; ++c) {
+            if ((node.validMask >> c) & 1) {
+              float childMin[3] = {node.minX[c], node.minY[c], node.minZ[c]};
+              float childMax[3] = {node.maxX[c], node.maxY[c], node.maxZ[c]};
+              for (int axis = 0; axis < 3; ++axis) {
+                boxMin[axis] = first || childMin[axis] < boxMin[axis] ? childMin[axis] : boxMin[axis];
+                boxMax[axis] = first || childMax[axis] > boxMax[axis] ? childMax[axis] : boxMax[axis];
+              }
+              chunkCount += node.chunkCount[c];
+              first = false;
+            }
+          }
+        }
+
+        nodes[index].validMask |= 1u << i;
+      }
+
+      // nodes may have grown, index again
+      HexBvhNode& node = nodes[index];
+      node.minX[i] = boxMin[0];
+      node.minY[i] = boxMin[1];
+      node.minZ[i] = boxMin[2];
+      node.maxX[i] = boxMax[0];
+      node.maxY[i] = boxMax[1];
+      node.maxZ[i] = boxMax[2];
+      node.children[i] = child;
+      node.chunkCount[i] = chunkCount;
+      node.chunkX[i] = static_cast<uint16_t>(x);
+      node.chunkY[i] = static_cast<uint16_t>(y);
+      node.chunkSpan[i] = static_cast<uint16_t>(half);
+    }
+
+    return index;
+  }
+};
+
+// Highest tile of every chunk in world units, the input of HexChunkBvh
+inline float HexChunkMaxHeight(const HexGrid& grid, uint32_t chunk) {
+  float top = 0.0f;
+  grid.ForEachTileInChunk(chunk, [&](uint32_t index, HexOffset) {
+    top = grid.heights[index] > top ? grid.heights[index] : top;
+  });
+
+  return top;
+}
+
+#endif // _H_HEX_CULLING
@@ -0,0 +1,380 @@
+#ifndef _H_HEX_GRID
+#define _H_HEX_GRID
+
+// Hexagonal grid - coordinate kernels and chunked structure-of-arrays tile
+// storage. Pointy-top hexes, maps are rectangles in "odd-r" offset
+// coordinates (odd rows are shoved half a tile to the right).
+//
+// Tiles are stored in chunks of 16x16. Inside a chunk every field is a
+// contiguous, cache-line aligned block, so sweeping a chunk touches only a
+// handful of cache lines per field and a tile's neighbors are almost always
+// in the same block. Tile indices are computed with shifts and masks - there
+// are no lookup structures to walk.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "Helpers.h"
+
+// Axial coordinate, cube coordinate is (q, r, s) with q + r + s == 0
+struct HexAxial {
+  int32_t q;
+  int32_t r;
+};
+
+struct HexCube {
+  int32_t q;
+  int32_t r;
+  int32_t s;
+};
+
+// Odd-r offset coordinate - the rectangular layout the maps are stored in
+struct HexOffset {
+  int32_t col;
+  int32_t row;
+};
+
+inline bool operator==(HexAxial a, HexAxial b) { return a.q == b.q && a.r == b.r; }
+inline bool operator!=(HexAxial a, HexAxial b) { return !(a == b); }
+inline bool operator==(HexOffset a, HexOffset b) { return a.col == b.col && a.row == b.row; }
+inline bool operator!=(HexOffset a, HexOffset b) { return !(a == b); }
+
+// Neighbor directions in axial space: E, NE, NW, W, SW, SE
+const HexAxial g_HexDirections[6] = {
+  {+1, 0}, {+1, -1}, {0, -1}, {-1, 0}, {-1, +1}, {0, +1}
+};
+
+// The same directions in odd-r offset space, indexed by [row & 1][direction]
+const HexOffset g_HexOffsetDirections[2][6] = {
+  {{+1, 0}, {0, -1}, {-1, -1}, {-1, 0}, {-1, +1}, {0, +1}},
+  {{+1, 0}, {+1, -1}, {0, -1}, {-1, 0}, {0, +1}, {+1, +1}}
+};
+
+inline HexCube AxialToCube(HexAxial a) {
+  return {a.q, a.r, -a.q - a.r};
+}
+
+inline HexAxial CubeToAxial(HexCube c) {
+  return {c.q, c.r};
+}
+
+// (row - (row & 1)) is always even, so the arithmetic shift is an exact
+// division by two for negative rows as well
+inline HexOffset AxialToOffset(HexAxial a) {
+  return {a.q + ((a.r - (a.r & 1)) >> 1), a.r};
+}
+
+inline HexAxial OffsetToAxial(HexOffset o) {
+  return {o.col - ((o.row - (o.row & 1)) >> 1), o.row};
+}
+
+inline HexAxial HexAdd(HexAxial a, HexAxial b) {
+  return {a.q + b.q, a.r + b.r};
+}
+
+inline HexAxial HexScale(HexAxial a, int32_t k) {
+  return {a.q * k, a.r * k};
+}
+
+inline HexAxial HexNeighbor(HexAxial a, int direction) {
+  return HexAdd(a, g_HexDirections[direction]);
+}
+
+inline HexOffset HexNeighbor(HexOffset o, int direction) {
+  HexOffset d = g_HexOffsetDirections[o.row & 1][direction];
+  return {o.col + d.col, o.row + d.row};
+}
+
+inline int32_t HexDistance(HexAxial a, HexAxial b) {
+  int32_t dq = a.q - b.q;
+  int32_t dr = a.r - b.r;
+  int32_t ds = -dq - dr;
+
+  return (std::abs(dq) + std::abs(dr) + std::abs(ds)) >> 1;
+}
+
+inline int32_t HexDistance(HexOffset a, HexOffset b) {
+  return HexDistance(OffsetToAxial(a), OffsetToAxial(b));
+}
+
+// Calls visit(HexAxial) for every hex exactly `radius` steps from center
+template <typename Visit>
+inline void HexRing(HexAxial center, int32_t radius, Visit&& visit) {
+  if (radius == 0) {
+    visit(center);
+    return;
+  }
+
+  HexAxial hex = HexAdd(center, HexScale(g_HexDirections[4], radius));
+  for (int side = 0; side < 6; ++side) {
+    for (int32_t step = 0; step < radius; ++step) {
+      visit(hex);
+      hex = HexNeighbor(hex, side);
+    }
+  }
+}
+
+// Calls visit(HexAxial) for center and then every ring out to `radius`
+template <typename Visit>
+inline void HexSpiral(HexAxial center, int32_t radius, Visit&& visit) {
+  for (int32_t ring = 0; ring <= radius; ++ring) {
+    HexRing(center, ring, visit);
+  }
+}
+
+// Number of hexes within `radius` steps, center included
+inline uint32_t HexSpiralCount(int32_t radius) {
+  return static_cast<uint32_t>(3 * radius * (radius + 1) + 1);
+}
+
+const uint32_t g_HexChunkShift = 4;
+const uint32_t g_HexChunkSize = 1u << g_HexChunkShift; // 16x16 tiles per chunk
+const uint32_t g_HexChunkMask = g_HexChunkSize - 1;
+const uint32_t g_HexChunkTiles = g_HexChunkSize * g_HexChunkSize;
+const uint32_t g_InvalidTile = UINT32_MAX;
+
+// Tile rectangle of one chunk - chunks on the right and bottom edge of a map
+// can be partially filled
+struct HexChunkBounds {
+  uint32_t col0;
+  uint32_t row0;
+  uint32_t cols;
+  uint32_t rows;
+  uint32_t base; // Index of the chunk's first tile
+};
+
+// Chunked SoA tile storage. Storage is rounded up to whole chunks, tiles in
+// the padding exist but are never visited by ForEachTile.
+struct HexGrid {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t chunksX = 0;
+  uint32_t chunksY = 0;
+
+  // Per-tile fields
+  float* heights = nullptr;    // Terrain height
+  uint8_t* materials = nullptr; // Material id
+  uint8_t* flags = nullptr;     // Gameplay flags
+
+  HexGrid() = default;
+
+  HexGrid(uint32_t width, uint32_t height) :
+    width(width),
+    height(height),
+    chunksX((width + g_HexChunkMask) >> g_HexChunkShift),
+    chunksY((height + g_HexChunkMask) >> g_HexChunkShift) {
+    size_t tileCount = TileCount();
+
+    heights = static_cast<float*>(AlignedAlloc(tileCount * sizeof(float)));
+    materials = static_cast<uint8_t*>(AlignedAlloc(tileCount));
+    flags = static_cast<uint8_t*>(AlignedAlloc(tileCount));
+
+    std::memset(heights, 0, tileCount * sizeof(float));
+    std::memset(materials, 0, tileCount);
+    std::memset(flags, 0, tileCount);
+  }
+
+  HexGrid(HexGrid&& other) noexcept {
+    *this = std::move(other);
+  }
+
+  HexGrid& operator=(HexGrid&& other) noexcept {
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(chunksX, other.chunksX);
+    std::swap(chunksY, other.chunksY);
+    std::swap(heights, other.heights);
+    std::swap(materials, other.materials);
+    std::swap(flags, other.flags);
+
+    return *this;
+  }
+
+  HexGrid(const HexGrid&) = delete;
+  HexGrid& operator=(const HexGrid&) = delete;
+
+  ~HexGrid() {
+    if (heights) {
+      AlignedFree(heights);
+      AlignedFree(materials);
+      AlignedFree(flags);
+    }
+  }
+
+  uint32_t ChunkCount() const {
+    return chunksX * chunksY;
+  }
+
+  // Storage size in tiles, padding included
+  size_t TileCount() const {
+    return static_cast<size_t>(ChunkCount()) * g_HexChunkTiles;
+  }
+
+  bool Contains(HexOffset o) const {
+    return (static_cast<uint32_t>(o.col) < width) & (static_cast<uint32_t>(o.row) < height);
+  }
+
+  uint32_t ChunkIndex(HexOffset o) const {
+    return (static_cast<uint32_t>(o.row) >> g_HexChunkShift) * chunksX + (static_cast<uint32_t>(o.col) >> g_HexChunkShift);
+  }
+
+  // Unchecked - the coordinate has to be inside the grid
+  uint32_t Index(HexOffset o) const {
+    uint32_t col = static_cast<uint32_t>(o.col);
+    uint32_t row = static_cast<uint32_t>(o.row);
+
+    return (ChunkIndex(o) << (2 * g_HexChunkShift)) | ((row & g_HexChunkMask) << g_HexChunkShift) | (col & g_HexChunkMask);
+  }
+
+  uint32_t Index(HexAxial a) const {
+    return Index(AxialToOffset(a));
+  }
+
+  // Returns g_InvalidTile outside the grid, without branching
+  uint32_t IndexChecked(HexOffset o) const {
+    uint32_t index = Index(o);
+    return Contains(o) ? index : g_InvalidTile;
+  }
+
+  HexOffset Coord(uint32_t index) const {
+    uint32_t chunk = index >> (2 * g_HexChunkShift);
+    uint32_t local = index & (g_HexChunkTiles - 1);
+    uint32_t chunkY = chunk / chunksX;
+    uint32_t chunkX = chunk - chunkY * chunksX;
+
+    return {
+      static_cast<int32_t>((chunkX << g_HexChunkShift) | (local & g_HexChunkMask)),
+      static_cast<int32_t>((chunkY << g_HexChunkShift) | (local >> g_HexChunkShift))
+    };
+  }
+
+  // Index of the neighbor in `direction`, g_InvalidTile past the map edge
+  uint32_t Neighbor(HexOffset o, int direction) const {
+    return IndexChecked(HexNeighbor(o, direction));
+  }
+
+  // All six neighbor indices at once, g_InvalidTile past the map edge
+  void Neighbors(HexOffset o, uint32_t out[6]) const {
+    const HexOffset* directions = g_HexOffsetDirections[o.row & 1];
+    for (int direction = 0; direction < 6; ++direction) {
+      out[direction] = IndexChecked({o.col + directions[direction].col, o.row + directions[direction].row});
+    }
+  }
+
+  HexChunkBounds ChunkBounds(uint32_t chunk) const {
+    uint32_t chunkY = chunk / chunksX;
+    uint32_t chunkX = chunk - chunkY * chunksX;
+    uint32_t col0 = chunkX << g_HexChunkShift;
+    uint32_t row0 = chunkY << g_HexChunkShift;
+
+    return {
+      col0,
+      row0,
+      width - col0 < g_HexChunkSize ? width - col0 : g_HexChunkSize,
+      height - row0 < g_HexChunkSize ? height - row0 : g_HexChunkSize,
+      chunk << (2 * g_HexChunkShift)
+    };
+  }
+
+  // Calls visit(uint32_t index, HexOffset coord) for every tile of one chunk
+  // in memory order
+  template <typename Visit>
+  void ForEachTileInChunk(uint32_t chunk, Visit&& visit) const {
+    HexChunkBounds bounds = ChunkBounds(chunk);
+
+    for (uint32_t y = 0; y < bounds.rows; ++y) {
+      for (uint32_t x = 0; x < bounds.cols; ++x) {
+        visit(bounds.base | (y << g_HexChunkShift) | x, HexOffset{static_cast<int32_t>(bounds.col0 + x), static_cast<int32_t>(bounds.row0 + y)});
+      }
+    }
+  }
+
+  // Calls visit(uint32_t index, HexOffset coord) for every tile in memory order
+  template <typename Visit>
+  void ForEachTile(Visit&& visit) const {
+    for (uint32_t chunk = 0; chunk < ChunkCount(); ++chunk) {
+      ForEachTileInChunk(chunk, visit);
+    }
+  }
+};
+
+// One dirty bit per chunk. Any thread may mark chunks at any time, a single
+// consumer takes them. Mark after writing the tile data, the consumer clears
+// the bit before reading it, so a change is never lost between the two.
+struct HexDirtyChunks {
+  std::unique_ptr<std::atomic<uint64_t>[]> words;
+  uint32_t wordCount = 0;
+  uint32_t chunkCount = 0;
+  uint32_t cursor = 0; // Word the next Take() starts at, so no region starves
+
+  void Init(uint32_t chunks) {
+    chunkCount = chunks;
+    wordCount = (chunks + 63) / 64;
+    words.reset(new std::atomic<uint64_t>[wordCount]);
+    for (uint32_t i = 0; i < wordCount; ++i) {
+      words[i].store(0, std::memory_order_relaxed);
+    }
+    cursor = 0;
+  }
+
+  void Mark(uint32_t chunk) {
+    words[chunk >> 6].fetch_or(1ull << (chunk & 63), std::memory_order_release);
+  }
+
+  // Marks the chunk of a tile, nothing outside the grid
+  void MarkTile(const HexGrid& grid, HexOffset o) {
+    if (grid.Contains(o)) {
+      Mark(grid.ChunkIndex(o));
+    }
+  }
+
+  void MarkAll() {
+    for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+      Mark(chunk);
+    }
+  }
+
+  uint32_t Count() const {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < wordCount; ++i) {
+      uint64_t word = words[i].load(std::memory_order_relaxed);
+      while (word) {
+        word &= word - 1;
+        count++;
+      }
+    }
+
+    return count;
+  }
+
+  // Clears and returns up to max dirty chunks
+  uint32_t Take(uint32_t* out, uint32_t max) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < wordCount && count < max; ++i) {
+      uint32_t wordIndex = (cursor + i) % wordCount;
+      uint64_t word = words[wordIndex].load(std::memory_order_acquire);
+
+      uint64_t taken = 0;
+      for (uint32_t bit = 0; bit < 64 && word >> bit && count < max; ++bit) {
+        if ((word >> bit) & 1) {
+          taken |= 1ull << bit;
+          out[count++] = wordIndex * 64 + bit;
+        }
+      }
+
+      words[wordIndex].fetch_and(~taken, std::memory_order_acq_rel);
+      if (count == max) {
+        cursor = word != taken ? wordIndex : wordIndex + 1;
+        return count;
+      }
+    }
+
+    return count;
+  }
+};
+
+#endif // _H_HEX_GRID
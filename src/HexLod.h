@@ -0,0 +1,198 @@
+#ifndef _H_HEX_LOD
+#define _H_HEX_LOD
+
+// Coarse levels of the hex grid for distant regions. Level L holds one
+// block per 2^L x 2^L tiles with the average height and the most common
+// material, each level reduced from the one below. A block is drawn as one
+// hex of size 2^L; odd block rows are shifted half a block so the coarse
+// hexes tile the plane like the fine ones.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "HexCulling.h"
+#include "HexMesh.h"
+
+struct HexLodLevel {
+  uint32_t blocksX = 0;
+  uint32_t blocksY = 0;
+  std::vector<float> heights;
+  std::vector<uint8_t> materials;
+};
+
+struct HexLodBatch {
+  uint32_t lod;
+  uint32_t firstInstance;
+  uint32_t instanceCount;
+};
+
+struct HexLodPyramid {
+  std::vector<HexLodLevel> levels; // levels[L] has blocks of 2^L tiles, levels[0] is the grid itself and left empty
+
+  void Build(const HexGrid& grid) {
+    levels.clear();
+    levels.emplace_back();
+
+    uint32_t blocksX = grid.width;
+    uint32_t blocksY = grid.height;
+    while (blocksX > 1 || blocksY > 1) {
+      blocksX = (blocksX + 1) / 2;
+      blocksY = (blocksY + 1) / 2;
+
+      HexLodLevel level;
+      level.blocksX = blocksX;
+      level.blocksY = blocksY;
+      level.heights.resize(static_cast<size_t>(blocksX) * blocksY);
+      level.materials.resize(static_cast<size_t>(blocksX) * blocksY);
+      levels.push_back(std::move(level));
+
+      uint32_t lod = static_cast<uint32_t>(levels.size() - 1);
+      for (uint32_t by = 0; by < blocksY; ++by) {
+        for (uint32_t bx = 0; bx < blocksX; ++bx) {
+          ReduceBlock(grid, lod, bx, by);
+        }
+      }
+    }
+  }
+
+  // Recomputes every block that covers a chunk, after its tiles changed
+  void UpdateChunk(const HexGrid& grid, uint32_t chunk) {
+    HexChunkBounds bounds = grid.ChunkBounds(chunk);
+    for (uint32_t lod = 1; lod < levels.size(); ++lod) {
+      for (uint32_t by = bounds.row0 >> lod; by <= (bounds.row0 + bounds.rows - 1) >> lod; ++by) {
+        for (uint32_t bx = bounds.col0 >> lod; bx <= (bounds.col0 + bounds.cols - 1) >> lod; ++bx) {
+          ReduceBlock(grid, lod, bx, by);
+        }
+      }
+    }
+  }
+
+  // Instances the regions need - every block of a region at its LOD
+  uint32_t CountInstances(const HexGrid& grid, const HexLodRegion* regions, size_t regionCount) const {
+    uint32_t total = 0;
+    for (size_t i = 0; i < regionCount; ++i) {
+      uint32_t bx0, by0, bx1, by1;
+      RegionBlocks(grid, regions[i], bx0, by0, bx1, by1);
+      total += (bx1 - bx0) * (by1 - by0);
+    }
+
+    return total;
+  }
+
+  // Packs the regions with lod > 0 into instances grouped by LOD, one batch
+  // per level that occurs. out needs CountInstances() entries, batches room
+  // for levels.size() batches. Returns the number of batches.
+  uint32_t PackInstances(const HexGrid& grid, const HexLodRegion* regions, size_t regionCount, HexAxial origin,
+      HexInstance* out, HexLodBatch* batches) const {
+    uint32_t counts[g_HexMaxLod + 1] = {};
+    for (size_t i = 0; i < regionCount; ++i) {
+      uint32_t bx0, by0, bx1, by1;
+      RegionBlocks(grid, regions[i], bx0, by0, bx1, by1);
+      counts[regions[i].lod] += (bx1 - bx0) * (by1 - by0);
+    }
+
+    uint32_t cursors[g_HexMaxLod + 1];
+    uint32_t total = 0;
+    uint32_t batchCount = 0;
+    for (uint32_t lod = 1; lod < levels.size(); ++lod) {
+      cursors[lod] = total;
+      if (counts[lod] > 0) {
+        batches[batchCount++] = {lod, total, counts[lod]};
+        total += counts[lod];
+      }
+    }
+
+    for (size_t i = 0; i < regionCount; ++i) {
+      uint32_t lod = regions[i].lod;
+      if (lod == 0) {
+        continue;
+      }
+
+      const HexLodLevel& level = levels[lod];
+      int32_t blockSize = 1 << lod;
+      uint32_t bx0, by0, bx1, by1;
+      RegionBlocks(grid, regions[i], bx0, by0, bx1, by1);
+
+      for (uint32_t by = by0; by < by1; ++by) {
+        int32_t row = static_cast<int32_t>(by) * blockSize + blockSize / 2;
+        int32_t shift = (by & 1) * (blockSize / 2);
+
+        for (uint32_t bx = bx0; bx < bx1; ++bx) {
+          size_t block = static_cast<size_t>(by) * level.blocksX + bx;
+          HexAxial hex = OffsetToAxial({static_cast<int32_t>(bx) * blockSize + blockSize / 2 + shift, row});
+
+          out[cursors[lod]++] = {static_cast<int16_t>(hex.q - origin.q), static_cast<int16_t>(hex.r - origin.r),
+              QuantizeHexHeight(level.heights[block]), level.materials[block], 0};
+        }
+      }
+    }
+
+    return batchCount;
+  }
+
+private:
+  // Block range [bx0, bx1) x [by0, by1) of a region at its LOD, clipped to the map
+  void RegionBlocks(const HexGrid& grid, const HexLodRegion& region, uint32_t& bx0, uint32_t& by0, uint32_t& bx1, uint32_t& by1) const {
+    uint32_t lod = region.lod;
+    uint32_t col0 = static_cast<uint32_t>(region.chunkX) << g_HexChunkShift;
+    uint32_t row0 = static_cast<uint32_t>(region.chunkY) << g_HexChunkShift;
+    uint32_t col1 = (static_cast<uint32_t>(region.chunkX) + region.chunkSpan) << g_HexChunkShift;
+    uint32_t row1 = (static_cast<uint32_t>(region.chunkY) + region.chunkSpan) << g_HexChunkShift;
+    col1 = col1 < grid.width ? col1 : grid.width;
+    row1 = row1 < grid.height ? row1 : grid.height;
+
+    bx0 = col0 >> lod;
+    by0 = row0 >> lod;
+    bx1 = ((col1 - 1) >> lod) + 1;
+    by1 = ((row1 - 1) >> lod) + 1;
+  }
+
+  void ReduceBlock(const HexGrid& grid, uint32_t lod, uint32_t bx, uint32_t by) {
+    HexLodLevel& level = levels[lod];
+    float height = 0.0f;
+    uint32_t count = 0;
+    uint8_t materials[4];
+
+    for (uint32_t i = 0; i < 4; ++i) {
+      uint32_t x = bx * 2 + (i & 1);
+      uint32_t y = by * 2 + (i >> 1);
+
+      if (lod == 1) {
+        if (x < grid.width && y < grid.height) {
+          uint32_t index = grid.Index(HexOffset{static_cast<int32_t>(x), static_cast<int32_t>(y)});
+          height += grid.heights[index];
+          materials[count++] = grid.materials[index];
+        }
+      }
+      else {
+        const HexLodLevel& finer = levels[lod - 1];
+        if (x < finer.blocksX && y < finer.blocksY) {
+          size_t block = static_cast<size_t>(y) * finer.blocksX + x;
+          height += finer.heights[block];
+          materials[count++] = finer.materials[block];
+        }
+      }
+    }
+
+    // Most common material, ties go to the first one seen
+    uint8_t material = materials[0];
+    uint32_t best = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t matches = 0;
+      for (uint32_t j = 0; j < count; ++j) {
+        matches += materials[j] == materials[i];
+      }
+      if (matches > best) {
+        best = matches;
+        material = materials[i];
+      }
+    }
+
+    size_t block = static_cast<size_t>(by) * level.blocksX + bx;
+    level.heights[block] = height / count;
+    level.materials[block] = material;
+  }
+};
+
+#endif // _H_HEX_LOD
@@ -0,0 +1,179 @@
+#ifndef _H_HEX_MESH
+#define _H_HEX_MESH
+
+// Instanced hex tile rendering, CPU side. Every tile is the same hexagon
+// prism mesh, placed and scaled in the vertex shader from an 8 byte instance.
+// Instances are packed grouped by material so each material is one
+// DrawIndexedInstanced call.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "HexGrid.h"
+
+const uint32_t g_HexMaxMaterials = 256; // Materials are a uint8_t per tile
+const float g_HexHeightScale = 256.0f;  // Instance heights are 8.8 fixed point
+
+// Material colors (material & 7) and the sun, for the shaders' constants
+// and the software rasterizer
+const float g_HexPalette[8][4] = {
+  {0.15f, 0.35f, 0.75f, 1.0f}, // Water
+  {0.85f, 0.78f, 0.55f, 1.0f}, // Sand
+  {0.30f, 0.62f, 0.25f, 1.0f}, // Grass
+  {0.50f, 0.48f, 0.45f, 1.0f}, // Rock
+  {0.90f, 0.90f, 0.95f, 1.0f},
+  {0.60f, 0.30f, 0.20f, 1.0f},
+  {0.20f, 0.20f, 0.20f, 1.0f},
+  {1.00f, 0.00f, 1.00f, 1.0f},
+};
+const float g_HexLightDirection[3] = {0.4f, -1.0f, 0.3f}; // Not normalized
+
+// Unit prism in the XZ plane - corners at distance 1 from the center, top at
+// y = 1, bottom at y = 0. The bottom cap is never visible and left out.
+struct HexVertex {
+  float position[3];
+  float normal[3];
+};
+
+const uint32_t g_HexPrismVertexCount = 6 + 6 * 4;
+const uint32_t g_HexPrismIndexCount = 4 * 3 + 6 * 6;
+
+// Triangles are clockwise seen from outside, the D3D12 default front face
+inline void BuildHexPrismMesh(HexVertex* vertices, uint16_t* indices) {
+  float cornerX[6];
+  float cornerZ[6];
+  for (int i = 0; i < 6; ++i) {
+    // Pointy-top, same orientation as HexToPixel with pixel y along z
+    float angle = (60.0f * i - 30.0f) * 3.14159265f / 180.0f;
+    cornerX[i] = std::cos(angle);
+    cornerZ[i] = std::sin(angle);
+  }
+
+  // Top cap, a fan around corner 0
+  for (int i = 0; i < 6; ++i) {
+    vertices[i] = {{cornerX[i], 1.0f, cornerZ[i]}, {0.0f, 1.0f, 0.0f}};
+  }
+  for (int i = 1; i < 5; ++i) {
+    indices[(i - 1) * 3 + 0] = 0;
+    indices[(i - 1) * 3 + 1] = static_cast<uint16_t>(i + 1);
+    indices[(i - 1) * 3 + 2] = static_cast<uint16_t>(i);
+  }
+
+  // Sides, one quad per edge with a flat normal through the edge midpoint
+  for (int i = 0; i < 6; ++i) {
+    int next = (i + 1) % 6;
+    float angle = 60.0f * i * 3.14159265f / 180.0f;
+    float nx = std::cos(angle);
+    float nz = std::sin(angle);
+
+    uint16_t base = static_cast<uint16_t>(6 + i * 4);
+    vertices[base + 0] = {{cornerX[i], 1.0f, cornerZ[i]}, {nx, 0.0f, nz}};
+    vertices[base + 1] = {{cornerX[next], 1.0f, cornerZ[next]}, {nx, 0.0f, nz}};
+    vertices[base + 2] = {{cornerX[next], 0.0f, cornerZ[next]}, {nx, 0.0f, nz}};
+    vertices[base + 3] = {{cornerX[i], 0.0f, cornerZ[i]}, {nx, 0.0f, nz}};
+
+    uint16_t* quad = indices + 12 + i * 6;
+    quad[0] = base;
+    quad[1] = static_cast<uint16_t>(base + 1);
+    quad[2] = static_cast<uint16_t>(base + 2);
+    quad[3] = base;
+    quad[4] = static_cast<uint16_t>(base + 2);
+    quad[5] = static_cast<uint16_t>(base + 3);
+  }
+}
+
+// Per-tile instance. Coordinates are relative to the origin of the draw so
+// they fit 16 bits however large the world is.
+struct HexInstance {
+  int16_t q;
+  int16_t r;
+  uint16_t height; // Terrain height * g_HexHeightScale
+  uint8_t material;
+  uint8_t flags;
+};
+
+static_assert(sizeof(HexInstance) == 8, "HexInstance is streamed to the GPU every frame, keep it small");
+
+inline uint16_t QuantizeHexHeight(float height) {
+  float scaled = height * g_HexHeightScale + 0.5f;
+  return scaled <= 0.0f ? 0 : (scaled >= 65535.0f ? 65535 : static_cast<uint16_t>(scaled));
+}
+
+struct HexDrawBatch {
+  uint32_t material;
+  uint32_t firstInstance;
+  uint32_t instanceCount;
+};
+
+struct HexInstanceBatches {
+  HexDrawBatch batches[g_HexMaxMaterials];
+  uint32_t batchCount = 0;
+  uint32_t instanceCount = 0; // Required instances, also when they did not fit
+};
+
+// Packs every tile of the given chunks into instances grouped by material,
+// one batch per material that occurs. Returns false, writing nothing, if the
+// instances do not fit into capacity - batches.instanceCount says how many
+// would have been needed. Two passes: a histogram of the material bytes, then
+// a scatter to each material's range. Both walk chunk rows, which are
+// contiguous in every field.
+inline bool PackHexInstances(const HexGrid& grid, const uint32_t* chunks, size_t chunkCount, HexAxial origin,
+    HexInstance* out, size_t capacity, HexInstanceBatches& batches) {
+  // Four histograms so runs of one material do not serialize on a single counter
+  uint32_t counts[4][g_HexMaxMaterials] = {};
+  for (size_t i = 0; i < chunkCount; ++i) {
+    HexChunkBounds bounds = grid.ChunkBounds(chunks[i]);
+    for (uint32_t y = 0; y < bounds.rows; ++y) {
+      const uint8_t* materials = grid.materials + bounds.base + (y << g_HexChunkShift);
+      uint32_t x = 0;
+      for (; x + 4 <= bounds.cols; x += 4) {
+        counts[0][materials[x + 0]]++;
+        counts[1][materials[x + 1]]++;
+        counts[2][materials[x + 2]]++;
+        counts[3][materials[x + 3]]++;
+      }
+      for (; x < bounds.cols; ++x) {
+        counts[0][materials[x]]++;
+      }
+    }
+  }
+
+  uint32_t cursors[g_HexMaxMaterials];
+  uint32_t total = 0;
+  batches.batchCount = 0;
+  for (uint32_t material = 0; material < g_HexMaxMaterials; ++material) {
+    uint32_t count = counts[0][material] + counts[1][material] + counts[2][material] + counts[3][material];
+    cursors[material] = total;
+    if (count > 0) {
+      batches.batches[batches.batchCount++] = {material, total, count};
+      total += count;
+    }
+  }
+
+  batches.instanceCount = total;
+  if (total > capacity) {
+    batches.batchCount = 0;
+    return false;
+  }
+
+  for (size_t i = 0; i < chunkCount; ++i) {
+    HexChunkBounds bounds = grid.ChunkBounds(chunks[i]);
+    for (uint32_t y = 0; y < bounds.rows; ++y) {
+      uint32_t rowBase = bounds.base + (y << g_HexChunkShift);
+      HexAxial first = OffsetToAxial({static_cast<int32_t>(bounds.col0), static_cast<int32_t>(bounds.row0 + y)});
+      int16_t q = static_cast<int16_t>(first.q - origin.q);
+      int16_t r = static_cast<int16_t>(first.r - origin.r);
+
+      for (uint32_t x = 0; x < bounds.cols; ++x) {
+        uint32_t index = rowBase + x;
+        uint8_t material = grid.materials[index];
+        out[cursors[material]++] = {static_cast<int16_t>(q + x), r, QuantizeHexHeight(grid.heights[index]), material, grid.flags[index]};
+      }
+    }
+  }
+
+  return true;
+}
+
+#endif // _H_HEX_MESH
@@ -0,0 +1,647 @@
+#ifndef _H_HEX_PATHFINDING
+#define _H_HEX_PATHFINDING
+
+// Pathfinding over the hex grid for ships. Every tile has a step cost, the
+// cost of entering it (0 is blocked). Costs come from the terrain height:
+// deep water is cheap, shallows are slow and land is blocked.
+//
+// Queries are answered in batches on the job system. A query to a goal that
+// many queries of the batch share walks a cached flow field. Any other
+// query runs A*. The open and closed sets live in per-thread scratch blocks
+// that are allocated once and reused, so a query allocates nothing. A
+// scratch block marks the tiles of the current search with a stamp instead
+// of clearing its arrays.
+//
+// Tile edits mark chunks in a HexDirtyChunks set. Update() recomputes the
+// costs of marked chunks. Only chunks whose costs really changed count as
+// changed. A changed chunk drops the flow fields that looked at it and
+// bumps the chunk's epoch, and IsPathCurrent() checks a path against the
+// epochs of the chunks it crosses.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "HexGrid.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+const uint8_t g_HexFlowGoal = 6;           // Flow direction of the goal tile
+const uint8_t g_HexFlowUnreached = 7;      // Blocked or past the field's cost limit
+const uint32_t g_HexPathBatchGrain = 16;   // Queries per job piece
+const uint32_t g_HexPathBuckets = 512;     // Bucket ring size, more than two of the highest step cost
+
+struct HexPathParams {
+  float seaLevel = 2.5f;
+  float shallowDepth = 0.5f;    // Water shallower than this is slow
+  uint8_t deepCost = 1;         // 0 blocks deep water too
+  uint8_t shallowCost = 3;
+  uint32_t maxSearchTiles = 1 << 16; // A* gives up after expanding this many tiles
+  uint32_t flowFieldSlots = 16;
+  uint32_t flowFieldMinQueries = 32; // Queries to one goal in a batch that earn it a flow field
+  uint32_t maxFlowCost = 384;        // Flow fields stop at this path cost
+};
+
+enum HexPathStatus : uint8_t {
+  HexPathFound,
+  HexPathTruncated, // Found, but longer than the query's capacity
+  HexPathNoPath,
+  HexPathGaveUp     // A* hit maxSearchTiles
+};
+
+// One query. path receives the tiles from start to goal, both included.
+struct HexPathQuery {
+  uint32_t start; // Tile indices
+  uint32_t goal;
+  uint32_t* path;
+  uint32_t capacity;
+
+  // Results
+  uint32_t length;  // Tiles in the full path, even if truncated
+  uint32_t cost;
+  uint64_t epoch;   // For IsPathCurrent()
+  HexPathStatus status;
+  bool fromFlowField;
+};
+
+struct HexPathStats {
+  std::atomic<uint64_t> queries{0};
+  std::atomic<uint64_t> flowFieldQueries{0};
+  std::atomic<uint64_t> searchedTiles{0}; // Tiles expanded by A*
+  std::atomic<uint64_t> failedQueries{0};
+  uint64_t fieldsBuilt = 0;
+  uint64_t fieldsInvalidated = 0;
+  uint64_t chunksChanged = 0;
+};
+
+// Cost of entering a tile for a ship, 0 is blocked
+inline uint8_t HexShipStepCost(const HexPathParams& params, float height) {
+  return height < params.seaLevel - params.shallowDepth ? params.deepCost : (height < params.seaLevel ? params.shallowCost : 0);
+}
+
+// Search state of one tile, packed so a visit touches one cache line
+struct HexPathNode {
+  uint32_t stamp;  // Search that last wrote the node, the rest is stale otherwise
+  uint32_t cost;   // Cost from the start, or to the goal for flow fields
+  uint8_t parent;  // Direction towards the start
+  bool closed;
+};
+
+// Per-thread search memory. The open set is a ring of buckets indexed by
+// path cost - step costs are small integers, so a search never has entries
+// more than two steps' worth of cost apart.
+struct HexPathScratch {
+  HexPathNode* nodes = nullptr;
+  uint32_t stamp = 0;
+  std::vector<uint32_t> buckets[g_HexPathBuckets];
+
+  HexPathScratch(size_t tileCount) :
+    tiles(tileCount) {
+    nodes = static_cast<HexPathNode*>(AlignedAlloc(tileCount * sizeof(HexPathNode)));
+    std::memset(nodes, 0, tileCount * sizeof(HexPathNode));
+  }
+
+  HexPathScratch(const HexPathScratch&) = delete;
+  HexPathScratch& operator=(const HexPathScratch&) = delete;
+
+  ~HexPathScratch() {
+    AlignedFree(nodes);
+  }
+
+  // Starts a search, every node reads as unvisited afterwards
+  void NextStamp() {
+    if (++stamp == 0) {
+      std::memset(nodes, 0, tiles * sizeof(HexPathNode));
+      stamp = 1;
+    }
+  }
+
+  // Bytes held by the growable containers
+  size_t ContainerBytes() const {
+    size_t bytes = 0;
+    for (const std::vector<uint32_t>& bucket : buckets) {
+      bytes += bucket.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+  }
+
+private:
+  size_t tiles = 0;
+};
+
+// Directions from every tile towards one goal, following them is a cheapest
+// path. examinedChunks has a bit for every chunk whose costs were read.
+struct HexFlowField {
+  uint32_t goal = g_InvalidTile;
+  uint8_t* directions = nullptr;
+  std::vector<uint64_t> examinedChunks;
+  uint64_t lastUsed = 0;
+  bool valid = false;
+};
+
+struct HexPathfinder {
+  HexPathParams params;
+  HexDirtyChunks dirty;
+  HexPathStats stats;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t chunksX = 0;
+  uint32_t minCost = 1;
+  uint8_t* costs = nullptr;    // Step cost per tile, padding is blocked
+  std::vector<uint64_t> chunkEpochs;
+  uint64_t epoch = 0;
+  uint64_t batch = 0;
+  std::vector<HexFlowField> fields;
+
+  HexPathfinder() = default;
+  HexPathfinder(const HexPathfinder&) = delete;
+  HexPathfinder& operator=(const HexPathfinder&) = delete;
+
+  ~HexPathfinder() {
+    Free();
+  }
+
+  void Init(const HexGrid& grid, const HexPathParams& pathParams = HexPathParams()) {
+    Free();
+    params = pathParams;
+    width = grid.width;
+    height = grid.height;
+    chunksX = grid.chunksX;
+    tileCount = grid.TileCount();
+    minCost = std::min(params.deepCost ? params.deepCost : 255, params.shallowCost ? params.shallowCost : 255);
+
+    costs = static_cast<uint8_t*>(AlignedAlloc(tileCount));
+    std::memset(costs, 0, tileCount);
+    for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+      UpdateChunkCosts(grid, chunk);
+    }
+
+    dirty.Init(grid.ChunkCount());
+    chunkEpochs.assign(grid.ChunkCount(), 0);
+    epoch = 0;
+    fields.resize(params.flowFieldSlots);
+  }
+
+  void Free() {
+    if (costs) {
+      AlignedFree(costs);
+      costs = nullptr;
+    }
+    for (HexFlowField& field : fields) {
+      if (field.directions) {
+        AlignedFree(field.directions);
+      }
+    }
+    fields.clear();
+    scratch.clear();
+    freeScratch.clear();
+  }
+
+  // Recomputes the costs of dirty chunks. Must not run during FindPaths().
+  // Returns the number of chunks whose costs changed.
+  uint32_t Update(const HexGrid& grid) {
+    PROFILE_ZONE("Pathfinder update");
+
+    uint32_t changed = 0;
+    uint32_t chunks[64];
+    while (uint32_t count = dirty.Take(chunks, 64)) {
+      for (uint32_t i = 0; i < count; ++i) {
+        uint32_t chunk = chunks[i];
+        if (!UpdateChunkCosts(grid, chunk)) {
+          continue;
+        }
+
+        if (changed++ == 0) {
+          epoch++;
+        }
+        chunkEpochs[chunk] = epoch;
+        for (HexFlowField& field : fields) {
+          if (field.valid && (field.examinedChunks[chunk >> 6] >> (chunk & 63) & 1)) {
+            field.valid = false;
+            stats.fieldsInvalidated++;
+          }
+        }
+      }
+    }
+
+    stats.chunksChanged += changed;
+    return changed;
+  }
+
+  // False once a chunk the path crosses changed after the path was found
+  bool IsPathCurrent(const uint32_t* path, uint32_t length, uint64_t pathEpoch) const {
+    uint32_t lastChunk = UINT32_MAX;
+    for (uint32_t i = 0; i < length; ++i) {
+      uint32_t chunk = path[i] >> (2 * g_HexChunkShift);
+      if (chunk != lastChunk) {
+        if (chunkEpochs[chunk] > pathEpoch) {
+          return false;
+        }
+        lastChunk = chunk;
+      }
+    }
+
+    return true;
+  }
+
+  // Answers a batch of queries on the job system. Goals shared by at least
+  // flowFieldMinQueries queries get a flow field first, the fields are built
+  // in parallel.
+  void FindPaths(HexPathQuery* queries, uint32_t count, JobSystem& jobs) {
+    PROFILE_ZONE("Find paths");
+    batch++;
+
+    PrepareFlowFields(queries, count, jobs);
+
+    jobs.ParallelFor(0, count, g_HexPathBatchGrain, [&](uint32_t begin, uint32_t end) {
+      HexPathScratch& s = AcquireScratch();
+      uint64_t flowFieldQueries = 0;
+      uint64_t searched = 0;
+      uint64_t failed = 0;
+      for (uint32_t i = begin; i < end; ++i) {
+        HexPathQuery& query = queries[i];
+        query.epoch = epoch;
+        const HexFlowField* field = FindFlowField(query.goal);
+        if (field && WalkFlowField(*field, query)) {
+          flowFieldQueries++;
+        }
+        else {
+          searched += Search(s, query);
+        }
+        failed += query.status >= HexPathNoPath;
+      }
+      ReleaseScratch(s);
+
+      stats.queries.fetch_add(end - begin, std::memory_order_relaxed);
+      stats.flowFieldQueries.fetch_add(flowFieldQueries, std::memory_order_relaxed);
+      stats.searchedTiles.fetch_add(searched, std::memory_order_relaxed);
+      stats.failedQueries.fetch_add(failed, std::memory_order_relaxed);
+    });
+  }
+
+  // Single query on the calling thread
+  void FindPath(HexPathQuery& query) {
+    HexPathScratch& s = AcquireScratch();
+    query.epoch = epoch;
+    const HexFlowField* field = FindFlowField(query.goal);
+    if (!field || !WalkFlowField(*field, query)) {
+      Search(s, query);
+    }
+    ReleaseScratch(s);
+  }
+
+  const HexFlowField* FindFlowField(uint32_t goal) const {
+    for (const HexFlowField& field : fields) {
+      if (field.valid && field.goal == goal) {
+        return &field;
+      }
+    }
+    return nullptr;
+  }
+
+  HexFlowField* FindFlowField(uint32_t goal) {
+    return const_cast<HexFlowField*>(static_cast<const HexPathfinder*>(this)->FindFlowField(goal));
+  }
+
+  // Bytes held by the scratch blocks' growable containers
+  size_t ScratchContainerBytes() {
+    std::lock_guard<std::mutex> lock(scratchMutex);
+    size_t bytes = 0;
+    for (const std::unique_ptr<HexPathScratch>& block : scratch) {
+      bytes += block->ContainerBytes();
+    }
+    return bytes;
+  }
+
+private:
+  size_t tileCount = 0;
+  std::vector<uint32_t> batchGoals;
+  std::vector<HexFlowField*> pendingFields;
+  std::mutex scratchMutex;
+  std::vector<std::unique_ptr<HexPathScratch>> scratch;
+  std::vector<HexPathScratch*> freeScratch;
+
+  HexPathScratch& AcquireScratch() {
+    std::lock_guard<std::mutex> lock(scratchMutex);
+    if (freeScratch.empty()) {
+      scratch.emplace_back(new HexPathScratch(tileCount));
+      return *scratch.back();
+    }
+
+    HexPathScratch* s = freeScratch.back();
+    freeScratch.pop_back();
+    return *s;
+  }
+
+  void ReleaseScratch(HexPathScratch& s) {
+    std::lock_guard<std::mutex> lock(scratchMutex);
+    freeScratch.push_back(&s);
+  }
+
+  // Returns whether any cost of the chunk changed
+  bool UpdateChunkCosts(const HexGrid& grid, uint32_t chunk) {
+    bool changed = false;
+    grid.ForEachTileInChunk(chunk, [&](uint32_t index, HexOffset) {
+      uint8_t cost = HexShipStepCost(params, grid.heights[index]);
+      changed |= costs[index] != cost;
+      costs[index] = cost;
+    });
+    return changed;
+  }
+
+  uint32_t IndexChecked(HexOffset o) const {
+    uint32_t col = static_cast<uint32_t>(o.col);
+    uint32_t row = static_cast<uint32_t>(o.row);
+    uint32_t index = (((row >> g_HexChunkShift) * chunksX + (col >> g_HexChunkShift)) << (2 * g_HexChunkShift)) |
+        ((row & g_HexChunkMask) << g_HexChunkShift) | (col & g_HexChunkMask);
+
+    return (col < width) & (row < height) ? index : g_InvalidTile;
+  }
+
+  HexOffset Coord(uint32_t index) const {
+    uint32_t chunk = index >> (2 * g_HexChunkShift);
+    uint32_t local = index & (g_HexChunkTiles - 1);
+    uint32_t chunkY = chunk / chunksX;
+    uint32_t chunkX = chunk - chunkY * chunksX;
+
+    return {
+      static_cast<int32_t>((chunkX << g_HexChunkShift) | (local & g_HexChunkMask)),
+      static_cast<int32_t>((chunkY << g_HexChunkShift) | (local >> g_HexChunkShift))
+    };
+  }
+
+  // Picks the goals that earn a flow field this batch and builds the missing
+  // fields, least recently used slots are reused first
+  void PrepareFlowFields(const HexPathQuery* queries, uint32_t count, JobSystem& jobs) {
+    if (fields.empty()) {
+      return;
+    }
+
+    batchGoals.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      batchGoals[i] = queries[i].goal;
+    }
+    std::sort(batchGoals.begin(), batchGoals.end());
+
+    pendingFields.clear();
+    for (uint32_t i = 0; i < count;) {
+      uint32_t goal = batchGoals[i];
+      uint32_t run = i;
+      while (run < count && batchGoals[run] == goal) {
+        run++;
+      }
+      uint32_t goalQueries = run - i;
+      i = run;
+
+      if (goalQueries < params.flowFieldMinQueries || goal >= tileCount || costs[goal] == 0) {
+        continue;
+      }
+
+      if (HexFlowField* field = FindFlowField(goal)) {
+        field->lastUsed = batch;
+        continue;
+      }
+
+      HexFlowField* slot = nullptr;
+      for (HexFlowField& field : fields) {
+        if (field.lastUsed == batch) {
+          continue; // Already taken by this batch
+        }
+        if (!slot || !field.valid || (slot->valid && field.lastUsed < slot->lastUsed)) {
+          slot = &field;
+        }
+      }
+      if (!slot) {
+        break; // More shared goals than slots, the rest use A*
+      }
+
+      slot->goal = goal;
+      slot->valid = false;
+      slot->lastUsed = batch;
+      pendingFields.push_back(slot);
+    }
+
+    if (pendingFields.empty()) {
+      return;
+    }
+
+    PROFILE_ZONE("Build flow fields");
+    jobs.ParallelFor(0, static_cast<uint32_t>(pendingFields.size()), 1, [&](uint32_t begin, uint32_t end) {
+      HexPathScratch& s = AcquireScratch();
+      for (uint32_t i = begin; i < end; ++i) {
+        BuildFlowField(s, *pendingFields[i]);
+      }
+      ReleaseScratch(s);
+    });
+    stats.fieldsBuilt += pendingFields.size();
+  }
+
+  // Dijkstra outwards from the goal with a bucket queue - step costs are
+  // small integers, so the queue is a ring of buckets indexed by cost.
+  // Moving from a tile to its neighbor n costs costs[n], so reaching the
+  // goal from n costs the goal's distance plus the goal's own cost.
+  void BuildFlowField(HexPathScratch& s, HexFlowField& field) {
+    if (!field.directions) {
+      field.directions = static_cast<uint8_t*>(AlignedAlloc(tileCount));
+    }
+    std::memset(field.directions, g_HexFlowUnreached, tileCount);
+    field.examinedChunks.assign((chunkEpochs.size() + 63) / 64, 0);
+
+    s.NextStamp();
+    uint32_t goal = field.goal;
+    s.nodes[goal] = {s.stamp, 0, g_HexFlowGoal, false};
+    field.directions[goal] = g_HexFlowGoal;
+    s.buckets[0].push_back(goal);
+    uint32_t queued = 1;
+
+    for (uint32_t distance = 0; queued; ++distance) {
+      std::vector<uint32_t>& bucket = s.buckets[distance % g_HexPathBuckets];
+      for (size_t i = 0; i < bucket.size(); ++i) {
+        uint32_t tile = bucket[i];
+        queued--;
+        if (s.nodes[tile].cost != distance) {
+          continue; // Reached more cheaply after it was queued
+        }
+
+        uint32_t chunk = tile >> (2 * g_HexChunkShift);
+        field.examinedChunks[chunk >> 6] |= 1ull << (chunk & 63);
+        uint32_t reach = distance + costs[tile];
+
+        HexOffset coord = Coord(tile);
+        const HexOffset* directions = g_HexOffsetDirections[coord.row & 1];
+        for (int direction = 0; direction < 6; ++direction) {
+          uint32_t neighbor = IndexChecked({coord.col + directions[direction].col, coord.row + directions[direction].row});
+          if (neighbor == g_InvalidTile) {
+            continue;
+          }
+
+          // Blocked tiles count as examined, opening them changes the field
+          uint32_t neighborChunk = neighbor >> (2 * g_HexChunkShift);
+          field.examinedChunks[neighborChunk >> 6] |= 1ull << (neighborChunk & 63);
+          if (costs[neighbor] == 0 || reach > params.maxFlowCost) {
+            continue;
+          }
+          HexPathNode& node = s.nodes[neighbor];
+          if (node.stamp == s.stamp && node.cost <= reach) {
+            continue;
+          }
+
+          node = {s.stamp, reach, 0, false};
+          field.directions[neighbor] = static_cast<uint8_t>((direction + 3) % 6);
+          s.buckets[reach % g_HexPathBuckets].push_back(neighbor);
+          queued++;
+        }
+      }
+      bucket.clear();
+    }
+
+    field.valid = true;
+  }
+
+  // Follows the field from the start. False when the start is outside the
+  // field, the query then falls back to A*.
+  bool WalkFlowField(const HexFlowField& field, HexPathQuery& query) const {
+    uint32_t tile = query.start;
+    if (tile >= tileCount || field.directions[tile] == g_HexFlowUnreached) {
+      return false;
+    }
+
+    HexOffset coord = Coord(tile);
+    uint32_t length = 0;
+    uint32_t cost = 0;
+    while (true) {
+      if (length < query.capacity) {
+        query.path[length] = tile;
+      }
+      length++;
+
+      uint8_t direction = field.directions[tile];
+      if (direction == g_HexFlowGoal) {
+        break;
+      }
+
+      HexOffset step = g_HexOffsetDirections[coord.row & 1][direction];
+      coord = {coord.col + step.col, coord.row + step.row};
+      tile = IndexChecked(coord);
+      cost += costs[tile];
+    }
+
+    query.length = length;
+    query.cost = cost;
+    query.status = length <= query.capacity ? HexPathFound : HexPathTruncated;
+    query.fromFlowField = true;
+    return true;
+  }
+
+  // A* with the hex distance times the cheapest step as the heuristic. A
+  // bucket is a stack, so among equally promising tiles the newest - the one
+  // furthest along - is expanded first. Returns the number of tiles expanded.
+  uint32_t Search(HexPathScratch& s, HexPathQuery& query) const {
+    query.length = 0;
+    query.cost = 0;
+    query.fromFlowField = false;
+    query.status = HexPathNoPath;
+
+    uint32_t start = query.start;
+    uint32_t goal = query.goal;
+    if (start >= tileCount || goal >= tileCount || costs[goal] == 0) {
+      return 0;
+    }
+
+    HexAxial goalHex = OffsetToAxial(Coord(goal));
+    s.NextStamp();
+    s.nodes[start] = {s.stamp, 0, g_HexFlowGoal, false};
+    uint32_t estimate = HexDistance(OffsetToAxial(Coord(start)), goalHex) * minCost;
+    s.buckets[estimate % g_HexPathBuckets].push_back(start);
+    uint32_t lastEstimate = estimate;
+    uint32_t queued = 1;
+
+    uint32_t expanded = 0;
+    for (; queued; ++estimate) {
+      std::vector<uint32_t>& bucket = s.buckets[estimate % g_HexPathBuckets];
+      while (!bucket.empty()) {
+        uint32_t tile = bucket.back();
+        bucket.pop_back();
+        queued--;
+
+        HexPathNode& current = s.nodes[tile];
+        if (current.closed) {
+          continue; // Already closed through a cheaper entry
+        }
+        current.closed = true;
+
+        if (tile == goal || ++expanded > params.maxSearchTiles) {
+          if (tile == goal) {
+            ReconstructPath(s, query);
+          }
+          else {
+            query.status = HexPathGaveUp;
+          }
+          for (uint32_t f = estimate; f <= lastEstimate; ++f) {
+            s.buckets[f % g_HexPathBuckets].clear();
+          }
+          return expanded;
+        }
+
+        uint32_t cost = current.cost;
+        HexOffset coord = Coord(tile);
+        const HexOffset* directions = g_HexOffsetDirections[coord.row & 1];
+        for (int direction = 0; direction < 6; ++direction) {
+          HexOffset next = {coord.col + directions[direction].col, coord.row + directions[direction].row};
+          uint32_t neighbor = IndexChecked(next);
+          if (neighbor == g_InvalidTile || costs[neighbor] == 0) {
+            continue;
+          }
+
+          uint32_t reach = cost + costs[neighbor];
+          HexPathNode& node = s.nodes[neighbor];
+          if (node.stamp == s.stamp && (node.closed || node.cost <= reach)) {
+            continue;
+          }
+
+          node = {s.stamp, reach, static_cast<uint8_t>((direction + 3) % 6), false};
+          uint32_t nextEstimate = reach + HexDistance(OffsetToAxial(next), goalHex) * minCost;
+          s.buckets[nextEstimate % g_HexPathBuckets].push_back(neighbor);
+          lastEstimate = nextEstimate > lastEstimate ? nextEstimate : lastEstimate;
+          queued++;
+        }
+      }
+    }
+
+    return expanded;
+  }
+
+  // Walks the parents back from the goal, once to count and once to write
+  void ReconstructPath(const HexPathScratch& s, HexPathQuery& query) const {
+    uint32_t length = 1;
+    HexOffset coord = Coord(query.goal);
+    for (uint32_t tile = query.goal; tile != query.start; ++length) {
+      HexOffset step = g_HexOffsetDirections[coord.row & 1][s.nodes[tile].parent];
+      coord = {coord.col + step.col, coord.row + step.row};
+      tile = IndexChecked(coord);
+    }
+
+    coord = Coord(query.goal);
+    uint32_t tile = query.goal;
+    for (uint32_t i = length; i-- > 0;) {
+      if (i < query.capacity) {
+        query.path[i] = tile;
+      }
+      if (i) {
+        HexOffset step = g_HexOffsetDirections[coord.row & 1][s.nodes[tile].parent];
+        coord = {coord.col + step.col, coord.row + step.row};
+        tile = IndexChecked(coord);
+      }
+    }
+
+    query.length = length;
+    query.cost = s.nodes[query.goal].cost;
+    query.status = length <= query.capacity ? HexPathFound : HexPathTruncated;
+  }
+};
+
+#endif // _H_HEX_PATHFINDING
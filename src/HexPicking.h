@@ -0,0 +1,182 @@
+#ifndef _H_HEX_PICKING
+#define _H_HEX_PICKING
+
+// World-space point to hex conversion. The batch versions convert arrays of
+// points 4 (SSE2) or 8 (AVX2) at a time and produce bit-identical results to
+// the scalar version: every variant does the same float operations in the
+// same order and rounds to nearest-even.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "HexGrid.h"
+#include "Simd.h"
+
+const float g_Sqrt3 = 1.7320508075688772f;
+
+// Pointy-top layout, size is the distance from a hex center to a corner
+struct HexLayout {
+  float size = 1.0f;
+  float originX = 0.0f;
+  float originY = 0.0f;
+};
+
+inline void HexToPixel(const HexLayout& layout, HexAxial hex, float& x, float& y) {
+  x = layout.originX + layout.size * g_Sqrt3 * (hex.q + 0.5f * hex.r);
+  y = layout.originY + layout.size * 1.5f * hex.r;
+}
+
+// Coefficients of the pixel to fractional axial transform
+struct HexPickConstants {
+  float kq;  // q = x * kq - y * kqy
+  float kqy;
+  float kr;  // r = y * kr
+};
+
+inline HexPickConstants GetHexPickConstants(const HexLayout& layout) {
+  return {(g_Sqrt3 / 3.0f) / layout.size, (1.0f / 3.0f) / layout.size, (2.0f / 3.0f) / layout.size};
+}
+
+// Cube rounding of a fractional axial coordinate - the component with the
+// largest rounding error is recomputed from the other two
+inline HexAxial HexRound(float fq, float fr) {
+  float fs = -fq - fr;
+
+  float rq = std::nearbyint(fq);
+  float rr = std::nearbyint(fr);
+  float rs = std::nearbyint(fs);
+
+  float dq = std::fabs(rq - fq);
+  float dr = std::fabs(rr - fr);
+  float ds = std::fabs(rs - fs);
+
+  int32_t q = static_cast<int32_t>(rq);
+  int32_t r = static_cast<int32_t>(rr);
+  int32_t s = static_cast<int32_t>(rs);
+
+  bool fixQ = dq > dr && dq > ds;
+  bool fixR = !fixQ && dr > ds;
+
+  return {fixQ ? -r - s : q, fixR ? -q - s : r};
+}
+
+inline HexAxial PixelToHex(const HexLayout& layout, float x, float y) {
+  HexPickConstants k = GetHexPickConstants(layout);
+  float px = x - layout.originX;
+  float py = y - layout.originY;
+
+  return HexRound(px * k.kq - py * k.kqy, py * k.kr);
+}
+
+inline void PixelToHexBatchScalar(const HexLayout& layout, const float* xs, const float* ys, size_t count, int32_t* qs, int32_t* rs) {
+  for (size_t i = 0; i < count; ++i) {
+    HexAxial hex = PixelToHex(layout, xs[i], ys[i]);
+    qs[i] = hex.q;
+    rs[i] = hex.r;
+  }
+}
+
+#if SIMD_X86
+
+inline void PixelToHexBatchSSE2(const HexLayout& layout, const float* xs, const float* ys, size_t count, int32_t* qs, int32_t* rs) {
+  HexPickConstants k = GetHexPickConstants(layout);
+  const __m128 originX = _mm_set1_ps(layout.originX);
+  const __m128 originY = _mm_set1_ps(layout.originY);
+  const __m128 kq = _mm_set1_ps(k.kq);
+  const __m128 kqy = _mm_set1_ps(k.kqy);
+  const __m128 kr = _mm_set1_ps(k.kr);
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  const __m128 zero = _mm_setzero_ps();
+  const __m128i zeroi = _mm_setzero_si128();
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 px = _mm_sub_ps(_mm_loadu_ps(xs + i), originX);
+    __m128 py = _mm_sub_ps(_mm_loadu_ps(ys + i), originY);
+
+    __m128 fq = _mm_sub_ps(_mm_mul_ps(px, kq), _mm_mul_ps(py, kqy));
+    __m128 fr = _mm_mul_ps(py, kr);
+    __m128 fs = _mm_sub_ps(_mm_sub_ps(zero, fq), fr);
+
+    __m128i iq = _mm_cvtps_epi32(fq);
+    __m128i ir = _mm_cvtps_epi32(fr);
+    __m128i is = _mm_cvtps_epi32(fs);
+
+    __m128 dq = _mm_and_ps(_mm_sub_ps(_mm_cvtepi32_ps(iq), fq), absMask);
+    __m128 dr = _mm_and_ps(_mm_sub_ps(_mm_cvtepi32_ps(ir), fr), absMask);
+    __m128 ds = _mm_and_ps(_mm_sub_ps(_mm_cvtepi32_ps(is), fs), absMask);
+
+    __m128i fixQ = _mm_castps_si128(_mm_and_ps(_mm_cmpgt_ps(dq, dr), _mm_cmpgt_ps(dq, ds)));
+    __m128i fixR = _mm_andnot_si128(fixQ, _mm_castps_si128(_mm_cmpgt_ps(dr, ds)));
+
+    __m128i q = _mm_or_si128(_mm_and_si128(fixQ, _mm_sub_epi32(_mm_sub_epi32(zeroi, ir), is)), _mm_andnot_si128(fixQ, iq));
+    __m128i r = _mm_or_si128(_mm_and_si128(fixR, _mm_sub_epi32(_mm_sub_epi32(zeroi, iq), is)), _mm_andnot_si128(fixR, ir));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(qs + i), q);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rs + i), r);
+  }
+
+  PixelToHexBatchScalar(layout, xs + i, ys + i, count - i, qs + i, rs + i);
+}
+
+SIMD_TARGET_AVX2 inline void PixelToHexBatchAVX2(const HexLayout& layout, const float* xs, const float* ys, size_t count, int32_t* qs, int32_t* rs) {
+  HexPickConstants k = GetHexPickConstants(layout);
+  const __m256 originX = _mm256_set1_ps(layout.originX);
+  const __m256 originY = _mm256_set1_ps(layout.originY);
+  const __m256 kq = _mm256_set1_ps(k.kq);
+  const __m256 kqy = _mm256_set1_ps(k.kqy);
+  const __m256 kr = _mm256_set1_ps(k.kr);
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256i zeroi = _mm256_setzero_si256();
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 px = _mm256_sub_ps(_mm256_loadu_ps(xs + i), originX);
+    __m256 py = _mm256_sub_ps(_mm256_loadu_ps(ys + i), originY);
+
+    __m256 fq = _mm256_sub_ps(_mm256_mul_ps(px, kq), _mm256_mul_ps(py, kqy));
+    __m256 fr = _mm256_mul_ps(py, kr);
+    __m256 fs = _mm256_sub_ps(_mm256_sub_ps(zero, fq), fr);
+
+    __m256i iq = _mm256_cvtps_epi32(fq);
+    __m256i ir = _mm256_cvtps_epi32(fr);
+    __m256i is = _mm256_cvtps_epi32(fs);
+
+    __m256 dq = _mm256_and_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(iq), fq), absMask);
+    __m256 dr = _mm256_and_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(ir), fr), absMask);
+    __m256 ds = _mm256_and_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(is), fs), absMask);
+
+    __m256i fixQ = _mm256_castps_si256(_mm256_and_ps(_mm256_cmp_ps(dq, dr, _CMP_GT_OQ), _mm256_cmp_ps(dq, ds, _CMP_GT_OQ)));
+    __m256i fixR = _mm256_andnot_si256(fixQ, _mm256_castps_si256(_mm256_cmp_ps(dr, ds, _CMP_GT_OQ)));
+
+    __m256i q = _mm256_blendv_epi8(iq, _mm256_sub_epi32(_mm256_sub_epi32(zeroi, ir), is), fixQ);
+    __m256i r = _mm256_blendv_epi8(ir, _mm256_sub_epi32(_mm256_sub_epi32(zeroi, iq), is), fixR);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(qs + i), q);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(rs + i), r);
+  }
+
+  PixelToHexBatchScalar(layout, xs + i, ys + i, count - i, qs + i, rs + i);
+}
+
+#endif
+
+// Converts count points (xs[i], ys[i]) to axial (qs[i], rs[i]) with the
+// widest instruction set available, or the one asked for
+inline void PixelToHexBatch(const HexLayout& layout, const float* xs, const float* ys, size_t count, int32_t* qs, int32_t* rs, SimdLevel level = GetSimdLevel()) {
+#if SIMD_X86
+  if (level == SimdLevel::AVX2) {
+    PixelToHexBatchAVX2(layout, xs, ys, count, qs, rs);
+    return;
+  }
+  if (level == SimdLevel::SSE2) {
+    PixelToHexBatchSSE2(layout, xs, ys, count, qs, rs);
+    return;
+  }
+#endif
+  PixelToHexBatchScalar(layout, xs, ys, count, qs, rs);
+}
+
+#endif // _H_HEX_PICKING
@@ -0,0 +1,412 @@
+#ifndef _H_HEX_REMESH
+#define _H_HEX_REMESH
+
+// Incremental chunk meshes. Every chunk keeps its packed instances, sorted
+// by material, in a block from a pool. Frames copy those runs instead of
+// packing tiles. Terrain edits and the water simulation mark chunks in a
+// HexDirtyChunks set, and only marked chunks are rebuilt.
+//
+// The rebuild is a background stage with one frame of latency. Update() at
+// the start of frame N takes a budgeted number of dirty chunks and copies
+// their tiles into snapshots, so the simulation can keep writing. It then
+// queues jobs that build the new meshes into fresh pool blocks. Update()
+// in frame N+1 waits for those jobs, which normally finished long ago,
+// and swaps the blocks in. The same call refits the chunks' culling bounds
+// and coarse LOD blocks before the frame packs and uploads them.
+//
+// Tiles covered by water draw as a single water column up to the surface.
+// The water is opaque, so the ground below it never shows.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "HexCulling.h"
+#include "HexGrid.h"
+#include "HexLod.h"
+#include "HexMesh.h"
+#include "HexWater.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+const uint8_t g_HexWaterMaterial = 0;      // Material of water columns
+const uint32_t g_HexMeshPoolSlab = 64;     // Blocks added to the pool at a time
+const uint32_t g_HexRemeshJobChunks = 4;   // Chunks per remesh job
+
+// A run of one material in a chunk mesh, count - 1 so 256 fits
+struct HexMeshRun {
+  uint8_t material;
+  uint8_t countMinusOne;
+};
+
+struct HexChunkMesh {
+  HexInstance instances[g_HexChunkTiles]; // Sorted by material, row order within a material
+  HexMeshRun runs[g_HexChunkTiles];
+  uint32_t instanceCount;
+  uint32_t runCount;
+  float maxHeight; // Highest column top, terrain or water
+};
+
+// Fixed-size mesh blocks. Blocks never move, slabs are only added.
+struct HexChunkMeshPool {
+  std::vector<HexChunkMesh*> slabs;
+  std::vector<uint32_t> freeBlocks;
+  uint32_t usedBlocks = 0;
+  uint32_t highWater = 0;
+
+  HexChunkMeshPool() = default;
+  HexChunkMeshPool(const HexChunkMeshPool&) = delete;
+  HexChunkMeshPool& operator=(const HexChunkMeshPool&) = delete;
+
+  ~HexChunkMeshPool() {
+    Clear();
+  }
+
+  void Clear() {
+    for (HexChunkMesh* slab : slabs) {
+      AlignedFree(slab);
+    }
+    slabs.clear();
+    freeBlocks.clear();
+    usedBlocks = 0;
+    highWater = 0;
+  }
+
+  uint32_t Allocate() {
+    if (freeBlocks.empty()) {
+      uint32_t first = static_cast<uint32_t>(slabs.size()) * g_HexMeshPoolSlab;
+      slabs.push_back(static_cast<HexChunkMesh*>(AlignedAlloc(g_HexMeshPoolSlab * sizeof(HexChunkMesh))));
+      for (uint32_t i = g_HexMeshPoolSlab; i > 0; --i) {
+        freeBlocks.push_back(first + i - 1);
+      }
+    }
+
+    uint32_t block = freeBlocks.back();
+    freeBlocks.pop_back();
+    usedBlocks++;
+    highWater = usedBlocks > highWater ? usedBlocks : highWater;
+
+    return block;
+  }
+
+  void Free(uint32_t block) {
+    freeBlocks.push_back(block);
+    usedBlocks--;
+  }
+
+  HexChunkMesh& operator[](uint32_t block) {
+    return slabs[block / g_HexMeshPoolSlab][block % g_HexMeshPoolSlab];
+  }
+
+  const HexChunkMesh& operator[](uint32_t block) const {
+    return slabs[block / g_HexMeshPoolSlab][block % g_HexMeshPoolSlab];
+  }
+
+  uint32_t CapacityBlocks() const {
+    return static_cast<uint32_t>(slabs.size()) * g_HexMeshPoolSlab;
+  }
+};
+
+// Copy of the tiles one mesh is built from
+struct HexChunkSnapshot {
+  uint32_t chunk;
+  uint32_t block;
+  HexChunkMesh* mesh; // The block, resolved up front so jobs never touch the pool
+  HexChunkBounds bounds;
+  float heights[g_HexChunkTiles];
+  float water[g_HexChunkTiles];
+  uint8_t materials[g_HexChunkTiles];
+  uint8_t flags[g_HexChunkTiles];
+};
+
+inline void SnapshotHexChunk(const HexGrid& grid, const HexWater* water, uint32_t chunk, HexChunkSnapshot& snapshot) {
+  snapshot.chunk = chunk;
+  snapshot.bounds = grid.ChunkBounds(chunk);
+
+  uint32_t base = snapshot.bounds.base;
+  std::memcpy(snapshot.heights, grid.heights + base, sizeof(snapshot.heights));
+  std::memcpy(snapshot.materials, grid.materials + base, sizeof(snapshot.materials));
+  std::memcpy(snapshot.flags, grid.flags + base, sizeof(snapshot.flags));
+  if (water) {
+    std::memcpy(snapshot.water, water->depth[water->current] + base, sizeof(snapshot.water));
+  }
+  else {
+    std::memset(snapshot.water, 0, sizeof(snapshot.water));
+  }
+}
+
+// Packs a chunk's tiles into its mesh - a counting sort by material, the
+// same order PackHexInstances() produces for one chunk
+inline void BuildHexChunkMesh(const HexChunkSnapshot& snapshot, HexAxial origin, HexChunkMesh& mesh) {
+  const HexChunkBounds& bounds = snapshot.bounds;
+  uint8_t materials[g_HexChunkTiles];
+  uint16_t heights[g_HexChunkTiles];
+  uint16_t counts[g_HexMaxMaterials] = {};
+  float top = 0.0f;
+
+  for (uint32_t y = 0; y < bounds.rows; ++y) {
+    for (uint32_t x = 0; x < bounds.cols; ++x) {
+      uint32_t local = (y << g_HexChunkShift) | x;
+      float ground = snapshot.heights[local];
+      uint16_t waterTop = QuantizeHexHeight(ground + snapshot.water[local]);
+      bool flooded = waterTop > QuantizeHexHeight(ground);
+
+      materials[local] = flooded ? g_HexWaterMaterial : snapshot.materials[local];
+      heights[local] = flooded ? waterTop : QuantizeHexHeight(ground);
+      counts[materials[local]]++;
+
+      float surface = ground + snapshot.water[local];
+      top = surface > top ? surface : top;
+    }
+  }
+
+  uint16_t cursors[g_HexMaxMaterials];
+  uint32_t total = 0;
+  mesh.runCount = 0;
+  for (uint32_t material = 0; material < g_HexMaxMaterials; ++material) {
+    cursors[material] = static_cast<uint16_t>(total);
+    if (counts[material] > 0) {
+      mesh.runs[mesh.runCount++] = {static_cast<uint8_t>(material), static_cast<uint8_t>(counts[material] - 1)};
+      total += counts[material];
+    }
+  }
+
+  for (uint32_t y = 0; y < bounds.rows; ++y) {
+    HexAxial first = OffsetToAxial({static_cast<int32_t>(bounds.col0), static_cast<int32_t>(bounds.row0 + y)});
+    int16_t q = static_cast<int16_t>(first.q - origin.q);
+    int16_t r = static_cast<int16_t>(first.r - origin.r);
+
+    for (uint32_t x = 0; x < bounds.cols; ++x) {
+      uint32_t local = (y << g_HexChunkShift) | x;
+      uint8_t material = materials[local];
+      mesh.instances[cursors[material]++] = {static_cast<int16_t>(q + x), r, heights[local], material, snapshot.flags[local]};
+    }
+  }
+
+  mesh.instanceCount = total;
+  mesh.maxHeight = top;
+}
+
+struct HexRemeshBudget {
+  uint32_t maxChunks = 64;        // Chunks started per frame
+  double maxMilliseconds = 2.0;   // Worker time started per frame, from the measured cost per chunk
+};
+
+struct HexRemeshStats {
+  uint64_t chunksRemeshed = 0;
+  uint64_t batches = 0;
+  uint64_t stalls = 0;               // Frames that had to wait for last frame's batch
+  uint32_t lastBatchChunks = 0;
+  uint32_t pendingChunks = 0;        // Still dirty after the last Update()
+  double lastBatchMilliseconds = 0.0; // Worker time of the last published batch
+  double maxBatchMilliseconds = 0.0;
+  double chunkMicroseconds = 0.0;    // Running average cost of one chunk
+  double lastPublishMilliseconds = 0.0; // Main thread time of the last Update()
+  double maxPublishMilliseconds = 0.0;
+};
+
+struct HexRemesher {
+  HexDirtyChunks dirty;
+  HexChunkMeshPool pool;
+  std::vector<uint32_t> meshes; // Pool block of every chunk
+  HexAxial origin = {0, 0};
+
+  HexRemeshBudget budget;
+  HexRemeshStats stats;
+
+  // The batch started last frame
+  std::vector<HexChunkSnapshot> batch;
+  uint32_t batchCount = 0;
+  JobCounter counter;
+  std::atomic<uint64_t> batchNanoseconds{0};
+
+  HexRemesher() = default;
+  HexRemesher(const HexRemesher&) = delete;
+  HexRemesher& operator=(const HexRemesher&) = delete;
+
+  // Builds every chunk's mesh right away
+  void Init(const HexGrid& grid, const HexWater* water, HexAxial drawOrigin) {
+    pool.Clear();
+    dirty.Init(grid.ChunkCount());
+    meshes.assign(grid.ChunkCount(), 0);
+    origin = drawOrigin;
+    stats = {};
+    batchCount = 0;
+
+    HexChunkSnapshot snapshot;
+    for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+      meshes[chunk] = pool.Allocate();
+      SnapshotHexChunk(grid, water, chunk, snapshot);
+      BuildHexChunkMesh(snapshot, origin, pool[meshes[chunk]]);
+    }
+  }
+
+  const HexChunkMesh& Mesh(uint32_t chunk) const {
+    return pool[meshes[chunk]];
+  }
+
+  // Once per frame, before the meshes are used. Publishes the batch from
+  // the last frame and starts the next one.
+  void Update(const HexGrid& grid, const HexWater* water, const HexDrawOrigin& drawOrigin,
+      HexChunkBvh& bvh, HexLodPyramid& lod, JobSystem& jobs) {
+    PROFILE_ZONE("RemeshUpdate");
+    auto t0 = std::chrono::steady_clock::now();
+
+    Publish(grid, drawOrigin, bvh, lod, jobs);
+    Start(grid, water, jobs);
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - t0;
+    stats.lastPublishMilliseconds = elapsed.count();
+    stats.maxPublishMilliseconds = std::max(stats.maxPublishMilliseconds, elapsed.count());
+    stats.pendingChunks = dirty.Count();
+
+    PROFILE_COUNTER("Remesh chunks", stats.lastBatchChunks);
+    PROFILE_COUNTER("Remesh pending", stats.pendingChunks);
+  }
+
+  // Waits for and publishes whatever is in flight. Call before the job
+  // system stops - the jobs write into the pool and read the batch.
+  void Flush(const HexGrid& grid, const HexDrawOrigin& drawOrigin, HexChunkBvh& bvh, HexLodPyramid& lod, JobSystem& jobs) {
+    Publish(grid, drawOrigin, bvh, lod, jobs);
+  }
+
+private:
+  void Publish(const HexGrid& grid, const HexDrawOrigin& drawOrigin, HexChunkBvh& bvh, HexLodPyramid& lod, JobSystem& jobs) {
+    if (batchCount == 0) {
+      return;
+    }
+
+    if (!counter.IsDone()) {
+      stats.stalls++;
+      jobs.Wait(counter);
+    }
+
+    for (uint32_t i = 0; i < batchCount; ++i) {
+      const HexChunkSnapshot& snapshot = batch[i];
+      pool.Free(meshes[snapshot.chunk]);
+      meshes[snapshot.chunk] = snapshot.block;
+
+      if (!bvh.nodes.empty()) {
+        bvh.RefitChunk(grid, drawOrigin, snapshot.chunk, snapshot.mesh->maxHeight);
+      }
+      if (!lod.levels.empty()) {
+        lod.UpdateChunk(grid, snapshot.chunk);
+      }
+    }
+
+    double batchMilliseconds = batchNanoseconds.load(std::memory_order_relaxed) * 1e-6;
+    double chunkMicroseconds = batchMilliseconds * 1e3 / batchCount;
+    stats.chunkMicroseconds = stats.batches == 0 ? chunkMicroseconds : stats.chunkMicroseconds * 0.9 + chunkMicroseconds * 0.1;
+    stats.lastBatchMilliseconds = batchMilliseconds;
+    stats.maxBatchMilliseconds = std::max(stats.maxBatchMilliseconds, batchMilliseconds);
+    stats.lastBatchChunks = batchCount;
+    stats.chunksRemeshed += batchCount;
+    stats.batches++;
+    batchCount = 0;
+  }
+
+  void Start(const HexGrid& grid, const HexWater* water, JobSystem& jobs) {
+    uint32_t limit = budget.maxChunks;
+    if (stats.chunkMicroseconds > 0.0) {
+      double affordable = budget.maxMilliseconds * 1e3 / stats.chunkMicroseconds;
+      limit = affordable < limit ? static_cast<uint32_t>(affordable) : limit;
+    }
+    limit = limit > 0 ? limit : 1; // Always make progress
+
+    if (batch.size() < limit) {
+      batch.resize(limit);
+    }
+
+    uint32_t chunks[256];
+    uint32_t taken = 0;
+    while (taken < limit) {
+      uint32_t want = std::min<uint32_t>(limit - taken, 256);
+      uint32_t count = dirty.Take(chunks, want);
+      for (uint32_t i = 0; i < count; ++i) {
+        HexChunkSnapshot& snapshot = batch[taken + i];
+        SnapshotHexChunk(grid, water, chunks[i], snapshot);
+        snapshot.block = pool.Allocate();
+        snapshot.mesh = &pool[snapshot.block];
+      }
+
+      taken += count;
+      if (count < want) {
+        break;
+      }
+    }
+
+    batchCount = taken;
+    if (batchCount == 0) {
+      stats.lastBatchChunks = 0;
+      return;
+    }
+
+    batchNanoseconds.store(0, std::memory_order_relaxed);
+    for (uint32_t begin = 0; begin < batchCount; begin += g_HexRemeshJobChunks) {
+      uint32_t end = std::min(begin + g_HexRemeshJobChunks, batchCount);
+      jobs.Run(&RemeshJob, this, begin, end, &counter);
+    }
+  }
+
+  static void RemeshJob(void* data, uint32_t begin, uint32_t end) {
+    HexRemesher& remesher = *static_cast<HexRemesher*>(data);
+    auto t0 = std::chrono::steady_clock::now();
+
+    for (uint32_t i = begin; i < end; ++i) {
+      const HexChunkSnapshot& snapshot = remesher.batch[i];
+      BuildHexChunkMesh(snapshot, remesher.origin, *snapshot.mesh);
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - t0;
+    remesher.batchNanoseconds.fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+  }
+};
+
+// PackHexInstances() from the chunk meshes - whole runs are copied. Same
+// result as packing the tiles when the meshes are current and there is no
+// water.
+inline bool PackHexChunkMeshes(const HexRemesher& remesher, const uint32_t* chunks, size_t chunkCount,
+    HexInstance* out, size_t capacity, HexInstanceBatches& batches) {
+  uint32_t counts[g_HexMaxMaterials] = {};
+  for (size_t i = 0; i < chunkCount; ++i) {
+    const HexChunkMesh& mesh = remesher.Mesh(chunks[i]);
+    for (uint32_t run = 0; run < mesh.runCount; ++run) {
+      counts[mesh.runs[run].material] += mesh.runs[run].countMinusOne + 1u;
+    }
+  }
+
+  uint32_t cursors[g_HexMaxMaterials];
+  uint32_t total = 0;
+  batches.batchCount = 0;
+  for (uint32_t material = 0; material < g_HexMaxMaterials; ++material) {
+    cursors[material] = total;
+    if (counts[material] > 0) {
+      batches.batches[batches.batchCount++] = {material, total, counts[material]};
+      total += counts[material];
+    }
+  }
+
+  batches.instanceCount = total;
+  if (total > capacity) {
+    batches.batchCount = 0;
+    return false;
+  }
+
+  for (size_t i = 0; i < chunkCount; ++i) {
+    const HexChunkMesh& mesh = remesher.Mesh(chunks[i]);
+    const HexInstance* source = mesh.instances;
+    for (uint32_t run = 0; run < mesh.runCount; ++run) {
+      uint32_t count = mesh.runs[run].countMinusOne + 1u;
+      std::memcpy(out + cursors[mesh.runs[run].material], source, count * sizeof(HexInstance));
+      cursors[mesh.runs[run].material] += count;
+      source += count;
+    }
+  }
+
+  return true;
+}
+
+#endif // _H_HEX_REMESH
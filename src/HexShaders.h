@@ -0,0 +1,80 @@
+#ifndef _H_HEX_SHADERS
+#define _H_HEX_SHADERS
+
+// HLSL of the hex renderer and the shaders built from it. The build
+// precompiles every entry of g_HexShaders into the shader archive (see
+// shadercompiler.cpp); the renderer only compiles at startup when the
+// archive is missing or was built from a different source.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Helpers.h"
+
+// Hex tile shaders. Instance coordinates are relative to the map center, so
+// world positions stay small however large the map is. Must place hexes the
+// same way as HexChunkWorldBounds() or culling is off.
+const char g_HexShaderSource[] = R"(
+cbuffer FrameConstants : register(b0) {
+  float4x4 viewProjection;
+  float3 lightDirection;
+  float hexSize;
+  float4 palette[8];
+};
+
+cbuffer DrawConstants : register(b1) {
+  float instanceScale; // Coarse LOD hexes cover 2^LOD tiles
+};
+
+struct VertexInput {
+  float3 position : POSITION;
+  float3 normal : NORMAL;
+  int2 hex : HEX;
+  uint height : HEIGHT;
+  uint2 materialFlags : MATERIAL;
+};
+
+struct PixelInput {
+  float4 position : SV_POSITION;
+  float3 normal : NORMAL;
+  nointerpolation float3 color : COLOR;
+};
+
+PixelInput VSMain(VertexInput input) {
+  float2 hex = float2(input.hex);
+  float2 center = hexSize * float2(1.7320508 * (hex.x + 0.5 * hex.y), 1.5 * hex.y);
+  float height = max(input.height / 256.0, 0.05) * hexSize;
+
+  float radius = hexSize * instanceScale;
+  float3 world = float3(center.x + input.position.x * radius, input.position.y * height, center.y + input.position.z * radius);
+
+  PixelInput output;
+  output.position = mul(viewProjection, float4(world, 1.0));
+  output.normal = input.normal;
+  output.color = palette[input.materialFlags.x & 7].rgb;
+  return output;
+}
+
+float4 PSMain(PixelInput input) : SV_TARGET {
+  float light = 0.35 + 0.65 * saturate(dot(normalize(input.normal), -lightDirection));
+  return float4(input.color * light, 1.0);
+}
+)";
+
+struct HexShaderEntry {
+  const char* name;       // Key in the shader archive
+  const char* entryPoint;
+  const char* target;
+};
+
+const HexShaderEntry g_HexShaders[] = {
+  {"HexVS", "VSMain", "vs_5_0"},
+  {"HexPS", "PSMain", "ps_5_0"},
+};
+
+// Identifies the source an archive was built from
+inline uint64_t HexShaderSourceHash() {
+  return HashBytes(g_HexShaderSource, sizeof(g_HexShaderSource) - 1);
+}
+
+#endif // _H_HEX_SHADERS
@@ -0,0 +1,225 @@
+#ifndef _H_HEX_SPATIAL_HASH
+#define _H_HEX_SPATIAL_HASH
+
+// Spatial hash over hex cells for proximity queries between moving things,
+// rebuilt from scratch every tick with a parallel two-pass counting sort.
+// The items are cut into fixed pieces. Every piece counts its items per
+// partition, a run of 128 buckets. A scan of those counts gives each piece
+// its own write offset in every partition, and the pieces scatter in
+// parallel. Every partition then counting-sorts its items by bucket. Both
+// passes are stable and never write to the same place from two threads, so
+// there are no atomics and the layout is the same for any thread count.
+//
+// Buckets are laid out in tiles of 8x8 cells: the tile coordinate is hashed
+// to a run of 64 buckets and the cell picks its bucket inside the run. A
+// range query or a fleet of ships then reads and writes a few runs of
+// buckets instead of one cache line per cell. Cells that share a bucket are
+// told apart by the cell stored with every entry.
+//
+// All arrays are sized by Reserve() and reused, a rebuild allocates nothing
+// unless the item count outgrows them.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "HexGrid.h"
+#include "HexPicking.h"
+#include "JobSystem.h"
+
+const uint32_t g_HexSpatialTileShift = 3;  // 8x8 cells share a run of buckets
+const uint32_t g_HexSpatialBlock = 8192;   // Items per piece
+const uint32_t g_HexSpatialPartitionShift = 7; // 128 buckets per partition
+
+// An item sorted into its bucket, with copies of its cell and position
+struct HexSpatialEntry {
+  uint32_t item;
+  int32_t q;
+  int32_t r;
+  float x;
+  float z;
+};
+
+struct HexSpatialHash {
+  uint32_t count = 0;
+  uint32_t capacity = 0;
+  uint32_t bucketMask = 0;
+
+  // After Build() bucket b holds the entries [starts[b], starts[b + 1])
+  std::unique_ptr<uint32_t[]> starts;
+  std::unique_ptr<HexSpatialEntry[]> entries; // Sorted by bucket, items in order within a bucket
+
+  uint32_t Bucket(int32_t q, int32_t r) const {
+    const uint32_t tileMask = (1u << g_HexSpatialTileShift) - 1;
+    uint32_t tile = static_cast<uint32_t>(q >> g_HexSpatialTileShift) * 0x9E3779B1u + static_cast<uint32_t>(r >> g_HexSpatialTileShift) * 0x85EBCA77u;
+    tile ^= tile >> 16;
+    uint32_t cell = ((static_cast<uint32_t>(r) & tileMask) << g_HexSpatialTileShift) | (static_cast<uint32_t>(q) & tileMask);
+
+    return ((tile << (2 * g_HexSpatialTileShift)) | cell) & bucketMask;
+  }
+
+  uint32_t BucketCount() const {
+    return bucketMask + 1;
+  }
+
+  uint32_t PartitionCount() const {
+    return BucketCount() >> g_HexSpatialPartitionShift;
+  }
+
+  // Sizes the table for up to maxItems items, at most one item per bucket
+  // on average
+  void Reserve(uint32_t maxItems) {
+    if (maxItems <= capacity && starts) {
+      return;
+    }
+
+    uint32_t bucketCount = 1024;
+    while (bucketCount < maxItems) {
+      bucketCount *= 2;
+    }
+
+    capacity = maxItems;
+    bucketMask = bucketCount - 1;
+    starts.reset(new uint32_t[bucketCount + 1]);
+    entries.reset(new HexSpatialEntry[capacity]);
+    partitioned.reset(new HexSpatialEntry[capacity]);
+    itemBuckets.reset(new uint32_t[capacity]);
+    partitionStarts.resize(PartitionCount() + 1);
+    pieceOffsets.resize(static_cast<size_t>((capacity + g_HexSpatialBlock - 1) / g_HexSpatialBlock) * PartitionCount());
+  }
+
+  // Rebuilds the hash from item i's cell (qs[i], rs[i]) and position
+  // (xs[i], zs[i])
+  void Build(const int32_t* qs, const int32_t* rs, const float* xs, const float* zs, uint32_t itemCount, JobSystem& jobs) {
+    Reserve(itemCount);
+    count = itemCount;
+    uint32_t partitions = PartitionCount();
+    uint32_t pieces = (itemCount + g_HexSpatialBlock - 1) / g_HexSpatialBlock;
+
+    // Items per partition in every piece
+    jobs.ParallelFor(0, pieces, 1, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t piece = begin; piece < end; ++piece) {
+        uint32_t* counts = pieceOffsets.data() + static_cast<size_t>(piece) * partitions;
+        std::memset(counts, 0, partitions * sizeof(uint32_t));
+        uint32_t last = std::min(itemCount, (piece + 1) * g_HexSpatialBlock);
+        for (uint32_t i = piece * g_HexSpatialBlock; i < last; ++i) {
+          uint32_t bucket = Bucket(qs[i], rs[i]);
+          itemBuckets[i] = bucket;
+          counts[bucket >> g_HexSpatialPartitionShift]++;
+        }
+      }
+    });
+
+    // Partition by partition, piece by piece - the counts become offsets
+    uint32_t offset = 0;
+    for (uint32_t partition = 0; partition < partitions; ++partition) {
+      partitionStarts[partition] = offset;
+      for (uint32_t piece = 0; piece < pieces; ++piece) {
+        uint32_t& slot = pieceOffsets[static_cast<size_t>(piece) * partitions + partition];
+        uint32_t pieceCount = slot;
+        slot = offset;
+        offset += pieceCount;
+      }
+    }
+    partitionStarts[partitions] = offset;
+
+    jobs.ParallelFor(0, pieces, 1, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t piece = begin; piece < end; ++piece) {
+        uint32_t* offsets = pieceOffsets.data() + static_cast<size_t>(piece) * partitions;
+        uint32_t last = std::min(itemCount, (piece + 1) * g_HexSpatialBlock);
+        for (uint32_t i = piece * g_HexSpatialBlock; i < last; ++i) {
+          partitioned[offsets[itemBuckets[i] >> g_HexSpatialPartitionShift]++] = {i, qs[i], rs[i], xs[i], zs[i]};
+        }
+      }
+    });
+
+    // Counting sort inside every partition, the buckets are recomputed from
+    // the cells instead of being carried along
+    const uint32_t partitionBuckets = 1u << g_HexSpatialPartitionShift;
+    jobs.ParallelFor(0, partitions, 64, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t partition = begin; partition < end; ++partition) {
+        uint32_t first = partitionStarts[partition];
+        uint32_t last = partitionStarts[partition + 1];
+        uint32_t* bucketStarts = starts.get() + partition * partitionBuckets;
+
+        std::memset(bucketStarts, 0, partitionBuckets * sizeof(uint32_t));
+        for (uint32_t i = first; i < last; ++i) {
+          bucketStarts[Bucket(partitioned[i].q, partitioned[i].r) & (partitionBuckets - 1)]++;
+        }
+
+        uint32_t cursor = first;
+        for (uint32_t b = 0; b < partitionBuckets; ++b) {
+          uint32_t bucketCount = bucketStarts[b];
+          bucketStarts[b] = cursor;
+          cursor += bucketCount;
+        }
+
+        // Advances each start to its bucket's end, shifted back below
+        for (uint32_t i = first; i < last; ++i) {
+          entries[bucketStarts[Bucket(partitioned[i].q, partitioned[i].r) & (partitionBuckets - 1)]++] = partitioned[i];
+        }
+        for (uint32_t b = partitionBuckets - 1; b > 0; --b) {
+          bucketStarts[b] = bucketStarts[b - 1];
+        }
+        bucketStarts[0] = first;
+      }
+    });
+    starts[BucketCount()] = itemCount;
+  }
+
+  // Calls visit(uint32_t item, float x, float z) for every item in the cell
+  template <typename Visit>
+  void ForEachInCell(HexAxial cell, Visit&& visit) const {
+    uint32_t bucket = Bucket(cell.q, cell.r);
+    uint32_t end = starts[bucket + 1];
+    for (uint32_t i = starts[bucket]; i < end; ++i) {
+      const HexSpatialEntry& entry = entries[i];
+      if (entry.q == cell.q && entry.r == cell.r) {
+        visit(entry.item, entry.x, entry.z);
+      }
+    }
+  }
+
+  // Items in the cells exactly `radius` steps from center
+  template <typename Visit>
+  void ForEachInRing(HexAxial center, int32_t radius, Visit&& visit) const {
+    HexRing(center, radius, [&](HexAxial cell) {
+      ForEachInCell(cell, visit);
+    });
+  }
+
+  // Items in the cells at most `radius` steps from center
+  template <typename Visit>
+  void ForEachInRange(HexAxial center, int32_t radius, Visit&& visit) const {
+    HexSpiral(center, radius, [&](HexAxial cell) {
+      ForEachInCell(cell, visit);
+    });
+  }
+
+  // Items within `distance` of a point. Centers of cells n steps apart are
+  // at least 1.5 * n hex sizes apart and a point is at most one size from
+  // its cell's center, which bounds the cells to look at.
+  template <typename Visit>
+  void ForEachNear(const HexLayout& layout, float x, float z, float distance, Visit&& visit) const {
+    int32_t radius = static_cast<int32_t>(std::floor((distance + 2.0f * layout.size) / (1.5f * layout.size)));
+    float distance2 = distance * distance;
+    ForEachInRange(PixelToHex(layout, x, z), radius, [&](uint32_t item, float itemX, float itemZ) {
+      float dx = itemX - x;
+      float dz = itemZ - z;
+      if (dx * dx + dz * dz <= distance2) {
+        visit(item, itemX, itemZ);
+      }
+    });
+  }
+
+private:
+  std::unique_ptr<HexSpatialEntry[]> partitioned;
+  std::unique_ptr<uint32_t[]> itemBuckets;
+  std::vector<uint32_t> partitionStarts;
+  std::vector<uint32_t> pieceOffsets; // Per piece and partition
+};
+
+#endif // _H_HEX_SPATIAL_HASH
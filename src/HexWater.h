@@ -0,0 +1,423 @@
+#ifndef _H_HEX_WATER
+#define _H_HEX_WATER
+
+// Column water over the hex grid. Every tile is a column of water on top of
+// the terrain with a depth and the flow through three of its six edges (E,
+// SE, SW, positive out of the column). The other three edges belong to the
+// W, NW and NE neighbors, so each edge is stored exactly once. Flow is
+// accelerated by the difference in water surface height and limited so a
+// column can never give away more water than it holds. This is the
+// "virtual pipes" model with signed flows.
+//
+// A tick is two passes over the chunks, both double-buffered:
+//   flow:  depth[current], flow[current] -> flow[next]
+//   depth: depth[current], flow[next]    -> depth[next]
+// A chunk writes only its own tiles and reads its neighbors' tiles from
+// buffers nobody writes during that pass, so chunks at a boundary need no
+// locks. The end of a pass is the only synchronization. Storage uses the
+// same chunked layout and tile indices as HexGrid. Chunk rows are
+// contiguous, so the kernels run along a row of 16 tiles. The neighbors'
+// values come from small halo lines that also cover the adjacent chunks.
+//
+// Walls are columns with very high terrain and no water. Tiles past the map
+// edge read as walls, and so do the padding tiles of partial chunks.
+//
+// Set dirtyChunks to have the depth pass mark every chunk whose water moved
+// enough to look different, for incremental remeshing.
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "HexGrid.h"
+#include "HexMesh.h"
+#include "JobSystem.h"
+#include "Simd.h"
+
+const float g_HexWaterWall = 1e30f;
+const uint32_t g_HexWaterLine = g_HexChunkSize + 2; // One row of a chunk plus a halo tile on each side
+
+struct HexWaterParams {
+  float gravity = 9.81f;
+  float pipeFactor = 0.5f; // Pipe cross section over pipe length and column area
+  float damping = 0.999f;  // Part of the flow kept from one tick to the next
+};
+
+// Per-tick constants of the kernels
+struct HexWaterConstants {
+  float damping;
+  float acceleration; // Flow gained per unit of surface height difference
+  float limit;        // Largest flow per unit of depth, so six edges drain at most the whole column
+  float dt;
+};
+
+// flowOut = clamp(flowIn * damping + acceleration * (hSelf - hNeighbor),
+//                 -dNeighbor * limit, dSelf * limit)
+inline void HexWaterEdgeRowScalar(const float* hSelf, const float* dSelf, const float* hNeighbor, const float* dNeighbor,
+    const float* flowIn, float* flowOut, const HexWaterConstants& k) {
+  float negativeLimit = -k.limit;
+  for (uint32_t x = 0; x < g_HexChunkSize; ++x) {
+    float flow = flowIn[x] * k.damping + k.acceleration * (hSelf[x] - hNeighbor[x]);
+    float outLimit = dSelf[x] * k.limit;
+    float inLimit = dNeighbor[x] * negativeLimit;
+    flow = flow < outLimit ? flow : outLimit;
+    flowOut[x] = flow > inLimit ? flow : inLimit;
+  }
+}
+
+// depthOut = max(depth + (in - out) * dt, 0), summed left to right
+inline void HexWaterDepthRowScalar(const float* depth, const float* inW, const float* inNW, const float* inNE,
+    const float* outE, const float* outSE, const float* outSW, float* depthOut, const HexWaterConstants& k) {
+  for (uint32_t x = 0; x < g_HexChunkSize; ++x) {
+    float net = inW[x] + inNW[x] + inNE[x] - outE[x] - outSE[x] - outSW[x];
+    float result = depth[x] + net * k.dt;
+    depthOut[x] = result > 0.0f ? result : 0.0f;
+  }
+}
+
+#if SIMD_X86
+
+// _mm_min_ps/_mm_max_ps return the second operand on ties and NaNs, the same
+// as the scalar selects, so all versions produce identical bits
+inline void HexWaterEdgeRowSSE2(const float* hSelf, const float* dSelf, const float* hNeighbor, const float* dNeighbor,
+    const float* flowIn, float* flowOut, const HexWaterConstants& k) {
+  const __m128 damping = _mm_set1_ps(k.damping);
+  const __m128 acceleration = _mm_set1_ps(k.acceleration);
+  const __m128 limit = _mm_set1_ps(k.limit);
+  const __m128 negativeLimit = _mm_set1_ps(-k.limit);
+
+  for (uint32_t x = 0; x < g_HexChunkSize; x += 4) {
+    __m128 difference = _mm_sub_ps(_mm_loadu_ps(hSelf + x), _mm_loadu_ps(hNeighbor + x));
+    __m128 flow = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(flowIn + x), damping), _mm_mul_ps(acceleration, difference));
+    __m128 outLimit = _mm_mul_ps(_mm_loadu_ps(dSelf + x), limit);
+    __m128 inLimit = _mm_mul_ps(_mm_loadu_ps(dNeighbor + x), negativeLimit);
+    flow = _mm_min_ps(flow, outLimit);
+    _mm_storeu_ps(flowOut + x, _mm_max_ps(flow, inLimit));
+  }
+}
+
+inline void HexWaterDepthRowSSE2(const float* depth, const float* inW, const float* inNW, const float* inNE,
+    const float* outE, const float* outSE, const float* outSW, float* depthOut, const HexWaterConstants& k) {
+  const __m128 dt = _mm_set1_ps(k.dt);
+  const __m128 zero = _mm_setzero_ps();
+
+  for (uint32_t x = 0; x < g_HexChunkSize; x += 4) {
+    __m128 net = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(inW + x), _mm_loadu_ps(inNW + x)), _mm_loadu_ps(inNE + x));
+    net = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(net, _mm_loadu_ps(outE + x)), _mm_loadu_ps(outSE + x)), _mm_loadu_ps(outSW + x));
+    __m128 result = _mm_add_ps(_mm_loadu_ps(depth + x), _mm_mul_ps(net, dt));
+    _mm_storeu_ps(depthOut + x, _mm_max_ps(result, zero));
+  }
+}
+
+SIMD_TARGET_AVX2 inline void HexWaterEdgeRowAVX2(const float* hSelf, const float* dSelf, const float* hNeighbor, const float* dNeighbor,
+    const float* flowIn, float* flowOut, const HexWaterConstants& k) {
+  const __m256 damping = _mm256_set1_ps(k.damping);
+  const __m256 acceleration = _mm256_set1_ps(k.acceleration);
+  const __m256 limit = _mm256_set1_ps(k.limit);
+  const __m256 negativeLimit = _mm256_set1_ps(-k.limit);
+
+  for (uint32_t x = 0; x < g_HexChunkSize; x += 8) {
+    __m256 difference = _mm256_sub_ps(_mm256_loadu_ps(hSelf + x), _mm256_loadu_ps(hNeighbor + x));
+    __m256 flow = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(flowIn + x), damping), _mm256_mul_ps(acceleration, difference));
+    __m256 outLimit = _mm256_mul_ps(_mm256_loadu_ps(dSelf + x), limit);
+    __m256 inLimit = _mm256_mul_ps(_mm256_loadu_ps(dNeighbor + x), negativeLimit);
+    flow = _mm256_min_ps(flow, outLimit);
+    _mm256_storeu_ps(flowOut + x, _mm256_max_ps(flow, inLimit));
+  }
+}
+
+SIMD_TARGET_AVX2 inline void HexWaterDepthRowAVX2(const float* depth, const float* inW, const float* inNW, const float* inNE,
+    const float* outE, const float* outSE, const float* outSW, float* depthOut, const HexWaterConstants& k) {
+  const __m256 dt = _mm256_set1_ps(k.dt);
+  const __m256 zero = _mm256_setzero_ps();
+
+  for (uint32_t x = 0; x < g_HexChunkSize; x += 8) {
+    __m256 net = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(inW + x), _mm256_loadu_ps(inNW + x)), _mm256_loadu_ps(inNE + x));
+    net = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(net, _mm256_loadu_ps(outE + x)), _mm256_loadu_ps(outSE + x)), _mm256_loadu_ps(outSW + x));
+    __m256 result = _mm256_add_ps(_mm256_loadu_ps(depth + x), _mm256_mul_ps(net, dt));
+    _mm256_storeu_ps(depthOut + x, _mm256_max_ps(result, zero));
+  }
+}
+
+#endif
+
+inline void HexWaterEdgeRow(const float* hSelf, const float* dSelf, const float* hNeighbor, const float* dNeighbor,
+    const float* flowIn, float* flowOut, const HexWaterConstants& k, SimdLevel level) {
+#if SIMD_X86
+  if (level == SimdLevel::AVX2) {
+    HexWaterEdgeRowAVX2(hSelf, dSelf, hNeighbor, dNeighbor, flowIn, flowOut, k);
+    return;
+  }
+  if (level == SimdLevel::SSE2) {
+    HexWaterEdgeRowSSE2(hSelf, dSelf, hNeighbor, dNeighbor, flowIn, flowOut, k);
+    return;
+  }
+#endif
+  HexWaterEdgeRowScalar(hSelf, dSelf, hNeighbor, dNeighbor, flowIn, flowOut, k);
+}
+
+inline void HexWaterDepthRow(const float* depth, const float* inW, const float* inNW, const float* inNE,
+    const float* outE, const float* outSE, const float* outSW, float* depthOut, const HexWaterConstants& k, SimdLevel level) {
+#if SIMD_X86
+  if (level == SimdLevel::AVX2) {
+    HexWaterDepthRowAVX2(depth, inW, inNW, inNE, outE, outSE, outSW, depthOut, k);
+    return;
+  }
+  if (level == SimdLevel::SSE2) {
+    HexWaterDepthRowSSE2(depth, inW, inNW, inNE, outE, outSE, outSW, depthOut, k);
+    return;
+  }
+#endif
+  HexWaterDepthRowScalar(depth, inW, inNW, inNE, outE, outSE, outSW, depthOut, k);
+}
+
+struct HexWater {
+  enum Edge {
+    EdgeE,
+    EdgeSE,
+    EdgeSW,
+    EdgeCount
+  };
+
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t chunksX = 0;
+  uint32_t chunksY = 0;
+
+  float* terrain = nullptr;               // Ground height, g_HexWaterWall in the padding
+  float* depth[2] = {};                   // Water depth over the ground
+  float* flow[2][EdgeCount] = {};         // Depth per second through the owned edges
+  uint32_t current = 0;                   // Buffer holding the latest state
+  uint64_t tick = 0;
+  HexDirtyChunks* dirtyChunks = nullptr;  // If set, chunks whose drawn depth changed are marked
+
+  HexWater() = default;
+  HexWater(const HexWater&) = delete;
+  HexWater& operator=(const HexWater&) = delete;
+
+  ~HexWater() {
+    Free();
+  }
+
+  // Takes the map size and the ground heights from the grid, without water
+  void Init(const HexGrid& grid) {
+    Free();
+
+    width = grid.width;
+    height = grid.height;
+    chunksX = grid.chunksX;
+    chunksY = grid.chunksY;
+    current = 0;
+    tick = 0;
+
+    size_t tileCount = grid.TileCount();
+    terrain = static_cast<float*>(AlignedAlloc(tileCount * sizeof(float)));
+    for (uint32_t buffer = 0; buffer < 2; ++buffer) {
+      depth[buffer] = static_cast<float*>(AlignedAlloc(tileCount * sizeof(float)));
+      std::memset(depth[buffer], 0, tileCount * sizeof(float));
+      for (uint32_t edge = 0; edge < EdgeCount; ++edge) {
+        flow[buffer][edge] = static_cast<float*>(AlignedAlloc(tileCount * sizeof(float)));
+        std::memset(flow[buffer][edge], 0, tileCount * sizeof(float));
+      }
+    }
+
+    for (size_t i = 0; i < tileCount; ++i) {
+      terrain[i] = g_HexWaterWall;
+    }
+    grid.ForEachTile([&](uint32_t index, HexOffset) {
+      terrain[index] = grid.heights[index];
+    });
+  }
+
+  void Free() {
+    if (!terrain) {
+      return;
+    }
+
+    AlignedFree(terrain);
+    for (uint32_t buffer = 0; buffer < 2; ++buffer) {
+      AlignedFree(depth[buffer]);
+      for (uint32_t edge = 0; edge < EdgeCount; ++edge) {
+        AlignedFree(flow[buffer][edge]);
+      }
+    }
+    terrain = nullptr;
+  }
+
+  uint32_t ChunkCount() const {
+    return chunksX * chunksY;
+  }
+
+  size_t TileCount() const {
+    return static_cast<size_t>(ChunkCount()) * g_HexChunkTiles;
+  }
+
+  // Same index as HexGrid::Index for the same map size
+  uint32_t Index(HexOffset o) const {
+    uint32_t col = static_cast<uint32_t>(o.col);
+    uint32_t row = static_cast<uint32_t>(o.row);
+    uint32_t chunk = (row >> g_HexChunkShift) * chunksX + (col >> g_HexChunkShift);
+
+    return (chunk << (2 * g_HexChunkShift)) | ((row & g_HexChunkMask) << g_HexChunkShift) | (col & g_HexChunkMask);
+  }
+
+  float Depth(HexOffset o) const {
+    return depth[current][Index(o)];
+  }
+
+  // Adds (or with a negative amount removes) water at one tile, between ticks
+  void AddWater(HexOffset o, float amount) {
+    float& value = depth[current][Index(o)];
+    value = value + amount > 0.0f ? value + amount : 0.0f;
+  }
+
+  // Fills every tile below `level` up to it
+  void Flood(float level) {
+    for (size_t i = 0; i < TileCount(); ++i) {
+      float fill = level - terrain[i];
+      depth[current][i] = fill > 0.0f ? fill : 0.0f;
+    }
+  }
+
+  // Sum of all water, in depth units times tiles
+  double TotalVolume() const {
+    double total = 0.0;
+    for (size_t i = 0; i < TileCount(); ++i) {
+      total += depth[current][i];
+    }
+
+    return total;
+  }
+
+  // Advances one tick of dt seconds, chunks spread over the job system
+  void Step(float dt, const HexWaterParams& params, JobSystem& jobs, SimdLevel level = GetSimdLevel()) {
+    HexWaterConstants k = {params.damping, params.gravity * params.pipeFactor * dt, 1.0f / (6.0f * dt), dt};
+    uint32_t next = current ^ 1;
+
+    jobs.ParallelFor(0, ChunkCount(), 4, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t chunk = begin; chunk < end; ++chunk) {
+        FlowChunk(chunk, next, k, level);
+      }
+    });
+
+    jobs.ParallelFor(0, ChunkCount(), 4, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t chunk = begin; chunk < end; ++chunk) {
+        DepthChunk(chunk, next, k, level);
+      }
+    });
+
+    current = next;
+    tick++;
+  }
+
+private:
+  // Copies one storage row of a chunk plus the tile left and right of it
+  // into line[0..17], `fill` where that is outside the storage
+  void FetchRow(const float* field, uint32_t chunkX, uint32_t row, float* line, float fill) const {
+    if (row >= (chunksY << g_HexChunkShift)) {
+      for (uint32_t i = 0; i < g_HexWaterLine; ++i) {
+        line[i] = fill;
+      }
+      return;
+    }
+
+    uint32_t chunk = (row >> g_HexChunkShift) * chunksX + chunkX;
+    const float* source = field + ((chunk << (2 * g_HexChunkShift)) | ((row & g_HexChunkMask) << g_HexChunkShift));
+
+    line[0] = chunkX > 0 ? *(source - g_HexChunkTiles + g_HexChunkMask) : fill;
+    std::memcpy(line + 1, source, g_HexChunkSize * sizeof(float));
+    line[g_HexWaterLine - 1] = chunkX + 1 < chunksX ? source[g_HexChunkTiles] : fill;
+  }
+
+  // Surface and depth lines of one row
+  void FetchSurface(uint32_t chunkX, uint32_t row, float* surface, float* water) const {
+    float ground[g_HexWaterLine];
+    FetchRow(terrain, chunkX, row, ground, g_HexWaterWall);
+    FetchRow(depth[current], chunkX, row, water, 0.0f);
+    for (uint32_t i = 0; i < g_HexWaterLine; ++i) {
+      surface[i] = ground[i] + water[i];
+    }
+  }
+
+  void FlowChunk(uint32_t chunk, uint32_t next, const HexWaterConstants& k, SimdLevel level) {
+    HexChunkBounds bounds = ChunkBounds(chunk);
+    uint32_t chunkX = bounds.col0 >> g_HexChunkShift;
+
+    float lines[4][g_HexWaterLine];
+    float* surface = lines[0];
+    float* water = lines[1];
+    float* surfaceBelow = lines[2];
+    float* waterBelow = lines[3];
+    FetchSurface(chunkX, bounds.row0, surface, water);
+
+    for (uint32_t y = 0; y < g_HexChunkSize; ++y) {
+      FetchSurface(chunkX, bounds.row0 + y + 1, surfaceBelow, waterBelow);
+
+      // Odd rows are shoved right, their SW and SE neighbors one column further
+      uint32_t odd = y & 1;
+      uint32_t row = bounds.base + (y << g_HexChunkShift);
+      const float* flowIn[EdgeCount] = {flow[current][EdgeE] + row, flow[current][EdgeSE] + row, flow[current][EdgeSW] + row};
+      float* flowOut[EdgeCount] = {flow[next][EdgeE] + row, flow[next][EdgeSE] + row, flow[next][EdgeSW] + row};
+
+      HexWaterEdgeRow(surface + 1, water + 1, surface + 2, water + 2, flowIn[EdgeE], flowOut[EdgeE], k, level);
+      HexWaterEdgeRow(surface + 1, water + 1, surfaceBelow + 1 + odd, waterBelow + 1 + odd, flowIn[EdgeSE], flowOut[EdgeSE], k, level);
+      HexWaterEdgeRow(surface + 1, water + 1, surfaceBelow + odd, waterBelow + odd, flowIn[EdgeSW], flowOut[EdgeSW], k, level);
+
+      std::swap(surface, surfaceBelow);
+      std::swap(water, waterBelow);
+    }
+  }
+
+  void DepthChunk(uint32_t chunk, uint32_t next, const HexWaterConstants& k, SimdLevel level) {
+    HexChunkBounds bounds = ChunkBounds(chunk);
+    uint32_t chunkX = bounds.col0 >> g_HexChunkShift;
+    float* const* flows = flow[next];
+
+    // Rows above the map wrap to UINT32_MAX and read as outside the storage
+    float east[g_HexWaterLine];
+    float southEastAbove[g_HexWaterLine];
+    float southWestAbove[g_HexWaterLine];
+    FetchRow(flows[EdgeSE], chunkX, bounds.row0 - 1, southEastAbove, 0.0f);
+    FetchRow(flows[EdgeSW], chunkX, bounds.row0 - 1, southWestAbove, 0.0f);
+
+    bool changed = false;
+    for (uint32_t y = 0; y < g_HexChunkSize; ++y) {
+      uint32_t odd = y & 1;
+      uint32_t row = bounds.base + (y << g_HexChunkShift);
+      FetchRow(flows[EdgeE], chunkX, bounds.row0 + y, east, 0.0f);
+
+      // W is one column left; NW and NE are the row above, shifted for odd rows
+      HexWaterDepthRow(depth[current] + row, east, southEastAbove + odd, southWestAbove + 1 + odd,
+          flows[EdgeE] + row, flows[EdgeSE] + row, flows[EdgeSW] + row, depth[next] + row, k, level);
+      changed |= dirtyChunks && DepthRowChanged(depth[current] + row, depth[next] + row);
+
+      FetchRow(flows[EdgeSE], chunkX, bounds.row0 + y, southEastAbove, 0.0f);
+      FetchRow(flows[EdgeSW], chunkX, bounds.row0 + y, southWestAbove, 0.0f);
+    }
+
+    if (changed) {
+      dirtyChunks->Mark(chunk);
+    }
+  }
+
+  // Whether any depth of the row moved to another step of the instance
+  // height precision - smaller changes would not show
+  static bool DepthRowChanged(const float* before, const float* after) {
+    bool changed = false;
+    for (uint32_t x = 0; x < g_HexChunkSize; ++x) {
+      changed |= static_cast<int32_t>(before[x] * g_HexHeightScale) != static_cast<int32_t>(after[x] * g_HexHeightScale);
+    }
+
+    return changed;
+  }
+
+  // Whole chunks, the padding tiles are walls and simulate like any other tile
+  HexChunkBounds ChunkBounds(uint32_t chunk) const {
+    uint32_t chunkY = chunk / chunksX;
+    uint32_t chunkX = chunk - chunkY * chunksX;
+
+    return {chunkX << g_HexChunkShift, chunkY << g_HexChunkShift, g_HexChunkSize, g_HexChunkSize, chunk << (2 * g_HexChunkShift)};
+  }
+};
+
+#endif // _H_HEX_WATER
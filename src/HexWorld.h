@@ -0,0 +1,343 @@
+#ifndef _H_HEX_WORLD
+#define _H_HEX_WORLD
+
+// Streamed hex world. A world file is a fixed-size header followed by every
+// 16x16 chunk of the map at a fixed stride, each chunk laid out exactly like
+// the HexGrid chunk blocks (heights, then materials, then flags). Chunk
+// offsets are implicit, so opening a world is mapping the file and checking
+// the header - nothing is parsed up front no matter how big the world is.
+//
+// HexWorldStreamer keeps the chunks around the camera resident in a pool of
+// slots sized from a memory budget and evicts the least recently wanted ones.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "HexGrid.h"
+#include "MappedFile.h"
+
+const uint32_t g_HexWorldMagic = 0x57584548; // "HEXW"
+const uint32_t g_HexWorldVersion = 1;
+const uint64_t g_HexWorldDataOffset = 4096;
+
+// Chunk payload layout
+const uint32_t g_HexChunkHeightsOffset = 0;
+const uint32_t g_HexChunkMaterialsOffset = g_HexChunkHeightsOffset + g_HexChunkTiles * sizeof(float);
+const uint32_t g_HexChunkFlagsOffset = g_HexChunkMaterialsOffset + g_HexChunkTiles;
+const uint32_t g_HexChunkBytes = g_HexChunkFlagsOffset + g_HexChunkTiles;
+
+struct HexWorldHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;       // In tiles
+  uint32_t height;
+  uint32_t chunksX;
+  uint32_t chunksY;
+  uint32_t chunkBytes;  // Payload of one chunk
+  uint32_t chunkStride; // Distance between consecutive chunks in the file
+  uint64_t dataOffset;  // File offset of chunk 0
+  uint8_t reserved[24];
+};
+
+static_assert(sizeof(HexWorldHeader) == 64, "HexWorldHeader is part of the file format");
+
+struct HexChunkView {
+  const float* heights;
+  const uint8_t* materials;
+  const uint8_t* flags;
+};
+
+inline HexChunkView GetHexChunkView(const uint8_t* payload) {
+  return {
+    reinterpret_cast<const float*>(payload + g_HexChunkHeightsOffset),
+    payload + g_HexChunkMaterialsOffset,
+    payload + g_HexChunkFlagsOffset
+  };
+}
+
+inline HexWorldHeader MakeHexWorldHeader(uint32_t width, uint32_t height) {
+  HexWorldHeader header = {};
+  header.magic = g_HexWorldMagic;
+  header.version = g_HexWorldVersion;
+  header.width = width;
+  header.height = height;
+  header.chunksX = (width + g_HexChunkMask) >> g_HexChunkShift;
+  header.chunksY = (height + g_HexChunkMask) >> g_HexChunkShift;
+  header.chunkBytes = g_HexChunkBytes;
+  header.chunkStride = static_cast<uint32_t>((g_HexChunkBytes + g_CacheLineSize - 1) & ~(g_CacheLineSize - 1));
+  header.dataOffset = g_HexWorldDataOffset;
+
+  return header;
+}
+
+inline uint64_t HexWorldFileSize(const HexWorldHeader& header) {
+  return header.dataOffset + static_cast<uint64_t>(header.chunksX) * header.chunksY * header.chunkStride;
+}
+
+// 64-bit file seek, std::fseek only takes a long
+inline bool FileSeek(std::FILE* file, uint64_t offset) {
+#if defined(_WIN32)
+  return ::_fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return ::fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+// Writes the header and extends the file to its full size. The chunks read
+// back as zeros, and on file systems with sparse files take no space.
+inline bool CreateHexWorldFile(const char* path, uint32_t width, uint32_t height) {
+  HexWorldHeader header = MakeHexWorldHeader(width, height);
+
+  std::FILE* file = std::fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && FileSeek(file, HexWorldFileSize(header) - 1);
+  ok = ok && std::fputc(0, file) != EOF;
+
+  return (std::fclose(file) == 0) && ok;
+}
+
+// Writes a whole in-memory grid as a world file
+inline bool WriteHexWorld(const char* path, const HexGrid& grid) {
+  if (!CreateHexWorldFile(path, grid.width, grid.height)) {
+    return false;
+  }
+
+  HexWorldHeader header = MakeHexWorldHeader(grid.width, grid.height);
+  std::FILE* file = std::fopen(path, "r+b");
+  if (!file) {
+    return false;
+  }
+
+  bool ok = FileSeek(file, header.dataOffset);
+  std::vector<uint8_t> payload(header.chunkStride, 0);
+  for (uint32_t chunk = 0; ok && chunk < grid.ChunkCount(); ++chunk) {
+    size_t first = static_cast<size_t>(chunk) * g_HexChunkTiles;
+    std::memcpy(payload.data() + g_HexChunkHeightsOffset, grid.heights + first, g_HexChunkTiles * sizeof(float));
+    std::memcpy(payload.data() + g_HexChunkMaterialsOffset, grid.materials + first, g_HexChunkTiles);
+    std::memcpy(payload.data() + g_HexChunkFlagsOffset, grid.flags + first, g_HexChunkTiles);
+
+    ok = std::fwrite(payload.data(), payload.size(), 1, file) == 1;
+  }
+
+  return (std::fclose(file) == 0) && ok;
+}
+
+struct HexWorldStreamStats {
+  uint64_t residentBytes = 0;
+  uint32_t residentChunks = 0;
+  uint32_t loads = 0;     // Last update
+  uint32_t evictions = 0; // Last update
+  uint32_t deferred = 0;  // Wanted by the last update but left for a later one
+  uint64_t totalLoads = 0;
+  double lastLoadMicroseconds = 0.0;
+  double averageLoadMicroseconds = 0.0;
+  double maxLoadMicroseconds = 0.0;
+};
+
+struct HexWorldStreamer {
+  MappedFile file;
+  HexWorldHeader header = {};
+
+  // Slot pool, slotCount * chunkBytes is the memory budget
+  uint8_t* slotMemory = nullptr;
+  uint32_t slotCount = 0;
+  std::vector<uint32_t> freeSlots;
+  std::vector<uint32_t> slotChunk;
+  std::vector<uint64_t> slotLastWanted;
+  std::vector<float> slotLoadMicroseconds;
+  std::unordered_map<uint32_t, uint32_t> residentSlots; // Chunk -> slot
+
+  uint64_t updateIndex = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> wanted; // (distance, chunk), reused between updates
+  std::vector<std::pair<uint64_t, uint32_t>> evictable; // (last wanted, slot), built when the pool runs dry
+  HexWorldStreamStats stats;
+
+  HexWorldStreamer() = default;
+  HexWorldStreamer(const HexWorldStreamer&) = delete;
+  HexWorldStreamer& operator=(const HexWorldStreamer&) = delete;
+
+  ~HexWorldStreamer() {
+    Close();
+  }
+
+  // Maps the world and allocates the slot pool. Cost is independent of the
+  // world size.
+  bool Open(const char* path, size_t budgetBytes) {
+    Close();
+
+    if (!file.Open(path) || file.size < sizeof(HexWorldHeader)) {
+      file.Close();
+      return false;
+    }
+
+    std::memcpy(&header, file.data, sizeof(header));
+    if (header.magic != g_HexWorldMagic || header.version != g_HexWorldVersion ||
+        header.chunkBytes != g_HexChunkBytes || header.chunkStride < header.chunkBytes ||
+        file.size < HexWorldFileSize(header)) {
+      file.Close();
+      return false;
+    }
+
+    slotCount = static_cast<uint32_t>(std::min<uint64_t>(budgetBytes / header.chunkBytes, static_cast<uint64_t>(header.chunksX) * header.chunksY));
+    slotMemory = static_cast<uint8_t*>(AlignedAlloc(std::max<size_t>(1, static_cast<size_t>(slotCount) * header.chunkBytes)));
+
+    freeSlots.resize(slotCount);
+    for (uint32_t slot = 0; slot < slotCount; ++slot) {
+      freeSlots[slot] = slotCount - 1 - slot;
+    }
+    slotChunk.assign(slotCount, g_InvalidTile);
+    slotLastWanted.assign(slotCount, 0);
+    slotLoadMicroseconds.assign(slotCount, 0.0f);
+    residentSlots.reserve(slotCount);
+    stats = {};
+
+    return true;
+  }
+
+  void Close() {
+    if (slotMemory) {
+      AlignedFree(slotMemory);
+      slotMemory = nullptr;
+    }
+    slotCount = 0;
+    freeSlots.clear();
+    slotChunk.clear();
+    slotLastWanted.clear();
+    slotLoadMicroseconds.clear();
+    residentSlots.clear();
+    file.Close();
+  }
+
+  uint32_t ChunkCount() const {
+    return header.chunksX * header.chunksY;
+  }
+
+  const uint8_t* ChunkSource(uint32_t chunk) const {
+    return file.data + header.dataOffset + static_cast<uint64_t>(chunk) * header.chunkStride;
+  }
+
+  // Resident chunk data, or a view of nulls if the chunk is not resident
+  HexChunkView FindChunk(uint32_t chunk) const {
+    auto it = residentSlots.find(chunk);
+    if (it == residentSlots.end()) {
+      return {nullptr, nullptr, nullptr};
+    }
+
+    return GetHexChunkView(slotMemory + static_cast<size_t>(it->second) * header.chunkBytes);
+  }
+
+  // Load latency of a resident chunk, negative if not resident
+  float ChunkLoadMicroseconds(uint32_t chunk) const {
+    auto it = residentSlots.find(chunk);
+    return it == residentSlots.end() ? -1.0f : slotLoadMicroseconds[it->second];
+  }
+
+  // Makes the chunks within radiusChunks of the camera resident, nearest
+  // first, loading at most maxLoads of them. Chunks that do not fit the
+  // budget or the load cap are prefetched and picked up by later updates.
+  void Update(HexOffset camera, uint32_t radiusChunks, uint32_t maxLoads) {
+    updateIndex++;
+    evictable.clear();
+    stats.loads = 0;
+    stats.evictions = 0;
+    stats.deferred = 0;
+
+    int32_t cameraX = camera.col >> static_cast<int32_t>(g_HexChunkShift);
+    int32_t cameraY = camera.row >> static_cast<int32_t>(g_HexChunkShift);
+    int32_t radius = static_cast<int32_t>(radiusChunks);
+
+    wanted.clear();
+    for (int32_t y = std::max(0, cameraY - radius); y <= std::min<int32_t>(header.chunksY - 1, cameraY + radius); ++y) {
+      for (int32_t x = std::max(0, cameraX - radius); x <= std::min<int32_t>(header.chunksX - 1, cameraX + radius); ++x) {
+        uint32_t distance = static_cast<uint32_t>((x - cameraX) * (x - cameraX) + (y - cameraY) * (y - cameraY));
+        wanted.push_back({distance, static_cast<uint32_t>(y) * header.chunksX + static_cast<uint32_t>(x)});
+      }
+    }
+    std::sort(wanted.begin(), wanted.end());
+
+    // Everything wanted counts as used this update, so it is not evicted to
+    // make room for something further away
+    for (const auto& entry : wanted) {
+      auto it = residentSlots.find(entry.second);
+      if (it != residentSlots.end()) {
+        slotLastWanted[it->second] = updateIndex;
+      }
+    }
+
+    for (const auto& entry : wanted) {
+      uint32_t chunk = entry.second;
+      if (residentSlots.count(chunk)) {
+        continue;
+      }
+
+      uint32_t slot = stats.loads < maxLoads ? AcquireSlot() : g_InvalidTile;
+      if (slot == g_InvalidTile) {
+        file.Prefetch(header.dataOffset + static_cast<uint64_t>(chunk) * header.chunkStride, header.chunkBytes);
+        stats.deferred++;
+        continue;
+      }
+
+      auto t0 = std::chrono::steady_clock::now();
+      std::memcpy(slotMemory + static_cast<size_t>(slot) * header.chunkBytes, ChunkSource(chunk), header.chunkBytes);
+      std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - t0;
+
+      slotChunk[slot] = chunk;
+      slotLastWanted[slot] = updateIndex;
+      slotLoadMicroseconds[slot] = static_cast<float>(latency.count());
+      residentSlots[chunk] = slot;
+
+      stats.loads++;
+      stats.totalLoads++;
+      stats.lastLoadMicroseconds = latency.count();
+      stats.averageLoadMicroseconds += (latency.count() - stats.averageLoadMicroseconds) / stats.totalLoads;
+      stats.maxLoadMicroseconds = std::max(stats.maxLoadMicroseconds, latency.count());
+    }
+
+    stats.residentChunks = static_cast<uint32_t>(residentSlots.size());
+    stats.residentBytes = static_cast<uint64_t>(stats.residentChunks) * header.chunkBytes;
+  }
+
+  // A free slot, or the least recently wanted one that was not wanted by the
+  // current update. g_InvalidTile when the budget is exhausted.
+  uint32_t AcquireSlot() {
+    if (!freeSlots.empty()) {
+      uint32_t slot = freeSlots.back();
+      freeSlots.pop_back();
+      return slot;
+    }
+
+    // Candidates are collected once per update, oldest at the back
+    if (evictable.empty()) {
+      for (uint32_t slot = 0; slot < slotCount; ++slot) {
+        if (slotChunk[slot] != g_InvalidTile && slotLastWanted[slot] < updateIndex) {
+          evictable.push_back({slotLastWanted[slot], slot});
+        }
+      }
+      std::sort(evictable.begin(), evictable.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    }
+
+    if (evictable.empty()) {
+      return g_InvalidTile;
+    }
+
+    uint32_t victim = evictable.back().second;
+    evictable.pop_back();
+
+    residentSlots.erase(slotChunk[victim]);
+    slotChunk[victim] = g_InvalidTile;
+    stats.evictions++;
+
+    return victim;
+  }
+};
+
+#endif // _H_HEX_WORLD
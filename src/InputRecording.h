@@ -0,0 +1,284 @@
+#ifndef _H_INPUT_RECORDING
+#define _H_INPUT_RECORDING
+
+// Input recording - everything from outside that changes what the engine
+// does, as platform-neutral events, and a compact binary log of them. The
+// window procedure turns messages into events, and every frame adds a
+// frame event with its wall time. Feeding a log back frame by frame, with
+// the recorded frame times, repeats the session's work exactly, as fast
+// as the machine can go.
+//
+// Log layout: an InputLogHeader, then the events. An event is a byte with
+// the type in the low nibble and the modifiers in the high one, the frame
+// and time as varint deltas to the event before, then the type's payload
+// as varints. Cursor positions are zigzag deltas to the last position. A
+// frame of a session without input is about nine bytes, four of them the
+// frame time in nanoseconds.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Helpers.h"
+#include "MappedFile.h"
+
+const uint32_t g_InputLogMagic = 0x4E495848; // "HXIN"
+const uint32_t g_InputLogVersion = 1;
+
+enum class InputEventType : uint8_t {
+  Frame,     // End of the frame's input, frameNanoseconds is its wall time
+  KeyDown,
+  MouseMove,
+  Resize,    // New client area size in x, y
+  Quit,
+  Count
+};
+
+// Keys the engine reacts to. Letters and digits are their ASCII codes.
+enum InputKey : uint16_t {
+  InputKeyNone = 0,
+  InputKeyEscape = 0x100,
+  InputKeyEnter,
+  InputKeyF11
+};
+
+enum InputModifier : uint8_t {
+  InputModifierAlt = 1,
+  InputModifierShift = 2,
+  InputModifierControl = 4
+};
+
+struct InputEvent {
+  InputEventType type = InputEventType::Frame;
+  uint8_t modifiers = 0;          // InputModifier bits, key events
+  uint16_t key = InputKeyNone;    // Key events
+  int32_t x = 0;                  // Cursor position or client size
+  int32_t y = 0;
+  uint64_t frameNanoseconds = 0;  // Frame events
+  uint64_t frame = 0;             // Frame the event was handled in
+  uint64_t time = 0;              // Microseconds since the recording started
+};
+
+// What a replay needs to recreate the recorded workload
+struct InputLogHeader {
+  uint32_t magic;
+  uint32_t version;
+  int32_t screenWidth;
+  int32_t screenHeight;
+  uint32_t gridSize;
+  uint32_t reserved;
+  double tickRate;
+  uint64_t frames;
+  uint64_t events;
+  uint64_t simulationTicks; // At the end of the recording, to check a replay against
+  uint8_t padding[8];
+};
+
+static_assert(sizeof(InputLogHeader) == 64, "InputLogHeader is part of the log format");
+
+inline void WriteVarint(std::vector<uint8_t>& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+// False past the end of the data or on a varint longer than 64 bits
+inline bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    if (p == end) {
+      return false;
+    }
+    uint8_t byte = *p++;
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+struct InputRecorder {
+  bool recording = false;
+  std::vector<uint8_t> bytes; // Encoded events, the header is added on save
+  std::chrono::steady_clock::time_point start;
+  uint64_t frames = 0;
+  uint64_t events = 0;
+
+  // Delta coding state
+  uint64_t lastFrame = 0;
+  uint64_t lastTime = 0;
+  int32_t lastX = 0;
+  int32_t lastY = 0;
+
+  void Begin() {
+    recording = true;
+    bytes.clear();
+    start = std::chrono::steady_clock::now();
+    frames = events = 0;
+    lastFrame = lastTime = 0;
+    lastX = lastY = 0;
+  }
+
+  // Stamps the event with the time since Begin() and appends it
+  void Record(InputEvent event, uint64_t frame) {
+    if (!recording) {
+      return;
+    }
+
+    event.frame = frame;
+    event.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    Append(event);
+  }
+
+  // Appends an event that already carries its frame and time
+  void Append(const InputEvent& event) {
+    bytes.push_back(static_cast<uint8_t>(static_cast<uint8_t>(event.type) | (event.modifiers << 4)));
+    WriteVarint(bytes, event.frame - lastFrame);
+    WriteVarint(bytes, event.time >= lastTime ? event.time - lastTime : 0);
+    lastFrame = event.frame;
+    lastTime = event.time >= lastTime ? event.time : lastTime;
+
+    switch (event.type) {
+      case InputEventType::Frame:
+        WriteVarint(bytes, event.frameNanoseconds);
+        frames++;
+        break;
+      case InputEventType::KeyDown:
+        WriteVarint(bytes, event.key);
+        break;
+      case InputEventType::MouseMove:
+        WriteVarint(bytes, ZigZag(static_cast<int64_t>(event.x) - lastX));
+        WriteVarint(bytes, ZigZag(static_cast<int64_t>(event.y) - lastY));
+        lastX = event.x;
+        lastY = event.y;
+        break;
+      case InputEventType::Resize:
+        WriteVarint(bytes, static_cast<uint32_t>(event.x));
+        WriteVarint(bytes, static_cast<uint32_t>(event.y));
+        break;
+      default:
+        break;
+    }
+    events++;
+  }
+
+  // Writes the header and the events, through a temporary file
+  bool Save(const char* path, InputLogHeader header) const {
+    header.magic = g_InputLogMagic;
+    header.version = g_InputLogVersion;
+    header.frames = frames;
+    header.events = events;
+
+    std::vector<uint8_t> file(sizeof(header) + bytes.size());
+    std::memcpy(file.data(), &header, sizeof(header));
+    if (!bytes.empty()) {
+      std::memcpy(file.data() + sizeof(header), bytes.data(), bytes.size());
+    }
+    return WriteWholeFile(path, file.data(), file.size());
+  }
+};
+
+// Reads a log back event by event, straight from the mapped file
+struct InputReplay {
+  MappedFile file;
+  InputLogHeader header = {};
+  const uint8_t* cursor = nullptr;
+  const uint8_t* end = nullptr;
+  bool corrupt = false;
+  uint64_t events = 0;
+
+  // Delta decoding state
+  uint64_t lastFrame = 0;
+  uint64_t lastTime = 0;
+  int32_t lastX = 0;
+  int32_t lastY = 0;
+
+  // False if the file is missing, not a log of this version, or its header
+  // describes a workload the engine cannot run
+  bool Open(const char* path) {
+    if (!file.Open(path) || file.size < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, file.data, sizeof(header));
+    if (header.magic != g_InputLogMagic || header.version != g_InputLogVersion) {
+      return false;
+    }
+    if (!std::isfinite(header.tickRate) || header.tickRate <= 0.0 || header.gridSize == 0 ||
+        header.screenWidth <= 0 || header.screenHeight <= 0) {
+      return false;
+    }
+
+    return Open(file.data + sizeof(header), file.size - sizeof(header));
+  }
+
+  // Events without a header, from memory
+  bool Open(const uint8_t* data, size_t size) {
+    cursor = data;
+    end = data + size;
+    corrupt = false;
+    events = 0;
+    lastFrame = lastTime = 0;
+    lastX = lastY = 0;
+    return true;
+  }
+
+  // The next event, false at the end of the log or if it is corrupt
+  bool Next(InputEvent& event) {
+    if (cursor == end || corrupt) {
+      return false;
+    }
+
+    uint8_t typeByte = *cursor++;
+    event = {};
+    event.type = static_cast<InputEventType>(typeByte & 15);
+    event.modifiers = typeByte >> 4;
+
+    uint64_t frameDelta, timeDelta, a = 0, b = 0;
+    bool ok = event.type < InputEventType::Count && ReadVarint(cursor, end, frameDelta) && ReadVarint(cursor, end, timeDelta);
+    switch (ok ? event.type : InputEventType::Count) {
+      case InputEventType::Frame:
+        ok = ReadVarint(cursor, end, event.frameNanoseconds);
+        break;
+      case InputEventType::KeyDown:
+        ok = ReadVarint(cursor, end, a) && a <= UINT16_MAX;
+        event.key = static_cast<uint16_t>(a);
+        break;
+      case InputEventType::MouseMove:
+        ok = ReadVarint(cursor, end, a) && ReadVarint(cursor, end, b);
+        lastX = event.x = static_cast<int32_t>(lastX + UnZigZag(a));
+        lastY = event.y = static_cast<int32_t>(lastY + UnZigZag(b));
+        break;
+      case InputEventType::Resize:
+        ok = ReadVarint(cursor, end, a) && ReadVarint(cursor, end, b);
+        event.x = static_cast<int32_t>(a);
+        event.y = static_cast<int32_t>(b);
+        break;
+      default:
+        break;
+    }
+    if (!ok) {
+      corrupt = true;
+      return false;
+    }
+
+    lastFrame = event.frame = lastFrame + frameDelta;
+    lastTime = event.time = lastTime + timeDelta;
+    events++;
+    return true;
+  }
+};
+
+#endif // _H_INPUT_RECORDING
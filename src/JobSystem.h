@@ -0,0 +1,303 @@
+#ifndef _H_JOB_SYSTEM
+#define _H_JOB_SYSTEM
+
+// Job system - a fixed pool of worker threads, each with its own deque. A
+// thread pushes and pops its own deque at the back and steals from the front
+// of the others when it runs dry. Completion is tracked with counters: Wait()
+// keeps executing jobs until the counter drops to zero, and jobs can be
+// queued behind a counter so they only start once it reaches zero.
+//
+// Jobs are plain function pointers plus a range, nothing is allocated per job.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+typedef void (*JobFunction)(void* data, uint32_t begin, uint32_t end);
+
+struct JobCounter;
+
+struct Job {
+  JobFunction function;
+  void* data;
+  uint32_t begin;
+  uint32_t end;
+  JobCounter* counter; // Decremented when the job finishes, may be null
+};
+
+// Number of unfinished jobs, plus the jobs waiting for it to reach zero
+struct JobCounter {
+  std::atomic<uint32_t> pending{0};
+  std::mutex mutex;
+  std::vector<Job> continuations;
+
+  bool IsDone() const {
+    return pending.load(std::memory_order_acquire) == 0;
+  }
+};
+
+// Fixed capacity deque, the owner works at the back and thieves at the front
+struct JobQueue {
+  static const uint32_t Capacity = 4096;
+
+  std::mutex mutex;
+  Job jobs[Capacity];
+  uint32_t head = 0; // Front, oldest job
+  uint32_t count = 0;
+
+  bool Push(const Job& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count == Capacity) {
+      return false;
+    }
+
+    jobs[(head + count) % Capacity] = job;
+    count++;
+    return true;
+  }
+
+  bool Pop(Job& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count == 0) {
+      return false;
+    }
+
+    count--;
+    job = jobs[(head + count) % Capacity];
+    return true;
+  }
+
+  bool Steal(Job& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count == 0) {
+      return false;
+    }
+
+    job = jobs[head];
+    head = (head + 1) % Capacity;
+    count--;
+    return true;
+  }
+};
+
+// Index of the calling thread's queue. Threads that are not workers share
+// queue 0 with the thread that started the job system.
+inline thread_local uint32_t t_JobWorkerIndex = 0;
+
+struct JobSystem {
+  std::vector<std::thread> threads;
+  std::vector<JobQueue*> queues;
+  std::atomic<uint32_t> queuedJobs{0};
+  std::atomic<bool> quitting{false};
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+
+  JobSystem() = default;
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  ~JobSystem() {
+    Stop();
+  }
+
+  // Starts workerCount - 1 threads, the calling thread is worker 0.
+  // workerCount 0 uses every hardware thread.
+  void Start(uint32_t workerCount) {
+    Stop();
+
+    if (workerCount == 0) {
+      workerCount = std::thread::hardware_concurrency();
+    }
+    workerCount = workerCount ? workerCount : 1;
+
+    quitting = false;
+    for (uint32_t i = 0; i < workerCount; ++i) {
+      queues.push_back(new JobQueue());
+    }
+
+    t_JobWorkerIndex = 0;
+    for (uint32_t i = 1; i < workerCount; ++i) {
+      threads.emplace_back([this, i]() { WorkerMain(i); });
+    }
+  }
+
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      quitting = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+
+    for (JobQueue* queue : queues) {
+      delete queue;
+    }
+    queues.clear();
+  }
+
+  uint32_t WorkerCount() const {
+    return static_cast<uint32_t>(queues.size());
+  }
+
+  // Queues one job. With a dependency the job is held back until the
+  // dependency counter reaches zero.
+  void Run(JobFunction function, void* data, uint32_t begin, uint32_t end, JobCounter* counter, JobCounter* dependency = nullptr) {
+    Job job = {function, data, begin, end, counter};
+    if (counter) {
+      counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (dependency) {
+      std::lock_guard<std::mutex> lock(dependency->mutex);
+      if (!dependency->IsDone()) {
+        dependency->continuations.push_back(job);
+        return;
+      }
+    }
+
+    Submit(job);
+  }
+
+  // Executes queued jobs until the counter reaches zero
+  void Wait(JobCounter& counter) {
+    while (!counter.IsDone()) {
+      Job job;
+      if (FindJob(job)) {
+        Execute(job);
+      }
+      else {
+        std::this_thread::yield();
+      }
+    }
+
+    // The last job may still be holding the counter's lock
+    std::lock_guard<std::mutex> lock(counter.mutex);
+  }
+
+  // Calls body(begin, end) over [begin, end) split into pieces of at least
+  // `grain` elements, and returns when all of them are done
+  template <typename Body>
+  void ParallelFor(uint32_t begin, uint32_t end, uint32_t grain, Body&& body) {
+    if (end <= begin) {
+      return;
+    }
+
+    uint32_t count = end - begin;
+    grain = grain ? grain : 1;
+    uint32_t pieces = (count + grain - 1) / grain;
+    uint32_t maxPieces = WorkerCount() * 4;
+    pieces = pieces < maxPieces ? pieces : maxPieces;
+
+    if (pieces <= 1) {
+      body(begin, end);
+      return;
+    }
+
+    JobCounter counter;
+    uint32_t pieceSize = (count + pieces - 1) / pieces;
+    for (uint32_t pieceBegin = begin + pieceSize; pieceBegin < end; pieceBegin += pieceSize) {
+      uint32_t pieceEnd = end - pieceBegin < pieceSize ? end : pieceBegin + pieceSize;
+      Run(&ParallelForTrampoline<typename std::remove_reference<Body>::type>, &body, pieceBegin, pieceEnd, &counter);
+    }
+
+    // The caller takes the first piece itself
+    body(begin, begin + pieceSize < end ? begin + pieceSize : end);
+    Wait(counter);
+  }
+
+  template <typename Body>
+  static void ParallelForTrampoline(void* data, uint32_t begin, uint32_t end) {
+    (*static_cast<Body*>(data))(begin, end);
+  }
+
+  void Submit(const Job& job) {
+    if (queues.empty() || !queues[t_JobWorkerIndex % queues.size()]->Push(job)) {
+      // No pool or a full queue, run it right here
+      Execute(job);
+      return;
+    }
+
+    queuedJobs.fetch_add(1, std::memory_order_release);
+    if (threads.size()) {
+      // Taking the lock orders this with a worker that is about to sleep
+      { std::lock_guard<std::mutex> lock(sleepMutex); }
+      wake.notify_one();
+    }
+  }
+
+  bool FindJob(Job& job) {
+    uint32_t queueCount = WorkerCount();
+    if (queueCount == 0) {
+      return false;
+    }
+
+    uint32_t self = t_JobWorkerIndex % queueCount;
+    if (queues[self]->Pop(job)) {
+      queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    for (uint32_t i = 1; i < queueCount; ++i) {
+      if (queues[(self + i) % queueCount]->Steal(job)) {
+        queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void Execute(const Job& job) {
+    job.function(job.data, job.begin, job.end);
+
+    JobCounter* counter = job.counter;
+    if (!counter) {
+      return;
+    }
+
+    // The counter is only touched under its lock, Wait() takes the same lock
+    // before returning so the counter can live on the waiter's stack
+    std::vector<Job> ready;
+    {
+      std::lock_guard<std::mutex> lock(counter->mutex);
+      if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        ready.swap(counter->continuations);
+      }
+    }
+
+    for (const Job& continuation : ready) {
+      Submit(continuation);
+    }
+  }
+
+  void WorkerMain(uint32_t index) {
+    t_JobWorkerIndex = index;
+
+    while (true) {
+      Job job;
+      if (FindJob(job)) {
+        Execute(job);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this]() { return quitting.load() || queuedJobs.load(std::memory_order_acquire) > 0; });
+      if (quitting) {
+        return;
+      }
+    }
+  }
+};
+
+// The engine's job system, started by the executables
+inline JobSystem g_JobSystem;
+
+#endif // _H_JOB_SYSTEM
@@ -0,0 +1,490 @@
+#ifndef _H_LOCKSTEP
+#define _H_LOCKSTEP
+
+// Lockstep simulation - the hex world and its ships advanced in fixed ticks
+// that give the same bits for the same commands, whatever the instruction
+// set or thread count. Replays and peers only exchange commands and check
+// that their per-tick checksums agree.
+//
+// The simulated state is two plain data arenas: the tile flags of the grid
+// and the ship store's block. Terrain heights and materials are content
+// that every peer loads, they are hashed once and folded into every
+// checksum instead of being copied around. A snapshot is a memcpy of the
+// two arenas plus a small header, and restoring one is the reverse.
+//
+// A ring of recent snapshots makes rollback cheap: a command that arrives
+// for a tick already simulated goes into the command log, the world is
+// restored to the last snapshot before that tick and resimulated to the
+// present. Deltas between two snapshots XOR them page by page and LZ
+// compress the pages that changed, for sending state over the wire or
+// storing it in a replay.
+//
+// Checksums hash the arenas in pages on the job system and then hash the
+// page hashes in order, so the value does not depend on how the pages were
+// spread over the workers. Words are read little-endian.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "Compression.h"
+#include "Helpers.h"
+#include "HexGrid.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Ships.h"
+#include "Simd.h"
+
+const uint8_t g_HexFlagCharted = 0x01;  // A ship has sailed over the tile
+const uint32_t g_LockstepHistory = 8;   // Snapshots kept for rollback
+const size_t g_LockstepPage = 16384;    // Unit of checksums and deltas
+
+// Word-at-a-time hash of simulation state, several times faster than
+// HashBytes. Four independent lanes so the multiplies overlap.
+inline uint64_t LockstepHash(const void* data, size_t size, uint64_t seed = 0) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t lanes[4] = {seed ^ 0x243F6A8885A308D3ull, seed ^ 0x13198A2E03707344ull, seed ^ 0xA4093822299F31D0ull, seed ^ 0x082EFA98EC4E6C89ull};
+
+  auto mix = [&](const uint8_t* block) {
+    for (int lane = 0; lane < 4; ++lane) {
+      uint64_t word;
+      std::memcpy(&word, block + lane * 8, 8);
+      uint64_t h = (lanes[lane] ^ word) * 0x9E3779B97F4A7C15ull;
+      lanes[lane] = h ^ (h >> 32);
+    }
+  };
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    mix(bytes + i);
+  }
+  if (i < size) {
+    uint8_t tail[32] = {};
+    std::memcpy(tail, bytes + i, size - i);
+    mix(tail);
+  }
+
+  uint64_t hash = size;
+  for (int lane = 0; lane < 4; ++lane) {
+    hash = (hash ^ lanes[lane]) * 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 31;
+  }
+  return hash;
+}
+
+enum LockstepCommandType : uint32_t {
+  LockstepLaunch, // Creates a ship from launch
+  LockstepSink,   // Destroys ship
+  LockstepSteer   // Sends ship to launch.x, launch.z
+};
+
+// Input of the simulation. Commands of a tick are applied before its ships
+// move, in the order they were added.
+struct LockstepCommand {
+  uint64_t tick = 0;
+  LockstepCommandType type = LockstepLaunch;
+  ShipHandle ship = g_InvalidShip;
+  ShipDesc launch;
+};
+
+struct LockstepSnapshotHeader {
+  uint64_t tick;
+  uint64_t checksum;
+  uint64_t tileBytes;
+  uint64_t shipBytes;
+  uint32_t shipCount;
+  uint32_t shipCapacity;
+  uint32_t slotCount;
+  uint32_t freeCount;
+};
+
+// The arenas of one tick, tile flags then the ship block
+struct LockstepSnapshot {
+  LockstepSnapshotHeader header = {};
+  uint8_t* data = nullptr;
+  size_t size = 0;
+  size_t allocated = 0;
+  bool valid = false;
+
+  LockstepSnapshot() = default;
+  LockstepSnapshot(const LockstepSnapshot&) = delete;
+  LockstepSnapshot& operator=(const LockstepSnapshot&) = delete;
+
+  ~LockstepSnapshot() {
+    if (data) {
+      AlignedFree(data);
+    }
+  }
+
+  // Contents are undefined after a resize that grows the buffer
+  void Resize(size_t newSize) {
+    if (newSize > allocated) {
+      if (data) {
+        AlignedFree(data);
+      }
+      data = static_cast<uint8_t*>(AlignedAlloc(newSize));
+      allocated = newSize;
+    }
+    size = newSize;
+  }
+};
+
+// A snapshot as the pages that differ from a base snapshot, each an LZ
+// block of the target XOR the base. Bytes past the end of the base count as
+// zero.
+struct LockstepDelta {
+  LockstepSnapshotHeader header = {}; // Of the target
+  uint64_t baseTick = 0;
+  std::vector<uint32_t> pages;   // Changed pages, ascending
+  std::vector<uint32_t> ends;    // End of each page's block in data
+  std::vector<uint8_t> data;
+
+  size_t Bytes() const {
+    return sizeof(header) + sizeof(baseTick) + pages.size() * 2 * sizeof(uint32_t) + data.size();
+  }
+};
+
+inline void EncodeLockstepDelta(const LockstepSnapshot& base, const LockstepSnapshot& target, LockstepDelta& delta) {
+  PROFILE_ZONE("EncodeLockstepDelta");
+
+  delta.header = target.header;
+  delta.baseTick = base.header.tick;
+  delta.pages.clear();
+  delta.ends.clear();
+  delta.data.clear();
+
+  uint8_t page[g_LockstepPage];
+  uint32_t pageCount = static_cast<uint32_t>((target.size + g_LockstepPage - 1) / g_LockstepPage);
+  for (uint32_t i = 0; i < pageCount; ++i) {
+    size_t begin = i * g_LockstepPage;
+    size_t size = std::min(g_LockstepPage, target.size - begin);
+    size_t shared = begin < base.size ? std::min(size, base.size - begin) : 0;
+    if (shared == size && std::memcmp(target.data + begin, base.data + begin, size) == 0) {
+      continue;
+    }
+
+    for (size_t j = 0; j < shared; ++j) {
+      page[j] = target.data[begin + j] ^ base.data[begin + j];
+    }
+    std::memcpy(page + shared, target.data + begin + shared, size - shared);
+
+    size_t offset = delta.data.size();
+    delta.data.resize(offset + LzCompressBound(size));
+    size_t compressed = LzCompress(page, size, delta.data.data() + offset);
+    delta.data.resize(offset + compressed);
+    delta.pages.push_back(i);
+    delta.ends.push_back(static_cast<uint32_t>(delta.data.size()));
+  }
+}
+
+// Rebuilds the target of a delta from its base into another snapshot.
+// False if the delta was made against another snapshot or is corrupt.
+inline bool DecodeLockstepDelta(const LockstepSnapshot& base, const LockstepDelta& delta, LockstepSnapshot& out) {
+  PROFILE_ZONE("DecodeLockstepDelta");
+  assert(&out != &base);
+
+  if (!base.valid || base.header.tick != delta.baseTick || delta.pages.size() != delta.ends.size()) {
+    return false;
+  }
+
+  size_t size = delta.header.tileBytes + delta.header.shipBytes;
+  out.Resize(size);
+  out.header = delta.header;
+  out.valid = false;
+  size_t shared = std::min(size, base.size);
+  std::memcpy(out.data, base.data, shared);
+  std::memset(out.data + shared, 0, size - shared);
+
+  uint8_t page[g_LockstepPage];
+  uint32_t blockBegin = 0;
+  for (size_t i = 0; i < delta.pages.size(); ++i) {
+    size_t begin = static_cast<size_t>(delta.pages[i]) * g_LockstepPage;
+    uint32_t blockEnd = delta.ends[i];
+    if (begin >= size || blockEnd < blockBegin || blockEnd > delta.data.size()) {
+      return false;
+    }
+
+    size_t pageSize = std::min(g_LockstepPage, size - begin);
+    if (!LzDecompress(delta.data.data() + blockBegin, blockEnd - blockBegin, page, pageSize)) {
+      return false;
+    }
+    for (size_t j = 0; j < pageSize; ++j) {
+      out.data[begin + j] ^= page[j];
+    }
+    blockBegin = blockEnd;
+  }
+
+  out.valid = true;
+  return true;
+}
+
+struct LockstepStats {
+  uint64_t ticks = 0;             // Including resimulated ones
+  uint64_t resimulatedTicks = 0;
+  uint64_t rollbacks = 0;
+  uint64_t lateCommands = 0;
+  uint64_t droppedCommands = 0;   // Too late to roll back for
+  double lastTickMicroseconds = 0.0;
+  double lastSnapshotMicroseconds = 0.0;
+  double lastChecksumMicroseconds = 0.0;
+  double maxRollbackMicroseconds = 0.0;
+};
+
+struct LockstepWorld {
+  HexGrid grid;
+  ShipStore ships;
+  ShipParams params;
+  float dt = 1.0f / 60.0f;
+  SimdLevel level = GetSimdLevel();
+  uint32_t snapshotInterval = 1;           // Ticks between history snapshots
+  uint64_t tick = 0;
+  uint64_t terrainHash = 0;
+  std::vector<LockstepCommand> commands;   // By tick
+  std::vector<uint64_t> checksums;         // Of the state at every tick so far
+  std::vector<uint64_t> pageHashes;
+  LockstepSnapshot history[g_LockstepHistory];
+  LockstepStats stats;
+  uint64_t frontier = 0;                   // Latest tick ever reached
+
+  // Takes over the map, without ships, at tick 0
+  void Init(HexGrid&& world, const ShipParams& shipParams, float tickSeconds, JobSystem& jobs) {
+    grid = std::move(world);
+    params = shipParams;
+    dt = tickSeconds;
+    tick = 0;
+    frontier = 0;
+    ships.count = ships.slotCount = ships.freeCount = 0;
+    ships.tick = 0;
+    ships.SetCapacity(g_ShipBlock);
+    commands.clear();
+    checksums.clear();
+    for (LockstepSnapshot& snapshot : history) {
+      snapshot.valid = false;
+    }
+    stats = {};
+
+    size_t tiles = grid.TileCount();
+    terrainHash = LockstepHash(grid.heights, tiles * sizeof(float), LockstepHash(grid.materials, tiles));
+    checksums.push_back(Checksum(jobs));
+  }
+
+  // Simulates one tick
+  void Tick(JobSystem& jobs) {
+    PROFILE_ZONE("LockstepTick");
+
+    auto t0 = std::chrono::steady_clock::now();
+    if (tick % snapshotInterval == 0) {
+      Snapshot(history[(tick / snapshotInterval) % g_LockstepHistory], jobs);
+    }
+
+    ApplyCommands();
+    StepShips(ships, params, dt, jobs, level);
+    ChartTiles();
+    tick++;
+    stats.resimulatedTicks += tick <= frontier ? 1 : 0;
+    frontier = std::max(frontier, tick);
+
+    checksums.resize(tick);
+    checksums.push_back(Checksum(jobs));
+
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - t0;
+    stats.lastTickMicroseconds = elapsed.count();
+    stats.ticks++;
+  }
+
+  // Adds a command. One for a tick that already ran rolls the world back
+  // and resimulates it; false if that tick is older than the history.
+  bool AddCommand(const LockstepCommand& command, JobSystem& jobs) {
+    if (command.tick < tick && !CanRollback(command.tick)) {
+      stats.droppedCommands++;
+      return false;
+    }
+
+    auto at = std::upper_bound(commands.begin(), commands.end(), command.tick,
+        [](uint64_t t, const LockstepCommand& c) { return t < c.tick; });
+    commands.insert(at, command);
+
+    if (command.tick < tick) {
+      stats.lateCommands++;
+      uint64_t now = tick;
+      auto t0 = std::chrono::steady_clock::now();
+      Rollback(command.tick, jobs);
+      Resimulate(now, jobs);
+      std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - t0;
+      stats.maxRollbackMicroseconds = std::max(stats.maxRollbackMicroseconds, elapsed.count());
+    }
+    return true;
+  }
+
+  bool CanRollback(uint64_t toTick) const {
+    return FindHistory(toTick) != nullptr;
+  }
+
+  // Goes back to an earlier tick through the last snapshot before it.
+  // Snapshots after it are dropped, they may not hold anymore.
+  bool Rollback(uint64_t toTick, JobSystem& jobs) {
+    const LockstepSnapshot* snapshot = FindHistory(toTick);
+    if (!snapshot) {
+      return false;
+    }
+
+    Restore(*snapshot);
+    for (LockstepSnapshot& later : history) {
+      later.valid &= later.header.tick <= tick;
+    }
+    stats.rollbacks++;
+
+    Resimulate(toTick, jobs);
+    return true;
+  }
+
+  // Simulates up to a later tick with the logged commands
+  void Resimulate(uint64_t toTick, JobSystem& jobs) {
+    while (tick < toTick) {
+      Tick(jobs);
+    }
+  }
+
+  void Snapshot(LockstepSnapshot& out, JobSystem& jobs) {
+    PROFILE_ZONE("LockstepSnapshot");
+
+    auto t0 = std::chrono::steady_clock::now();
+    size_t tileBytes = grid.TileCount();
+    out.Resize(tileBytes + ships.blockSize);
+    out.header = {tick, checksums.size() > tick ? checksums[tick] : 0, tileBytes, ships.blockSize,
+        ships.count, ships.capacity, ships.slotCount, ships.freeCount};
+
+    ForEachPage(jobs, [&](const uint8_t* source, size_t offset, size_t size) {
+      std::memcpy(out.data + offset, source, size);
+    });
+    out.valid = true;
+
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - t0;
+    stats.lastSnapshotMicroseconds = elapsed.count();
+  }
+
+  // False if the snapshot is of another map
+  bool Restore(const LockstepSnapshot& snapshot) {
+    PROFILE_ZONE("LockstepRestore");
+
+    const LockstepSnapshotHeader& header = snapshot.header;
+    if (!snapshot.valid || header.tileBytes != grid.TileCount() || header.tileBytes + header.shipBytes != snapshot.size) {
+      return false;
+    }
+
+    if (ships.capacity != header.shipCapacity) {
+      ships.count = ships.slotCount = ships.freeCount = 0;
+      ships.SetCapacity(header.shipCapacity);
+    }
+    assert(ships.blockSize == header.shipBytes);
+
+    std::memcpy(grid.flags, snapshot.data, header.tileBytes);
+    std::memcpy(ships.block, snapshot.data + header.tileBytes, header.shipBytes);
+    ships.count = header.shipCount;
+    ships.slotCount = header.slotCount;
+    ships.freeCount = header.freeCount;
+    ships.tick = header.tick;
+    tick = header.tick;
+    checksums.resize(tick + 1);
+    checksums[tick] = header.checksum;
+    return true;
+  }
+
+  // Hash of the whole simulated state
+  uint64_t Checksum(JobSystem& jobs) {
+    PROFILE_ZONE("LockstepChecksum");
+
+    auto t0 = std::chrono::steady_clock::now();
+    pageHashes.resize(PageCount());
+    ForEachPage(jobs, [&](const uint8_t* source, size_t offset, size_t size) {
+      uint64_t& page = pageHashes[offset / g_LockstepPage];
+      page = LockstepHash(source, size, offset % g_LockstepPage ? page : 0);
+    });
+
+    uint64_t scalars[6] = {tick, terrainHash, ships.count, ships.capacity, ships.slotCount, ships.freeCount};
+    uint64_t hash = LockstepHash(pageHashes.data(), pageHashes.size() * sizeof(uint64_t), LockstepHash(scalars, sizeof(scalars)));
+
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - t0;
+    stats.lastChecksumMicroseconds = elapsed.count();
+    return hash;
+  }
+
+private:
+  const LockstepSnapshot* FindHistory(uint64_t toTick) const {
+    const LockstepSnapshot* best = nullptr;
+    for (const LockstepSnapshot& snapshot : history) {
+      if (snapshot.valid && snapshot.header.tick <= toTick && (!best || snapshot.header.tick > best->header.tick)) {
+        best = &snapshot;
+      }
+    }
+    return best;
+  }
+
+  // Pages of both arenas, numbered as if the ship block followed the tiles
+  uint32_t PageCount() const {
+    return static_cast<uint32_t>((grid.TileCount() + ships.blockSize + g_LockstepPage - 1) / g_LockstepPage);
+  }
+
+  // Calls visit(source, arena offset, size) for every page, on the job
+  // system. A page at the seam is visited in two parts, in order.
+  template <typename Visit>
+  void ForEachPage(JobSystem& jobs, Visit&& visit) {
+    size_t tileBytes = grid.TileCount();
+    size_t total = tileBytes + ships.blockSize;
+
+    jobs.ParallelFor(0, PageCount(), 8, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t page = begin; page < end; ++page) {
+        size_t offset = page * g_LockstepPage;
+        size_t pageEnd = std::min(offset + g_LockstepPage, total);
+        if (offset < tileBytes) {
+          size_t split = std::min(pageEnd, tileBytes);
+          visit(grid.flags + offset, offset, split - offset);
+          offset = split;
+        }
+        if (offset < pageEnd) {
+          visit(ships.block + (offset - tileBytes), offset, pageEnd - offset);
+        }
+      }
+    });
+  }
+
+  void ApplyCommands() {
+    auto at = std::lower_bound(commands.begin(), commands.end(), tick,
+        [](const LockstepCommand& c, uint64_t t) { return c.tick < t; });
+    for (; at != commands.end() && at->tick == tick; ++at) {
+      switch (at->type) {
+        case LockstepLaunch:
+          ships.Create(at->launch);
+          break;
+        case LockstepSink:
+          ships.Destroy(at->ship);
+          break;
+        case LockstepSteer: {
+          uint32_t i = ships.Find(at->ship);
+          if (i != UINT32_MAX) {
+            ships.targetX[i] = at->launch.x;
+            ships.targetZ[i] = at->launch.z;
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  // Marks the tiles under the ships. Ships share tiles, so this runs on one
+  // thread after the ship systems.
+  void ChartTiles() {
+    for (uint32_t i = 0; i < ships.count; ++i) {
+      uint32_t index = grid.IndexChecked(AxialToOffset({ships.cellQ[i], ships.cellR[i]}));
+      if (index != g_InvalidTile) {
+        grid.flags[index] |= g_HexFlagCharted;
+      }
+    }
+  }
+};
+
+#endif // _H_LOCKSTEP
@@ -0,0 +1,137 @@
+#ifndef _H_MAPPED_FILE
+#define _H_MAPPED_FILE
+
+// Read-only memory-mapped file. Opening only maps the file - nothing is read
+// until the pages are touched, so the cost does not depend on the file size.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Helpers.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct MappedFile {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+
+#if defined(_WIN32)
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = NULL;
+#else
+  int fd = -1;
+#endif
+
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    Close();
+  }
+
+  bool IsOpen() const {
+    return data != nullptr;
+  }
+
+  bool Open(const char* path) {
+    Close();
+
+#if defined(_WIN32)
+    file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    if (!::GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+      Close();
+      return false;
+    }
+
+    mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+      Close();
+      return false;
+    }
+
+    data = static_cast<const uint8_t*>(::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat fileStat = {};
+    if (::fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+      Close();
+      return false;
+    }
+
+    void* view = ::mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    data = view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+    if (data == nullptr) {
+      Close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void Close() {
+#if defined(_WIN32)
+    if (data) {
+      ::UnmapViewOfFile(data);
+    }
+    if (mapping != NULL) {
+      ::CloseHandle(mapping);
+      mapping = NULL;
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      ::CloseHandle(file);
+      file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (data) {
+      ::munmap(const_cast<uint8_t*>(data), size);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+#endif
+    data = nullptr;
+    size = 0;
+  }
+
+  // Hints the OS to start reading a range in the background
+  void Prefetch(size_t offset, size_t length) const {
+    if (offset >= size) {
+      return;
+    }
+    length = length < size - offset ? length : size - offset;
+
+#if defined(_WIN32)
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range = {const_cast<uint8_t*>(data + offset), length};
+    ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+    // madvise wants a page aligned start
+    size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t alignedOffset = offset & ~(pageSize - 1);
+    ::madvise(const_cast<uint8_t*>(data + alignedOffset), length + (offset - alignedOffset), MADV_WILLNEED);
+#endif
+  }
+};
+
+#endif // _H_MAPPED_FILE
@@ -0,0 +1,216 @@
+#ifndef _H_PIPELINE_CACHE
+#define _H_PIPELINE_CACHE
+
+// Pipeline state cache. Creating a pipeline makes the driver compile the
+// shaders for the GPU, which is the slow part of startup. The renderer keys
+// every pipeline by a hash of its description and keeps the driver's
+// compiled blob under that key. The cache is saved to disk, so the next
+// launch hands the blob back to the driver and skips the compile.
+//
+// The file belongs to one adapter and driver: the header carries a device
+// key, and a cache written for another device is dropped on load. A blob the
+// driver still rejects is erased and its pipeline created from scratch.
+//
+// File layout: header, blobs at 16-byte aligned offsets, then a table of
+// contents sorted by key.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "Helpers.h"
+#include "MappedFile.h"
+
+const uint32_t g_PipelineCacheMagic = 0x434F5350; // "PSOC"
+const uint32_t g_PipelineCacheVersion = 1;
+
+struct PipelineCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t deviceKey;
+  uint32_t entryCount;
+  uint32_t reserved;
+  uint64_t tocOffset;
+};
+
+static_assert(sizeof(PipelineCacheHeader) == 32, "PipelineCacheHeader is part of the file format");
+
+struct PipelineCacheEntry {
+  uint64_t key;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t contentHash;
+};
+
+static_assert(sizeof(PipelineCacheEntry) == 32, "PipelineCacheEntry is part of the file format");
+
+// Builds a pipeline key field by field. Descriptions are full of pointers,
+// so callers add what the pointers point at - shader bytecode hashes,
+// input layout elements, semantic names - never the pointers themselves.
+struct PipelineHasher {
+  uint64_t hash = HashBytes(nullptr, 0);
+
+  // Plain structs only, and only ones without padding. Padding bytes of a
+  // copied struct are indeterminate and would change the key between runs,
+  // hash such structs member by member.
+  template <typename T>
+  void Add(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value && !std::is_pointer<T>::value, "Hash the pointed-to data instead");
+    static_assert(std::has_unique_object_representations<T>::value, "Hash structs with padding or floats member by member");
+    hash = HashBytes(&value, sizeof(value), hash);
+  }
+
+  // By its bits, so 0.0 and -0.0 give different keys like the driver sees them
+  void Add(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    Add(bits);
+  }
+
+  void AddBytes(const void* data, size_t size) {
+    Add(static_cast<uint64_t>(size));
+    hash = HashBytes(data, size, hash);
+  }
+
+  void AddString(const char* text) {
+    AddBytes(text, text ? std::strlen(text) : 0);
+  }
+};
+
+struct PipelineCacheStats {
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  uint32_t rejected = 0; // Blobs the driver refused
+  uint32_t stored = 0;
+};
+
+struct PipelineCache {
+  uint64_t deviceKey = 0;
+  std::unordered_map<uint64_t, std::vector<uint8_t>> blobs;
+  PipelineCacheStats stats;
+  bool dirty = false;
+
+  // Loads the cache for a device. A missing, damaged or foreign file leaves
+  // an empty cache and returns false.
+  bool Load(const char* path, uint64_t device) {
+    Reset(device);
+
+    MappedFile file;
+    if (!file.Open(path)) {
+      return false;
+    }
+    return Deserialize(file.data, file.size);
+  }
+
+  bool Deserialize(const uint8_t* data, size_t size) {
+    uint64_t device = deviceKey;
+    Reset(device);
+    if (size < sizeof(PipelineCacheHeader)) {
+      return false;
+    }
+
+    const PipelineCacheHeader* header = reinterpret_cast<const PipelineCacheHeader*>(data);
+    if (header->magic != g_PipelineCacheMagic || header->version != g_PipelineCacheVersion || header->deviceKey != device) {
+      return false;
+    }
+    if (header->tocOffset % 8 != 0 || header->tocOffset > size ||
+        (size - header->tocOffset) / sizeof(PipelineCacheEntry) < header->entryCount) {
+      return false;
+    }
+
+    const PipelineCacheEntry* entries = reinterpret_cast<const PipelineCacheEntry*>(data + header->tocOffset);
+    for (uint32_t i = 0; i < header->entryCount; ++i) {
+      const PipelineCacheEntry& entry = entries[i];
+      if (entry.offset > header->tocOffset || entry.size > header->tocOffset - entry.offset ||
+          HashBytes(data + entry.offset, entry.size) != entry.contentHash) {
+        Reset(device);
+        return false;
+      }
+      blobs[entry.key].assign(data + entry.offset, data + entry.offset + entry.size);
+    }
+
+    return true;
+  }
+
+  void Reset(uint64_t device) {
+    deviceKey = device;
+    blobs.clear();
+    dirty = false;
+  }
+
+  // The stored blob for key, or null
+  const std::vector<uint8_t>* Find(uint64_t key) {
+    auto found = blobs.find(key);
+    if (found == blobs.end()) {
+      stats.misses++;
+      return nullptr;
+    }
+    stats.hits++;
+    return &found->second;
+  }
+
+  void Store(uint64_t key, const void* data, size_t size) {
+    blobs[key].assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+    stats.stored++;
+    dirty = true;
+  }
+
+  // Drops a blob the driver refused to use
+  void Reject(uint64_t key) {
+    blobs.erase(key);
+    stats.rejected++;
+    dirty = true;
+  }
+
+  // Keys are written in order, the same cache always gives the same file
+  void Serialize(std::vector<uint8_t>& out) const {
+    std::vector<uint64_t> keys;
+    keys.reserve(blobs.size());
+    for (const auto& blob : blobs) {
+      keys.push_back(blob.first);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    PipelineCacheHeader header = {};
+    header.magic = g_PipelineCacheMagic;
+    header.version = g_PipelineCacheVersion;
+    header.deviceKey = deviceKey;
+    header.entryCount = static_cast<uint32_t>(keys.size());
+
+    out.assign(sizeof(header), 0);
+    std::vector<PipelineCacheEntry> entries;
+    for (uint64_t key : keys) {
+      const std::vector<uint8_t>& blob = blobs.at(key);
+      out.resize((out.size() + 15) & ~static_cast<size_t>(15));
+      entries.push_back({key, out.size(), blob.size(), HashBytes(blob.data(), blob.size())});
+      out.insert(out.end(), blob.begin(), blob.end());
+    }
+
+    out.resize((out.size() + 7) & ~static_cast<size_t>(7));
+    header.tocOffset = out.size();
+    std::memcpy(out.data(), &header, sizeof(header));
+    out.insert(out.end(), reinterpret_cast<const uint8_t*>(entries.data()),
+        reinterpret_cast<const uint8_t*>(entries.data() + entries.size()));
+  }
+
+  // Writes the cache if anything changed since it was loaded or saved
+  bool Save(const char* path) {
+    if (!dirty) {
+      return true;
+    }
+
+    std::vector<uint8_t> bytes;
+    Serialize(bytes);
+    if (!WriteWholeFile(path, bytes.data(), bytes.size())) {
+      return false;
+    }
+    dirty = false;
+    return true;
+  }
+};
+
+#endif // _H_PIPELINE_CACHE
@@ -0,0 +1,289 @@
+#ifndef _H_PROFILER
+#define _H_PROFILER
+
+// Profiler - scoped CPU zones, frame times and fence-based GPU timing.
+//
+// Every thread writes its zones into its own ring buffer, so recording a
+// zone is two timestamps and a store with no locks. Timestamps are RDTSC on
+// x86 and steady_clock elsewhere, converted to microseconds only when the
+// data is read. Reading (percentiles, trace export) is meant to happen
+// between frames - it does not stop threads that are still recording.
+//
+// Counters are named values sampled once per frame from the frame loop
+// thread, exported as graphs in the trace.
+//
+// Build with PROFILER_ENABLED=0 to compile every zone out.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "Simd.h"
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+inline uint64_t ProfilerTicks() {
+#if SIMD_X86
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+struct ProfileEvent {
+  const char* name; // Must be a string literal or otherwise outlive the profiler
+  uint64_t begin;
+  uint64_t end;
+};
+
+struct ProfileThreadBuffer {
+  static const uint32_t Capacity = 1u << 16;
+
+  ProfileEvent events[Capacity];
+  uint64_t written = 0; // Total ever written, the ring keeps the last Capacity
+  uint32_t threadId = 0;
+  std::atomic<bool> active{false}; // Cleared by the owning thread on exit
+};
+
+struct FrameTimeStats {
+  double p50 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+  double average = 0.0;
+  size_t count = 0;
+};
+
+// Percentiles of a set of frame times, in whatever unit they are given in
+inline FrameTimeStats ComputeFrameTimeStats(const float* times, size_t count) {
+  FrameTimeStats stats;
+  if (count == 0) {
+    return stats;
+  }
+
+  std::vector<float> sorted(times, times + count);
+  std::sort(sorted.begin(), sorted.end());
+
+  double total = 0.0;
+  for (float time : sorted) {
+    total += time;
+  }
+
+  stats.p50 = sorted[(count - 1) / 2];
+  stats.p99 = sorted[std::min(count - 1, static_cast<size_t>(count * 0.99))];
+  stats.max = sorted.back();
+  stats.average = total / count;
+  stats.count = count;
+
+  return stats;
+}
+
+struct Profiler {
+  static const uint32_t FrameHistory = 4096;
+  static const uint32_t GpuHistory = 256;
+  static const uint32_t CounterHistory = 1u << 14;
+
+  std::mutex mutex; // Only for registering threads and reading
+  std::vector<ProfileThreadBuffer*> buffers;
+
+  // Calibration pair, ticks are converted with the rate measured from here
+  uint64_t startTicks = ProfilerTicks();
+  std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+  // Frame times in milliseconds, written by the frame loop thread
+  float frameTimes[FrameHistory] = {};
+  uint64_t frameCount = 0;
+
+  // GPU work per fence value - CPU time of the signal and of the first time
+  // the fence was seen completed
+  struct GpuInterval {
+    uint64_t fenceValue;
+    uint64_t submitted;
+    uint64_t completed;
+  };
+  GpuInterval gpuIntervals[GpuHistory] = {};
+
+  // Named per-frame values (visible chunks, bytes uploaded...), written by the frame loop thread
+  struct CounterSample {
+    const char* name; // Must be a string literal or otherwise outlive the profiler
+    uint64_t ticks;
+    double value;
+  };
+  CounterSample counters[CounterHistory] = {};
+  uint64_t counterCount = 0;
+
+  Profiler() = default;
+  Profiler(const Profiler&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+
+  ~Profiler() {
+    for (ProfileThreadBuffer* buffer : buffers) {
+      delete buffer;
+    }
+  }
+
+  ProfileThreadBuffer* RegisterThread() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Reuse the buffer of a thread that has exited
+    for (ProfileThreadBuffer* buffer : buffers) {
+      if (!buffer->active) {
+        buffer->active = true;
+        return buffer;
+      }
+    }
+
+    ProfileThreadBuffer* buffer = new ProfileThreadBuffer; // Events left uninitialized, pages are touched as they fill
+    buffer->threadId = static_cast<uint32_t>(buffers.size());
+    buffer->active = true;
+    buffers.push_back(buffer);
+
+    return buffer;
+  }
+
+  double TicksPerMicrosecond() {
+#if SIMD_X86
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - startTime;
+    uint64_t ticks = ProfilerTicks() - startTicks;
+    return elapsed.count() > 1000.0 ? ticks / elapsed.count() : 1000.0;
+#else
+    return 1000.0;
+#endif
+  }
+
+  void RecordFrame(double frameSeconds) {
+    frameTimes[frameCount % FrameHistory] = static_cast<float>(frameSeconds * 1e3);
+    frameCount++;
+  }
+
+  // Percentiles over the last FrameHistory frames, in milliseconds
+  FrameTimeStats GetFrameTimeStats() const {
+    return ComputeFrameTimeStats(frameTimes, static_cast<size_t>(std::min<uint64_t>(frameCount, FrameHistory)));
+  }
+
+  void RecordCounter(const char* name, double value) {
+    counters[counterCount % CounterHistory] = {name, ProfilerTicks(), value};
+    counterCount++;
+  }
+
+  void GpuSignal(uint64_t fenceValue) {
+    GpuInterval& interval = gpuIntervals[fenceValue % GpuHistory];
+    interval = {fenceValue, ProfilerTicks(), 0};
+  }
+
+  void GpuCompleted(uint64_t completedFenceValue) {
+    uint64_t now = ProfilerTicks();
+    for (GpuInterval& interval : gpuIntervals) {
+      if (interval.completed == 0 && interval.submitted != 0 && interval.fenceValue <= completedFenceValue) {
+        interval.completed = now;
+      }
+    }
+  }
+
+  // Chrome trace_event JSON, load it in chrome://tracing or Perfetto
+  bool WriteChromeTrace(const char* path) {
+    std::FILE* file = std::fopen(path, "wb");
+    if (!file) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    double ticksPerMicrosecond = TicksPerMicrosecond();
+    auto toMicroseconds = [&](uint64_t ticks) {
+      return ticks >= startTicks ? (ticks - startTicks) / ticksPerMicrosecond : 0.0;
+    };
+
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (ProfileThreadBuffer* buffer : buffers) {
+      std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}",
+          first ? "" : ",\n", buffer->threadId, buffer->threadId);
+      first = false;
+
+      uint64_t count = std::min<uint64_t>(buffer->written, ProfileThreadBuffer::Capacity);
+      for (uint64_t i = buffer->written - count; i < buffer->written; ++i) {
+        const ProfileEvent& event = buffer->events[i % ProfileThreadBuffer::Capacity];
+        double begin = toMicroseconds(event.begin);
+        std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            event.name, buffer->threadId, begin, toMicroseconds(event.end) - begin);
+      }
+    }
+
+    // GPU work gets its own track
+    std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":0,\"args\":{\"name\":\"GPU queue\"}}", first ? "" : ",\n");
+    for (const GpuInterval& interval : gpuIntervals) {
+      if (interval.completed != 0) {
+        double begin = toMicroseconds(interval.submitted);
+        std::fprintf(file, ",\n{\"name\":\"Fence %llu\",\"ph\":\"X\",\"pid\":2,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+            static_cast<unsigned long long>(interval.fenceValue), begin, toMicroseconds(interval.completed) - begin);
+      }
+    }
+
+    // Counters show up as graphs above the threads
+    uint64_t counterSamples = std::min<uint64_t>(counterCount, CounterHistory);
+    for (uint64_t i = counterCount - counterSamples; i < counterCount; ++i) {
+      const CounterSample& sample = counters[i % CounterHistory];
+      std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%.17g}}",
+          sample.name, toMicroseconds(sample.ticks), sample.value);
+    }
+
+    std::fprintf(file, "\n]}\n");
+
+    return std::fclose(file) == 0;
+  }
+};
+
+inline Profiler g_Profiler;
+
+// Hands the thread's buffer back when the thread exits
+struct ProfileThreadHandle {
+  ProfileThreadBuffer* buffer = nullptr;
+
+  ~ProfileThreadHandle() {
+    if (buffer) {
+      buffer->active = false;
+    }
+  }
+};
+
+inline thread_local ProfileThreadHandle t_ProfileThread;
+
+inline ProfileThreadBuffer* GetProfileThreadBuffer() {
+  if (!t_ProfileThread.buffer) {
+    t_ProfileThread.buffer = g_Profiler.RegisterThread();
+  }
+
+  return t_ProfileThread.buffer;
+}
+
+struct ProfileZone {
+  const char* name;
+  uint64_t begin;
+
+  explicit ProfileZone(const char* name) : name(name), begin(ProfilerTicks()) {}
+
+  ~ProfileZone() {
+    ProfileThreadBuffer* buffer = GetProfileThreadBuffer();
+    buffer->events[buffer->written % ProfileThreadBuffer::Capacity] = {name, begin, ProfilerTicks()};
+    buffer->written++;
+  }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if PROFILER_ENABLED
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) g_Profiler.RecordCounter(name, static_cast<double>(value))
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_COUNTER(name, value)
+#endif
+
+#endif // _H_PROFILER
@@ -0,0 +1,212 @@
+#ifndef _H_SHADER_ARCHIVE
+#define _H_SHADER_ARCHIVE
+
+// Precompiled shader archive. The build compiles every shader into one file:
+// a header, the bytecode blobs at 16-byte aligned offsets, then a table of
+// contents sorted by name hash. The header records the hash of the HLSL
+// source and the compile flags, so an archive left over from other sources
+// or another build flavor is rejected and the renderer compiles instead.
+//
+// Opening maps the file and checks the header and the table; a blob is
+// checked against its content hash when it is looked up.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Helpers.h"
+#include "MappedFile.h"
+
+const uint32_t g_ShaderArchiveMagic = 0x52415348; // "HSAR"
+const uint32_t g_ShaderArchiveVersion = 1;
+const uint32_t g_ShaderArchiveAlignment = 16;
+
+struct ShaderArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;   // HashBytes of the HLSL the blobs were compiled from
+  uint32_t compileFlags;
+  uint32_t entryCount;
+  uint64_t tocOffset;
+};
+
+static_assert(sizeof(ShaderArchiveHeader) == 32, "ShaderArchiveHeader is part of the file format");
+
+struct ShaderArchiveEntry {
+  uint64_t nameHash;
+  char name[32];
+  char target[16]; // Shader model, "vs_5_0"
+  uint64_t offset;
+  uint64_t size;
+  uint64_t contentHash;
+};
+
+static_assert(sizeof(ShaderArchiveEntry) == 80, "ShaderArchiveEntry is part of the file format");
+
+struct ShaderBlob {
+  const uint8_t* data;
+  size_t size;
+  uint64_t contentHash;
+};
+
+inline uint64_t ShaderNameHash(const char* name) {
+  return HashBytes(name, std::strlen(name));
+}
+
+// Collects blobs and lays out an archive
+struct ShaderArchiveWriter {
+  uint64_t sourceHash = 0;
+  uint32_t compileFlags = 0;
+  std::vector<ShaderArchiveEntry> entries;
+  std::vector<uint8_t> blobs;
+
+  // False if the name or target does not fit or the name is taken
+  bool Add(const char* name, const char* target, const void* data, size_t size) {
+    ShaderArchiveEntry entry = {};
+    if (std::strlen(name) >= sizeof(entry.name) || std::strlen(target) >= sizeof(entry.target)) {
+      return false;
+    }
+
+    entry.nameHash = ShaderNameHash(name);
+    for (const ShaderArchiveEntry& other : entries) {
+      if (other.nameHash == entry.nameHash) {
+        return false;
+      }
+    }
+
+    std::strcpy(entry.name, name);
+    std::strcpy(entry.target, target);
+    blobs.resize((blobs.size() + g_ShaderArchiveAlignment - 1) & ~static_cast<size_t>(g_ShaderArchiveAlignment - 1));
+    entry.offset = sizeof(ShaderArchiveHeader) + blobs.size();
+    entry.size = size;
+    entry.contentHash = HashBytes(data, size);
+    blobs.insert(blobs.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+    entries.push_back(entry);
+
+    return true;
+  }
+
+  void Serialize(std::vector<uint8_t>& out) const {
+    std::vector<ShaderArchiveEntry> sorted = entries;
+    std::sort(sorted.begin(), sorted.end(), [](const ShaderArchiveEntry& a, const ShaderArchiveEntry& b) {
+      return a.nameHash < b.nameHash;
+    });
+
+    ShaderArchiveHeader header = {};
+    header.magic = g_ShaderArchiveMagic;
+    header.version = g_ShaderArchiveVersion;
+    header.sourceHash = sourceHash;
+    header.compileFlags = compileFlags;
+    header.entryCount = static_cast<uint32_t>(sorted.size());
+    header.tocOffset = (sizeof(header) + blobs.size() + 7) & ~static_cast<uint64_t>(7);
+
+    out.assign(header.tocOffset + sorted.size() * sizeof(ShaderArchiveEntry), 0);
+    std::memcpy(out.data(), &header, sizeof(header));
+    if (!blobs.empty()) {
+      std::memcpy(out.data() + sizeof(header), blobs.data(), blobs.size());
+    }
+    if (!sorted.empty()) {
+      std::memcpy(out.data() + header.tocOffset, sorted.data(), sorted.size() * sizeof(ShaderArchiveEntry));
+    }
+  }
+
+  bool Write(const char* path) const {
+    std::vector<uint8_t> bytes;
+    Serialize(bytes);
+    return WriteWholeFile(path, bytes.data(), bytes.size());
+  }
+};
+
+struct ShaderArchive {
+  MappedFile file;
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  const ShaderArchiveHeader* header = nullptr;
+  const ShaderArchiveEntry* entries = nullptr;
+
+  bool IsOpen() const {
+    return header != nullptr;
+  }
+
+  void Close() {
+    file.Close();
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+    entries = nullptr;
+  }
+
+  // False if the file is missing, damaged or was built from other sources
+  // or with other flags
+  bool Open(const char* path, uint64_t sourceHash, uint32_t compileFlags) {
+    Close();
+    if (!file.Open(path)) {
+      return false;
+    }
+    if (!OpenMemory(file.data, file.size, sourceHash, compileFlags)) {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  // Same checks over an archive already in memory, which has to outlive
+  // the ShaderArchive
+  bool OpenMemory(const uint8_t* bytes, size_t byteCount, uint64_t sourceHash, uint32_t compileFlags) {
+    data = nullptr;
+    header = nullptr;
+    entries = nullptr;
+    if (byteCount < sizeof(ShaderArchiveHeader)) {
+      return false;
+    }
+
+    const ShaderArchiveHeader* candidate = reinterpret_cast<const ShaderArchiveHeader*>(bytes);
+    if (candidate->magic != g_ShaderArchiveMagic || candidate->version != g_ShaderArchiveVersion ||
+        candidate->sourceHash != sourceHash || candidate->compileFlags != compileFlags) {
+      return false;
+    }
+    if (candidate->tocOffset % 8 != 0 || candidate->tocOffset > byteCount ||
+        (byteCount - candidate->tocOffset) / sizeof(ShaderArchiveEntry) < candidate->entryCount) {
+      return false;
+    }
+
+    const ShaderArchiveEntry* table = reinterpret_cast<const ShaderArchiveEntry*>(bytes + candidate->tocOffset);
+    for (uint32_t i = 0; i < candidate->entryCount; ++i) {
+      const ShaderArchiveEntry& entry = table[i];
+      if (entry.offset > candidate->tocOffset || entry.size > candidate->tocOffset - entry.offset ||
+          (i > 0 && table[i - 1].nameHash >= entry.nameHash)) {
+        return false;
+      }
+    }
+
+    data = bytes;
+    size = byteCount;
+    header = candidate;
+    entries = table;
+    return true;
+  }
+
+  // Binary search on the name hash. False if the name is missing or the
+  // blob does not match its hash.
+  bool Find(const char* name, ShaderBlob& blob) const {
+    if (!header) {
+      return false;
+    }
+
+    uint64_t nameHash = ShaderNameHash(name);
+    const ShaderArchiveEntry* end = entries + header->entryCount;
+    const ShaderArchiveEntry* entry = std::lower_bound(entries, end, nameHash, [](const ShaderArchiveEntry& e, uint64_t hash) {
+      return e.nameHash < hash;
+    });
+    if (entry == end || entry->nameHash != nameHash || std::strncmp(entry->name, name, sizeof(entry->name)) != 0) {
+      return false;
+    }
+
+    blob = {data + entry->offset, static_cast<size_t>(entry->size), entry->contentHash};
+    return HashBytes(blob.data, blob.size) == entry->contentHash;
+  }
+};
+
+#endif // _H_SHADER_ARCHIVE
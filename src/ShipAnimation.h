@@ -0,0 +1,655 @@
+#ifndef _H_SHIP_ANIMATION
+#define _H_SHIP_ANIMATION
+
+// Ship animation - samples the rig of every ship in batches, so a frame
+// costs a few passes over the ship arrays instead of per-ship bone work on
+// the main thread.
+//
+// Clips are loops of uniformly spaced keys, quantized to 16 bits and stored
+// channel by channel, one clip per ShipAnimation state. Ships are sampled
+// eight at a time: their two keys are gathered into lanes, blended with a
+// SIMD lerp for translations and an approximated slerp for rotations, and
+// the hierarchy and skinning palettes are built from the lanes. The
+// palettes are kept per handle slot, so they survive ships being destroyed
+// around them, and are copied to the frame's upload memory in one go.
+//
+// Distant ships are sampled at a reduced rate, staggered by slot so every
+// frame does about the same work. Ships skipped in a frame keep their last
+// pose.
+//
+// SkinShips() is the CPU path of the skinning shader, for the headless
+// build and the software rasterizer: it poses the ship mesh of every ship
+// in world space on the job system.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "FrameMemory.h"
+#include "Helpers.h"
+#include "HexMesh.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Ships.h"
+#include "Simd.h"
+
+const uint32_t g_ShipBones = 6;          // Root, hull, mast, sail, flag, rudder
+const uint32_t g_ShipAnimationKeys = 17; // 16 steps per loop, the last key repeats the first
+const uint32_t g_ShipAnimationClips = 3; // One per ShipAnimation state
+const uint32_t g_ShipAnimationLanes = 8; // Ships sampled together
+const uint32_t g_ShipPaletteFloats = g_ShipBones * 12; // 3x4 matrix per bone
+
+// Bone hierarchy in bind pose. Bones only translate in bind pose, so the
+// inverse bind matrix is a translation by -bindModel.
+struct ShipSkeleton {
+  uint8_t parent[g_ShipBones];  // Parents come before their children, the root is its own parent
+  float bindLocal[g_ShipBones][3];
+  float bindModel[g_ShipBones][3];
+};
+
+inline void BuildShipSkeleton(ShipSkeleton& skeleton) {
+  const uint8_t parent[g_ShipBones] = {0, 0, 1, 2, 2, 1};
+  const float bindLocal[g_ShipBones][3] = {
+    {0.0f, 0.0f, 0.0f},   // Root
+    {0.0f, 0.0f, 0.0f},   // Hull, rolls and pitches on the waves
+    {0.0f, 0.5f, 0.2f},   // Mast
+    {0.0f, 0.35f, 0.0f},  // Sail, swings around the mast
+    {0.0f, 1.25f, 0.0f},  // Flag at the top of the mast
+    {0.0f, 0.25f, -1.0f}, // Rudder at the stern
+  };
+
+  for (uint32_t bone = 0; bone < g_ShipBones; ++bone) {
+    skeleton.parent[bone] = parent[bone];
+    for (int i = 0; i < 3; ++i) {
+      skeleton.bindLocal[bone][i] = bindLocal[bone][i];
+      skeleton.bindModel[bone][i] = bindLocal[bone][i] + (bone > 0 ? skeleton.bindModel[parent[bone]][i] : 0.0f);
+    }
+  }
+}
+
+// One looping clip. Rotations are unit quaternions scaled by 32767,
+// translations are bias + value * scale per channel.
+struct ShipAnimationClip {
+  int16_t rotation[4][g_ShipBones][g_ShipAnimationKeys];
+  int16_t translation[3][g_ShipBones][g_ShipAnimationKeys];
+  float translationBias[3];
+  float translationScale[3];
+};
+
+// Quantizes a clip from float keys, rotations as x, y, z, w. Each key is
+// flipped into the hemisphere of the one before, so neighbors blend the
+// short way round.
+inline void QuantizeShipClip(const float (*rotations)[g_ShipAnimationKeys][4], const float (*translations)[g_ShipAnimationKeys][3], ShipAnimationClip& clip) {
+  for (int c = 0; c < 3; ++c) {
+    float low = translations[0][0][c];
+    float high = low;
+    for (uint32_t bone = 0; bone < g_ShipBones; ++bone) {
+      for (uint32_t key = 0; key < g_ShipAnimationKeys; ++key) {
+        low = std::min(low, translations[bone][key][c]);
+        high = std::max(high, translations[bone][key][c]);
+      }
+    }
+    clip.translationBias[c] = 0.5f * (low + high);
+    clip.translationScale[c] = std::max(0.5f * (high - low), 1e-6f) / 32767.0f;
+  }
+
+  for (uint32_t bone = 0; bone < g_ShipBones; ++bone) {
+    float sign = 1.0f;
+    for (uint32_t key = 0; key < g_ShipAnimationKeys; ++key) {
+      const float* q = rotations[bone][key];
+      if (key > 0) {
+        const float* previous = rotations[bone][key - 1];
+        float dot = q[0] * previous[0] + q[1] * previous[1] + q[2] * previous[2] + q[3] * previous[3];
+        sign = dot < 0.0f ? -sign : sign;
+      }
+      float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+      for (int c = 0; c < 4; ++c) {
+        clip.rotation[c][bone][key] = static_cast<int16_t>(std::lround(sign * q[c] / length * 32767.0f));
+      }
+      for (int c = 0; c < 3; ++c) {
+        float value = (translations[bone][key][c] - clip.translationBias[c]) / clip.translationScale[c];
+        clip.translation[c][bone][key] = static_cast<int16_t>(std::lround(std::min(std::max(value, -32767.0f), 32767.0f)));
+      }
+    }
+  }
+}
+
+// The procedural clips of the ship rig - idle bobbing, sailing with the
+// sail full and the flag streaming, and a turn with the hull heeled over and
+// the rudder hard across
+inline void BuildShipClips(const ShipSkeleton& skeleton, ShipAnimationClip* clips) {
+  struct Motion {
+    float roll, pitch, bob;   // Hull, radians and units
+    float sail, flag, rudder; // Swing amplitudes around y, radians
+    float heel, sailSet, rudderSet; // Held angles
+  };
+  const Motion motions[g_ShipAnimationClips] = {
+    {0.035f, 0.02f, 0.03f, 0.05f, 0.15f, 0.0f, 0.0f, 0.0f, 0.0f},    // Idle
+    {0.07f, 0.05f, 0.06f, 0.12f, 0.45f, 0.05f, 0.0f, 0.0f, 0.0f},    // Sailing
+    {0.05f, 0.04f, 0.05f, 0.08f, 0.35f, 0.05f, 0.17f, 0.35f, 0.45f}, // Turning
+  };
+
+  auto axisAngle = [](float* q, float x, float y, float z, float angle) {
+    float s = std::sin(angle * 0.5f);
+    q[0] = x * s;
+    q[1] = y * s;
+    q[2] = z * s;
+    q[3] = std::cos(angle * 0.5f);
+  };
+
+  float rotations[g_ShipBones][g_ShipAnimationKeys][4];
+  float translations[g_ShipBones][g_ShipAnimationKeys][3];
+  for (uint32_t clip = 0; clip < g_ShipAnimationClips; ++clip) {
+    const Motion& m = motions[clip];
+    for (uint32_t key = 0; key < g_ShipAnimationKeys; ++key) {
+      float angle = 6.2831853f * (key % (g_ShipAnimationKeys - 1)) / (g_ShipAnimationKeys - 1);
+
+      for (uint32_t bone = 0; bone < g_ShipBones; ++bone) {
+        std::memcpy(translations[bone][key], skeleton.bindLocal[bone], sizeof(translations[bone][key]));
+        axisAngle(rotations[bone][key], 0.0f, 1.0f, 0.0f, 0.0f);
+      }
+
+      // Roll about the keel and pitch about the beam, a quarter loop apart
+      float roll = m.heel + m.roll * std::sin(angle);
+      float pitch = m.pitch * std::cos(angle);
+      float r[4], p[4];
+      axisAngle(r, 0.0f, 0.0f, 1.0f, roll);
+      axisAngle(p, 1.0f, 0.0f, 0.0f, pitch);
+      float* hull = rotations[1][key];
+      hull[0] = r[3] * p[0] + r[0] * p[3] + r[1] * p[2] - r[2] * p[1];
+      hull[1] = r[3] * p[1] - r[0] * p[2] + r[1] * p[3] + r[2] * p[0];
+      hull[2] = r[3] * p[2] + r[0] * p[1] - r[1] * p[0] + r[2] * p[3];
+      hull[3] = r[3] * p[3] - r[0] * p[0] - r[1] * p[1] - r[2] * p[2];
+      translations[1][key][1] += m.bob * std::sin(2.0f * angle);
+
+      axisAngle(rotations[3][key], 0.0f, 1.0f, 0.0f, m.sailSet + m.sail * std::sin(angle + 1.0f));
+      axisAngle(rotations[4][key], 0.0f, 1.0f, 0.0f, m.flag * std::sin(3.0f * angle));
+      axisAngle(rotations[5][key], 0.0f, 1.0f, 0.0f, m.rudderSet + m.rudder * std::sin(angle));
+    }
+    QuantizeShipClip(rotations, translations, clips[clip]);
+  }
+}
+
+// Which ships are sampled in a frame: full rate inside distances[0], then
+// every 2nd, 4th and beyond distances[2] every 8th frame
+struct ShipAnimationLod {
+  float distances[3] = {48.0f, 128.0f, 320.0f};
+  bool enabled = true;
+};
+
+struct ShipAnimationStats {
+  uint64_t frames = 0;
+  uint32_t sampled = 0; // Last frame
+  uint32_t skipped = 0;
+  uint64_t totalSampled = 0;
+  double lastMicroseconds = 0.0;
+  double totalMicroseconds = 0.0;
+};
+
+// Keys of one bone for a group of ships, dequantized into lanes
+struct ShipKeyLanes {
+  float rotation[4][g_ShipAnimationLanes];
+  float translation[3][g_ShipAnimationLanes];
+};
+
+struct ShipPoseLanes {
+  float rotation[4][g_ShipAnimationLanes];
+  float translation[3][g_ShipAnimationLanes];
+};
+
+// Blends a group's two keys at t. Rotations use nlerp with a correction of
+// the blend weight, which is within 0.001 of slerp at a fraction of its cost
+// and needs no trigonometry (https://zeux.io/2016/05/05/optimizing-slerp/).
+// The SSE2 and AVX2 versions do the same operations in the same order and
+// produce the same bits.
+inline void BlendShipKeysScalar(const ShipKeyLanes& a, const ShipKeyLanes& b, const float* t, ShipPoseLanes& out) {
+  for (uint32_t lane = 0; lane < g_ShipAnimationLanes; ++lane) {
+    float dot = a.rotation[0][lane] * b.rotation[0][lane] + a.rotation[1][lane] * b.rotation[1][lane] +
+        a.rotation[2][lane] * b.rotation[2][lane] + a.rotation[3][lane] * b.rotation[3][lane];
+    bool flip = dot < 0.0f;
+    float d = std::fabs(dot);
+    float s = t[lane];
+    float k0 = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    float k1 = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    float centered = s - 0.5f;
+    float k = k0 * centered * centered + k1;
+    float corrected = s + s * centered * (s - 1.0f) * k;
+
+    float q[4];
+    for (int c = 0; c < 4; ++c) {
+      float target = flip ? -b.rotation[c][lane] : b.rotation[c][lane];
+      q[c] = a.rotation[c][lane] + (target - a.rotation[c][lane]) * corrected;
+    }
+    float inverse = 1.0f / std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int c = 0; c < 4; ++c) {
+      out.rotation[c][lane] = q[c] * inverse;
+    }
+    for (int c = 0; c < 3; ++c) {
+      out.translation[c][lane] = a.translation[c][lane] + (b.translation[c][lane] - a.translation[c][lane]) * s;
+    }
+  }
+}
+
+#if SIMD_X86
+inline void BlendShipKeysSSE2(const ShipKeyLanes& a, const ShipKeyLanes& b, const float* t, ShipPoseLanes& out) {
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 signBit = _mm_set1_ps(-0.0f);
+
+  for (uint32_t lane = 0; lane < g_ShipAnimationLanes; lane += 4) {
+    __m128 ar[4], br[4];
+    for (int c = 0; c < 4; ++c) {
+      ar[c] = _mm_loadu_ps(a.rotation[c] + lane);
+      br[c] = _mm_loadu_ps(b.rotation[c] + lane);
+    }
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ar[0], br[0]), _mm_mul_ps(ar[1], br[1])), _mm_mul_ps(ar[2], br[2])), _mm_mul_ps(ar[3], br[3]));
+    __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), signBit);
+    __m128 d = _mm_andnot_ps(signBit, dot);
+    __m128 s = _mm_loadu_ps(t + lane);
+    __m128 k0 = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-3.2452f),
+        _mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)))))));
+    __m128 k1 = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)))));
+    __m128 centered = _mm_sub_ps(s, half);
+    __m128 k = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(k0, centered), centered), k1);
+    __m128 corrected = _mm_add_ps(s, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(s, centered), _mm_sub_ps(s, one)), k));
+
+    __m128 q[4];
+    for (int c = 0; c < 4; ++c) {
+      __m128 target = _mm_xor_ps(br[c], flip);
+      q[c] = _mm_add_ps(ar[c], _mm_mul_ps(_mm_sub_ps(target, ar[c]), corrected));
+    }
+    __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(q[0], q[0]), _mm_mul_ps(q[1], q[1])), _mm_mul_ps(q[2], q[2])), _mm_mul_ps(q[3], q[3]));
+    __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(length2));
+    for (int c = 0; c < 4; ++c) {
+      _mm_storeu_ps(out.rotation[c] + lane, _mm_mul_ps(q[c], inverse));
+    }
+    for (int c = 0; c < 3; ++c) {
+      __m128 from = _mm_loadu_ps(a.translation[c] + lane);
+      __m128 to = _mm_loadu_ps(b.translation[c] + lane);
+      _mm_storeu_ps(out.translation[c] + lane, _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(to, from), s)));
+    }
+  }
+}
+
+SIMD_TARGET_AVX2 inline void BlendShipKeysAVX2(const ShipKeyLanes& a, const ShipKeyLanes& b, const float* t, ShipPoseLanes& out) {
+  static_assert(g_ShipAnimationLanes == 8, "One AVX2 register per channel");
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+  __m256 ar[4], br[4];
+  for (int c = 0; c < 4; ++c) {
+    ar[c] = _mm256_loadu_ps(a.rotation[c]);
+    br[c] = _mm256_loadu_ps(b.rotation[c]);
+  }
+  __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ar[0], br[0]), _mm256_mul_ps(ar[1], br[1])), _mm256_mul_ps(ar[2], br[2])), _mm256_mul_ps(ar[3], br[3]));
+  __m256 flip = _mm256_and_ps(_mm256_cmp_ps(dot, _mm256_setzero_ps(), _CMP_LT_OQ), signBit);
+  __m256 d = _mm256_andnot_ps(signBit, dot);
+  __m256 s = _mm256_loadu_ps(t);
+  __m256 k0 = _mm256_add_ps(_mm256_set1_ps(1.0904f), _mm256_mul_ps(d, _mm256_add_ps(_mm256_set1_ps(-3.2452f),
+      _mm256_mul_ps(d, _mm256_sub_ps(_mm256_set1_ps(3.55645f), _mm256_mul_ps(d, _mm256_set1_ps(1.43519f)))))));
+  __m256 k1 = _mm256_add_ps(_mm256_set1_ps(0.848013f), _mm256_mul_ps(d, _mm256_add_ps(_mm256_set1_ps(-1.06021f), _mm256_mul_ps(d, _mm256_set1_ps(0.215638f)))));
+  __m256 centered = _mm256_sub_ps(s, half);
+  __m256 k = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(k0, centered), centered), k1);
+  __m256 corrected = _mm256_add_ps(s, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(s, centered), _mm256_sub_ps(s, one)), k));
+
+  __m256 q[4];
+  for (int c = 0; c < 4; ++c) {
+    __m256 target = _mm256_xor_ps(br[c], flip);
+    q[c] = _mm256_add_ps(ar[c], _mm256_mul_ps(_mm256_sub_ps(target, ar[c]), corrected));
+  }
+  __m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(q[0], q[0]), _mm256_mul_ps(q[1], q[1])), _mm256_mul_ps(q[2], q[2])), _mm256_mul_ps(q[3], q[3]));
+  __m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(length2));
+  for (int c = 0; c < 4; ++c) {
+    _mm256_storeu_ps(out.rotation[c], _mm256_mul_ps(q[c], inverse));
+  }
+  for (int c = 0; c < 3; ++c) {
+    __m256 from = _mm256_loadu_ps(a.translation[c]);
+    __m256 to = _mm256_loadu_ps(b.translation[c]);
+    _mm256_storeu_ps(out.translation[c], _mm256_add_ps(from, _mm256_mul_ps(_mm256_sub_ps(to, from), s)));
+  }
+}
+#endif
+
+inline void BlendShipKeys(const ShipKeyLanes& a, const ShipKeyLanes& b, const float* t, ShipPoseLanes& out, SimdLevel level) {
+#if SIMD_X86
+  if (level == SimdLevel::AVX2) {
+    BlendShipKeysAVX2(a, b, t, out);
+    return;
+  }
+  if (level == SimdLevel::SSE2) {
+    BlendShipKeysSSE2(a, b, t, out);
+    return;
+  }
+#endif
+  BlendShipKeysScalar(a, b, t, out);
+}
+
+struct ShipAnimator {
+  ShipSkeleton skeleton;
+  ShipAnimationClip clips[g_ShipAnimationClips];
+  ShipAnimationLod lod;
+  SimdLevel level = GetSimdLevel();
+
+  // Skinning palettes by handle slot, bone major within a ship. A palette is
+  // three rows of a 3x4 matrix, model space of the ship to posed model space.
+  float* palettes = nullptr;
+  uint32_t slotCapacity = 0;
+  uint32_t slotCount = 0; // Slots with a palette, the upload covers these
+  ShipAnimationStats stats;
+
+  ShipAnimator() = default;
+  ShipAnimator(const ShipAnimator&) = delete;
+  ShipAnimator& operator=(const ShipAnimator&) = delete;
+
+  ~ShipAnimator() {
+    if (palettes) {
+      AlignedFree(palettes);
+    }
+  }
+
+  void Init() {
+    BuildShipSkeleton(skeleton);
+    BuildShipClips(skeleton, clips);
+    stats = {};
+  }
+
+  // Samples the ships due this frame. eyeX and eyeZ are in the ships' space,
+  // frameIndex staggers the reduced rates.
+  void Update(const ShipStore& ships, float eyeX, float eyeZ, uint64_t frameIndex, JobSystem& jobs) {
+    PROFILE_ZONE("AnimateShipRigs");
+
+    auto t0 = std::chrono::steady_clock::now();
+    Reserve(ships.slotCount);
+
+    std::atomic<uint32_t> sampledCount{0};
+    jobs.ParallelFor(0, ships.count, g_ShipBlock, [&](uint32_t begin, uint32_t end) {
+      uint32_t sampled = 0;
+      for (uint32_t block = begin; block < end; block += g_ShipBlock) {
+        uint32_t blockEnd = end - block < g_ShipBlock ? end : block + g_ShipBlock;
+        sampled += SampleBlock(ships, block, blockEnd, eyeX, eyeZ, frameIndex);
+      }
+      sampledCount += sampled;
+    });
+
+    uint32_t sampled = sampledCount.load();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - t0;
+
+    stats.frames++;
+    stats.sampled = sampled;
+    stats.skipped = ships.count - sampled;
+    stats.totalSampled += sampled;
+    stats.lastMicroseconds = elapsed.count();
+    stats.totalMicroseconds += elapsed.count();
+  }
+
+  // Copies the palettes to the frame's upload memory, where the skinning
+  // shader reads them by ship slot. cpu is null if the ring is full.
+  UploadAllocation UploadPalettes(UploadRing& ring) const {
+    size_t size = static_cast<size_t>(std::max(slotCount, 1u)) * g_ShipPaletteFloats * sizeof(float);
+    UploadAllocation allocation = ring.Allocate(size, 256);
+    if (allocation.cpu && slotCount > 0) {
+      std::memcpy(allocation.cpu, palettes, size);
+    }
+    return allocation;
+  }
+
+  const float* Palette(uint32_t slot) const {
+    return palettes + static_cast<size_t>(slot) * g_ShipPaletteFloats;
+  }
+
+private:
+  // New slots start in bind pose until they are first sampled
+  void Reserve(uint32_t slots) {
+    if (slots > slotCapacity) {
+      uint32_t capacity = std::max(slots, slotCapacity * 2);
+      float* grown = static_cast<float*>(AlignedAlloc(static_cast<size_t>(capacity) * g_ShipPaletteFloats * sizeof(float)));
+      if (palettes) {
+        std::memcpy(grown, palettes, static_cast<size_t>(slotCount) * g_ShipPaletteFloats * sizeof(float));
+        AlignedFree(palettes);
+      }
+      palettes = grown;
+      slotCapacity = capacity;
+    }
+
+    for (uint32_t slot = slotCount; slot < slots; ++slot) {
+      float* palette = palettes + static_cast<size_t>(slot) * g_ShipPaletteFloats;
+      for (uint32_t bone = 0; bone < g_ShipBones; ++bone) {
+        const float identity[12] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+        std::memcpy(palette + bone * 12, identity, sizeof(identity));
+      }
+    }
+    slotCount = std::max(slotCount, slots);
+  }
+
+  // Reduced rate of a ship at a distance, as a mask of the frame bits that
+  // have to be zero
+  uint32_t LodMask(float distance2) const {
+    if (!lod.enabled) {
+      return 0;
+    }
+    uint32_t level = 0;
+    for (float distance : lod.distances) {
+      level += distance2 > distance * distance ? 1 : 0;
+    }
+    return (1u << level) - 1;
+  }
+
+  uint32_t SampleBlock(const ShipStore& ships, uint32_t begin, uint32_t end, float eyeX, float eyeZ, uint64_t frameIndex) {
+    uint32_t due[g_ShipBlock];
+    uint32_t dueCount = 0;
+    for (uint32_t i = begin; i < end; ++i) {
+      float x = ships.posX[i] - eyeX;
+      float z = ships.posZ[i] - eyeZ;
+      uint32_t slot = ships.slotOf[i];
+      due[dueCount] = i;
+      dueCount += ((frameIndex + slot) & LodMask(x * x + z * z)) == 0 ? 1 : 0;
+    }
+
+    for (uint32_t first = 0; first < dueCount; first += g_ShipAnimationLanes) {
+      SampleGroup(ships, due + first, std::min(g_ShipAnimationLanes, dueCount - first));
+    }
+    return dueCount;
+  }
+
+  // Poses up to a lane width of ships. Unused lanes repeat the last ship and
+  // are not written back.
+  void SampleGroup(const ShipStore& ships, const uint32_t* indices, uint32_t count) {
+    const ShipAnimationClip* clip[g_ShipAnimationLanes];
+    uint32_t key[g_ShipAnimationLanes];
+    float t[g_ShipAnimationLanes];
+    for (uint32_t lane = 0; lane < g_ShipAnimationLanes; ++lane) {
+      uint32_t i = indices[std::min(lane, count - 1)];
+      float position = std::min(std::max(ships.animPhase[i], 0.0f), 1.0f) * (g_ShipAnimationKeys - 1);
+      key[lane] = std::min(static_cast<uint32_t>(position), g_ShipAnimationKeys - 2);
+      t[lane] = position - static_cast<float>(key[lane]);
+      clip[lane] = &clips[std::min<uint32_t>(ships.animState[i], g_ShipAnimationClips - 1)];
+    }
+
+    // Model space rotation and translation of every bone, in lanes
+    ShipPoseLanes model[g_ShipBones];
+    for (uint32_t bone = 0; bone < g_ShipBones; ++bone) {
+      ShipKeyLanes a, b;
+      for (uint32_t lane = 0; lane < g_ShipAnimationLanes; ++lane) {
+        const ShipAnimationClip& c = *clip[lane];
+        uint32_t k = key[lane];
+        for (int channel = 0; channel < 4; ++channel) {
+          a.rotation[channel][lane] = c.rotation[channel][bone][k] * (1.0f / 32767.0f);
+          b.rotation[channel][lane] = c.rotation[channel][bone][k + 1] * (1.0f / 32767.0f);
+        }
+        for (int channel = 0; channel < 3; ++channel) {
+          a.translation[channel][lane] = c.translationBias[channel] + c.translation[channel][bone][k] * c.translationScale[channel];
+          b.translation[channel][lane] = c.translationBias[channel] + c.translation[channel][bone][k + 1] * c.translationScale[channel];
+        }
+      }
+
+      ShipPoseLanes local;
+      BlendShipKeys(a, b, t, local, level);
+      if (bone == 0) {
+        model[0] = local;
+        continue;
+      }
+
+      // Parent rotation times local rotation, and the local translation
+      // rotated into the parent: t + 2w(u x t) + 2u x (u x t)
+      const ShipPoseLanes& parent = model[skeleton.parent[bone]];
+      ShipPoseLanes& out = model[bone];
+      for (uint32_t lane = 0; lane < g_ShipAnimationLanes; ++lane) {
+        float px = parent.rotation[0][lane], py = parent.rotation[1][lane], pz = parent.rotation[2][lane], pw = parent.rotation[3][lane];
+        float lx = local.rotation[0][lane], ly = local.rotation[1][lane], lz = local.rotation[2][lane], lw = local.rotation[3][lane];
+        out.rotation[0][lane] = pw * lx + px * lw + py * lz - pz * ly;
+        out.rotation[1][lane] = pw * ly - px * lz + py * lw + pz * lx;
+        out.rotation[2][lane] = pw * lz + px * ly - py * lx + pz * lw;
+        out.rotation[3][lane] = pw * lw - px * lx - py * ly - pz * lz;
+
+        float tx = local.translation[0][lane], ty = local.translation[1][lane], tz = local.translation[2][lane];
+        float cx = py * tz - pz * ty;
+        float cy = pz * tx - px * tz;
+        float cz = px * ty - py * tx;
+        float ccx = py * cz - pz * cy;
+        float ccy = pz * cx - px * cz;
+        float ccz = px * cy - py * cx;
+        out.translation[0][lane] = parent.translation[0][lane] + tx + 2.0f * (pw * cx + ccx);
+        out.translation[1][lane] = parent.translation[1][lane] + ty + 2.0f * (pw * cy + ccy);
+        out.translation[2][lane] = parent.translation[2][lane] + tz + 2.0f * (pw * cz + ccz);
+      }
+    }
+
+    // Palette = posed bone * inverse bind, a rotation and the translation
+    // minus the rotated bind position
+    for (uint32_t lane = 0; lane < count; ++lane) {
+      float* palette = palettes + static_cast<size_t>(ships.slotOf[indices[lane]]) * g_ShipPaletteFloats;
+      for (uint32_t bone = 0; bone < g_ShipBones; ++bone) {
+        const ShipPoseLanes& pose = model[bone];
+        float x = pose.rotation[0][lane], y = pose.rotation[1][lane], z = pose.rotation[2][lane], w = pose.rotation[3][lane];
+        float m[3][3] = {
+          {1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y - w * z), 2.0f * (x * z + w * y)},
+          {2.0f * (x * y + w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z - w * x)},
+          {2.0f * (x * z - w * y), 2.0f * (y * z + w * x), 1.0f - 2.0f * (x * x + y * y)},
+        };
+        const float* bind = skeleton.bindModel[bone];
+        float* row = palette + bone * 12;
+        for (int r = 0; r < 3; ++r) {
+          row[r * 4 + 0] = m[r][0];
+          row[r * 4 + 1] = m[r][1];
+          row[r * 4 + 2] = m[r][2];
+          row[r * 4 + 3] = pose.translation[r][lane] - (m[r][0] * bind[0] + m[r][1] * bind[1] + m[r][2] * bind[2]);
+        }
+      }
+    }
+  }
+};
+
+// Ship mesh vertex bound to up to two bones
+struct ShipSkinVertex {
+  float position[3];
+  float normal[3];
+  uint8_t bones[2];
+  float weight; // Of bones[0], bones[1] gets the rest
+};
+
+// Boxes for the hull, mast, sail, flag and rudder in bind pose, 2 long
+// along +z like the rasterizer's ship. The sail's top edge is shared with
+// the mast so it bends instead of coming apart.
+inline void BuildShipSkinMesh(std::vector<ShipSkinVertex>& vertices, std::vector<uint16_t>& indices) {
+  struct Box {
+    float min[3];
+    float max[3];
+    uint8_t bone;
+    uint8_t topBone; // Bone of the top face, with a weight of half
+  };
+  const Box boxes[] = {
+    {{-0.35f, 0.0f, -1.0f}, {0.35f, 0.5f, 1.0f}, 1, 1},     // Hull
+    {{-0.04f, 0.5f, 0.16f}, {0.04f, 1.9f, 0.24f}, 2, 2},    // Mast
+    {{-0.6f, 0.9f, 0.25f}, {0.6f, 1.75f, 0.28f}, 3, 2},     // Sail
+    {{0.04f, 1.65f, 0.19f}, {0.35f, 1.85f, 0.21f}, 4, 4},   // Flag
+    {{-0.02f, 0.0f, -1.15f}, {0.02f, 0.4f, -1.0f}, 5, 5},   // Rudder
+  };
+
+  vertices.clear();
+  indices.clear();
+  for (const Box& box : boxes) {
+    for (int axis = 0; axis < 3; ++axis) {
+      for (int side = 0; side < 2; ++side) {
+        // Face corners in an order that is clockwise seen from outside
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        if (side == 0) {
+          std::swap(u, v);
+        }
+        uint16_t base = static_cast<uint16_t>(vertices.size());
+        for (int corner = 0; corner < 4; ++corner) {
+          ShipSkinVertex vertex = {};
+          vertex.position[axis] = side ? box.max[axis] : box.min[axis];
+          vertex.position[u] = (corner == 1 || corner == 2) ? box.max[u] : box.min[u];
+          vertex.position[v] = corner >= 2 ? box.max[v] : box.min[v];
+          vertex.normal[axis] = side ? 1.0f : -1.0f;
+          bool top = vertex.position[1] == box.max[1];
+          vertex.bones[0] = box.bone;
+          vertex.bones[1] = top ? box.topBone : box.bone;
+          vertex.weight = top && box.topBone != box.bone ? 0.5f : 1.0f;
+          vertices.push_back(vertex);
+        }
+        const uint16_t quad[6] = {0, 1, 2, 0, 2, 3};
+        for (uint16_t index : quad) {
+          indices.push_back(static_cast<uint16_t>(base + index));
+        }
+      }
+    }
+  }
+}
+
+// Poses the mesh of ships [begin, end) into out, vertexCount vertices per
+// ship, in the XZ plane of the ships at height y. The same blend of two
+// palette rows as the skinning shader.
+inline void SkinShipRange(const ShipAnimator& animator, const ShipStore& ships, const ShipSkinVertex* vertices, uint32_t vertexCount,
+    float y, uint32_t begin, uint32_t end, HexVertex* out) {
+  for (uint32_t i = begin; i < end; ++i) {
+    const float* palette = animator.Palette(ships.slotOf[i]);
+    float forwardX = ships.dirX[i];
+    float forwardZ = ships.dirZ[i];
+    HexVertex* shipOut = out + static_cast<size_t>(i) * vertexCount;
+
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+      const ShipSkinVertex& vertex = vertices[v];
+      const float* m0 = palette + vertex.bones[0] * 12;
+      const float* m1 = palette + vertex.bones[1] * 12;
+      float m[12];
+      for (int j = 0; j < 12; ++j) {
+        m[j] = m1[j] + (m0[j] - m1[j]) * vertex.weight;
+      }
+
+      float p[3], n[3];
+      for (int r = 0; r < 3; ++r) {
+        p[r] = m[r * 4] * vertex.position[0] + m[r * 4 + 1] * vertex.position[1] + m[r * 4 + 2] * vertex.position[2] + m[r * 4 + 3];
+        n[r] = m[r * 4] * vertex.normal[0] + m[r * 4 + 1] * vertex.normal[1] + m[r * 4 + 2] * vertex.normal[2];
+      }
+      float inverse = 1.0f / std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+      // Ship space to the world, x to the right of the heading and z along it
+      HexVertex& posed = shipOut[v];
+      posed.position[0] = ships.posX[i] + p[0] * forwardZ + p[2] * forwardX;
+      posed.position[1] = y + p[1];
+      posed.position[2] = ships.posZ[i] - p[0] * forwardX + p[2] * forwardZ;
+      posed.normal[0] = (n[0] * forwardZ + n[2] * forwardX) * inverse;
+      posed.normal[1] = n[1] * inverse;
+      posed.normal[2] = (-n[0] * forwardX + n[2] * forwardZ) * inverse;
+    }
+  }
+}
+
+// CPU skinning of every ship on the job system, for when there is no GPU
+inline void SkinShips(const ShipAnimator& animator, const ShipStore& ships, const ShipSkinVertex* vertices, uint32_t vertexCount,
+    float y, HexVertex* out, JobSystem& jobs) {
+  PROFILE_ZONE("SkinShips");
+
+  jobs.ParallelFor(0, ships.count, 64, [&](uint32_t begin, uint32_t end) {
+    SkinShipRange(animator, ships, vertices, vertexCount, y, begin, end, out);
+  });
+}
+
+#endif // _H_SHIP_ANIMATION
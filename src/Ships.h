@@ -0,0 +1,482 @@
+#ifndef _H_SHIPS
+#define _H_SHIPS
+
+// Ships - the largest entity population, stored data-oriented. Ships are a
+// single archetype, so there is no per-entity type information, only dense
+// structure-of-arrays components: [0, count) are the live ships. Each
+// system is a plain function over a range of that array, and a tick runs
+// every system back to back on one block of ships while the block is in
+// cache. The job system spreads the blocks over the cores.
+//
+// Handles stay valid while ships come and go. A handle names a slot, and
+// the slot holds the ship's dense index and a generation that is bumped on
+// destruction. Destroy moves the last ship into the hole, so both creation
+// and destruction are O(1) and the dense arrays never have gaps. Components
+// and slots share one allocation, so the whole store can be snapshotted
+// with a memcpy.
+//
+// Ships move in the XZ plane of the hex layout (pixel y along z), the same
+// space HexToPixel and PixelToHexBatch work in.
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "Helpers.h"
+#include "HexGrid.h"
+#include "HexPicking.h"
+#include "JobSystem.h"
+#include "Simd.h"
+
+const uint32_t g_ShipBlock = 1024; // Ships per job, every system runs on the block in turn
+
+struct ShipHandle {
+  uint32_t slot;
+  uint32_t generation;
+};
+
+inline bool operator==(ShipHandle a, ShipHandle b) { return a.slot == b.slot && a.generation == b.generation; }
+inline bool operator!=(ShipHandle a, ShipHandle b) { return !(a == b); }
+
+const ShipHandle g_InvalidShip = {UINT32_MAX, 0};
+
+enum ShipAnimation : uint8_t {
+  ShipAnimationIdle,
+  ShipAnimationSailing,
+  ShipAnimationTurning
+};
+
+struct ShipDesc {
+  float x = 0.0f;
+  float z = 0.0f;
+  float heading = 0.0f; // Radians from +x towards +z
+  float maxSpeed = 4.0f;
+  uint32_t seed = 0;    // Picks the ship's waypoints
+};
+
+// Per-tick system parameters
+struct ShipParams {
+  HexLayout layout;
+  float areaWidth = 1024.0f;  // Waypoints are picked inside [0, areaWidth) x [0, areaHeight)
+  float areaHeight = 1024.0f;
+  float turnRate = 1.2f;      // Radians per second
+  float acceleration = 2.0f;  // Speed change per second
+  float arriveRadius = 4.0f;
+};
+
+struct ShipStore {
+  uint32_t count = 0;
+  uint32_t capacity = 0;
+
+  // Components, dense
+  float* posX = nullptr;
+  float* posZ = nullptr;
+  float* dirX = nullptr;       // Heading as a unit vector
+  float* dirZ = nullptr;
+  float* speed = nullptr;
+  float* maxSpeed = nullptr;
+  float* targetX = nullptr;    // Current waypoint
+  float* targetZ = nullptr;
+  float* animPhase = nullptr;  // 0..1, loops faster with speed
+  int32_t* cellQ = nullptr;    // Hex cell under the ship
+  int32_t* cellR = nullptr;
+  uint8_t* animState = nullptr;
+  uint32_t* seed = nullptr;
+  uint32_t* slotOf = nullptr;  // Dense index -> handle slot
+
+  // Handle slots, sparse. Every slot is either live or free, so there are
+  // never more than capacity of them.
+  uint32_t* slotDense = nullptr;
+  uint32_t* slotGeneration = nullptr;
+  uint32_t* freeSlots = nullptr;
+  uint32_t slotCount = 0;
+  uint32_t freeCount = 0;
+
+  // Every array above lives in this one block, at offsets that depend only
+  // on the capacity. The block is plain data and starts zeroed, so copying
+  // it is a complete snapshot of the store and two stores that went
+  // through the same operations hold the same bytes.
+  uint8_t* block = nullptr;
+  size_t blockSize = 0;
+
+  uint64_t tick = 0;
+
+  ShipStore() = default;
+  ShipStore(const ShipStore&) = delete;
+  ShipStore& operator=(const ShipStore&) = delete;
+
+  ~ShipStore() {
+    if (block) {
+      AlignedFree(block);
+    }
+  }
+
+  void Reserve(uint32_t newCapacity) {
+    if (newCapacity > capacity) {
+      SetCapacity(newCapacity);
+    }
+  }
+
+  // Moves the store to a block of exactly newCapacity ships, which the live
+  // ships and slots have to fit in
+  void SetCapacity(uint32_t newCapacity) {
+    assert(newCapacity >= slotCount);
+
+    size_t size = 0;
+    ForEachArray([&](auto*&, size_t elementSize, bool) {
+      size += (newCapacity * elementSize + g_CacheLineSize - 1) & ~(g_CacheLineSize - 1);
+    });
+
+    uint8_t* grown = static_cast<uint8_t*>(AlignedAlloc(size > 0 ? size : g_CacheLineSize));
+    std::memset(grown, 0, size);
+
+    size_t offset = 0;
+    ForEachArray([&](auto*& array, size_t elementSize, bool dense) {
+      uint8_t* moved = grown + offset;
+      if (array) {
+        std::memcpy(moved, array, (dense ? count : slotCount) * elementSize);
+      }
+      array = reinterpret_cast<std::remove_reference_t<decltype(array)>>(moved);
+      offset += (newCapacity * elementSize + g_CacheLineSize - 1) & ~(g_CacheLineSize - 1);
+    });
+
+    if (block) {
+      AlignedFree(block);
+    }
+    block = grown;
+    blockSize = size;
+    capacity = newCapacity;
+  }
+
+  ShipHandle Create(const ShipDesc& desc) {
+    if (count == capacity) {
+      Reserve(capacity ? capacity * 2 : g_ShipBlock);
+    }
+
+    uint32_t slot;
+    if (freeCount == 0) {
+      slot = slotCount++;
+      slotGeneration[slot] = 1;
+    }
+    else {
+      slot = freeSlots[--freeCount];
+    }
+
+    uint32_t i = count++;
+    slotDense[slot] = i;
+    slotOf[i] = slot;
+
+    posX[i] = desc.x;
+    posZ[i] = desc.z;
+    dirX[i] = std::cos(desc.heading);
+    dirZ[i] = std::sin(desc.heading);
+    speed[i] = 0.0f;
+    maxSpeed[i] = desc.maxSpeed;
+    targetX[i] = desc.x;
+    targetZ[i] = desc.z; // Arrived, the first tick picks a waypoint
+    animPhase[i] = 0.0f;
+    cellQ[i] = 0;
+    cellR[i] = 0;
+    animState[i] = ShipAnimationIdle;
+    seed[i] = desc.seed;
+
+    return {slot, slotGeneration[slot]};
+  }
+
+  bool IsAlive(ShipHandle handle) const {
+    return handle.slot < slotCount && slotGeneration[handle.slot] == handle.generation;
+  }
+
+  // Dense index of a live ship, UINT32_MAX for a stale handle. Only valid
+  // until the next Destroy().
+  uint32_t Find(ShipHandle handle) const {
+    return IsAlive(handle) ? slotDense[handle.slot] : UINT32_MAX;
+  }
+
+  bool Destroy(ShipHandle handle) {
+    if (!IsAlive(handle)) {
+      return false;
+    }
+
+    uint32_t i = slotDense[handle.slot];
+    uint32_t last = --count;
+    if (i != last) {
+      ForEachArray([&](auto*& array, size_t, bool dense) {
+        if (dense) {
+          array[i] = array[last];
+        }
+      });
+      slotDense[slotOf[i]] = i;
+    }
+
+    slotGeneration[handle.slot]++;
+    freeSlots[freeCount++] = handle.slot;
+    return true;
+  }
+
+private:
+  // Calls visit(array, element size, dense) for every array of the block,
+  // in block order. Dense arrays are indexed by ship, the rest by slot.
+  template <typename Visit>
+  void ForEachArray(Visit&& visit) {
+    visit(posX, sizeof(float), true);
+    visit(posZ, sizeof(float), true);
+    visit(dirX, sizeof(float), true);
+    visit(dirZ, sizeof(float), true);
+    visit(speed, sizeof(float), true);
+    visit(maxSpeed, sizeof(float), true);
+    visit(targetX, sizeof(float), true);
+    visit(targetZ, sizeof(float), true);
+    visit(animPhase, sizeof(float), true);
+    visit(cellQ, sizeof(int32_t), true);
+    visit(cellR, sizeof(int32_t), true);
+    visit(animState, sizeof(uint8_t), true);
+    visit(seed, sizeof(uint32_t), true);
+    visit(slotOf, sizeof(uint32_t), true);
+    visit(slotDense, sizeof(uint32_t), false);
+    visit(slotGeneration, sizeof(uint32_t), false);
+    visit(freeSlots, sizeof(uint32_t), false);
+  }
+};
+
+// Waypoints come from a hash of the ship's seed and the tick, so they do not
+// depend on the order ships are updated in
+inline uint32_t ShipHash(uint32_t seed, uint64_t tick) {
+  uint64_t x = (static_cast<uint64_t>(seed) << 32 | (tick & 0xFFFFFFFFu)) + 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return static_cast<uint32_t>(x ^ (x >> 31));
+}
+
+// Constants of one tick, shared by every block
+struct ShipTick {
+  ShipParams params;
+  float dt;
+  float cosTurn; // Largest turn of one tick
+  float sinTurn;
+  uint64_t tick;
+};
+
+// Arrived ships pick their next waypoint. Rare, so it is kept out of the
+// steering loop.
+inline void RouteShips(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t) {
+  const float arrive2 = t.params.arriveRadius * t.params.arriveRadius;
+
+  for (uint32_t i = begin; i < end; ++i) {
+    float toX = ships.targetX[i] - ships.posX[i];
+    float toZ = ships.targetZ[i] - ships.posZ[i];
+    if (toX * toX + toZ * toZ < arrive2) {
+      uint32_t hash = ShipHash(ships.seed[i], t.tick);
+      ships.targetX[i] = (hash & 0xFFFF) * (1.0f / 65536.0f) * t.params.areaWidth;
+      ships.targetZ[i] = (hash >> 16) * (1.0f / 65536.0f) * t.params.areaHeight;
+    }
+  }
+}
+
+// Turns each ship towards its waypoint by at most one tick's turn, slowing
+// down in sharp turns. Branch free - which way a ship turns is as good as
+// random, a branch on it would mispredict half the time. The SSE2 and AVX2
+// versions do the same operations in the same order, every select is a
+// min/max or a blend, so all three produce the same bits.
+inline void SteerShipsScalar(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t) {
+  const float* posX = ships.posX;
+  const float* posZ = ships.posZ;
+  const float* targetX = ships.targetX;
+  const float* targetZ = ships.targetZ;
+  const float* maxSpeed = ships.maxSpeed;
+  float* dirX = ships.dirX;
+  float* dirZ = ships.dirZ;
+  float* speed = ships.speed;
+  uint8_t* animState = ships.animState;
+  const float step = t.params.acceleration * t.dt;
+
+  for (uint32_t i = begin; i < end; ++i) {
+    float toX = targetX[i] - posX[i];
+    float toZ = targetZ[i] - posZ[i];
+    float distance2 = toX * toX + toZ * toZ;
+    float inverse = 1.0f / std::sqrt(distance2 > 1e-12f ? distance2 : 1e-12f);
+    float wantX = toX * inverse;
+    float wantZ = toZ * inverse;
+
+    float x = dirX[i];
+    float z = dirZ[i];
+    float dot = x * wantX + z * wantZ;
+    float cross = x * wantZ - z * wantX;
+
+    // One tick's turn towards the waypoint, renormalized so rounding cannot
+    // shrink the heading, or straight at it when that is closer
+    float s = cross >= 0.0f ? t.sinTurn : -t.sinTurn;
+    float turnedX = x * t.cosTurn - z * s;
+    float turnedZ = x * s + z * t.cosTurn;
+    float length = 1.0f / std::sqrt(turnedX * turnedX + turnedZ * turnedZ);
+    bool turning = dot < t.cosTurn;
+    dirX[i] = turning ? turnedX * length : wantX;
+    dirZ[i] = turning ? turnedZ * length : wantZ;
+
+    float want = maxSpeed[i] * (0.5f + 0.5f * (dot > 0.0f ? dot : 0.0f));
+    float current = speed[i];
+    float faster = current + step < want ? current + step : want;
+    float slower = current - step > want ? current - step : want;
+    speed[i] = current < want ? faster : slower;
+    animState[i] = turning ? ShipAnimationTurning : ShipAnimationSailing;
+  }
+}
+
+#if SIMD_X86
+
+inline void SteerShipsSSE2(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t) {
+  const __m128 epsilon = _mm_set1_ps(1e-12f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 cosTurn = _mm_set1_ps(t.cosTurn);
+  const __m128 sinTurn = _mm_set1_ps(t.sinTurn);
+  const __m128 negativeSinTurn = _mm_set1_ps(-t.sinTurn);
+  const __m128 step = _mm_set1_ps(t.params.acceleration * t.dt);
+
+  uint32_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 toX = _mm_sub_ps(_mm_loadu_ps(ships.targetX + i), _mm_loadu_ps(ships.posX + i));
+    __m128 toZ = _mm_sub_ps(_mm_loadu_ps(ships.targetZ + i), _mm_loadu_ps(ships.posZ + i));
+    __m128 distance2 = _mm_add_ps(_mm_mul_ps(toX, toX), _mm_mul_ps(toZ, toZ));
+    __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(distance2, epsilon)));
+    __m128 wantX = _mm_mul_ps(toX, inverse);
+    __m128 wantZ = _mm_mul_ps(toZ, inverse);
+
+    __m128 x = _mm_loadu_ps(ships.dirX + i);
+    __m128 z = _mm_loadu_ps(ships.dirZ + i);
+    __m128 dot = _mm_add_ps(_mm_mul_ps(x, wantX), _mm_mul_ps(z, wantZ));
+    __m128 cross = _mm_sub_ps(_mm_mul_ps(x, wantZ), _mm_mul_ps(z, wantX));
+
+    __m128 left = _mm_cmpge_ps(cross, zero);
+    __m128 s = _mm_or_ps(_mm_and_ps(left, sinTurn), _mm_andnot_ps(left, negativeSinTurn));
+    __m128 turnedX = _mm_sub_ps(_mm_mul_ps(x, cosTurn), _mm_mul_ps(z, s));
+    __m128 turnedZ = _mm_add_ps(_mm_mul_ps(x, s), _mm_mul_ps(z, cosTurn));
+    __m128 length = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(turnedX, turnedX), _mm_mul_ps(turnedZ, turnedZ))));
+    __m128 turning = _mm_cmplt_ps(dot, cosTurn);
+    _mm_storeu_ps(ships.dirX + i, _mm_or_ps(_mm_and_ps(turning, _mm_mul_ps(turnedX, length)), _mm_andnot_ps(turning, wantX)));
+    _mm_storeu_ps(ships.dirZ + i, _mm_or_ps(_mm_and_ps(turning, _mm_mul_ps(turnedZ, length)), _mm_andnot_ps(turning, wantZ)));
+
+    __m128 want = _mm_mul_ps(_mm_loadu_ps(ships.maxSpeed + i), _mm_add_ps(half, _mm_mul_ps(half, _mm_max_ps(dot, zero))));
+    __m128 current = _mm_loadu_ps(ships.speed + i);
+    __m128 faster = _mm_min_ps(_mm_add_ps(current, step), want);
+    __m128 slower = _mm_max_ps(_mm_sub_ps(current, step), want);
+    __m128 accelerate = _mm_cmplt_ps(current, want);
+    _mm_storeu_ps(ships.speed + i, _mm_or_ps(_mm_and_ps(accelerate, faster), _mm_andnot_ps(accelerate, slower)));
+
+    int mask = _mm_movemask_ps(turning);
+    for (int lane = 0; lane < 4; ++lane) {
+      ships.animState[i + lane] = (mask >> lane) & 1 ? ShipAnimationTurning : ShipAnimationSailing;
+    }
+  }
+
+  SteerShipsScalar(ships, i, end, t);
+}
+
+SIMD_TARGET_AVX2 inline void SteerShipsAVX2(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t) {
+  const __m256 epsilon = _mm256_set1_ps(1e-12f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 cosTurn = _mm256_set1_ps(t.cosTurn);
+  const __m256 sinTurn = _mm256_set1_ps(t.sinTurn);
+  const __m256 negativeSinTurn = _mm256_set1_ps(-t.sinTurn);
+  const __m256 step = _mm256_set1_ps(t.params.acceleration * t.dt);
+
+  uint32_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 toX = _mm256_sub_ps(_mm256_loadu_ps(ships.targetX + i), _mm256_loadu_ps(ships.posX + i));
+    __m256 toZ = _mm256_sub_ps(_mm256_loadu_ps(ships.targetZ + i), _mm256_loadu_ps(ships.posZ + i));
+    __m256 distance2 = _mm256_add_ps(_mm256_mul_ps(toX, toX), _mm256_mul_ps(toZ, toZ));
+    __m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_max_ps(distance2, epsilon)));
+    __m256 wantX = _mm256_mul_ps(toX, inverse);
+    __m256 wantZ = _mm256_mul_ps(toZ, inverse);
+
+    __m256 x = _mm256_loadu_ps(ships.dirX + i);
+    __m256 z = _mm256_loadu_ps(ships.dirZ + i);
+    __m256 dot = _mm256_add_ps(_mm256_mul_ps(x, wantX), _mm256_mul_ps(z, wantZ));
+    __m256 cross = _mm256_sub_ps(_mm256_mul_ps(x, wantZ), _mm256_mul_ps(z, wantX));
+
+    __m256 s = _mm256_blendv_ps(negativeSinTurn, sinTurn, _mm256_cmp_ps(cross, zero, _CMP_GE_OQ));
+    __m256 turnedX = _mm256_sub_ps(_mm256_mul_ps(x, cosTurn), _mm256_mul_ps(z, s));
+    __m256 turnedZ = _mm256_add_ps(_mm256_mul_ps(x, s), _mm256_mul_ps(z, cosTurn));
+    __m256 length = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(turnedX, turnedX), _mm256_mul_ps(turnedZ, turnedZ))));
+    __m256 turning = _mm256_cmp_ps(dot, cosTurn, _CMP_LT_OQ);
+    _mm256_storeu_ps(ships.dirX + i, _mm256_blendv_ps(wantX, _mm256_mul_ps(turnedX, length), turning));
+    _mm256_storeu_ps(ships.dirZ + i, _mm256_blendv_ps(wantZ, _mm256_mul_ps(turnedZ, length), turning));
+
+    __m256 want = _mm256_mul_ps(_mm256_loadu_ps(ships.maxSpeed + i), _mm256_add_ps(half, _mm256_mul_ps(half, _mm256_max_ps(dot, zero))));
+    __m256 current = _mm256_loadu_ps(ships.speed + i);
+    __m256 faster = _mm256_min_ps(_mm256_add_ps(current, step), want);
+    __m256 slower = _mm256_max_ps(_mm256_sub_ps(current, step), want);
+    _mm256_storeu_ps(ships.speed + i, _mm256_blendv_ps(slower, faster, _mm256_cmp_ps(current, want, _CMP_LT_OQ)));
+
+    int mask = _mm256_movemask_ps(turning);
+    for (int lane = 0; lane < 8; ++lane) {
+      ships.animState[i + lane] = (mask >> lane) & 1 ? ShipAnimationTurning : ShipAnimationSailing;
+    }
+  }
+
+  SteerShipsScalar(ships, i, end, t);
+}
+
+#endif
+
+inline void SteerShips(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t, SimdLevel level = GetSimdLevel()) {
+#if SIMD_X86
+  if (level == SimdLevel::AVX2) {
+    SteerShipsAVX2(ships, begin, end, t);
+    return;
+  }
+  if (level == SimdLevel::SSE2) {
+    SteerShipsSSE2(ships, begin, end, t);
+    return;
+  }
+#endif
+  SteerShipsScalar(ships, begin, end, t);
+}
+
+
+inline void MoveShips(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t) {
+  for (uint32_t i = begin; i < end; ++i) {
+    float distance = ships.speed[i] * t.dt;
+    ships.posX[i] += ships.dirX[i] * distance;
+    ships.posZ[i] += ships.dirZ[i] * distance;
+  }
+}
+
+// Hex cell under every ship, with the batched SIMD picking kernels
+inline void LocateShips(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t) {
+  PixelToHexBatch(t.params.layout, ships.posX + begin, ships.posZ + begin, end - begin, ships.cellQ + begin, ships.cellR + begin);
+}
+
+inline void AnimateShips(ShipStore& ships, uint32_t begin, uint32_t end, const ShipTick& t) {
+  for (uint32_t i = begin; i < end; ++i) {
+    float phase = ships.animPhase[i] + t.dt * (0.5f + 0.25f * ships.speed[i]);
+    ships.animPhase[i] = phase >= 1.0f ? phase - 1.0f : phase; // Less than a loop per tick
+    ships.animState[i] = ships.speed[i] < 0.05f ? static_cast<uint8_t>(ShipAnimationIdle) : ships.animState[i];
+  }
+}
+
+// One tick of every ship system. Ships must not be created or destroyed
+// while it runs.
+inline void StepShips(ShipStore& ships, const ShipParams& params, float dt, JobSystem& jobs, SimdLevel level = GetSimdLevel()) {
+  ShipTick t = {params, dt, std::cos(params.turnRate * dt), std::sin(params.turnRate * dt), ships.tick};
+
+  jobs.ParallelFor(0, ships.count, g_ShipBlock, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t block = begin; block < end; block += g_ShipBlock) {
+      uint32_t blockEnd = end - block < g_ShipBlock ? end : block + g_ShipBlock;
+      RouteShips(ships, block, blockEnd, t);
+      SteerShips(ships, block, blockEnd, t, level);
+      MoveShips(ships, block, blockEnd, t);
+      LocateShips(ships, block, blockEnd, t);
+      AnimateShips(ships, block, blockEnd, t);
+    }
+  });
+
+  ships.tick++;
+}
+
+#endif // _H_SHIPS
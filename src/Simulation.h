@@ -0,0 +1,20 @@
+#ifndef _H_SIMULATION
+#define _H_SIMULATION
+
+// Simulation - everything that advances in fixed ticks, independent of how
+// often frames are rendered
+
+#include <cstdint>
+
+struct SimulationState {
+  uint64_t tick = 0;
+  double time = 0.0; // Simulated seconds
+};
+
+// Advances the simulation by exactly one fixed step
+inline void SimulationTick(SimulationState& state, double step) {
+  state.tick++;
+  state.time = state.tick * step;
+}
+
+#endif // _H_SIMULATION
@@ -0,0 +1,891 @@
+#ifndef _H_SOFTWARE_RASTERIZER
+#define _H_SOFTWARE_RASTERIZER
+
+// Software rasterizer - draws the hex grid, ships and posed meshes on the
+// CPU into an in-memory framebuffer. Used where there is no GPU: golden
+// images from the headless build, and measuring how frame cost grows with
+// the map.
+//
+// A frame runs in two parallel stages, like a tile-based GPU:
+//   setup:  instances are expanded to clip-space triangles, clipped at the
+//           near plane and back faces culled. Every triangle is binned to
+//           the 64x64 pixel tiles its bounds touch.
+//   raster: every tile clears itself and draws its bins in order, 4 or 8
+//           pixels per step with edge functions and a depth test.
+// Setup works on fixed batches of instances and a tile reads the batches in
+// draw order, so the image does not depend on the thread count. The SIMD
+// kernels evaluate the same float expressions per pixel as the scalar one
+// (no FMA), so it does not depend on the instruction set either.
+//
+// Coverage follows the D3D rules - pixel centers, top-left fill on shared
+// edges, clockwise front faces - and shading follows the hex shaders: the
+// palette color with a lambert term per face.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "CommandRecording.h"
+#include "Helpers.h"
+#include "HexCulling.h"
+#include "HexMesh.h"
+#include "HexPicking.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Simd.h"
+
+const uint32_t g_RasterTileShift = 6;
+const uint32_t g_RasterTileSize = 1u << g_RasterTileShift;
+const uint32_t g_RasterBatchInstances = 256; // Instances per setup job
+const uint32_t g_ShipMeshTriangles = 13;     // Deck and sides, the bottom is never seen
+const float g_ShipColor[3] = {0.55f, 0.35f, 0.22f};
+
+// A triangle ready for the tiles. Edge functions and depth are planes
+// a * x + b * y + c over pixel coordinates.
+struct RasterTriangle {
+  float edgeA[3];
+  float edgeB[3];
+  float edgeC[3];
+  float depthA;
+  float depthB;
+  float depthC;
+  uint16_t minX; // Pixel bounds, inclusive
+  uint16_t minY;
+  uint16_t maxX;
+  uint16_t maxY;
+  uint32_t color;   // RGBA8
+  uint32_t topLeft; // Bit per edge, set if pixel centers exactly on the edge are inside
+};
+
+static_assert(sizeof(RasterTriangle) == 64, "One cache line per triangle");
+
+enum class RasterDrawKind : uint32_t {
+  Hexes,
+  Ships,
+  Meshes // Posed ship meshes from the CPU skinning path
+};
+
+// One draw call. The arrays are read when the frame renders.
+struct RasterDraw {
+  RasterDrawKind kind;
+  uint32_t count;
+  const HexInstance* instances; // Hexes, relative to the draw origin like the shader's
+  float scale;                  // Hexes, 2^LOD for coarse ones
+  const float* posX;            // Ships, in hex layout space
+  const float* posZ;
+  const float* dirX;
+  const float* dirZ;
+  float originX;                // Ships and meshes, subtracted like the hexes' draw origin
+  float originZ;
+  float y;                      // Ships, height of the keel
+  const HexVertex* vertices;    // Meshes, vertexCount per instance in the ships' space
+  uint32_t vertexCount;
+  const uint16_t* indices;      // Meshes, shared by every instance
+  uint32_t indexCount;
+};
+
+inline RasterDraw RasterHexDraw(const HexInstance* instances, uint32_t count, float scale) {
+  RasterDraw draw = {};
+  draw.kind = RasterDrawKind::Hexes;
+  draw.count = count;
+  draw.instances = instances;
+  draw.scale = scale;
+  return draw;
+}
+
+inline RasterDraw RasterShipDraw(const float* posX, const float* posZ, const float* dirX, const float* dirZ, uint32_t count,
+    float originX, float originZ, float y) {
+  RasterDraw draw = {};
+  draw.kind = RasterDrawKind::Ships;
+  draw.count = count;
+  draw.posX = posX;
+  draw.posZ = posZ;
+  draw.dirX = dirX;
+  draw.dirZ = dirZ;
+  draw.originX = originX;
+  draw.originZ = originZ;
+  draw.y = y;
+  return draw;
+}
+
+inline RasterDraw RasterMeshDraw(const HexVertex* vertices, uint32_t vertexCount, const uint16_t* indices, uint32_t indexCount, uint32_t count,
+    float originX, float originZ) {
+  RasterDraw draw = {};
+  draw.kind = RasterDrawKind::Meshes;
+  draw.count = count;
+  draw.vertices = vertices;
+  draw.vertexCount = vertexCount;
+  draw.indices = indices;
+  draw.indexCount = indexCount;
+  draw.originX = originX;
+  draw.originZ = originZ;
+  return draw;
+}
+
+inline uint32_t RasterDrawTriangles(const RasterDraw& draw) {
+  switch (draw.kind) {
+    case RasterDrawKind::Hexes:
+      return g_HexPrismIndexCount / 3;
+    case RasterDrawKind::Ships:
+      return g_ShipMeshTriangles;
+    default:
+      return draw.indexCount / 3;
+  }
+}
+
+// Lambert term of the hex pixel shader
+inline float RasterLight(const float normal[3]) {
+  float length = std::sqrt(g_HexLightDirection[0] * g_HexLightDirection[0] + g_HexLightDirection[1] * g_HexLightDirection[1] +
+      g_HexLightDirection[2] * g_HexLightDirection[2]);
+  float facing = -(normal[0] * g_HexLightDirection[0] + normal[1] * g_HexLightDirection[1] + normal[2] * g_HexLightDirection[2]) / length;
+  return 0.35f + 0.65f * std::min(std::max(facing, 0.0f), 1.0f);
+}
+
+inline uint32_t PackRasterColor(const float rgb[3], float light) {
+  uint32_t packed = 0xFF000000u;
+  for (int i = 0; i < 3; ++i) {
+    float value = std::min(std::max(rgb[i] * light, 0.0f), 1.0f);
+    packed |= static_cast<uint32_t>(value * 255.0f + 0.5f) << (8 * i);
+  }
+  return packed;
+}
+
+// A hull with a pointed bow along +z, 2 long. Triangles face outward
+// (clockwise seen from outside) like the hex prism's.
+struct ShipMesh {
+  float positions[g_ShipMeshTriangles][3][3];
+  float normals[g_ShipMeshTriangles][3];
+};
+
+inline void BuildShipMesh(ShipMesh& mesh) {
+  const float outline[5][2] = {{0.0f, 1.0f}, {0.35f, 0.3f}, {0.35f, -1.0f}, {-0.35f, -1.0f}, {-0.35f, 0.3f}};
+  const float deck = 0.5f;
+  const float center[3] = {0.0f, deck * 0.5f, -0.28f};
+
+  float triangles[g_ShipMeshTriangles][3][3];
+  uint32_t count = 0;
+  for (int i = 1; i < 4; ++i) {
+    const float* corners[3] = {outline[0], outline[i], outline[i + 1]};
+    for (int v = 0; v < 3; ++v) {
+      triangles[count][v][0] = corners[v][0];
+      triangles[count][v][1] = deck;
+      triangles[count][v][2] = corners[v][1];
+    }
+    count++;
+  }
+  for (int i = 0; i < 5; ++i) {
+    const float* a = outline[i];
+    const float* b = outline[(i + 1) % 5];
+    const float quad[4][3] = {{a[0], deck, a[1]}, {b[0], deck, b[1]}, {b[0], 0.0f, b[1]}, {a[0], 0.0f, a[1]}};
+    const int corners[2][3] = {{0, 1, 2}, {0, 2, 3}};
+    for (const int* triangle : corners) {
+      for (int v = 0; v < 3; ++v) {
+        std::memcpy(triangles[count][v], quad[triangle[v]], sizeof(quad[0]));
+      }
+      count++;
+    }
+  }
+
+  // The hull is convex, so a triangle faces outward when its normal points
+  // away from the center
+  for (uint32_t t = 0; t < g_ShipMeshTriangles; ++t) {
+    float (*p)[3] = triangles[t];
+    float u[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+    float w[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+    float n[3] = {u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]};
+    float out = 0.0f;
+    for (int i = 0; i < 3; ++i) {
+      out += n[i] * ((p[0][i] + p[1][i] + p[2][i]) / 3.0f - center[i]);
+    }
+    if (out < 0.0f) {
+      std::swap(p[1], p[2]);
+      for (float& value : n) {
+        value = -value;
+      }
+    }
+
+    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (int i = 0; i < 3; ++i) {
+      mesh.normals[t][i] = n[i] / length;
+    }
+    std::memcpy(mesh.positions[t], p, sizeof(mesh.positions[t]));
+  }
+}
+
+// Inside test of one edge: past it, or exactly on it and owning it
+inline bool RasterInside(float edge, uint32_t topLeft, uint32_t bit) {
+  return edge > 0.0f || (edge == 0.0f && (topLeft & bit));
+}
+
+// Draws the part of a triangle inside [x0, x1] x [y0, y1]
+inline void RasterTriangleScalar(const RasterTriangle& t, int x0, int x1, int y0, int y1, uint32_t* color, float* depth, uint32_t stride) {
+  for (int y = y0; y <= y1; ++y) {
+    float py = static_cast<float>(y) + 0.5f;
+    float b0 = t.edgeB[0] * py;
+    float b1 = t.edgeB[1] * py;
+    float b2 = t.edgeB[2] * py;
+    float bz = t.depthB * py;
+    uint32_t* colorRow = color + static_cast<size_t>(y) * stride;
+    float* depthRow = depth + static_cast<size_t>(y) * stride;
+
+    for (int x = x0; x <= x1; ++x) {
+      float px = static_cast<float>(x) + 0.5f;
+      float e0 = t.edgeA[0] * px + b0 + t.edgeC[0];
+      float e1 = t.edgeA[1] * px + b1 + t.edgeC[1];
+      float e2 = t.edgeA[2] * px + b2 + t.edgeC[2];
+      if (!RasterInside(e0, t.topLeft, 1) || !RasterInside(e1, t.topLeft, 2) || !RasterInside(e2, t.topLeft, 4)) {
+        continue;
+      }
+
+      float z = t.depthA * px + bz + t.depthC;
+      if (z < depthRow[x]) {
+        depthRow[x] = z;
+        colorRow[x] = t.color;
+      }
+    }
+  }
+}
+
+#if SIMD_X86
+inline __m128 RasterInsideSse2(__m128 edge, __m128 topLeft) {
+  __m128 zero = _mm_setzero_ps();
+  return _mm_or_ps(_mm_cmpgt_ps(edge, zero), _mm_and_ps(_mm_cmpge_ps(edge, zero), topLeft));
+}
+
+// Four pixels per step from x0 rounded down to a multiple of 4, which
+// stays inside the tile. Lanes outside [x0, x1] are masked so exactly the
+// scalar kernel's pixels are written.
+inline void RasterTriangleSse2(const RasterTriangle& t, int x0, int x1, int y0, int y1, uint32_t* color, float* depth, uint32_t stride) {
+  const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  __m128 pxMin = _mm_set1_ps(static_cast<float>(x0) + 0.5f);
+  __m128 pxMax = _mm_set1_ps(static_cast<float>(x1) + 0.5f);
+  x0 &= ~3;
+  __m128 a0 = _mm_set1_ps(t.edgeA[0]), a1 = _mm_set1_ps(t.edgeA[1]), a2 = _mm_set1_ps(t.edgeA[2]);
+  __m128 c0 = _mm_set1_ps(t.edgeC[0]), c1 = _mm_set1_ps(t.edgeC[1]), c2 = _mm_set1_ps(t.edgeC[2]);
+  __m128 za = _mm_set1_ps(t.depthA), zc = _mm_set1_ps(t.depthC);
+  __m128 tl0 = _mm_castsi128_ps(_mm_set1_epi32((t.topLeft & 1) ? -1 : 0));
+  __m128 tl1 = _mm_castsi128_ps(_mm_set1_epi32((t.topLeft & 2) ? -1 : 0));
+  __m128 tl2 = _mm_castsi128_ps(_mm_set1_epi32((t.topLeft & 4) ? -1 : 0));
+  __m128 rgba = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int32_t>(t.color)));
+
+  for (int y = y0; y <= y1; ++y) {
+    __m128 py = _mm_set1_ps(static_cast<float>(y) + 0.5f);
+    __m128 b0 = _mm_mul_ps(_mm_set1_ps(t.edgeB[0]), py);
+    __m128 b1 = _mm_mul_ps(_mm_set1_ps(t.edgeB[1]), py);
+    __m128 b2 = _mm_mul_ps(_mm_set1_ps(t.edgeB[2]), py);
+    __m128 bz = _mm_mul_ps(_mm_set1_ps(t.depthB), py);
+    uint32_t* colorRow = color + static_cast<size_t>(y) * stride;
+    float* depthRow = depth + static_cast<size_t>(y) * stride;
+
+    for (int x = x0; x <= x1; x += 4) {
+      __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+      __m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, px), b0), c0);
+      __m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a1, px), b1), c1);
+      __m128 e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a2, px), b2), c2);
+      __m128 inside = _mm_and_ps(_mm_and_ps(RasterInsideSse2(e0, tl0), RasterInsideSse2(e1, tl1)), RasterInsideSse2(e2, tl2));
+      inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(px, pxMin), _mm_cmple_ps(px, pxMax)));
+      if (_mm_movemask_ps(inside) == 0) {
+        continue;
+      }
+
+      __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(za, px), bz), zc);
+      __m128 d = _mm_loadu_ps(depthRow + x);
+      __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(z, d));
+      _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, d)));
+      __m128 c = _mm_loadu_ps(reinterpret_cast<const float*>(colorRow + x));
+      _mm_storeu_ps(reinterpret_cast<float*>(colorRow + x), _mm_or_ps(_mm_and_ps(pass, rgba), _mm_andnot_ps(pass, c)));
+    }
+  }
+}
+
+SIMD_TARGET_AVX2 inline __m256 RasterInsideAvx2(__m256 edge, __m256 topLeft) {
+  __m256 zero = _mm256_setzero_ps();
+  return _mm256_or_ps(_mm256_cmp_ps(edge, zero, _CMP_GT_OQ), _mm256_and_ps(_mm256_cmp_ps(edge, zero, _CMP_GE_OQ), topLeft));
+}
+
+// Eight pixels per step, same expressions as the scalar kernel
+SIMD_TARGET_AVX2 inline void RasterTriangleAvx2(const RasterTriangle& t, int x0, int x1, int y0, int y1, uint32_t* color, float* depth, uint32_t stride) {
+  const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  __m256 pxMin = _mm256_set1_ps(static_cast<float>(x0) + 0.5f);
+  __m256 pxMax = _mm256_set1_ps(static_cast<float>(x1) + 0.5f);
+  x0 &= ~7;
+  __m256 a0 = _mm256_set1_ps(t.edgeA[0]), a1 = _mm256_set1_ps(t.edgeA[1]), a2 = _mm256_set1_ps(t.edgeA[2]);
+  __m256 c0 = _mm256_set1_ps(t.edgeC[0]), c1 = _mm256_set1_ps(t.edgeC[1]), c2 = _mm256_set1_ps(t.edgeC[2]);
+  __m256 za = _mm256_set1_ps(t.depthA), zc = _mm256_set1_ps(t.depthC);
+  __m256 tl0 = _mm256_castsi256_ps(_mm256_set1_epi32((t.topLeft & 1) ? -1 : 0));
+  __m256 tl1 = _mm256_castsi256_ps(_mm256_set1_epi32((t.topLeft & 2) ? -1 : 0));
+  __m256 tl2 = _mm256_castsi256_ps(_mm256_set1_epi32((t.topLeft & 4) ? -1 : 0));
+  __m256 rgba = _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int32_t>(t.color)));
+
+  for (int y = y0; y <= y1; ++y) {
+    __m256 py = _mm256_set1_ps(static_cast<float>(y) + 0.5f);
+    __m256 b0 = _mm256_mul_ps(_mm256_set1_ps(t.edgeB[0]), py);
+    __m256 b1 = _mm256_mul_ps(_mm256_set1_ps(t.edgeB[1]), py);
+    __m256 b2 = _mm256_mul_ps(_mm256_set1_ps(t.edgeB[2]), py);
+    __m256 bz = _mm256_mul_ps(_mm256_set1_ps(t.depthB), py);
+    uint32_t* colorRow = color + static_cast<size_t>(y) * stride;
+    float* depthRow = depth + static_cast<size_t>(y) * stride;
+
+    for (int x = x0; x <= x1; x += 8) {
+      __m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets);
+      __m256 e0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, px), b0), c0);
+      __m256 e1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a1, px), b1), c1);
+      __m256 e2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a2, px), b2), c2);
+      __m256 inside = _mm256_and_ps(_mm256_and_ps(RasterInsideAvx2(e0, tl0), RasterInsideAvx2(e1, tl1)), RasterInsideAvx2(e2, tl2));
+      inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(px, pxMin, _CMP_GE_OQ), _mm256_cmp_ps(px, pxMax, _CMP_LE_OQ)));
+      if (_mm256_movemask_ps(inside) == 0) {
+        continue;
+      }
+
+      __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(za, px), bz), zc);
+      __m256 d = _mm256_loadu_ps(depthRow + x);
+      __m256 pass = _mm256_and_ps(inside, _mm256_cmp_ps(z, d, _CMP_LT_OQ));
+      _mm256_storeu_ps(depthRow + x, _mm256_blendv_ps(d, z, pass));
+      __m256 c = _mm256_loadu_ps(reinterpret_cast<const float*>(colorRow + x));
+      _mm256_storeu_ps(reinterpret_cast<float*>(colorRow + x), _mm256_blendv_ps(c, rgba, pass));
+    }
+  }
+}
+#endif
+
+// Setup output of one batch of instances. The triangles of tile t are
+// entries[tileStarts[t], tileStarts[t + 1]).
+struct RasterBatch {
+  uint32_t draw;
+  uint32_t first;
+  uint32_t count;
+  uint32_t culled;
+  uint32_t clipped;
+  std::vector<RasterTriangle> triangles;
+  std::vector<uint32_t> tileStarts;
+  std::vector<uint32_t> entries;
+};
+
+struct RasterStats {
+  uint64_t frames = 0;
+  uint64_t triangles = 0;  // Last frame, submitted
+  uint64_t culled = 0;     // Back faces, outside the frustum or between pixel centers
+  uint64_t clipped = 0;    // Crossed the near plane
+  uint64_t binEntries = 0; // Triangle-tile pairs
+  double setupMicroseconds = 0.0;
+  double rasterMicroseconds = 0.0;
+  double totalSetupMicroseconds = 0.0;
+  double totalRasterMicroseconds = 0.0;
+};
+
+struct SoftwareRasterizer {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t tilesX = 0;
+  uint32_t tilesY = 0;
+  uint32_t stride = 0; // Pixels per row, whole tiles
+  uint32_t* color = nullptr;
+  float* depth = nullptr;
+
+  float viewProjection[16] = {};
+  uint32_t clearColor = 0xFF000000u;
+  SimdLevel level = GetSimdLevel();
+  std::vector<RasterDraw> draws;
+  std::vector<RasterBatch> batches;
+  uint32_t batchCount = 0;
+  RasterStats stats;
+
+  HexVertex prismVertices[g_HexPrismVertexCount];
+  uint16_t prismIndices[g_HexPrismIndexCount];
+  uint32_t hexColors[8][7]; // By material & 7, then top and the six sides
+  ShipMesh shipMesh;
+
+  SoftwareRasterizer() = default;
+  SoftwareRasterizer(const SoftwareRasterizer&) = delete;
+  SoftwareRasterizer& operator=(const SoftwareRasterizer&) = delete;
+
+  ~SoftwareRasterizer() {
+    Release();
+  }
+
+  void Init(uint32_t framebufferWidth, uint32_t framebufferHeight) {
+    Release();
+
+    width = std::max(1u, framebufferWidth);
+    height = std::max(1u, framebufferHeight);
+    tilesX = (width + g_RasterTileSize - 1) >> g_RasterTileShift;
+    tilesY = (height + g_RasterTileSize - 1) >> g_RasterTileShift;
+    stride = tilesX * g_RasterTileSize;
+    size_t pixels = static_cast<size_t>(stride) * tilesY * g_RasterTileSize;
+    color = static_cast<uint32_t*>(AlignedAlloc(pixels * sizeof(uint32_t)));
+    depth = static_cast<float*>(AlignedAlloc(pixels * sizeof(float)));
+    std::fill(color, color + pixels, clearColor);
+    std::fill(depth, depth + pixels, 1.0f);
+
+    BuildHexPrismMesh(prismVertices, prismIndices);
+    for (uint32_t material = 0; material < 8; ++material) {
+      hexColors[material][0] = PackRasterColor(g_HexPalette[material], RasterLight(prismVertices[0].normal));
+      for (uint32_t side = 0; side < 6; ++side) {
+        hexColors[material][1 + side] = PackRasterColor(g_HexPalette[material], RasterLight(prismVertices[6 + side * 4].normal));
+      }
+    }
+    BuildShipMesh(shipMesh);
+  }
+
+  uint32_t TileCount() const {
+    return tilesX * tilesY;
+  }
+
+  // Starts a frame, draws queue up until Render()
+  void BeginFrame(const float frameViewProjection[16], uint32_t clearRgba = 0xFF000000u) {
+    std::memcpy(viewProjection, frameViewProjection, sizeof(viewProjection));
+    clearColor = clearRgba;
+    draws.clear();
+  }
+
+  void Draw(const RasterDraw& draw) {
+    if (draw.count > 0) {
+      draws.push_back(draw);
+    }
+  }
+
+  void Render(JobSystem& jobs) {
+    PROFILE_ZONE("SoftwareRasterizer::Render");
+
+    batchCount = 0;
+    for (uint32_t i = 0; i < draws.size(); ++i) {
+      for (uint32_t first = 0; first < draws[i].count; first += g_RasterBatchInstances) {
+        if (batchCount == batches.size()) {
+          batches.emplace_back();
+        }
+        RasterBatch& batch = batches[batchCount++];
+        batch.draw = i;
+        batch.first = first;
+        batch.count = std::min(g_RasterBatchInstances, draws[i].count - first);
+      }
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    jobs.ParallelFor(0, batchCount, 1, [this](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        SetupBatch(batches[i]);
+      }
+    });
+    auto t1 = std::chrono::steady_clock::now();
+    jobs.ParallelFor(0, TileCount(), 1, [this](uint32_t begin, uint32_t end) {
+      for (uint32_t tile = begin; tile < end; ++tile) {
+        RasterTile(tile);
+      }
+    });
+    auto t2 = std::chrono::steady_clock::now();
+
+    stats.frames++;
+    stats.triangles = stats.culled = stats.clipped = stats.binEntries = 0;
+    for (uint32_t i = 0; i < batchCount; ++i) {
+      const RasterBatch& batch = batches[i];
+      stats.triangles += static_cast<uint64_t>(batch.count) * RasterDrawTriangles(draws[batch.draw]);
+      stats.culled += batch.culled;
+      stats.clipped += batch.clipped;
+      stats.binEntries += batch.entries.size();
+    }
+    stats.setupMicroseconds = std::chrono::duration<double, std::micro>(t1 - t0).count();
+    stats.rasterMicroseconds = std::chrono::duration<double, std::micro>(t2 - t1).count();
+    stats.totalSetupMicroseconds += stats.setupMicroseconds;
+    stats.totalRasterMicroseconds += stats.rasterMicroseconds;
+  }
+
+  // The visible part of the framebuffer as tightly packed RGB
+  void ReadRgb(uint8_t* rgb) const {
+    for (uint32_t y = 0; y < height; ++y) {
+      const uint32_t* row = color + static_cast<size_t>(y) * stride;
+      for (uint32_t x = 0; x < width; ++x) {
+        *rgb++ = static_cast<uint8_t>(row[x]);
+        *rgb++ = static_cast<uint8_t>(row[x] >> 8);
+        *rgb++ = static_cast<uint8_t>(row[x] >> 16);
+      }
+    }
+  }
+
+  uint64_t Hash() const {
+    uint64_t hash = HashBytes(nullptr, 0);
+    for (uint32_t y = 0; y < height; ++y) {
+      hash = HashBytes(color + static_cast<size_t>(y) * stride, width * sizeof(uint32_t), hash);
+    }
+    return hash;
+  }
+
+private:
+  void Release() {
+    if (color) {
+      AlignedFree(color);
+      AlignedFree(depth);
+    }
+    color = nullptr;
+    depth = nullptr;
+  }
+
+  void SetupBatch(RasterBatch& batch) {
+    batch.triangles.clear();
+    batch.culled = 0;
+    batch.clipped = 0;
+
+    const RasterDraw& draw = draws[batch.draw];
+    if (draw.kind == RasterDrawKind::Hexes) {
+      SetupHexes(batch, draw);
+    }
+    else if (draw.kind == RasterDrawKind::Ships) {
+      SetupShips(batch, draw);
+    }
+    else {
+      SetupMeshes(batch, draw);
+    }
+    Bin(batch);
+  }
+
+  // The hex shader's placement. Clip space is linear, so a vertex is the
+  // instance's base point plus a per-draw corner offset plus the height.
+  void SetupHexes(RasterBatch& batch, const RasterDraw& draw) {
+    const float* m = viewProjection;
+    float offsets[g_HexPrismVertexCount][4];
+    bool top[g_HexPrismVertexCount];
+    for (uint32_t v = 0; v < g_HexPrismVertexCount; ++v) {
+      float x = prismVertices[v].position[0] * draw.scale;
+      float z = prismVertices[v].position[2] * draw.scale;
+      for (int j = 0; j < 4; ++j) {
+        offsets[v][j] = x * m[j] + z * m[8 + j];
+      }
+      top[v] = prismVertices[v].position[1] > 0.5f;
+    }
+
+    for (uint32_t i = batch.first; i < batch.first + batch.count; ++i) {
+      const HexInstance& instance = draw.instances[i];
+      float centerX = g_Sqrt3 * (instance.q + 0.5f * instance.r);
+      float centerZ = 1.5f * instance.r;
+      float height = std::max(instance.height / g_HexHeightScale, g_HexMinWorldHeight);
+
+      float base[4];
+      float raise[4];
+      for (int j = 0; j < 4; ++j) {
+        base[j] = centerX * m[j] + centerZ * m[8 + j] + m[12 + j];
+        raise[j] = height * m[4 + j];
+      }
+
+      float clip[g_HexPrismVertexCount][4];
+      for (uint32_t v = 0; v < g_HexPrismVertexCount; ++v) {
+        for (int j = 0; j < 4; ++j) {
+          clip[v][j] = base[j] + offsets[v][j] + (top[v] ? raise[j] : 0.0f);
+        }
+      }
+
+      uint32_t outcodes[g_HexPrismVertexCount];
+      uint32_t outsideAll = ~0u;
+      uint32_t outsideAny = 0;
+      for (uint32_t v = 0; v < g_HexPrismVertexCount; ++v) {
+        outcodes[v] = Outcode(clip[v]);
+        outsideAll &= outcodes[v];
+        outsideAny |= outcodes[v];
+      }
+      if (outsideAll) {
+        batch.culled += g_HexPrismIndexCount / 3;
+        continue;
+      }
+
+      const uint32_t* colors = hexColors[instance.material & 7];
+      if (outsideAny & 16) {
+        for (uint32_t t = 0; t < g_HexPrismIndexCount / 3; ++t) {
+          const uint16_t* index = prismIndices + t * 3;
+          SetupTriangle(batch, clip[index[0]], clip[index[1]], clip[index[2]], colors[t < 4 ? 0 : 1 + (t - 4) / 2]);
+        }
+        continue;
+      }
+
+      // In front of the near plane, every vertex is projected once instead
+      // of once per triangle
+      float screen[g_HexPrismVertexCount][3];
+      for (uint32_t v = 0; v < g_HexPrismVertexCount; ++v) {
+        Project(clip[v], screen[v]);
+      }
+      for (uint32_t t = 0; t < g_HexPrismIndexCount / 3; ++t) {
+        const uint16_t* index = prismIndices + t * 3;
+        if (outcodes[index[0]] & outcodes[index[1]] & outcodes[index[2]]) {
+          batch.culled++;
+          continue;
+        }
+        EmitTriangle(batch, screen[index[0]], screen[index[1]], screen[index[2]], colors[t < 4 ? 0 : 1 + (t - 4) / 2]);
+      }
+    }
+  }
+
+  void SetupShips(RasterBatch& batch, const RasterDraw& draw) {
+    const float* m = viewProjection;
+    for (uint32_t i = batch.first; i < batch.first + batch.count; ++i) {
+      float x = draw.posX[i] - draw.originX;
+      float z = draw.posZ[i] - draw.originZ;
+      float forwardX = draw.dirX[i];
+      float forwardZ = draw.dirZ[i];
+
+      for (uint32_t t = 0; t < g_ShipMeshTriangles; ++t) {
+        float clip[3][4];
+        for (int v = 0; v < 3; ++v) {
+          const float* local = shipMesh.positions[t][v];
+          float world[3] = {x + local[0] * forwardZ + local[2] * forwardX, draw.y + local[1], z - local[0] * forwardX + local[2] * forwardZ};
+          for (int j = 0; j < 4; ++j) {
+            clip[v][j] = world[0] * m[j] + world[1] * m[4 + j] + world[2] * m[8 + j] + m[12 + j];
+          }
+        }
+
+        const float* n = shipMesh.normals[t];
+        float normal[3] = {n[0] * forwardZ + n[2] * forwardX, n[1], -n[0] * forwardX + n[2] * forwardZ};
+        SetupTriangle(batch, clip[0], clip[1], clip[2], PackRasterColor(g_ShipColor, RasterLight(normal)));
+      }
+    }
+  }
+
+  // Flat shaded with the normal of each triangle's first vertex
+  void SetupMeshes(RasterBatch& batch, const RasterDraw& draw) {
+    const float* m = viewProjection;
+    for (uint32_t i = batch.first; i < batch.first + batch.count; ++i) {
+      const HexVertex* vertices = draw.vertices + static_cast<size_t>(i) * draw.vertexCount;
+      for (uint32_t t = 0; t + 2 < draw.indexCount; t += 3) {
+        float clip[3][4];
+        for (int v = 0; v < 3; ++v) {
+          const float* p = vertices[draw.indices[t + v]].position;
+          float x = p[0] - draw.originX;
+          float z = p[2] - draw.originZ;
+          for (int j = 0; j < 4; ++j) {
+            clip[v][j] = x * m[j] + p[1] * m[4 + j] + z * m[8 + j] + m[12 + j];
+          }
+        }
+        SetupTriangle(batch, clip[0], clip[1], clip[2], PackRasterColor(g_ShipColor, RasterLight(vertices[draw.indices[t]].normal)));
+      }
+    }
+  }
+
+  static uint32_t Outcode(const float* c) {
+    return (c[0] < -c[3] ? 1u : 0u) | (c[0] > c[3] ? 2u : 0u) | (c[1] < -c[3] ? 4u : 0u) | (c[1] > c[3] ? 8u : 0u) |
+        (c[2] < 0.0f ? 16u : 0u) | (c[2] > c[3] ? 32u : 0u);
+  }
+
+  void SetupTriangle(RasterBatch& batch, const float* c0, const float* c1, const float* c2, uint32_t rgba) {
+    uint32_t o0 = Outcode(c0);
+    uint32_t o1 = Outcode(c1);
+    uint32_t o2 = Outcode(c2);
+    if (o0 & o1 & o2) {
+      batch.culled++;
+      return;
+    }
+
+    float screen[4][3];
+    if (!((o0 | o1 | o2) & 16)) {
+      Project(c0, screen[0]);
+      Project(c1, screen[1]);
+      Project(c2, screen[2]);
+      EmitTriangle(batch, screen[0], screen[1], screen[2], rgba);
+      return;
+    }
+
+    // Clip against the near plane z = 0, a triangle becomes one or two
+    batch.clipped++;
+    const float* in[3] = {c0, c1, c2};
+    float out[4][4];
+    uint32_t count = 0;
+    for (int i = 0; i < 3; ++i) {
+      const float* a = in[i];
+      const float* b = in[(i + 1) % 3];
+      if (a[2] >= 0.0f) {
+        std::memcpy(out[count++], a, sizeof(out[0]));
+      }
+      if ((a[2] >= 0.0f) != (b[2] >= 0.0f)) {
+        float t = a[2] / (a[2] - b[2]);
+        for (int j = 0; j < 4; ++j) {
+          out[count][j] = a[j] + (b[j] - a[j]) * t;
+        }
+        out[count++][2] = 0.0f;
+      }
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+      Project(out[i], screen[i]);
+    }
+    for (uint32_t i = 2; i < count; ++i) {
+      EmitTriangle(batch, screen[0], screen[i - 1], screen[i], rgba);
+    }
+  }
+
+  // Clip space to pixel coordinates and depth
+  void Project(const float* clip, float* screen) const {
+    float invW = 1.0f / clip[3];
+    screen[0] = (clip[0] * invW * 0.5f + 0.5f) * width;
+    screen[1] = (0.5f - clip[1] * invW * 0.5f) * height;
+    screen[2] = clip[2] * invW;
+  }
+
+  void EmitTriangle(RasterBatch& batch, const float* s0, const float* s1, const float* s2, uint32_t rgba) {
+    const float x[3] = {s0[0], s1[0], s2[0]};
+    const float y[3] = {s0[1], s1[1], s2[1]};
+    const float z[3] = {s0[2], s1[2], s2[2]};
+
+    // Clockwise on screen, with y down, is a positive area
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(area > 0.0f)) {
+      batch.culled++;
+      return;
+    }
+
+    // Pixel centers inside the bounds, clamped to the framebuffer
+    float minX = std::max(std::min({x[0], x[1], x[2]}) - 0.5f, 0.0f);
+    float minY = std::max(std::min({y[0], y[1], y[2]}) - 0.5f, 0.0f);
+    float maxX = std::min(std::max({x[0], x[1], x[2]}) - 0.5f, static_cast<float>(width - 1));
+    float maxY = std::min(std::max({y[0], y[1], y[2]}) - 0.5f, static_cast<float>(height - 1));
+    if (!(minX <= maxX && minY <= maxY)) {
+      batch.culled++;
+      return;
+    }
+
+    RasterTriangle t;
+    t.minX = static_cast<uint16_t>(std::ceil(minX));
+    t.minY = static_cast<uint16_t>(std::ceil(minY));
+    t.maxX = static_cast<uint16_t>(std::floor(maxX));
+    t.maxY = static_cast<uint16_t>(std::floor(maxY));
+    if (t.minX > t.maxX || t.minY > t.maxY) {
+      batch.culled++;
+      return;
+    }
+
+    // Edge k is opposite vertex k. Swapping an edge's ends negates a, b and
+    // c exactly, so neighbors sharing the edge agree on every pixel.
+    t.topLeft = 0;
+    for (int k = 0; k < 3; ++k) {
+      int i = (k + 1) % 3;
+      int j = (k + 2) % 3;
+      t.edgeA[k] = y[i] - y[j];
+      t.edgeB[k] = x[j] - x[i];
+      t.edgeC[k] = x[i] * y[j] - y[i] * x[j];
+      bool topLeft = t.edgeA[k] > 0.0f || (t.edgeA[k] == 0.0f && t.edgeB[k] > 0.0f);
+      t.topLeft |= topLeft ? 1u << k : 0u;
+    }
+
+    // Depth gradients from differences to vertex 0 - the edge constants are
+    // in the millions and would cancel away the few bits depth varies in
+    float invArea = 1.0f / area;
+    t.depthA = (t.edgeA[1] * (z[1] - z[0]) + t.edgeA[2] * (z[2] - z[0])) * invArea;
+    t.depthB = (t.edgeB[1] * (z[1] - z[0]) + t.edgeB[2] * (z[2] - z[0])) * invArea;
+    t.depthC = z[0] - t.depthA * x[0] - t.depthB * y[0];
+    t.color = rgba;
+    batch.triangles.push_back(t);
+  }
+
+  // Counts the triangles of every tile, then scatters their indices
+  void Bin(RasterBatch& batch) {
+    batch.tileStarts.assign(TileCount() + 1, 0);
+    for (const RasterTriangle& t : batch.triangles) {
+      for (uint32_t ty = t.minY >> g_RasterTileShift; ty <= (t.maxY >> g_RasterTileShift); ++ty) {
+        for (uint32_t tx = t.minX >> g_RasterTileShift; tx <= (t.maxX >> g_RasterTileShift); ++tx) {
+          batch.tileStarts[ty * tilesX + tx + 1]++;
+        }
+      }
+    }
+    for (uint32_t tile = 0; tile < TileCount(); ++tile) {
+      batch.tileStarts[tile + 1] += batch.tileStarts[tile];
+    }
+
+    batch.entries.resize(batch.tileStarts[TileCount()]);
+    for (uint32_t i = 0; i < batch.triangles.size(); ++i) {
+      const RasterTriangle& t = batch.triangles[i];
+      for (uint32_t ty = t.minY >> g_RasterTileShift; ty <= (t.maxY >> g_RasterTileShift); ++ty) {
+        for (uint32_t tx = t.minX >> g_RasterTileShift; tx <= (t.maxX >> g_RasterTileShift); ++tx) {
+          batch.entries[batch.tileStarts[ty * tilesX + tx]++] = i;
+        }
+      }
+    }
+
+    // The scatter advanced every start to the next tile's
+    for (uint32_t tile = TileCount(); tile > 0; --tile) {
+      batch.tileStarts[tile] = batch.tileStarts[tile - 1];
+    }
+    batch.tileStarts[0] = 0;
+  }
+
+  void RasterTile(uint32_t tile) {
+    int x0 = static_cast<int>((tile % tilesX) << g_RasterTileShift);
+    int y0 = static_cast<int>((tile / tilesX) << g_RasterTileShift);
+    int x1 = x0 + static_cast<int>(g_RasterTileSize) - 1;
+    int y1 = y0 + static_cast<int>(g_RasterTileSize) - 1;
+
+    for (int y = y0; y <= y1; ++y) {
+      std::fill(color + static_cast<size_t>(y) * stride + x0, color + static_cast<size_t>(y) * stride + x1 + 1, clearColor);
+      std::fill(depth + static_cast<size_t>(y) * stride + x0, depth + static_cast<size_t>(y) * stride + x1 + 1, 1.0f);
+    }
+
+    for (uint32_t b = 0; b < batchCount; ++b) {
+      const RasterBatch& batch = batches[b];
+      for (uint32_t e = batch.tileStarts[tile]; e < batch.tileStarts[tile + 1]; ++e) {
+        const RasterTriangle& t = batch.triangles[batch.entries[e]];
+        int rx0 = std::max<int>(t.minX, x0);
+        int ry0 = std::max<int>(t.minY, y0);
+        int rx1 = std::min<int>(t.maxX, x1);
+        int ry1 = std::min<int>(t.maxY, y1);
+
+        switch (level) {
+#if SIMD_X86
+          case SimdLevel::AVX2:
+            RasterTriangleAvx2(t, rx0, rx1, ry0, ry1, color, depth, stride);
+            break;
+          case SimdLevel::SSE2:
+            RasterTriangleSse2(t, rx0, rx1, ry0, ry1, color, depth, stride);
+            break;
+#endif
+          default:
+            RasterTriangleScalar(t, rx0, rx1, ry0, ry1, color, depth, stride);
+            break;
+        }
+      }
+    }
+  }
+};
+
+// Pixels of two RGB images that differ by more than tolerance in a channel.
+// Golden image tests allow a little slack so a rounding change in the
+// shading does not fail them.
+inline uint64_t CountDifferentPixels(const uint8_t* a, const uint8_t* b, uint32_t width, uint32_t height, int tolerance) {
+  uint64_t different = 0;
+  for (size_t i = 0; i < static_cast<size_t>(width) * height * 3; i += 3) {
+    different += (std::abs(a[i] - b[i]) > tolerance || std::abs(a[i + 1] - b[i + 1]) > tolerance || std::abs(a[i + 2] - b[i + 2]) > tolerance) ? 1 : 0;
+  }
+  return different;
+}
+
+// The rasterizer as a command backend. Lists hold draws, and executing them
+// renders the frame right away on the job system - the "GPU" is done when
+// Execute() returns. Allocators have nothing to free.
+struct SoftwareCommandBackend : CommandBackend {
+  SoftwareRasterizer rasterizer;
+  JobSystem* jobs = nullptr;
+  std::vector<std::vector<RasterDraw>> lists;
+
+  void Reserve(uint32_t, uint32_t listCount) override {
+    lists.assign(listCount, {});
+  }
+
+  void ResetAllocator(uint32_t) override {}
+
+  void BeginList(uint32_t list, uint32_t) override {
+    lists[list].clear();
+  }
+
+  void EndList(uint32_t) override {}
+
+  void Execute(const uint32_t* indices, uint32_t count) override {
+    for (uint32_t i = 0; i < count; ++i) {
+      for (const RasterDraw& draw : lists[indices[i]]) {
+        rasterizer.Draw(draw);
+      }
+    }
+    rasterizer.Render(*jobs);
+  }
+
+  void Draw(uint32_t list, const RasterDraw& draw) {
+    lists[list].push_back(draw);
+  }
+};
+
+#endif // _H_SOFTWARE_RASTERIZER
@@ -0,0 +1,3463 @@
+// Benchmark executable - headless microbenchmarks of the engine subsystems.
+//
+//   bench [scenario ...] [--size N]
+//
+// Without scenario names every scenario is run.
+//
+//   bench --suite [--samples N] [--json out.json] [--baseline in.json] [--threshold PERCENT]
+//
+// runs the regression suite instead: a fixed, small workload per hot path,
+// timed N times (15 by default) after a warm-up run. --json writes the
+// samples and their statistics, --baseline compares against such a file and
+// fails if a case got slower than the threshold (10% by default) beyond
+// the noise of both runs, or computed a different result. A baseline from
+// another SIMD level or thread count fails the run without comparing.
+// bench.sh and bench.bat wrap this with a baseline per machine.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AssetArchive.h"
+#include "AssetStreaming.h"
+#include "Bench.h"
+#include "Camera.h"
+#include "CommandRecording.h"
+#include "FrameMemory.h"
+#include "HexCulling.h"
+#include "HexGrid.h"
+#include "HexLod.h"
+#include "HexMesh.h"
+#include "HexPathfinding.h"
+#include "HexPicking.h"
+#include "HexShaders.h"
+#include "HexRemesh.h"
+#include "HexSpatialHash.h"
+#include "HexWater.h"
+#include "HexWorld.h"
+#include "InputRecording.h"
+#include "JobSystem.h"
+#include "Lockstep.h"
+#include "PipelineCache.h"
+#include "ShaderArchive.h"
+#include "ShipAnimation.h"
+#include "Ships.h"
+#include "SoftwareRasterizer.h"
+
+struct BenchOptions {
+  uint32_t size = 0; // Scenario specific problem size, 0 picks the default
+};
+
+// Fills the grid with deterministic pseudo-random terrain
+void FillRandomTerrain(HexGrid& grid, uint64_t seed) {
+  Random random(seed);
+  grid.ForEachTile([&](uint32_t index, HexOffset) {
+    grid.heights[index] = random.NextFloat() * 16.0f;
+    grid.materials[index] = static_cast<uint8_t>(random.NextBelow(4));
+  });
+}
+
+// Neighbor lookups at random tiles and full-grid neighbor sweeps
+bool BenchHexGrid(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 2048;
+  HexGrid grid(size, size);
+  FillRandomTerrain(grid, 1);
+
+  // Random neighbor queries
+  {
+    const uint32_t queryCount = 1u << 20;
+    Random random(2);
+    std::vector<HexOffset> queries(queryCount);
+    for (HexOffset& query : queries) {
+      query = {static_cast<int32_t>(random.NextBelow(size)), static_cast<int32_t>(random.NextBelow(size))};
+    }
+
+    BenchTimer timer;
+    double sum = 0.0;
+    for (HexOffset query : queries) {
+      for (int direction = 0; direction < 6; ++direction) {
+        uint32_t neighbor = grid.Neighbor(query, direction);
+        sum += neighbor != g_InvalidTile ? grid.heights[neighbor] : 0.0f;
+      }
+    }
+    double elapsed = timer.ElapsedNanoseconds();
+    DoNotOptimize(sum);
+
+    BenchReport("hexgrid", "random neighbor query", elapsed / (queryCount * 6.0), "ns");
+  }
+
+  // Full sweep in memory order, every tile averages its six neighbors
+  {
+    const int sweeps = 4;
+    BenchTimer timer;
+    double sum = 0.0;
+    for (int sweep = 0; sweep < sweeps; ++sweep) {
+      grid.ForEachTile([&](uint32_t index, HexOffset coord) {
+        uint32_t neighbors[6];
+        grid.Neighbors(coord, neighbors);
+
+        float total = 0.0f;
+        for (uint32_t neighbor : neighbors) {
+          total += neighbor != g_InvalidTile ? grid.heights[neighbor] : grid.heights[index];
+        }
+        sum += total;
+      });
+    }
+    double elapsed = timer.ElapsedNanoseconds() / sweeps;
+    DoNotOptimize(sum);
+
+    BenchReport("hexgrid", "full-grid neighbor sweep", elapsed * 1e-6, "ms");
+    BenchReport("hexgrid", "full-grid neighbor sweep per tile", elapsed / (static_cast<double>(size) * size), "ns");
+  }
+
+  // Spiral iteration and distance kernels
+  {
+    const int32_t radius = 64;
+    HexAxial center = OffsetToAxial({static_cast<int32_t>(size / 2), static_cast<int32_t>(size / 2)});
+    BenchTimer timer;
+    int64_t sum = 0;
+    HexSpiral(center, radius, [&](HexAxial hex) {
+      sum += HexDistance(hex, center);
+    });
+    double elapsed = timer.ElapsedNanoseconds();
+    DoNotOptimize(static_cast<double>(sum));
+
+    BenchReport("hexgrid", "spiral + distance per hex", elapsed / HexSpiralCount(radius), "ns");
+  }
+
+  return true;
+}
+
+// Batch pixel-to-hex conversion per instruction set, checked bit-exact
+// against the scalar version
+bool BenchPicking(const BenchOptions& options) {
+  size_t count = options.size ? options.size : 10000000;
+  HexLayout layout = {24.0f, -310.0f, 125.0f};
+
+  std::vector<float> xs(count);
+  std::vector<float> ys(count);
+  Random random(3);
+  for (size_t i = 0; i < count; ++i) {
+    // Every 16th point sits exactly on a hex center or corner to exercise ties
+    if ((i & 15) == 0) {
+      HexAxial hex = {static_cast<int32_t>(random.NextBelow(512)) - 256, static_cast<int32_t>(random.NextBelow(512)) - 256};
+      HexToPixel(layout, hex, xs[i], ys[i]);
+      xs[i] += (i & 16) ? layout.size * g_Sqrt3 * 0.5f : 0.0f;
+      ys[i] += (i & 32) ? layout.size * 0.5f : 0.0f;
+    }
+    else {
+      xs[i] = (random.NextFloat() - 0.5f) * 20000.0f;
+      ys[i] = (random.NextFloat() - 0.5f) * 20000.0f;
+    }
+  }
+
+  std::vector<int32_t> referenceQ(count);
+  std::vector<int32_t> referenceR(count);
+  std::vector<int32_t> qs(count);
+  std::vector<int32_t> rs(count);
+
+  bool exact = true;
+  SimdLevel levels[] = {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2};
+  for (SimdLevel level : levels) {
+    if (level > GetSimdLevel()) {
+      continue;
+    }
+
+    int32_t* outQ = level == SimdLevel::Scalar ? referenceQ.data() : qs.data();
+    int32_t* outR = level == SimdLevel::Scalar ? referenceR.data() : rs.data();
+
+    BenchTimer timer;
+    PixelToHexBatch(layout, xs.data(), ys.data(), count, outQ, outR, level);
+    double elapsed = timer.ElapsedNanoseconds();
+    DoNotOptimize(outQ[count / 2] + outR[count / 3]);
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "pixel-to-hex %s", SimdLevelName(level));
+    BenchReport("picking", metric, elapsed / count, "ns/point");
+
+    if (level != SimdLevel::Scalar) {
+      size_t mismatches = 0;
+      for (size_t i = 0; i < count; ++i) {
+        mismatches += (qs[i] != referenceQ[i]) | (rs[i] != referenceR[i]);
+      }
+
+      std::snprintf(metric, sizeof(metric), "mismatches %s vs scalar", SimdLevelName(level));
+      BenchReport("picking", metric, static_cast<double>(mismatches), "points");
+      exact &= mismatches == 0;
+    }
+  }
+
+  return exact;
+}
+
+// World open time on a ~10 GB sparse world and chunk streaming along a
+// camera path through a smaller, fully written one
+bool BenchStreaming(const BenchOptions& options) {
+  const char* largePath = "bench_large.hexw";
+  const char* smallPath = "bench_small.hexw";
+  bool ok = true;
+
+  // Open time must not depend on the world size
+  {
+    const uint32_t size = 42240; // 2640x2640 chunks, ~10.7 GB
+    ok = CreateHexWorldFile(largePath, size, size);
+
+    HexWorldStreamer streamer;
+    BenchTimer timer;
+    ok = ok && streamer.Open(largePath, 64u << 20);
+    double elapsed = timer.ElapsedSeconds();
+
+    BenchReport("streaming", "world file size", HexWorldFileSize(MakeHexWorldHeader(size, size)) / 1e9, "GB");
+    BenchReport("streaming", "open large world", elapsed * 1e3, "ms");
+    streamer.Close();
+    std::remove(largePath);
+  }
+
+  // Streaming around a moving camera under a budget
+  {
+    uint32_t size = options.size ? options.size : 2048;
+    HexGrid grid(size, size);
+    FillRandomTerrain(grid, 4);
+    ok = ok && WriteHexWorld(smallPath, grid);
+
+    HexWorldStreamer streamer;
+    BenchTimer timer;
+    ok = ok && streamer.Open(smallPath, 1u << 20);
+    BenchReport("streaming", "open small world", timer.ElapsedSeconds() * 1e3, "ms");
+
+    const int steps = 512;
+    double updateSeconds = 0.0;
+    uint64_t maxResident = 0;
+    bool correct = true;
+    for (int step = 0; ok && step < steps; ++step) {
+      HexOffset camera = {static_cast<int32_t>(step * (size - 1) / steps), static_cast<int32_t>(step * (size - 1) / steps)};
+
+      timer.Reset();
+      streamer.Update(camera, 8, 64);
+      updateSeconds += timer.ElapsedSeconds();
+      maxResident = std::max<uint64_t>(maxResident, streamer.stats.residentBytes);
+
+      // The chunk under the camera has to be resident and match the grid
+      uint32_t chunk = grid.ChunkIndex(camera);
+      HexChunkView view = streamer.FindChunk(chunk);
+      correct &= view.heights != nullptr &&
+        std::memcmp(view.heights, grid.heights + static_cast<size_t>(chunk) * g_HexChunkTiles, g_HexChunkTiles * sizeof(float)) == 0;
+    }
+
+    BenchReport("streaming", "update per step", updateSeconds / steps * 1e6, "us");
+    BenchReport("streaming", "chunk loads", static_cast<double>(streamer.stats.totalLoads), "chunks");
+    BenchReport("streaming", "chunk load latency avg", streamer.stats.averageLoadMicroseconds, "us");
+    BenchReport("streaming", "chunk load latency max", streamer.stats.maxLoadMicroseconds, "us");
+    BenchReport("streaming", "resident bytes max", static_cast<double>(maxResident) / 1024.0, "KB");
+    streamer.Close();
+    std::remove(smallPath);
+
+    ok &= correct;
+  }
+
+  return ok;
+}
+
+// Synthetic hex-grid update (neighbor smoothing, chunk per job) at 1 to N
+// worker threads
+bool BenchJobs(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 2048;
+  HexGrid grid(size, size);
+  FillRandomTerrain(grid, 5);
+
+  std::vector<float> reference(grid.TileCount());
+  std::vector<float> output(grid.TileCount());
+
+  auto updateChunks = [&](float* out, uint32_t chunkBegin, uint32_t chunkEnd) {
+    for (uint32_t chunk = chunkBegin; chunk < chunkEnd; ++chunk) {
+      grid.ForEachTileInChunk(chunk, [&](uint32_t index, HexOffset coord) {
+        uint32_t neighbors[6];
+        grid.Neighbors(coord, neighbors);
+
+        float total = 0.0f;
+        for (uint32_t neighbor : neighbors) {
+          total += grid.heights[neighbor != g_InvalidTile ? neighbor : index];
+        }
+        out[index] = 0.5f * grid.heights[index] + total * (1.0f / 12.0f);
+      });
+    }
+  };
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  for (uint32_t threads = 2; threads < hardwareThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(std::max(2u, hardwareThreads)); // Always exercise the threaded path
+
+  const int updates = 8;
+  double singleThreaded = 0.0;
+  bool deterministic = true;
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+
+    float* out = threads == 1 ? reference.data() : output.data();
+    BenchTimer timer;
+    for (int update = 0; update < updates; ++update) {
+      jobs.ParallelFor(0, grid.ChunkCount(), 16, [&](uint32_t begin, uint32_t end) {
+        updateChunks(out, begin, end);
+      });
+    }
+    double elapsed = timer.ElapsedSeconds() / updates;
+    jobs.Stop();
+
+    singleThreaded = threads == 1 ? elapsed : singleThreaded;
+    if (threads != 1) {
+      deterministic &= std::memcmp(reference.data(), output.data(), reference.size() * sizeof(float)) == 0;
+    }
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "grid update %u threads", threads);
+    BenchReport("jobs", metric, elapsed * 1e3, "ms");
+    std::snprintf(metric, sizeof(metric), "speedup %u threads", threads);
+    BenchReport("jobs", metric, singleThreaded / elapsed, "x");
+  }
+
+  // Raw scheduling overhead - empty jobs through a counter
+  {
+    JobSystem jobs;
+    jobs.Start(hardwareThreads);
+
+    const uint32_t jobCount = 100000;
+    JobCounter counter;
+    BenchTimer timer;
+    for (uint32_t i = 0; i < jobCount; ++i) {
+      jobs.Run([](void*, uint32_t, uint32_t) {}, nullptr, 0, 0, &counter);
+      if ((i & 1023) == 1023) {
+        jobs.Wait(counter);
+      }
+    }
+    jobs.Wait(counter);
+    BenchReport("jobs", "empty job overhead", timer.ElapsedNanoseconds() / jobCount, "ns");
+  }
+
+  return deterministic;
+}
+
+// Transient frame allocations - arena and upload ring against the general
+// purpose heap, plus a check that the ring never hands out memory the GPU of
+// an earlier frame could still be reading
+bool BenchFrameMemory(const BenchOptions& options) {
+  const uint32_t frameCount = 2000;
+  const uint32_t allocationsPerFrame = options.size ? options.size : 2048;
+  const uint32_t gpuLag = 2; // Frames the simulated GPU trails behind
+
+  Random random(9);
+  std::vector<uint32_t> sizes(allocationsPerFrame);
+  for (uint32_t& size : sizes) {
+    size = 16 + static_cast<uint32_t>(random.NextBelow(496));
+  }
+
+  // Arena
+  {
+    LinearArena arenas[3];
+    for (LinearArena& arena : arenas) {
+      arena.Init(4u << 20);
+    }
+
+    BenchTimer timer;
+    uint64_t sum = 0;
+    for (uint32_t frame = 0; frame < frameCount; ++frame) {
+      LinearArena& arena = arenas[frame % 3];
+      arena.Reset();
+      for (uint32_t size : sizes) {
+        sum += reinterpret_cast<uintptr_t>(arena.Allocate(size));
+      }
+    }
+    double elapsed = timer.ElapsedNanoseconds();
+    DoNotOptimize(static_cast<double>(sum));
+
+    BenchReport("framememory", "arena allocation", elapsed / (double(frameCount) * allocationsPerFrame), "ns");
+    BenchReport("framememory", "arena high water", arenas[0].highWater / 1024.0, "KB");
+  }
+
+  // Heap, what the arena replaces
+  {
+    std::vector<void*> blocks(allocationsPerFrame);
+    BenchTimer timer;
+    for (uint32_t frame = 0; frame < frameCount; ++frame) {
+      for (uint32_t i = 0; i < allocationsPerFrame; ++i) {
+        blocks[i] = std::malloc(sizes[i]);
+      }
+      for (void* block : blocks) {
+        std::free(block);
+      }
+    }
+    double elapsed = timer.ElapsedNanoseconds();
+
+    BenchReport("framememory", "malloc + free", elapsed / (double(frameCount) * allocationsPerFrame), "ns");
+  }
+
+  // Upload ring with a GPU that completes frames gpuLag frames late. Every
+  // allocation is filled with its frame's tag and verified when the frame
+  // retires - a premature reuse overwrites it with a later tag.
+  bool intact = true;
+  {
+    const size_t ringSize = 8u << 20;
+    uint8_t* memory = static_cast<uint8_t*>(AlignedAlloc(ringSize, 256));
+    UploadRing ring;
+    ring.Init(memory, 0x100000, ringSize);
+
+    struct Block {
+      uint8_t* cpu;
+      uint32_t size;
+      uint64_t fenceValue;
+    };
+    std::vector<Block> inFlight;
+    uint64_t allocationCount = 0;
+    double elapsed = 0.0;
+
+    for (uint64_t fenceValue = 1; fenceValue <= frameCount; ++fenceValue) {
+      uint64_t completed = fenceValue > gpuLag ? fenceValue - gpuLag : 0;
+
+      // Verify what retires this frame
+      size_t kept = 0;
+      for (const Block& block : inFlight) {
+        if (block.fenceValue <= completed) {
+          for (uint32_t i = 0; i < block.size; ++i) {
+            intact &= block.cpu[i] == static_cast<uint8_t>(block.fenceValue);
+          }
+        }
+        else {
+          inFlight[kept++] = block;
+        }
+      }
+      inFlight.resize(kept);
+
+      BenchTimer timer;
+      ring.Retire(completed);
+      for (uint32_t size : sizes) {
+        UploadAllocation allocation = ring.Allocate(size);
+        if (allocation.cpu) {
+          inFlight.push_back({allocation.cpu, size, fenceValue});
+          intact &= allocation.gpu - 0x100000 == allocation.offset && allocation.offset % 256 == 0;
+          allocationCount++;
+        }
+      }
+      ring.EndFrame(fenceValue);
+      elapsed += timer.ElapsedNanoseconds();
+
+      for (const Block& block : inFlight) {
+        if (block.fenceValue == fenceValue) {
+          std::memset(block.cpu, static_cast<uint8_t>(fenceValue), block.size);
+        }
+      }
+    }
+
+    BenchReport("framememory", "upload ring allocation", elapsed / allocationCount, "ns");
+    BenchReport("framememory", "upload ring frame high water", ring.frameHighWater / 1024.0, "KB");
+    BenchReport("framememory", "upload ring in flight high water", ring.inFlightHighWater / 1024.0, "KB");
+    BenchReport("framememory", "upload ring failed allocations", static_cast<double>(ring.failedAllocations), "");
+    BenchReport("framememory", "upload ring reuse", intact ? 1.0 : 0.0, intact ? "(safe)" : "(OVERWRITTEN IN FLIGHT)");
+
+    AlignedFree(memory, 256);
+  }
+
+  return intact;
+}
+
+// Instance packing for the whole grid, checked against the tiles it came from
+bool BenchInstancing(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 2048;
+  HexGrid grid(size, size);
+  FillRandomTerrain(grid, 10);
+
+  std::vector<uint32_t> chunks(grid.ChunkCount());
+  for (uint32_t i = 0; i < grid.ChunkCount(); ++i) {
+    chunks[i] = i;
+  }
+
+  size_t tileCount = static_cast<size_t>(size) * size;
+  HexInstance* instances = static_cast<HexInstance*>(AlignedAlloc(tileCount * sizeof(HexInstance)));
+  HexInstanceBatches batches;
+  HexAxial origin = OffsetToAxial({static_cast<int32_t>(size / 2), static_cast<int32_t>(size / 2)});
+
+  const int repeats = 8;
+  bool packed = true;
+  BenchTimer timer;
+  for (int i = 0; i < repeats; ++i) {
+    packed &= PackHexInstances(grid, chunks.data(), chunks.size(), origin, instances, tileCount, batches);
+  }
+  double elapsed = timer.ElapsedNanoseconds() / repeats;
+
+  BenchReport("instancing", "pack per tile", elapsed / tileCount, "ns");
+  BenchReport("instancing", "pack full grid", elapsed * 1e-6, "ms");
+  BenchReport("instancing", "instance stream", tileCount * sizeof(HexInstance) / (1024.0 * 1024.0), "MB");
+  BenchReport("instancing", "draw calls", batches.batchCount, "");
+
+  // Every batch holds only its material, every instance decodes back to its tile
+  bool correct = packed && batches.instanceCount == tileCount;
+  for (uint32_t b = 0; correct && b < batches.batchCount; ++b) {
+    const HexDrawBatch& batch = batches.batches[b];
+    for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i) {
+      const HexInstance& instance = instances[i];
+      uint32_t index = grid.IndexChecked(AxialToOffset({instance.q + origin.q, instance.r + origin.r}));
+      correct &= instance.material == batch.material && index != g_InvalidTile &&
+          grid.materials[index] == instance.material &&
+          std::fabs(instance.height / g_HexHeightScale - grid.heights[index]) <= 0.5f / g_HexHeightScale;
+    }
+  }
+
+  // Too small an output buffer is reported, not overrun
+  HexInstanceBatches overflow;
+  correct &= !PackHexInstances(grid, chunks.data(), chunks.size(), origin, instances, tileCount - 1, overflow) &&
+      overflow.instanceCount == tileCount && overflow.batchCount == 0;
+
+  BenchReport("instancing", "decoded instances", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  AlignedFree(instances);
+
+  return correct;
+}
+
+// Frustum culling along a camera path over a large map - BVH against a
+// brute-force test of every chunk, scalar against SSE2
+bool BenchCulling(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 4096;
+  HexGrid grid(size, size);
+  FillRandomTerrain(grid, 11);
+  HexDrawOrigin origin = MakeHexDrawOrigin(grid);
+
+  BenchTimer timer;
+  std::vector<float> maxHeights(grid.ChunkCount());
+  for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+    maxHeights[chunk] = HexChunkMaxHeight(grid, chunk);
+  }
+  HexChunkBvh bvh;
+  bvh.Build(grid, origin, maxHeights.data());
+  BenchReport("culling", "bvh build", timer.ElapsedSeconds() * 1e3, "ms");
+
+  timer.Reset();
+  HexLodPyramid lod;
+  lod.Build(grid);
+  BenchReport("culling", "lod pyramid build", timer.ElapsedSeconds() * 1e3, "ms");
+
+  // Brute force reference boxes
+  std::vector<float> boxes(static_cast<size_t>(grid.ChunkCount()) * 6);
+  for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+    HexChunkWorldBounds(grid, origin, chunk, maxHeights[chunk], &boxes[chunk * 6], &boxes[chunk * 6 + 3]);
+  }
+
+  std::vector<HexLodRegion> regions(grid.ChunkCount());
+  std::vector<HexLodRegion> reference(grid.ChunkCount());
+  std::vector<uint8_t> visible(grid.ChunkCount());
+
+  const int steps = 256;
+  double cullSeconds[2] = {};
+  double lodCullSeconds = 0.0;
+  double bruteSeconds = 0.0;
+  double packSeconds = 0.0;
+  uint64_t visibleChunks = 0;
+  uint64_t culledChunks = 0;
+  uint64_t nodesVisited = 0;
+  uint64_t lodRegions = 0;
+  uint64_t lodInstances = 0;
+  bool correct = true;
+  std::vector<HexInstance> instances;
+
+  float extentX = g_Sqrt3 * size * 0.5f;
+  float extentZ = 1.5f * size * 0.5f;
+  for (int step = 0; step < steps; ++step) {
+    // Diagonal flight across the map, circling the view direction
+    float t = static_cast<float>(step) / steps;
+    float angle = t * 6.2831853f * 2.0f;
+    Camera camera;
+    camera.eye = {(t * 2.0f - 1.0f) * extentX * 0.9f, 80.0f, (t * 2.0f - 1.0f) * extentZ * 0.9f};
+    camera.target = camera.eye + Vec3{std::cos(angle) * 100.0f, -40.0f, std::sin(angle) * 100.0f};
+    camera.farZ = 3000.0f;
+
+    float viewProjection[16];
+    ComputeViewProjection(camera, viewProjection);
+    Frustum frustum = ExtractFrustum(viewProjection);
+
+    HexCullParams params;
+    params.eye = camera.eye;
+    params.lodDistance = 0.0f; // Full detail, comparable to brute force
+    HexCullStats stats;
+
+    // Scalar and SSE2 have to agree region for region
+    uint32_t regionCounts[2] = {};
+    SimdLevel levels[2] = {SimdLevel::Scalar, SimdLevel::SSE2};
+    for (int i = 0; i < 2; ++i) {
+      HexLodRegion* out = i == 0 ? reference.data() : regions.data();
+      timer.Reset();
+      regionCounts[i] = bvh.Cull(frustum, params, out, stats, GetSimdLevel() >= levels[i] ? levels[i] : SimdLevel::Scalar);
+      cullSeconds[i] += timer.ElapsedSeconds();
+    }
+    correct &= regionCounts[0] == regionCounts[1] &&
+        std::memcmp(reference.data(), regions.data(), regionCounts[0] * sizeof(HexLodRegion)) == 0;
+
+    visibleChunks += stats.chunksVisible;
+    culledChunks += stats.chunksCulled;
+    nodesVisited += stats.nodesVisited;
+
+    // Brute force has to find exactly the same chunks
+    timer.Reset();
+    for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+      const float* box = &boxes[chunk * 6];
+      bool outside = false;
+      for (const float* plane : frustum.planes) {
+        float px = plane[0] >= 0.0f ? box[3] : box[0];
+        float py = plane[1] >= 0.0f ? box[4] : box[1];
+        float pz = plane[2] >= 0.0f ? box[5] : box[2];
+        outside |= plane[0] * px + plane[1] * py + plane[2] * pz + plane[3] < 0.0f;
+      }
+      visible[chunk] = !outside;
+    }
+    bruteSeconds += timer.ElapsedSeconds();
+
+    uint32_t matched = 0;
+    for (uint32_t i = 0; i < regionCounts[1]; ++i) {
+      matched += regions[i].chunkSpan == 1 && visible[regions[i].chunkY * grid.chunksX + regions[i].chunkX];
+    }
+    uint32_t bruteVisible = 0;
+    for (uint8_t v : visible) {
+      bruteVisible += v;
+    }
+    correct &= matched == regionCounts[1] && bruteVisible == regionCounts[1];
+
+    // With LOD, distant subtrees collapse into merged regions
+    params.lodDistance = 128.0f;
+    params.maxLod = static_cast<uint32_t>(lod.levels.size() - 1);
+    timer.Reset();
+    uint32_t regionCount = bvh.Cull(frustum, params, regions.data(), stats);
+    lodCullSeconds += timer.ElapsedSeconds();
+    lodRegions += regionCount;
+
+    uint32_t coarseCount = 0;
+    for (uint32_t i = 0; i < regionCount; ++i) {
+      if (regions[i].lod > 0) {
+        regions[coarseCount++] = regions[i];
+      }
+    }
+    instances.resize(lod.CountInstances(grid, regions.data(), coarseCount) + 1);
+    HexLodBatch batches[g_HexMaxLod + 1];
+    timer.Reset();
+    uint32_t batchCount = lod.PackInstances(grid, regions.data(), coarseCount, origin.hex, instances.data(), batches);
+    packSeconds += timer.ElapsedSeconds();
+    for (uint32_t i = 0; i < batchCount; ++i) {
+      lodInstances += batches[i].instanceCount;
+    }
+  }
+
+  BenchReport("culling", "chunks", grid.ChunkCount(), "");
+  BenchReport("culling", "visible chunks avg", static_cast<double>(visibleChunks) / steps, "");
+  BenchReport("culling", "culled chunks avg", static_cast<double>(culledChunks) / steps, "");
+  BenchReport("culling", "bvh nodes visited avg", static_cast<double>(nodesVisited) / steps, "");
+  BenchReport("culling", "bvh cull scalar", cullSeconds[0] * 1e6 / steps, "us");
+  BenchReport("culling", "bvh cull sse2", cullSeconds[1] * 1e6 / steps, "us");
+  BenchReport("culling", "brute force cull", bruteSeconds * 1e6 / steps, "us");
+  BenchReport("culling", "bvh cull with lod", lodCullSeconds * 1e6 / steps, "us");
+  BenchReport("culling", "lod regions avg", static_cast<double>(lodRegions) / steps, "");
+  BenchReport("culling", "coarse instances avg", static_cast<double>(lodInstances) / steps, "");
+  BenchReport("culling", "coarse instance pack", packSeconds * 1e6 / steps, "us");
+  BenchReport("culling", "matches brute force", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Water ticks on an ocean with islands and a dam break, per thread count and
+// per instruction set. Every run has to end in the same bits.
+bool BenchWater(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 1024;
+  HexGrid grid(size, size);
+  grid.ForEachTile([&](uint32_t index, HexOffset coord) {
+    float x = static_cast<float>(coord.col);
+    float y = static_cast<float>(coord.row);
+    grid.heights[index] = 2.0f + 1.5f * std::sin(x * 0.05f) * std::cos(y * 0.04f) + 0.5f * std::sin((x + y) * 0.21f);
+  });
+
+  const float dt = 1.0f / 60.0f;
+  const int ticks = 60;
+  HexWaterParams params;
+
+  auto reset = [&](HexWater& water) {
+    water.Init(grid);
+    water.Flood(2.5f);
+    for (int32_t row = 0; row < static_cast<int32_t>(size / 8); ++row) {
+      for (int32_t col = 0; col < static_cast<int32_t>(size / 8); ++col) {
+        water.AddWater({col, row}, 4.0f);
+      }
+    }
+  };
+
+  size_t tileCount = grid.TileCount();
+  std::vector<float> reference(tileCount);
+  double cells = static_cast<double>(size) * size * ticks;
+  bool deterministic = true;
+
+  // Instruction sets, single threaded
+  {
+    JobSystem jobs;
+    jobs.Start(1);
+
+    SimdLevel levels[] = {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2};
+    for (SimdLevel level : levels) {
+      if (level > GetSimdLevel()) {
+        continue;
+      }
+
+      HexWater water;
+      reset(water);
+      BenchTimer timer;
+      for (int tick = 0; tick < ticks; ++tick) {
+        water.Step(dt, params, jobs, level);
+      }
+      double elapsed = timer.ElapsedSeconds();
+
+      char metric[64];
+      std::snprintf(metric, sizeof(metric), "tick %s 1 thread", SimdLevelName(level));
+      BenchReport("water", metric, elapsed * 1e3 / ticks, "ms");
+      std::snprintf(metric, sizeof(metric), "cells %s 1 thread", SimdLevelName(level));
+      BenchReport("water", metric, cells / elapsed * 1e-6, "Mcells/s");
+
+      if (level == SimdLevel::Scalar) {
+        std::memcpy(reference.data(), water.depth[water.current], tileCount * sizeof(float));
+      }
+      else {
+        deterministic &= std::memcmp(reference.data(), water.depth[water.current], tileCount * sizeof(float)) == 0;
+      }
+    }
+  }
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  for (uint32_t threads = 2; threads < hardwareThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(std::max(2u, hardwareThreads));
+
+  double singleThreaded = 0.0;
+  double bestTick = 0.0;
+  double volumeDrift = 0.0;
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+
+    HexWater water;
+    reset(water);
+    double volume = water.TotalVolume();
+
+    BenchTimer timer;
+    for (int tick = 0; tick < ticks; ++tick) {
+      water.Step(dt, params, jobs);
+    }
+    double elapsed = timer.ElapsedSeconds();
+    jobs.Stop();
+
+    singleThreaded = threads == 1 ? elapsed : singleThreaded;
+    bestTick = bestTick == 0.0 || elapsed < bestTick * ticks ? elapsed / ticks : bestTick;
+    deterministic &= std::memcmp(reference.data(), water.depth[water.current], tileCount * sizeof(float)) == 0;
+    volumeDrift = std::max(volumeDrift, std::fabs(water.TotalVolume() - volume) / volume);
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "cells %u threads", threads);
+    BenchReport("water", metric, cells / elapsed * 1e-6, "Mcells/s");
+    std::snprintf(metric, sizeof(metric), "speedup %u threads", threads);
+    BenchReport("water", metric, singleThreaded / elapsed, "x");
+  }
+
+  BenchReport("water", "best tick", bestTick * 1e3, bestTick < dt ? "ms (fits 60 Hz)" : "ms (OVER 60 Hz BUDGET)");
+  BenchReport("water", "volume drift", volumeDrift * 100.0, "%");
+  BenchReport("water", "deterministic", deterministic ? 1.0 : 0.0, deterministic ? "(match)" : "(MISMATCH)");
+
+  return deterministic && volumeDrift < 1e-3;
+}
+
+// Incremental remeshing under water motion and large terrain edits, frame
+// by frame, against rebuilding every chunk. The meshes have to end up equal
+// to fresh ones, and packing from them equal to packing the tiles.
+bool BenchRemesh(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 1024;
+  HexGrid grid(size, size);
+  FillRandomTerrain(grid, 12);
+
+  HexDrawOrigin origin = MakeHexDrawOrigin(grid);
+  std::vector<float> maxHeights(grid.ChunkCount());
+  for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+    maxHeights[chunk] = HexChunkMaxHeight(grid, chunk);
+  }
+  HexChunkBvh bvh;
+  bvh.Build(grid, origin, maxHeights.data());
+  HexLodPyramid lod;
+  lod.Build(grid);
+
+  JobSystem jobs;
+  jobs.Start(0);
+  bool correct = true;
+
+  // Packing from the meshes against packing the tiles, no water
+  {
+    HexRemesher remesher;
+    BenchTimer timer;
+    remesher.Init(grid, nullptr, origin.hex);
+    BenchReport("remesh", "full rebuild", timer.ElapsedSeconds() * 1e3, "ms");
+    BenchReport("remesh", "mesh pool", remesher.pool.CapacityBlocks() * sizeof(HexChunkMesh) / (1024.0 * 1024.0), "MB");
+
+    std::vector<uint32_t> chunks(grid.ChunkCount());
+    for (uint32_t i = 0; i < grid.ChunkCount(); ++i) {
+      chunks[i] = i;
+    }
+    size_t tileCount = static_cast<size_t>(size) * size;
+    std::vector<HexInstance> fromTiles(tileCount);
+    std::vector<HexInstance> fromMeshes(tileCount);
+    HexInstanceBatches tileBatches;
+    HexInstanceBatches meshBatches;
+
+    timer.Reset();
+    PackHexInstances(grid, chunks.data(), chunks.size(), origin.hex, fromTiles.data(), tileCount, tileBatches);
+    BenchReport("remesh", "pack from tiles", timer.ElapsedSeconds() * 1e3, "ms");
+    timer.Reset();
+    PackHexChunkMeshes(remesher, chunks.data(), chunks.size(), fromMeshes.data(), tileCount, meshBatches);
+    BenchReport("remesh", "pack from chunk meshes", timer.ElapsedSeconds() * 1e3, "ms");
+
+    correct &= tileBatches.instanceCount == meshBatches.instanceCount && tileBatches.batchCount == meshBatches.batchCount &&
+        std::memcmp(fromTiles.data(), fromMeshes.data(), tileCount * sizeof(HexInstance)) == 0;
+  }
+
+  // Frames with a wave rolling over a quarter of the map and a big brush
+  // stroke every 30 frames
+  HexWater water;
+  water.Init(grid);
+  water.Flood(6.0f);
+  for (int32_t row = 0; row < static_cast<int32_t>(size / 4); ++row) {
+    for (int32_t col = 0; col < static_cast<int32_t>(size); ++col) {
+      water.AddWater({col, row}, 5.0f);
+    }
+  }
+
+  HexRemesher remesher;
+  remesher.Init(grid, &water, origin.hex);
+  water.dirtyChunks = &remesher.dirty;
+
+  const int frames = 240;
+  std::vector<float> updateTimes;
+  uint32_t maxPending = 0;
+  Random random(13);
+  for (int frame = 0; frame < frames; ++frame) {
+    if (frame % 30 == 0) {
+      HexOffset center = {static_cast<int32_t>(random.NextBelow(size)), static_cast<int32_t>(random.NextBelow(size))};
+      HexSpiral(OffsetToAxial(center), 48, [&](HexAxial hex) {
+        HexOffset tile = AxialToOffset(hex);
+        if (grid.Contains(tile)) {
+          grid.heights[grid.Index(tile)] += 3.0f;
+          remesher.dirty.MarkTile(grid, tile);
+        }
+      });
+    }
+
+    water.Step(1.0f / 60.0f, HexWaterParams(), jobs);
+
+    BenchTimer timer;
+    remesher.Update(grid, &water, origin, bvh, lod, jobs);
+    updateTimes.push_back(static_cast<float>(timer.ElapsedSeconds() * 1e6));
+    maxPending = std::max(maxPending, remesher.stats.pendingChunks);
+  }
+
+  FrameTimeStats update = ComputeFrameTimeStats(updateTimes.data(), updateTimes.size());
+  BenchReport("remesh", "update avg", update.average * 1e-3, "ms");
+  BenchReport("remesh", "update p99", update.p99 * 1e-3, "ms");
+  BenchReport("remesh", "update max", update.max * 1e-3, "ms");
+  BenchReport("remesh", "chunks per frame", static_cast<double>(remesher.stats.chunksRemeshed) / frames, "");
+  BenchReport("remesh", "cost per chunk", remesher.stats.chunkMicroseconds, "us");
+  BenchReport("remesh", "pending chunks max", maxPending, "");
+  BenchReport("remesh", "pool high water", remesher.pool.highWater, "blocks");
+
+  // Once everything settles, every mesh equals a fresh build
+  water.dirtyChunks = nullptr;
+  while (remesher.stats.pendingChunks > 0 || remesher.stats.lastBatchChunks > 0) {
+    remesher.Update(grid, &water, origin, bvh, lod, jobs);
+  }
+  remesher.Flush(grid, origin, bvh, lod, jobs);
+
+  HexChunkSnapshot snapshot;
+  HexChunkMesh fresh;
+  uint32_t stale = 0;
+  for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+    SnapshotHexChunk(grid, &water, chunk, snapshot);
+    BuildHexChunkMesh(snapshot, origin.hex, fresh);
+    const HexChunkMesh& mesh = remesher.Mesh(chunk);
+    stale += mesh.instanceCount != fresh.instanceCount || mesh.runCount != fresh.runCount ||
+        std::memcmp(mesh.instances, fresh.instances, fresh.instanceCount * sizeof(HexInstance)) != 0;
+  }
+  jobs.Stop();
+
+  correct &= stale == 0;
+  BenchReport("remesh", "stale chunks", stale, "");
+  BenchReport("remesh", "meshes up to date", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// The layout ShipStore replaces - one heap object per ship, updated through
+// a virtual call. Same math as the ship systems.
+struct BenchShipObject {
+  virtual ~BenchShipObject() = default;
+  virtual void Update(const ShipTick& t) = 0;
+};
+
+struct BenchSailingShip : BenchShipObject {
+  float posX, posZ, dirX, dirZ, speed, maxSpeed, targetX, targetZ, animPhase;
+  HexAxial cell;
+  uint8_t animState;
+  uint32_t seed;
+
+  void Update(const ShipTick& t) override {
+    float toX = targetX - posX;
+    float toZ = targetZ - posZ;
+    float distance2 = toX * toX + toZ * toZ;
+    if (distance2 < t.params.arriveRadius * t.params.arriveRadius) {
+      uint32_t hash = ShipHash(seed, t.tick);
+      targetX = (hash & 0xFFFF) * (1.0f / 65536.0f) * t.params.areaWidth;
+      targetZ = (hash >> 16) * (1.0f / 65536.0f) * t.params.areaHeight;
+      toX = targetX - posX;
+      toZ = targetZ - posZ;
+      distance2 = toX * toX + toZ * toZ;
+    }
+
+    float inverse = distance2 > 0.0f ? 1.0f / std::sqrt(distance2) : 0.0f;
+    float dot = dirX * toX * inverse + dirZ * toZ * inverse;
+    float cross = dirX * toZ * inverse - dirZ * toX * inverse;
+    if (dot < t.cosTurn) {
+      float s = cross >= 0.0f ? t.sinTurn : -t.sinTurn;
+      float x = dirX * t.cosTurn - dirZ * s;
+      float z = dirX * s + dirZ * t.cosTurn;
+      float length = 1.0f / std::sqrt(x * x + z * z);
+      dirX = x * length;
+      dirZ = z * length;
+    }
+    else {
+      dirX = toX * inverse;
+      dirZ = toZ * inverse;
+    }
+
+    float want = maxSpeed * (0.5f + 0.5f * (dot > 0.0f ? dot : 0.0f));
+    float step = t.params.acceleration * t.dt;
+    speed = speed < want ? std::min(speed + step, want) : std::max(speed - step, want);
+    posX += dirX * speed * t.dt;
+    posZ += dirZ * speed * t.dt;
+    cell = PixelToHex(t.params.layout, posX, posZ);
+
+    float phase = animPhase + t.dt * (0.5f + 0.25f * speed);
+    animPhase = phase - std::floor(phase);
+    animState = speed < 0.05f ? ShipAnimationIdle : (dot < t.cosTurn ? ShipAnimationTurning : ShipAnimationSailing);
+  }
+};
+
+// 100k ships sailing between random waypoints, per thread count, against
+// the per-object layout. Plus handle churn: destroy and create at random.
+bool BenchShips(const BenchOptions& options) {
+  uint32_t shipCount = options.size ? options.size : 100000;
+  const int ticks = 120;
+  const float dt = 1.0f / 60.0f;
+
+  ShipParams params;
+  params.areaWidth = g_Sqrt3 * 1024.0f;
+  params.areaHeight = 1.5f * 1024.0f;
+
+  auto populate = [&](ShipStore& ships) {
+    Random random(14);
+    ships.Reserve(shipCount);
+    for (uint32_t i = 0; i < shipCount; ++i) {
+      ShipDesc desc;
+      desc.x = random.NextFloat() * params.areaWidth;
+      desc.z = random.NextFloat() * params.areaHeight;
+      desc.heading = random.NextFloat() * 6.2831853f;
+      desc.maxSpeed = 2.0f + random.NextFloat() * 4.0f;
+      desc.seed = i;
+      ships.Create(desc);
+    }
+  };
+
+  bool correct = true;
+  std::vector<float> referenceX;
+  std::vector<int32_t> referenceQ;
+
+  // Steering per instruction set, single threaded. All levels give the same bits
+  {
+    JobSystem jobs;
+    jobs.Start(1);
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2}) {
+      if (level > GetSimdLevel()) {
+        continue;
+      }
+
+      ShipStore ships;
+      populate(ships);
+      BenchTimer timer;
+      for (int tick = 0; tick < ticks; ++tick) {
+        StepShips(ships, params, dt, jobs, level);
+      }
+      double elapsed = timer.ElapsedNanoseconds();
+
+      char metric[64];
+      std::snprintf(metric, sizeof(metric), "soa tick %s 1 thread", SimdLevelName(level));
+      BenchReport("ships", metric, elapsed / (static_cast<double>(shipCount) * ticks), "ns/ship");
+
+      if (referenceX.empty()) {
+        referenceX.assign(ships.posX, ships.posX + ships.count);
+        referenceQ.assign(ships.cellQ, ships.cellQ + ships.count);
+      }
+      else {
+        correct &= std::memcmp(referenceX.data(), ships.posX, ships.count * sizeof(float)) == 0 &&
+            std::memcmp(referenceQ.data(), ships.cellQ, ships.count * sizeof(int32_t)) == 0;
+      }
+    }
+    jobs.Stop();
+  }
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  for (uint32_t threads = 2; threads < hardwareThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(std::max(2u, hardwareThreads));
+
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+    ShipStore ships;
+    populate(ships);
+
+    BenchTimer timer;
+    for (int tick = 0; tick < ticks; ++tick) {
+      StepShips(ships, params, dt, jobs);
+    }
+    double elapsed = timer.ElapsedNanoseconds();
+    jobs.Stop();
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "soa tick %u threads", threads);
+    BenchReport("ships", metric, elapsed / (static_cast<double>(shipCount) * ticks), "ns/ship");
+
+    // Same result however the ships were split over threads
+    if (referenceX.empty()) {
+      referenceX.assign(ships.posX, ships.posX + ships.count);
+      referenceQ.assign(ships.cellQ, ships.cellQ + ships.count);
+    }
+    else {
+      correct &= std::memcmp(referenceX.data(), ships.posX, ships.count * sizeof(float)) == 0 &&
+          std::memcmp(referenceQ.data(), ships.cellQ, ships.count * sizeof(int32_t)) == 0;
+    }
+
+    // Every ship knows the cell it is in
+    uint32_t wrongCells = 0;
+    for (uint32_t i = 0; i < ships.count; i += 97) {
+      HexAxial cell = PixelToHex(params.layout, ships.posX[i], ships.posZ[i]);
+      wrongCells += cell.q != ships.cellQ[i] || cell.r != ships.cellR[i];
+    }
+    correct &= wrongCells == 0;
+  }
+
+  // One object per ship behind a virtual call
+  {
+    Random random(14);
+    std::vector<BenchShipObject*> objects;
+    for (uint32_t i = 0; i < shipCount; ++i) {
+      BenchSailingShip* ship = new BenchSailingShip();
+      ship->posX = random.NextFloat() * params.areaWidth;
+      ship->posZ = random.NextFloat() * params.areaHeight;
+      float heading = random.NextFloat() * 6.2831853f;
+      ship->dirX = std::cos(heading);
+      ship->dirZ = std::sin(heading);
+      ship->maxSpeed = 2.0f + random.NextFloat() * 4.0f;
+      ship->speed = 0.0f;
+      ship->targetX = ship->posX;
+      ship->targetZ = ship->posZ;
+      ship->animPhase = 0.0f;
+      ship->seed = i;
+      objects.push_back(ship);
+    }
+
+    // Shuffled like a heap that has seen some churn
+    for (uint32_t i = shipCount - 1; i > 0; --i) {
+      std::swap(objects[i], objects[random.NextBelow(i + 1)]);
+    }
+
+    ShipTick t = {params, dt, std::cos(params.turnRate * dt), std::sin(params.turnRate * dt), 0};
+    BenchTimer timer;
+    for (int tick = 0; tick < ticks; ++tick) {
+      t.tick = tick;
+      for (BenchShipObject* object : objects) {
+        object->Update(t);
+      }
+    }
+    double elapsed = timer.ElapsedNanoseconds();
+    BenchReport("ships", "virtual per-object tick 1 thread", elapsed / (static_cast<double>(shipCount) * ticks), "ns/ship");
+
+    for (BenchShipObject* object : objects) {
+      delete object;
+    }
+  }
+
+  // Churn - handles of destroyed ships go stale, the others keep resolving
+  {
+    ShipStore ships;
+    std::vector<ShipHandle> handles;
+    Random random(15);
+    BenchTimer timer;
+    for (uint32_t i = 0; i < shipCount; ++i) {
+      ShipDesc desc;
+      desc.seed = i;
+      handles.push_back(ships.Create(desc));
+    }
+    double createNs = timer.ElapsedNanoseconds() / shipCount;
+
+    std::vector<ShipHandle> destroyed;
+    timer.Reset();
+    for (uint32_t i = 0; i < shipCount / 2; ++i) {
+      uint32_t pick = random.NextBelow(static_cast<uint32_t>(handles.size()));
+      ships.Destroy(handles[pick]);
+      destroyed.push_back(handles[pick]);
+      handles[pick] = handles.back();
+      handles.pop_back();
+    }
+    double destroyNs = timer.ElapsedNanoseconds() / (shipCount / 2);
+
+    for (uint32_t i = 0; i < shipCount / 2; ++i) {
+      ShipDesc desc;
+      desc.seed = shipCount + i;
+      handles.push_back(ships.Create(desc));
+    }
+
+    uint32_t wrong = 0;
+    for (ShipHandle handle : destroyed) {
+      wrong += ships.IsAlive(handle);
+    }
+    for (ShipHandle handle : handles) {
+      uint32_t i = ships.Find(handle);
+      wrong += i == UINT32_MAX || ships.slotOf[i] != handle.slot;
+    }
+    correct &= wrong == 0 && ships.count == shipCount;
+
+    BenchReport("ships", "create", createNs, "ns");
+    BenchReport("ships", "destroy", destroyNs, "ns");
+    BenchReport("ships", "handle errors", wrong, "");
+  }
+
+  BenchReport("ships", "deterministic and located", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Ocean with islands, about a sixth of it land
+void FillIslandTerrain(HexGrid& grid, uint64_t seed) {
+  Random random(seed);
+  grid.ForEachTile([&](uint32_t index, HexOffset coord) {
+    float x = coord.col * 0.043f;
+    float y = coord.row * 0.051f;
+    float height = 1.2f + 1.6f * std::sin(x) * std::cos(y) + 1.0f * std::sin(x * 0.41f + y * 0.37f) + random.NextFloat() * 0.4f;
+    grid.heights[index] = height > 0.0f ? height : 0.0f;
+  });
+}
+
+// Checks that a path steps between neighbors over passable tiles and that
+// its step costs add up
+bool ValidHexPath(const HexGrid& grid, const HexPathfinder& pathfinder, const HexPathQuery& query) {
+  if (query.length == 0 || query.length > query.capacity || query.path[0] != query.start || query.path[query.length - 1] != query.goal) {
+    return false;
+  }
+
+  uint32_t cost = 0;
+  for (uint32_t i = 1; i < query.length; ++i) {
+    uint32_t neighbors[6];
+    grid.Neighbors(grid.Coord(query.path[i - 1]), neighbors);
+    if (std::find(neighbors, neighbors + 6, query.path[i]) == neighbors + 6 || pathfinder.costs[query.path[i]] == 0) {
+      return false;
+    }
+    cost += pathfinder.costs[query.path[i]];
+  }
+
+  return cost == query.cost;
+}
+
+// Batched A* queries, flow fields for shared goals and invalidation after
+// tile edits
+bool BenchPathfinding(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 1024;
+  const uint32_t queryCount = 10000;
+  const uint32_t capacity = 1024;
+
+  HexGrid grid(size, size);
+  FillIslandTerrain(grid, 15);
+
+  HexPathfinder pathfinder;
+  BenchTimer timer;
+  pathfinder.Init(grid);
+  BenchReport("pathfinding", "init", timer.ElapsedSeconds() * 1e3, "ms");
+
+  uint32_t seaTiles = 0;
+  grid.ForEachTile([&](uint32_t index, HexOffset) {
+    seaTiles += pathfinder.costs[index] != 0;
+  });
+  BenchReport("pathfinding", "sea tiles", 100.0 * seaTiles / (static_cast<double>(size) * size), "%");
+
+  Random random(16);
+  auto randomSeaTile = [&](HexOffset center, int32_t radius) {
+    while (true) {
+      HexOffset tile = {center.col + static_cast<int32_t>(random.NextBelow(2 * radius + 1)) - radius,
+          center.row + static_cast<int32_t>(random.NextBelow(2 * radius + 1)) - radius};
+      if (grid.Contains(tile) && pathfinder.costs[grid.Index(tile)] == pathfinder.params.deepCost) {
+        return grid.Index(tile);
+      }
+    }
+  };
+
+  // Independent queries, goals up to 96 tiles away
+  const int32_t half = static_cast<int32_t>(size / 2);
+  std::vector<HexPathQuery> queries(queryCount);
+  std::vector<uint32_t> paths(static_cast<size_t>(queryCount) * capacity);
+  for (uint32_t i = 0; i < queryCount; ++i) {
+    queries[i].start = randomSeaTile({half, half}, half);
+    queries[i].goal = randomSeaTile(grid.Coord(queries[i].start), 96);
+    queries[i].path = paths.data() + static_cast<size_t>(i) * capacity;
+    queries[i].capacity = capacity;
+  }
+
+  bool correct = true;
+  std::vector<uint32_t> reference;
+  std::vector<uint32_t> searchCosts(queryCount);
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  if (hardwareThreads > 1) {
+    threadCounts.push_back(hardwareThreads);
+  }
+
+  pathfinder.params.flowFieldMinQueries = UINT32_MAX;
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+
+    pathfinder.FindPaths(queries.data(), queryCount, jobs); // Warms the scratch blocks
+    size_t scratchBytes = pathfinder.ScratchContainerBytes();
+    uint64_t searched = pathfinder.stats.searchedTiles;
+
+    timer.Reset();
+    pathfinder.FindPaths(queries.data(), queryCount, jobs);
+    double elapsed = timer.ElapsedSeconds();
+    jobs.Stop();
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "A* %uk queries %u threads", queryCount / 1000, threads);
+    BenchReport("pathfinding", metric, elapsed * 1e3, "ms");
+    std::snprintf(metric, sizeof(metric), "A* query %u threads", threads);
+    BenchReport("pathfinding", metric, elapsed * 1e6 / queryCount, "us");
+
+    if (threads == 1) {
+      uint32_t failed = 0;
+      uint32_t invalid = 0;
+      for (uint32_t i = 0; i < queryCount; ++i) {
+        failed += queries[i].status != HexPathFound;
+        invalid += queries[i].status == HexPathFound && !ValidHexPath(grid, pathfinder, queries[i]);
+        searchCosts[i] = queries[i].status == HexPathFound ? queries[i].cost : UINT32_MAX;
+      }
+      BenchReport("pathfinding", "A* tiles expanded per query", static_cast<double>(pathfinder.stats.searchedTiles - searched) / queryCount, "");
+      BenchReport("pathfinding", "A* queries without a path", failed, "");
+      BenchReport("pathfinding", "scratch growth in warm batch", static_cast<double>(pathfinder.ScratchContainerBytes() - scratchBytes), "bytes");
+      correct &= invalid == 0 && pathfinder.ScratchContainerBytes() == scratchBytes;
+    }
+
+    // Same paths however the batch was split over threads
+    std::vector<uint32_t> result;
+    for (const HexPathQuery& query : queries) {
+      result.push_back(query.cost);
+      result.push_back(query.length);
+      result.insert(result.end(), query.path, query.path + std::min(query.length, capacity));
+    }
+    if (reference.empty()) {
+      reference.swap(result);
+    }
+    else {
+      correct &= reference == result;
+    }
+  }
+
+  // Shared goals - fleets heading for a handful of ports
+  const uint32_t portCount = 8;
+  uint32_t ports[portCount];
+  for (uint32_t& port : ports) {
+    port = randomSeaTile({half, half}, half - 200);
+  }
+  for (uint32_t i = 0; i < queryCount; ++i) {
+    queries[i].goal = ports[i % portCount];
+    queries[i].start = randomSeaTile(grid.Coord(queries[i].goal), 150);
+  }
+
+  JobSystem jobs;
+  jobs.Start(hardwareThreads);
+
+  pathfinder.FindPaths(queries.data(), queryCount, jobs);
+  timer.Reset();
+  pathfinder.FindPaths(queries.data(), queryCount, jobs);
+  BenchReport("pathfinding", "ports A* 10k queries", timer.ElapsedSeconds() * 1e3, "ms");
+  for (uint32_t i = 0; i < queryCount; ++i) {
+    searchCosts[i] = queries[i].status == HexPathFound ? queries[i].cost : UINT32_MAX;
+  }
+
+  pathfinder.params.flowFieldMinQueries = HexPathParams().flowFieldMinQueries;
+  timer.Reset();
+  pathfinder.FindPaths(queries.data(), queryCount, jobs);
+  BenchReport("pathfinding", "ports cold, builds 8 fields", timer.ElapsedSeconds() * 1e3, "ms");
+
+  uint64_t fieldQueries = pathfinder.stats.flowFieldQueries;
+  timer.Reset();
+  pathfinder.FindPaths(queries.data(), queryCount, jobs);
+  BenchReport("pathfinding", "ports flow fields 10k queries", timer.ElapsedSeconds() * 1e3, "ms");
+  BenchReport("pathfinding", "ports queries on a flow field", static_cast<double>(pathfinder.stats.flowFieldQueries - fieldQueries), "");
+
+  // Fields and A* find equally cheap paths
+  uint32_t mismatches = 0;
+  for (uint32_t i = 0; i < queryCount; ++i) {
+    uint32_t cost = queries[i].status == HexPathFound ? queries[i].cost : UINT32_MAX;
+    mismatches += cost != searchCosts[i] || (cost != UINT32_MAX && !ValidHexPath(grid, pathfinder, queries[i]));
+  }
+  BenchReport("pathfinding", "ports field vs A* cost mismatches", mismatches, "");
+  correct &= mismatches == 0;
+
+  // Edits. Raising land that is already land changes no costs, a new island
+  // next to a port drops only the fields that looked at it.
+  auto raise = [&](HexOffset center, int32_t radius, bool landOnly) {
+    HexSpiral(OffsetToAxial(center), radius, [&](HexAxial hex) {
+      HexOffset tile = AxialToOffset(hex);
+      if (grid.Contains(tile) && (!landOnly || pathfinder.costs[grid.Index(tile)] == 0)) {
+        grid.heights[grid.Index(tile)] += 3.0f;
+        pathfinder.dirty.MarkTile(grid, tile);
+      }
+    });
+  };
+
+  uint64_t invalidated = pathfinder.stats.fieldsInvalidated;
+  raise(grid.Coord(ports[0]), 200, true);
+  timer.Reset();
+  uint32_t changed = pathfinder.Update(grid);
+  BenchReport("pathfinding", "land edit update", timer.ElapsedSeconds() * 1e6, "us");
+  BenchReport("pathfinding", "land edit changed chunks", changed, "");
+  BenchReport("pathfinding", "land edit fields dropped", static_cast<double>(pathfinder.stats.fieldsInvalidated - invalidated), "");
+  correct &= changed == 0;
+
+  HexOffset island = grid.Coord(ports[0]);
+  island.col += 20;
+  raise(island, 4, false);
+  invalidated = pathfinder.stats.fieldsInvalidated;
+  changed = pathfinder.Update(grid);
+  uint32_t stale = 0;
+  for (const HexPathQuery& query : queries) {
+    stale += !pathfinder.IsPathCurrent(query.path, std::min(query.length, capacity), query.epoch);
+  }
+  BenchReport("pathfinding", "island edit changed chunks", changed, "");
+  BenchReport("pathfinding", "island edit fields dropped", static_cast<double>(pathfinder.stats.fieldsInvalidated - invalidated), "");
+  BenchReport("pathfinding", "island edit stale paths", stale, "");
+  correct &= changed > 0 && pathfinder.stats.fieldsInvalidated > invalidated && pathfinder.FindFlowField(ports[0]) == nullptr;
+
+  // Requerying rebuilds the dropped fields, which agree with a fresh A*
+  pathfinder.FindPaths(queries.data(), queryCount, jobs);
+  std::vector<uint32_t> fieldCosts(queryCount);
+  for (uint32_t i = 0; i < queryCount; ++i) {
+    fieldCosts[i] = queries[i].status == HexPathFound ? queries[i].cost : UINT32_MAX;
+  }
+  pathfinder.params.flowFieldMinQueries = UINT32_MAX;
+  for (HexFlowField& field : pathfinder.fields) {
+    field.valid = false;
+  }
+  pathfinder.FindPaths(queries.data(), queryCount, jobs);
+  mismatches = 0;
+  for (uint32_t i = 0; i < queryCount; ++i) {
+    mismatches += fieldCosts[i] != (queries[i].status == HexPathFound ? queries[i].cost : UINT32_MAX);
+  }
+  jobs.Stop();
+
+  BenchReport("pathfinding", "rebuilt field vs A* cost mismatches", mismatches, "");
+  correct &= mismatches == 0;
+
+  BenchReport("pathfinding", "paths valid and deterministic", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Ship neighborhoods from the cell hash against testing every pair
+bool BenchSpatialHash(const BenchOptions& options) {
+  uint32_t shipCount = options.size ? options.size : 100000;
+  const float radius = 3.0f; // Avoidance distance
+  const uint32_t fleetSize = 1000;
+  const int ticks = 20;
+
+  // Fleets spread over a 1024x1024 cell sea
+  HexLayout layout;
+  Random random(17);
+  std::vector<float> xs(shipCount);
+  std::vector<float> zs(shipCount);
+  float fleetX = 0.0f;
+  float fleetZ = 0.0f;
+  for (uint32_t i = 0; i < shipCount; ++i) {
+    if (i % fleetSize == 0) {
+      fleetX = random.NextFloat() * g_Sqrt3 * 1024.0f;
+      fleetZ = random.NextFloat() * 1.5f * 1024.0f;
+    }
+    float angle = random.NextFloat() * 6.2831853f;
+    float spread = 40.0f * std::sqrt(random.NextFloat());
+    xs[i] = fleetX + spread * std::cos(angle);
+    zs[i] = fleetZ + spread * std::sin(angle);
+  }
+  std::vector<int32_t> qs(shipCount);
+  std::vector<int32_t> rs(shipCount);
+  PixelToHexBatch(layout, xs.data(), zs.data(), shipCount, qs.data(), rs.data());
+
+  bool correct = true;
+  std::vector<uint32_t> reference;
+  HexSpatialHash hash;
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  if (hardwareThreads > 1) {
+    threadCounts.push_back(hardwareThreads);
+  }
+
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+
+    hash.Build(qs.data(), rs.data(), xs.data(), zs.data(), shipCount, jobs);
+    const HexSpatialEntry* entries = hash.entries.get();
+    BenchTimer timer;
+    for (int tick = 0; tick < ticks; ++tick) {
+      hash.Build(qs.data(), rs.data(), xs.data(), zs.data(), shipCount, jobs);
+    }
+    double elapsed = timer.ElapsedSeconds();
+    correct &= hash.entries.get() == entries; // Rebuilds reuse the arrays
+
+    // Neighbors of every ship, split over the workers
+    std::vector<uint32_t> neighborCounts(shipCount);
+    timer.Reset();
+    jobs.ParallelFor(0, shipCount, 1024, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        uint32_t found = 0;
+        hash.ForEachNear(layout, xs[i], zs[i], radius, [&](uint32_t, float, float) {
+          found++;
+        });
+        neighborCounts[i] = found;
+      }
+    });
+    double queryElapsed = timer.ElapsedSeconds();
+    jobs.Stop();
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "rebuild %u threads", threads);
+    BenchReport("spatialhash", metric, elapsed * 1e3 / ticks, "ms");
+    std::snprintf(metric, sizeof(metric), "queries %u threads", threads);
+    BenchReport("spatialhash", metric, shipCount / queryElapsed * 1e-6, "Mqueries/s");
+
+    // Same layout however many threads built it
+    std::vector<uint32_t> layoutCheck;
+    for (uint32_t i = 0; i < shipCount; ++i) {
+      layoutCheck.push_back(entries[i].item);
+    }
+    layoutCheck.insert(layoutCheck.end(), neighborCounts.begin(), neighborCounts.end());
+    if (reference.empty()) {
+      reference.swap(layoutCheck);
+    }
+    else {
+      correct &= reference == layoutCheck;
+    }
+  }
+
+  // Ring queries visit every ship of the range exactly once
+  uint32_t ringMismatches = 0;
+  for (uint32_t i = 0; i < shipCount; i += 997) {
+    HexAxial center = {qs[i], rs[i]};
+    uint32_t inRange = 0;
+    uint32_t inRings = 0;
+    hash.ForEachInRange(center, 3, [&](uint32_t, float, float) { inRange++; });
+    for (int32_t ring = 0; ring <= 3; ++ring) {
+      hash.ForEachInRing(center, ring, [&](uint32_t, float, float) { inRings++; });
+    }
+    ringMismatches += inRange != inRings;
+  }
+  correct &= ringMismatches == 0;
+
+  // Brute force over a sample of the ships
+  const uint32_t sampleStride = 97;
+  uint32_t samples = 0;
+  uint32_t mismatches = 0;
+  float radius2 = radius * radius;
+  BenchTimer timer;
+  for (uint32_t i = 0; i < shipCount; i += sampleStride) {
+    uint32_t found = 0;
+    for (uint32_t j = 0; j < shipCount; ++j) {
+      float dx = xs[j] - xs[i];
+      float dz = zs[j] - zs[i];
+      found += dx * dx + dz * dz <= radius2;
+    }
+    mismatches += found != reference[shipCount + i];
+    samples++;
+  }
+  double bruteQuery = timer.ElapsedSeconds() / samples;
+  BenchReport("spatialhash", "brute force queries 1 thread", 1e-6 / bruteQuery, "Mqueries/s");
+  BenchReport("spatialhash", "brute force all ships 1 thread", bruteQuery * shipCount * 1e3, "ms (estimate from the sample)");
+
+  uint64_t neighbors = 0;
+  for (uint32_t i = 0; i < shipCount; ++i) {
+    neighbors += reference[shipCount + i];
+  }
+  BenchReport("spatialhash", "neighbors per ship", static_cast<double>(neighbors) / shipCount, "");
+  BenchReport("spatialhash", "brute force mismatches", mismatches, "");
+  correct &= mismatches == 0;
+
+  BenchReport("spatialhash", "deterministic and exact", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Warm startup paths: shaders from the precompiled archive and pipeline
+// blobs from the cache. Compiling HLSL and creating pipelines needs D3D12,
+// main.exe prints the cold numbers at startup.
+bool BenchShaders(const BenchOptions& options) {
+  const char* archivePath = "bench_shaders.bin";
+  const char* cachePath = "bench_pipelines.bin";
+  const int repeats = 20;
+  bool correct = true;
+
+  // Synthetic bytecode, sizes around those of real shaders
+  uint32_t shaderCount = options.size ? options.size : 64;
+  Random random(23);
+  ShaderArchiveWriter writer;
+  writer.sourceHash = HexShaderSourceHash();
+  writer.compileFlags = 0x800; // Any value, it only has to match on open
+  std::vector<std::vector<uint8_t>> shaders(shaderCount);
+  std::vector<std::string> names(shaderCount);
+  for (uint32_t i = 0; i < shaderCount; ++i) {
+    shaders[i].resize(1024 + random.NextBelow(16 * 1024));
+    for (uint8_t& byte : shaders[i]) {
+      byte = static_cast<uint8_t>(random.Next());
+    }
+    names[i] = "Shader" + std::to_string(i);
+    correct &= writer.Add(names[i].c_str(), i % 2 ? "ps_5_0" : "vs_5_0", shaders[i].data(), shaders[i].size());
+  }
+  correct &= !writer.Add(names[0].c_str(), "vs_5_0", shaders[0].data(), shaders[0].size()); // Taken name
+  correct &= writer.Write(archivePath);
+
+  double archiveSeconds = 0.0;
+  for (int repeat = 0; repeat < repeats; ++repeat) {
+    BenchTimer timer;
+    ShaderArchive archive;
+    bool opened = archive.Open(archivePath, writer.sourceHash, writer.compileFlags);
+    for (uint32_t i = 0; opened && i < shaderCount; ++i) {
+      ShaderBlob blob;
+      opened = archive.Find(names[i].c_str(), blob) && blob.size == shaders[i].size() &&
+        std::memcmp(blob.data, shaders[i].data(), blob.size) == 0;
+    }
+    archiveSeconds += timer.ElapsedSeconds();
+    correct &= opened;
+  }
+  BenchReport("shaders", "archive size", static_cast<double>(writer.blobs.size()) / 1024.0, "KB");
+  BenchReport("shaders", "archive open + load all", archiveSeconds / repeats * 1e6, "us");
+
+  // Archives from other sources, flags or damaged ones are refused
+  {
+    ShaderArchive archive;
+    ShaderBlob blob;
+    correct &= !archive.Open(archivePath, writer.sourceHash + 1, writer.compileFlags);
+    correct &= !archive.Open(archivePath, writer.sourceHash, writer.compileFlags + 1);
+    correct &= archive.Open(archivePath, writer.sourceHash, writer.compileFlags) && !archive.Find("Missing", blob);
+
+    std::vector<uint8_t> bytes;
+    writer.Serialize(bytes);
+    correct &= !archive.OpenMemory(bytes.data(), bytes.size() - 1, writer.sourceHash, writer.compileFlags);
+    correct &= !archive.OpenMemory(bytes.data(), sizeof(ShaderArchiveHeader) - 1, writer.sourceHash, writer.compileFlags);
+    bytes[sizeof(ShaderArchiveHeader) + 5] ^= 0xFF; // Inside the first blob
+    correct &= archive.OpenMemory(bytes.data(), bytes.size(), writer.sourceHash, writer.compileFlags);
+    uint32_t intact = 0;
+    for (uint32_t i = 0; i < shaderCount; ++i) {
+      intact += archive.Find(names[i].c_str(), blob);
+    }
+    correct &= intact == shaderCount - 1;
+  }
+  std::remove(archivePath);
+
+  // Pipeline cache round trip, driver blobs are tens of KB
+  const uint64_t deviceKey = 0x10DE2684;
+  const uint32_t pipelineCount = 256;
+  PipelineCache cache;
+  cache.Reset(deviceKey);
+  std::vector<uint64_t> keys(pipelineCount);
+  for (uint32_t i = 0; i < pipelineCount; ++i) {
+    PipelineHasher hasher;
+    hasher.Add(i);
+    hasher.AddString("HexPipeline");
+    keys[i] = hasher.hash;
+
+    std::vector<uint8_t> blob(8 * 1024 + random.NextBelow(56 * 1024));
+    for (uint8_t& byte : blob) {
+      byte = static_cast<uint8_t>(random.Next());
+    }
+    cache.Store(keys[i], blob.data(), blob.size());
+  }
+
+  BenchTimer timer;
+  correct &= cache.Save(cachePath);
+  BenchReport("shaders", "pipeline cache save", timer.ElapsedSeconds() * 1e3, "ms");
+
+  double loadSeconds = 0.0;
+  for (int repeat = 0; repeat < repeats; ++repeat) {
+    PipelineCache loaded;
+    timer.Reset();
+    correct &= loaded.Load(cachePath, deviceKey);
+    uint32_t found = 0;
+    for (uint64_t key : keys) {
+      const std::vector<uint8_t>* blob = loaded.Find(key);
+      found += blob && *blob == cache.blobs.at(key);
+    }
+    loadSeconds += timer.ElapsedSeconds();
+    correct &= found == pipelineCount && !loaded.dirty;
+  }
+
+  size_t cacheBytes = 0;
+  for (const auto& blob : cache.blobs) {
+    cacheBytes += blob.second.size();
+  }
+  BenchReport("shaders", "pipeline cache size", static_cast<double>(cacheBytes) / (1024.0 * 1024.0), "MB");
+  BenchReport("shaders", "pipeline cache load + find all", loadSeconds / repeats * 1e3, "ms");
+
+  // Other devices and damaged files start from an empty cache
+  {
+    PipelineCache other;
+    correct &= !other.Load(cachePath, deviceKey + 1) && other.blobs.empty();
+
+    std::vector<uint8_t> bytes;
+    cache.Serialize(bytes);
+    other.Reset(deviceKey);
+    correct &= !other.Deserialize(bytes.data(), bytes.size() - 1) && other.blobs.empty();
+    bytes[sizeof(PipelineCacheHeader) + 5] ^= 0xFF;
+    correct &= !other.Deserialize(bytes.data(), bytes.size()) && other.blobs.empty();
+
+    // A refused blob is dropped and the cache written again
+    correct &= other.Load(cachePath, deviceKey);
+    other.Reject(keys[0]);
+    correct &= other.dirty && other.Find(keys[0]) == nullptr;
+  }
+  std::remove(cachePath);
+
+  // Keys are stable and every field counts
+  {
+    PipelineHasher a;
+    PipelineHasher b;
+    PipelineHasher c;
+    a.AddString("POSITION");
+    a.Add(uint32_t(6));
+    b.AddString("POSITION");
+    b.Add(uint32_t(6));
+    c.AddString("POSITION");
+    c.Add(uint32_t(7));
+    correct &= a.hash == b.hash && a.hash != c.hash;
+  }
+
+  BenchReport("shaders", "round trips and rejects", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Box filtered mip of an RGBA8 level, computed without the streamer's code
+std::vector<uint8_t> ReferenceMip(const std::vector<uint8_t>& level, uint32_t width, uint32_t height) {
+  uint32_t nextWidth = std::max(1u, width / 2);
+  uint32_t nextHeight = std::max(1u, height / 2);
+  std::vector<uint8_t> next(static_cast<size_t>(nextWidth) * nextHeight * 4);
+  for (uint32_t y = 0; y < nextHeight; ++y) {
+    for (uint32_t x = 0; x < nextWidth; ++x) {
+      for (uint32_t c = 0; c < 4; ++c) {
+        uint32_t sum = 0;
+        for (uint32_t dy = 0; dy < 2; ++dy) {
+          for (uint32_t dx = 0; dx < 2; ++dx) {
+            uint32_t sx = std::min(2 * x + dx, width - 1);
+            uint32_t sy = std::min(2 * y + dy, height - 1);
+            sum += level[(static_cast<size_t>(sy) * width + sx) * 4 + c];
+          }
+        }
+        next[(static_cast<size_t>(y) * nextWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+      }
+    }
+  }
+  return next;
+}
+
+// Pumps like a 1 ms frame loop until every request is ready or failed. The
+// copies of a frame complete before the next one.
+void PumpUntilIdle(AssetStreamer& streamer, MockUploadSink& sink) {
+  while (!streamer.IsIdle()) {
+    streamer.Pump(sink);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    sink.Complete(sink.submittedValue);
+  }
+}
+
+// Texture and buffer streaming through the I/O threads into a mock upload
+// sink. The files are freshly written, so they come from the page cache and
+// the numbers are the decode and staging side, not the disk.
+bool BenchAssets(const BenchOptions& options) {
+  const uint32_t textureCount = options.size ? options.size : 48;
+  const uint32_t textureSize = 512;
+  const uint32_t bufferCount = 16;
+  const size_t bufferSize = 256 * 1024;
+  const size_t stagingSize = 32u << 20;
+  const size_t slotSize = 2u << 20;
+  bool correct = true;
+
+  Random random(29);
+  std::vector<std::string> paths;
+  std::vector<std::vector<uint8_t>> sources;
+  for (uint32_t i = 0; i < textureCount + bufferCount; ++i) {
+    bool texture = i < textureCount;
+    paths.push_back("bench_asset_" + std::to_string(i) + (texture ? ".ppm" : ".bin"));
+    std::vector<uint8_t> bytes(texture ? static_cast<size_t>(textureSize) * textureSize * 3 : bufferSize);
+    uint64_t value = 0;
+    for (size_t b = 0; b < bytes.size(); ++b) {
+      value = (b & 7) == 0 ? random.Next() : value >> 8; // Noise, the worst case for a codec later on
+      bytes[b] = static_cast<uint8_t>(value);
+    }
+    if (texture) {
+      correct &= WritePpm(paths.back().c_str(), textureSize, textureSize, bytes.data());
+    }
+    else {
+      correct &= WriteWholeFile(paths.back().c_str(), bytes.data(), bytes.size());
+    }
+    sources.push_back(std::move(bytes));
+  }
+
+  uint8_t* staging = static_cast<uint8_t*>(AlignedAlloc(stagingSize, 512));
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1, 2};
+  if (hardwareThreads > 2) {
+    threadCounts.push_back(hardwareThreads);
+  }
+
+  for (uint32_t threads : threadCounts) {
+    AssetStreamer streamer;
+    MockUploadSink sink;
+    sink.staging = staging;
+    streamer.Start(threads, staging, stagingSize, slotSize);
+
+    BenchTimer timer;
+    for (uint32_t i = 0; i < paths.size(); ++i) {
+      streamer.Request(paths[i].c_str(), i < textureCount ? AssetKind::Texture : AssetKind::Buffer);
+    }
+    PumpUntilIdle(streamer, sink);
+    double elapsed = timer.ElapsedSeconds();
+    streamer.Stop();
+
+    const AssetStreamStats& stats = streamer.stats;
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "end to end %u I/O threads", threads);
+    BenchReport("assets", metric, stats.bytesUploaded / 1e6 / elapsed, "MB/s");
+    std::snprintf(metric, sizeof(metric), "load per thread %u I/O threads", threads);
+    BenchReport("assets", metric, stats.bytesRead / 1e6 / stats.loadSeconds, "MB/s");
+    std::snprintf(metric, sizeof(metric), "latency max %u I/O threads", threads);
+    BenchReport("assets", metric, stats.maxLatencyMilliseconds, "ms");
+    std::snprintf(metric, sizeof(metric), "pump avg %u I/O threads", threads);
+    BenchReport("assets", metric, stats.averagePumpMicroseconds, "us");
+    std::snprintf(metric, sizeof(metric), "pump max %u I/O threads", threads);
+    BenchReport("assets", metric, stats.maxPumpMicroseconds, "us");
+    correct &= stats.ready == paths.size() && stats.failed == 0;
+
+    // Every texture is its source plus the exact mip chain, buffers are their bytes
+    for (uint32_t i = 0; i < paths.size() && correct; ++i) {
+      const std::vector<uint8_t>& resource = sink.resources[i];
+      if (i >= textureCount) {
+        correct &= resource == sources[i];
+        continue;
+      }
+
+      std::vector<uint8_t> level(static_cast<size_t>(textureSize) * textureSize * 4);
+      for (size_t p = 0; p < level.size() / 4; ++p) {
+        std::memcpy(&level[p * 4], &sources[i][p * 3], 3);
+        level[p * 4 + 3] = 255;
+      }
+      size_t offset = 0;
+      for (uint32_t size = textureSize; correct; size /= 2) {
+        correct &= offset + level.size() <= resource.size() && std::memcmp(resource.data() + offset, level.data(), level.size()) == 0;
+        offset += level.size();
+        if (size == 1 || i % 8 != 0) { // Full chains on every 8th texture
+          break;
+        }
+        level = ReferenceMip(level, size, size);
+      }
+      correct &= i % 8 != 0 || offset == resource.size();
+    }
+  }
+  AssetTextureLayout layout;
+  correct &= ComputeTextureLayout(textureSize, textureSize, 256, 512, layout) && layout.mipCount == 10;
+  BenchReport("assets", "staging per texture with mips", layout.size / 1024.0, "KB");
+
+  // Slots are only reused after their copy completed: while the copy queue
+  // is held back, two slots take two assets and the rest wait for them
+  {
+    AssetStreamer streamer;
+    MockUploadSink sink;
+    sink.staging = staging;
+    streamer.Start(2, staging, 2 * slotSize, slotSize);
+    for (uint32_t i = 0; i < 6; ++i) {
+      streamer.Request(paths[i].c_str(), AssetKind::Texture);
+    }
+    for (int frame = 0; frame < 50; ++frame) {
+      streamer.Pump(sink);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    correct &= streamer.stats.uploading == 2 && streamer.stats.ready == 0 && streamer.Status(2) == AssetStatus::Queued;
+
+    PumpUntilIdle(streamer, sink);
+    for (uint32_t i = 0; i < 6; ++i) {
+      correct &= sink.resources[i].size() > 3 && sink.resources[i][0] == sources[i][0] && sink.resources[i][3] == 255 &&
+        std::memcmp(&sink.resources[i][(textureSize * textureSize - 1) * 4], &sources[i][(textureSize * textureSize - 1) * 3], 3) == 0;
+    }
+    correct &= streamer.stats.slotWaits > 0 && streamer.stats.ready == 6;
+  }
+
+  // Missing, malformed and oversized files fail without taking a slot
+  {
+    const char* badPath = "bench_asset_bad.ppm";
+    const char header[] = "P6\n64 64\n65535\n";
+    correct &= WriteWholeFile(badPath, header, sizeof(header) - 1);
+
+    AssetStreamer streamer;
+    MockUploadSink sink;
+    sink.staging = staging;
+    streamer.Start(1, staging, slotSize, slotSize / 4);
+    uint32_t missing = streamer.Request("bench_asset_missing.ppm", AssetKind::Texture);
+    uint32_t malformed = streamer.Request(badPath, AssetKind::Texture);
+    uint32_t oversized = streamer.Request(paths[0].c_str(), AssetKind::Texture);
+    uint32_t fits = streamer.Request(paths[textureCount].c_str(), AssetKind::Buffer);
+    PumpUntilIdle(streamer, sink);
+    correct &= streamer.Status(missing) == AssetStatus::Failed && streamer.Status(malformed) == AssetStatus::Failed &&
+      streamer.Status(oversized) == AssetStatus::Failed && streamer.Status(fits) == AssetStatus::Ready;
+    std::remove(badPath);
+  }
+
+  AlignedFree(staging, 512);
+  for (const std::string& path : paths) {
+    std::remove(path.c_str());
+  }
+
+  BenchReport("assets", "uploads exact", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Reads a whole loose file the plain way
+bool ReadLooseFile(const char* path, std::vector<uint8_t>& bytes) {
+  std::FILE* file = std::fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  std::fseek(file, 0, SEEK_END);
+  long size = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+  bytes.resize(size > 0 ? static_cast<size_t>(size) : 0);
+  bool ok = size >= 0 && (bytes.empty() || std::fread(bytes.data(), bytes.size(), 1, file) == 1);
+  return (std::fclose(file) == 0) && ok;
+}
+
+// Packed archive against loose files, with and without compression. The
+// files are freshly written and come from the page cache, so this is the
+// per-file overhead and the decompression cost, not disk time.
+bool BenchArchive(const BenchOptions& options) {
+  const uint32_t fileCount = options.size ? options.size : 600;
+  const char* archivePath = "bench_assets.pak";
+  const char* compressedPath = "bench_assets_lz.pak";
+  const int repeats = 5;
+  bool correct = true;
+
+  // Textures with smooth gradients, vertex-like float buffers and small map
+  // chunks - a mix of well and poorly compressible data
+  Random random(31);
+  std::vector<std::string> paths;
+  std::vector<std::vector<uint8_t>> sources;
+  for (uint32_t i = 0; i < fileCount; ++i) {
+    std::vector<uint8_t> bytes;
+    switch (i % 3) {
+      case 0: {
+        const uint32_t size = 128;
+        std::vector<uint8_t> rgb(size * size * 3);
+        for (uint32_t p = 0; p < size * size; ++p) {
+          rgb[p * 3 + 0] = static_cast<uint8_t>(p % size + i);
+          rgb[p * 3 + 1] = static_cast<uint8_t>(p / size);
+          rgb[p * 3 + 2] = static_cast<uint8_t>(random.NextBelow(16));
+        }
+        paths.push_back("textures/bench_" + std::to_string(i) + ".ppm");
+        correct &= WritePpm(("bench_archive_" + std::to_string(i)).c_str(), size, size, rgb.data());
+        correct &= ReadLooseFile(("bench_archive_" + std::to_string(i)).c_str(), bytes);
+        break;
+      }
+      case 1: {
+        std::vector<float> vertices(16 * 1024);
+        for (size_t v = 0; v < vertices.size(); ++v) {
+          vertices[v] = (v % 8 < 3) ? std::floor(random.NextFloat() * 64.0f) * 0.25f : static_cast<float>(v % 8);
+        }
+        bytes.assign(reinterpret_cast<const uint8_t*>(vertices.data()), reinterpret_cast<const uint8_t*>(vertices.data() + vertices.size()));
+        paths.push_back("meshes/bench_" + std::to_string(i) + ".bin");
+        break;
+      }
+      default: {
+        bytes.resize(g_HexChunkBytes);
+        for (uint8_t& byte : bytes) {
+          byte = static_cast<uint8_t>(random.NextBelow(4));
+        }
+        paths.push_back("maps/bench_" + std::to_string(i) + ".chunk");
+        break;
+      }
+    }
+    correct &= WriteWholeFile(("bench_archive_" + std::to_string(i)).c_str(), bytes.data(), bytes.size());
+    sources.push_back(std::move(bytes));
+  }
+
+  uint64_t totalBytes = 0;
+  for (const std::vector<uint8_t>& bytes : sources) {
+    totalBytes += bytes.size();
+  }
+
+  for (bool compress : {false, true}) {
+    BenchTimer timer;
+    AssetArchiveWriter writer;
+    for (uint32_t i = 0; i < fileCount; ++i) {
+      correct &= writer.Add(paths[i].c_str(), sources[i].data(), sources[i].size(), compress);
+    }
+    correct &= writer.Write(compress ? compressedPath : archivePath);
+    BenchReport("archive", compress ? "pack compressed" : "pack", timer.ElapsedSeconds() * 1e3, "ms");
+  }
+
+  // Loose files, one open and read per asset
+  std::vector<uint8_t> buffer;
+  double looseSeconds = 0.0;
+  for (int repeat = 0; repeat < repeats; ++repeat) {
+    BenchTimer timer;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < fileCount; ++i) {
+      correct &= ReadLooseFile(("bench_archive_" + std::to_string(i)).c_str(), buffer);
+      sum += buffer[buffer.size() / 2];
+    }
+    looseSeconds += timer.ElapsedSeconds();
+    DoNotOptimize(static_cast<double>(sum));
+  }
+  BenchReport("archive", "loose files open + read", looseSeconds / repeats * 1e3, "ms");
+
+  // Archive, opened once, assets used in place or decompressed
+  for (bool compress : {false, true}) {
+    double seconds = 0.0;
+    uint64_t fileSize = 0;
+    for (int repeat = 0; repeat < repeats; ++repeat) {
+      BenchTimer timer;
+      AssetArchive archive;
+      correct &= archive.Open(compress ? compressedPath : archivePath);
+      fileSize = archive.file.size;
+      uint64_t sum = 0;
+      for (uint32_t i = 0; i < fileCount; ++i) {
+        AssetView view;
+        if (!archive.Find(paths[i].c_str(), view)) {
+          correct = false;
+          continue;
+        }
+        if (view.compressed) {
+          buffer.resize(view.size);
+          correct &= AssetArchive::Read(view, buffer.data());
+          sum += buffer[view.size / 2];
+        }
+        else {
+          // Touch every page, like a consumer would
+          for (size_t b = 0; b < view.size; b += 4096) {
+            sum += view.data[b];
+          }
+        }
+      }
+      seconds += timer.ElapsedSeconds();
+      DoNotOptimize(static_cast<double>(sum));
+    }
+    BenchReport("archive", compress ? "compressed archive open + read" : "archive open + read", seconds / repeats * 1e3, "ms");
+    BenchReport("archive", compress ? "compressed archive size" : "archive size", 100.0 * fileSize / totalBytes, "% of loose");
+  }
+
+  // Decompression speed and lookups on their own
+  {
+    AssetArchive archive;
+    correct &= archive.Open(compressedPath) && archive.Verify();
+
+    BenchTimer timer;
+    uint64_t decompressed = 0;
+    for (uint32_t i = 0; i < archive.EntryCount(); ++i) {
+      AssetView view;
+      if (archive.View(i, view) && view.compressed) {
+        buffer.resize(view.size);
+        correct &= AssetArchive::Read(view, buffer.data());
+        decompressed += view.size;
+      }
+    }
+    BenchReport("archive", "decompression", decompressed / 1e9 / timer.ElapsedSeconds(), "GB/s");
+
+    const uint32_t lookups = 1000000;
+    uint32_t found = 0;
+    timer.Reset();
+    for (uint32_t i = 0; i < lookups; ++i) {
+      found += archive.FindEntry(paths[(i * 7919u) % fileCount].c_str()) != UINT32_MAX;
+    }
+    BenchReport("archive", "lookup", timer.ElapsedNanoseconds() / lookups, "ns");
+    correct &= found == lookups;
+
+    // Backslashes find the same asset, unknown paths nothing
+    std::string windowsPath = paths[1];
+    std::replace(windowsPath.begin(), windowsPath.end(), '/', '\\');
+    correct &= archive.FindEntry(windowsPath.c_str()) == archive.FindEntry(paths[1].c_str());
+    correct &= archive.FindEntry("meshes/missing.bin") == UINT32_MAX && archive.FindEntry("") == UINT32_MAX;
+
+    // Every asset round trips
+    for (uint32_t i = 0; i < fileCount; ++i) {
+      AssetView view = {};
+      correct &= archive.Find(paths[i].c_str(), view) && view.size == sources[i].size();
+      buffer.resize(view.size);
+      correct &= AssetArchive::Read(view, buffer.data()) && buffer == sources[i];
+    }
+  }
+
+  // A truncated archive does not open, a damaged block does not decode
+  {
+    std::vector<uint8_t> bytes;
+    correct &= ReadLooseFile(compressedPath, bytes);
+    correct &= WriteWholeFile("bench_assets_cut.pak", bytes.data(), bytes.size() - 1);
+    AssetArchive archive;
+    correct &= !archive.Open("bench_assets_cut.pak");
+    std::remove("bench_assets_cut.pak");
+
+    std::vector<uint8_t> data(100000);
+    for (size_t b = 0; b < data.size(); ++b) {
+      data[b] = static_cast<uint8_t>((b / 7) % 13);
+    }
+    std::vector<uint8_t> packed(LzCompressBound(data.size()));
+    packed.resize(LzCompress(data.data(), data.size(), packed.data()));
+    std::vector<uint8_t> out(data.size());
+    correct &= LzDecompress(packed.data(), packed.size(), out.data(), out.size()) && out == data;
+    correct &= !LzDecompress(packed.data(), packed.size() - 1, out.data(), out.size());
+    correct &= !LzDecompress(packed.data(), packed.size(), out.data(), out.size() - 1);
+    uint32_t survived = 0;
+    for (size_t b = 0; b < packed.size(); b += 17) {
+      std::vector<uint8_t> damaged = packed;
+      damaged[b] ^= 0x5A;
+      survived += !LzDecompress(damaged.data(), damaged.size(), out.data(), out.size()) || out != data;
+    }
+    correct &= survived > 0; // Mostly rejected, never out of bounds
+
+    // Sizes around the end-of-block rules
+    for (size_t size : {0, 1, 5, 12, 13, 17, 64, 65536 + 100}) {
+      std::vector<uint8_t> small(size, 'a');
+      for (size_t b = 0; b < size; b += 3) {
+        small[b] = static_cast<uint8_t>(b);
+      }
+      std::vector<uint8_t> smallPacked(LzCompressBound(size));
+      smallPacked.resize(LzCompress(small.data(), size, smallPacked.data()));
+      std::vector<uint8_t> smallOut(size + 1);
+      correct &= LzDecompress(smallPacked.data(), smallPacked.size(), smallOut.data(), size) &&
+        std::equal(small.begin(), small.end(), smallOut.begin());
+    }
+  }
+
+  // The streamer finds assets in the archive
+  {
+    AssetArchive archive;
+    correct &= archive.Open(compressedPath);
+    const size_t stagingSize = 4u << 20;
+    uint8_t* staging = static_cast<uint8_t*>(AlignedAlloc(stagingSize, 512));
+    AssetStreamer streamer;
+    MockUploadSink sink;
+    sink.staging = staging;
+    streamer.archive = &archive;
+    streamer.Start(1, staging, stagingSize, 1u << 20);
+    uint32_t texture = streamer.Request(paths[0].c_str(), AssetKind::Texture);
+    uint32_t mesh = streamer.Request(paths[1].c_str(), AssetKind::Buffer);
+    PumpUntilIdle(streamer, sink);
+    streamer.Stop();
+    correct &= streamer.Status(texture) == AssetStatus::Ready && streamer.Status(mesh) == AssetStatus::Ready &&
+      sink.resources[mesh] == sources[1] && sink.resources[texture][0] == sources[0][15]; // First pixel after the header
+    AlignedFree(staging, 512);
+  }
+
+  for (uint32_t i = 0; i < fileCount; ++i) {
+    std::remove(("bench_archive_" + std::to_string(i)).c_str());
+  }
+  std::remove(archivePath);
+  std::remove(compressedPath);
+
+  BenchReport("archive", "round trips and rejects", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Queue depth of the frame pacer against the simulated GPU. A frame starts
+// with at most framesInFlight frames queued and leaves BeginFrame() with
+// fewer, a GPU that finishes on signal never makes the CPU wait.
+bool BenchFramePacing(const BenchOptions& options) {
+  uint32_t frames = options.size ? options.size : 100;
+  const uint32_t slots = 3;
+  bool correct = true;
+
+  for (uint32_t framesInFlight = 1; framesInFlight <= slots; ++framesInFlight) {
+    SimulatedGpuFence fence;
+    fence.gpuFrameTime = std::chrono::milliseconds(1);
+    FramePacer pacer;
+    pacer.Init(&fence, framesInFlight);
+
+    uint64_t slotFenceValues[slots] = {};
+    uint32_t maxQueued = 0;
+    uint32_t maxQueuedAfterWait = 0;
+    BenchTimer timer;
+    for (uint32_t i = 0; i < frames; ++i) {
+      uint32_t slot = i % slots;
+      pacer.BeginFrame(slotFenceValues[slot]);
+      maxQueued = std::max(maxQueued, pacer.stats.framesInFlight);
+      maxQueuedAfterWait = std::max(maxQueuedAfterWait, static_cast<uint32_t>(pacer.lastSignaled - fence.GetCompletedValue()));
+      slotFenceValues[slot] = pacer.EndFrame();
+    }
+    pacer.WaitForIdle();
+    double elapsed = timer.ElapsedSeconds();
+
+    // Only the first frames get ahead without waiting
+    bool paced = maxQueued <= framesInFlight && maxQueuedAfterWait < framesInFlight && pacer.stats.waits >= frames - framesInFlight;
+    correct &= paced;
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "slow gpu %u in flight frame", framesInFlight);
+    BenchReport("framepacing", metric, elapsed * 1e3 / frames, "ms");
+    std::snprintf(metric, sizeof(metric), "slow gpu %u in flight queued max", framesInFlight);
+    BenchReport("framepacing", metric, maxQueued, paced ? "frames (match)" : "frames (MISMATCH)");
+    std::snprintf(metric, sizeof(metric), "slow gpu %u in flight waits", framesInFlight);
+    BenchReport("framepacing", metric, static_cast<double>(pacer.stats.waits), "");
+  }
+
+  // A GPU that is done on signal, the null renderer's
+  {
+    SimulatedGpuFence fence;
+    FramePacer pacer;
+    pacer.Init(&fence, 1);
+
+    uint64_t slotFenceValues[slots] = {};
+    for (uint32_t i = 0; i < frames * 10; ++i) {
+      uint32_t slot = i % slots;
+      pacer.BeginFrame(slotFenceValues[slot]);
+      slotFenceValues[slot] = pacer.EndFrame();
+    }
+
+    bool noWaits = pacer.stats.waits == 0;
+    correct &= noWaits;
+    BenchReport("framepacing", "instant gpu waits", static_cast<double>(pacer.stats.waits), noWaits ? "(match)" : "(MISMATCH)");
+  }
+
+  return correct;
+}
+
+struct BenchScenario {
+  const char* name;
+  bool (*run)(const BenchOptions& options);
+};
+
+// A synthetic frame for the command recorder - passes of different widths,
+// each list recording a stream of stand-in commands
+struct BenchCommandFrame {
+  NullCommandBackend* backend;
+  JobSystem* jobs;
+  uint64_t frame;
+  uint32_t commandsPerList;
+};
+
+void BenchRecordCommands(void* data, uint32_t list, uint32_t piece, uint32_t) {
+  const BenchCommandFrame& frame = *static_cast<BenchCommandFrame*>(data);
+  for (uint32_t i = 0; i < frame.commandsPerList; ++i) {
+    frame.backend->Command(list, (frame.frame << 40) ^ (static_cast<uint64_t>(piece) << 20) ^ i);
+  }
+}
+
+// Runs jobs of its own before recording, so a waiting thread can pick up
+// another list and nest it on the same thread
+void BenchRecordCommandsNested(void* data, uint32_t list, uint32_t piece, uint32_t pieceCount) {
+  const BenchCommandFrame& frame = *static_cast<BenchCommandFrame*>(data);
+  std::atomic<uint64_t> total{0};
+  frame.jobs->ParallelFor(0, 256, 16, [&](uint32_t begin, uint32_t end) {
+    uint64_t sum = 0;
+    for (uint32_t i = begin; i < end; ++i) {
+      sum += HashBytes(&i, sizeof(i), frame.frame);
+    }
+    total += sum;
+  });
+
+  frame.backend->Command(list, total.load());
+  BenchRecordCommands(data, list, piece, pieceCount);
+}
+
+// Parallel command list recording against the null backend. Every thread
+// count has to submit the same command stream and never break an allocator
+// or list rule, with frames really in flight on the simulated GPU.
+bool BenchCommands(const BenchOptions& options) {
+  uint32_t commandsPerList = options.size ? options.size : 2000;
+  const uint32_t frames = 200;
+  const uint32_t slots = 3;
+  bool correct = true;
+
+  struct BenchPass {
+    CommandRecordFunction function;
+    uint32_t pieces;
+  };
+  const BenchPass passes[] = {
+    {BenchRecordCommands, 1},        // Frame begin
+    {BenchRecordCommands, 16},       // Terrain
+    {BenchRecordCommands, 4},        // Water
+    {BenchRecordCommandsNested, 8},  // Ships
+    {BenchRecordCommands, 1},        // UI
+    {BenchRecordCommands, 1},        // Frame end
+  };
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  for (uint32_t threads = 2; threads < hardwareThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(std::max(2u, hardwareThreads));
+
+  double singleThreaded = 0.0;
+  uint64_t referenceHash = 0;
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+
+    SimulatedGpuFence fence;
+    fence.gpuFrameTime = std::chrono::microseconds(500);
+    NullCommandBackend backend;
+    backend.fence = &fence;
+    CommandRecorder recorder;
+    recorder.Init(&backend, slots, jobs.WorkerCount());
+    FramePacer pacer;
+    pacer.Init(&fence, 2);
+
+    uint64_t slotFenceValues[slots] = {};
+    BenchCommandFrame frame = {&backend, &jobs, 0, commandsPerList};
+    for (uint32_t i = 0; i < frames; ++i) {
+      uint32_t slot = i % slots;
+      pacer.BeginFrame(slotFenceValues[slot]);
+      recorder.BeginFrame(slot);
+
+      frame.frame = i;
+      for (const BenchPass& pass : passes) {
+        correct &= recorder.AddPass(pass.function, &frame, pass.pieces);
+      }
+      recorder.Record(jobs);
+      recorder.Submit();
+      slotFenceValues[slot] = pacer.EndFrame();
+    }
+    pacer.WaitForIdle();
+    jobs.Stop();
+
+    double elapsed = recorder.stats.totalRecordMicroseconds / frames * 1e-3;
+    singleThreaded = threads == 1 ? elapsed : singleThreaded;
+    referenceHash = threads == 1 ? backend.submittedHash : referenceHash;
+    correct &= backend.errors == 0 && backend.submittedHash == referenceHash && backend.executions == frames;
+    // One allocator per worker and slot, plus the ones nested lists took
+    correct &= recorder.AllocatorCount() >= slots && recorder.AllocatorCount() <= slots * threads * g_CommandPoolDepth;
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "record %u lists %u threads", recorder.stats.lists, threads);
+    BenchReport("commands", metric, elapsed, "ms");
+    std::snprintf(metric, sizeof(metric), "speedup %u threads", threads);
+    BenchReport("commands", metric, singleThreaded / elapsed, "x");
+    std::snprintf(metric, sizeof(metric), "allocators %u threads", threads);
+    BenchReport("commands", metric, recorder.AllocatorCount(), "");
+    if (threads == 1) {
+      BenchReport("commands", "commands per second 1 thread", backend.commands / (recorder.stats.totalRecordMicroseconds * 1e-6) / 1e6, "M");
+    }
+  }
+
+  // The null backend has to catch the misuse it exists for
+  {
+    SimulatedGpuFence fence;
+    fence.gpuFrameTime = std::chrono::seconds(10);
+    NullCommandBackend backend;
+    backend.fence = &fence;
+    backend.Reserve(2, 2);
+
+    uint32_t list = 0;
+    backend.BeginList(0, 0);
+    backend.BeginList(1, 0);   // Second open list on an allocator
+    backend.Execute(&list, 1); // Open list
+    backend.EndList(0);
+    backend.EndList(1);
+    backend.Execute(&list, 1);
+    fence.Signal();
+    backend.ResetAllocator(0); // GPU still busy
+    correct &= backend.errors == 3;
+  }
+
+  BenchReport("commands", "ordered and safe", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// The demo world's terrain on a size x size grid centered on the origin, with
+// the sea flattened to one level and a ship on every 16th sea tile
+struct BenchRasterScene {
+  std::vector<HexInstance> instances;
+  std::vector<float> posX, posZ, dirX, dirZ;
+  float viewProjection[16];
+  float seaLevel = 2.5f;
+};
+
+void BuildRasterScene(BenchRasterScene& scene, uint32_t size, uint32_t width, uint32_t height) {
+  Random random(1);
+  HexAxial center = OffsetToAxial({static_cast<int32_t>(size / 2), static_cast<int32_t>(size / 2)});
+  for (uint32_t row = 0; row < size; ++row) {
+    for (uint32_t col = 0; col < size; ++col) {
+      float x = col * 0.11f;
+      float y = row * 0.13f;
+      float tileHeight = 4.0f + 2.5f * std::sin(x) * std::cos(y) + 1.5f * std::sin(x * 0.37f + y * 0.23f) + random.NextFloat() * 0.5f;
+      uint8_t material = tileHeight < scene.seaLevel ? 0 : (tileHeight < 3.2f ? 1 : (tileHeight < 6.0f ? 2 : 3));
+      tileHeight = std::max(tileHeight, scene.seaLevel);
+
+      HexAxial hex = OffsetToAxial({static_cast<int32_t>(col), static_cast<int32_t>(row)});
+      HexInstance instance = {};
+      instance.q = static_cast<int16_t>(hex.q - center.q);
+      instance.r = static_cast<int16_t>(hex.r - center.r);
+      instance.height = static_cast<uint16_t>(tileHeight * g_HexHeightScale);
+      instance.material = material;
+      scene.instances.push_back(instance);
+
+      if (material == 0 && random.NextBelow(16) == 0) {
+        float heading = random.NextFloat() * 6.2831853f;
+        scene.posX.push_back(g_Sqrt3 * (instance.q + 0.5f * instance.r));
+        scene.posZ.push_back(1.5f * instance.r);
+        scene.dirX.push_back(std::cos(heading));
+        scene.dirZ.push_back(std::sin(heading));
+      }
+    }
+  }
+
+  // The whole grid in view, so the triangles shrink as it grows
+  Camera camera;
+  camera.eye = {0.0f, 0.75f * size, -1.05f * size};
+  camera.aspect = static_cast<float>(width) / height;
+  camera.farZ = 4.0f * size;
+  ComputeViewProjection(camera, scene.viewProjection);
+}
+
+void DrawRasterScene(SoftwareRasterizer& rasterizer, const BenchRasterScene& scene) {
+  rasterizer.BeginFrame(scene.viewProjection, 0xFFB0A080u);
+  rasterizer.Draw(RasterHexDraw(scene.instances.data(), static_cast<uint32_t>(scene.instances.size()), 1.0f));
+  rasterizer.Draw(RasterShipDraw(scene.posX.data(), scene.posZ.data(), scene.dirX.data(), scene.dirZ.data(),
+      static_cast<uint32_t>(scene.posX.size()), 0.0f, 0.0f, scene.seaLevel));
+}
+
+// Software rasterizer throughput. Every instruction set and thread count has
+// to produce the same image, and the cost is measured against the grid size.
+bool BenchRaster(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 256;
+  const uint32_t width = 1280;
+  const uint32_t height = 720;
+  const uint32_t frames = 10;
+  bool correct = true;
+
+  BenchRasterScene scene;
+  BuildRasterScene(scene, size, width, height);
+
+  // Per instruction set on one thread, so the rates are per core
+  uint64_t referenceHash = 0;
+  {
+    JobSystem jobs;
+    jobs.Start(1);
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2}) {
+      if (level > GetSimdLevel()) {
+        continue;
+      }
+
+      SoftwareRasterizer rasterizer;
+      rasterizer.Init(width, height);
+      rasterizer.level = level;
+      for (uint32_t i = 0; i < frames; ++i) {
+        DrawRasterScene(rasterizer, scene);
+        rasterizer.Render(jobs);
+      }
+
+      const RasterStats& stats = rasterizer.stats;
+      double seconds = (stats.totalSetupMicroseconds + stats.totalRasterMicroseconds) * 1e-6;
+      char metric[64];
+      std::snprintf(metric, sizeof(metric), "frame %s 1 thread", SimdLevelName(level));
+      BenchReport("raster", metric, seconds / frames * 1e3, "ms");
+      std::snprintf(metric, sizeof(metric), "pixels %s per core", SimdLevelName(level));
+      BenchReport("raster", metric, static_cast<double>(width) * height * frames / seconds / 1e6, "Mpix/s");
+      std::snprintf(metric, sizeof(metric), "triangles %s per core", SimdLevelName(level));
+      BenchReport("raster", metric, static_cast<double>(stats.triangles) * frames / seconds / 1e6, "Mtri/s");
+      std::snprintf(metric, sizeof(metric), "raster share %s", SimdLevelName(level));
+      BenchReport("raster", metric, 100.0 * stats.totalRasterMicroseconds * 1e-6 / seconds, "%");
+
+      if (level == SimdLevel::Scalar) {
+        referenceHash = rasterizer.Hash();
+        BenchReport("raster", "triangles submitted", static_cast<double>(stats.triangles), "");
+        BenchReport("raster", "triangles culled", static_cast<double>(stats.culled), "");
+        BenchReport("raster", "tile bin entries", static_cast<double>(stats.binEntries), "");
+
+        std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+        rasterizer.ReadRgb(rgb.data());
+        WritePpm("bench_raster.ppm", width, height, rgb.data());
+      }
+      correct &= rasterizer.Hash() == referenceHash;
+    }
+    jobs.Stop();
+  }
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  for (uint32_t threads = 2; threads < hardwareThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(std::max(2u, hardwareThreads));
+
+  double singleThreaded = 0.0;
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+    SoftwareRasterizer rasterizer;
+    rasterizer.Init(width, height);
+    for (uint32_t i = 0; i < frames; ++i) {
+      DrawRasterScene(rasterizer, scene);
+      rasterizer.Render(jobs);
+    }
+    jobs.Stop();
+
+    double elapsed = (rasterizer.stats.totalSetupMicroseconds + rasterizer.stats.totalRasterMicroseconds) / frames * 1e-3;
+    singleThreaded = threads == 1 ? elapsed : singleThreaded;
+    correct &= rasterizer.Hash() == referenceHash;
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "frame %u threads", threads);
+    BenchReport("raster", metric, elapsed, "ms");
+    std::snprintf(metric, sizeof(metric), "speedup %u threads", threads);
+    BenchReport("raster", metric, singleThreaded / elapsed, "x");
+  }
+
+  // Cost against the tile count with the grid filling the view
+  {
+    JobSystem jobs;
+    jobs.Start(0);
+    for (uint32_t gridSize = 64; gridSize <= 512; gridSize *= 2) {
+      BenchRasterScene sweep;
+      BuildRasterScene(sweep, gridSize, width, height);
+      SoftwareRasterizer rasterizer;
+      rasterizer.Init(width, height);
+      for (uint32_t i = 0; i < frames; ++i) {
+        DrawRasterScene(rasterizer, sweep);
+        rasterizer.Render(jobs);
+      }
+
+      const RasterStats& stats = rasterizer.stats;
+      char metric[64];
+      std::snprintf(metric, sizeof(metric), "frame %ux%u tiles setup", gridSize, gridSize);
+      BenchReport("raster", metric, stats.totalSetupMicroseconds / frames * 1e-3, "ms");
+      std::snprintf(metric, sizeof(metric), "frame %ux%u tiles raster", gridSize, gridSize);
+      BenchReport("raster", metric, stats.totalRasterMicroseconds / frames * 1e-3, "ms");
+    }
+    jobs.Stop();
+  }
+
+  BenchReport("raster", "deterministic", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Exact slerp, to check the approximation in BlendShipKeys against
+void BenchSlerp(const float* a, const float* b, float t, float* out) {
+  float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+  float sign = dot < 0.0f ? -1.0f : 1.0f;
+  double angle = std::acos(std::min(1.0, static_cast<double>(dot * sign)));
+  double wa = angle > 1e-6 ? std::sin((1.0 - t) * angle) / std::sin(angle) : 1.0 - t;
+  double wb = angle > 1e-6 ? std::sin(t * angle) / std::sin(angle) : t;
+  for (int c = 0; c < 4; ++c) {
+    out[c] = static_cast<float>(wa * a[c] + wb * sign * b[c]);
+  }
+}
+
+// Batched rig sampling, palette upload and CPU skinning of a fleet. Every
+// instruction set and thread count has to pose the ships to the same bits.
+bool BenchAnimation(const BenchOptions& options) {
+  uint32_t shipCount = options.size ? options.size : 20000;
+  const uint32_t frames = 60;
+  const float dt = 1.0f / 60.0f;
+  bool correct = true;
+
+  ShipParams params;
+  params.areaWidth = g_Sqrt3 * 512.0f;
+  params.areaHeight = 1.5f * 512.0f;
+  float eyeX = params.areaWidth * 0.5f;
+  float eyeZ = params.areaHeight * 0.5f;
+
+  // Ships under way, some turning and some idle, at every point of their loops
+  ShipStore ships;
+  {
+    JobSystem jobs;
+    jobs.Start(1);
+    Random random(22);
+    ships.Reserve(shipCount);
+    for (uint32_t i = 0; i < shipCount; ++i) {
+      ShipDesc desc;
+      desc.x = random.NextFloat() * params.areaWidth;
+      desc.z = random.NextFloat() * params.areaHeight;
+      desc.heading = random.NextFloat() * 6.2831853f;
+      desc.maxSpeed = 2.0f + random.NextFloat() * 4.0f;
+      desc.seed = i;
+      ships.Create(desc);
+    }
+    for (int tick = 0; tick < 30; ++tick) {
+      StepShips(ships, params, dt, jobs);
+    }
+    for (uint32_t i = 0; i < ships.count; ++i) {
+      ships.animPhase[i] = random.NextFloat();
+      if (i % 10 == 0) {
+        ships.animState[i] = ShipAnimationIdle;
+      }
+    }
+    jobs.Stop();
+  }
+
+  // Full rate per instruction set on one thread
+  std::vector<float> reference;
+  {
+    JobSystem jobs;
+    jobs.Start(1);
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2}) {
+      if (level > GetSimdLevel()) {
+        continue;
+      }
+
+      ShipAnimator animator;
+      animator.Init();
+      animator.level = level;
+      animator.lod.enabled = false;
+      for (uint32_t frame = 0; frame < frames; ++frame) {
+        animator.Update(ships, eyeX, eyeZ, frame, jobs);
+      }
+
+      char metric[64];
+      std::snprintf(metric, sizeof(metric), "sample %s 1 thread", SimdLevelName(level));
+      BenchReport("animation", metric, animator.stats.totalSampled / (animator.stats.totalMicroseconds * 1e-3), "ships/ms");
+
+      const float* palettes = animator.palettes;
+      size_t floats = static_cast<size_t>(animator.slotCount) * g_ShipPaletteFloats;
+      if (reference.empty()) {
+        reference.assign(palettes, palettes + floats);
+      }
+      else {
+        correct &= std::memcmp(reference.data(), palettes, floats * sizeof(float)) == 0;
+      }
+    }
+    jobs.Stop();
+  }
+
+  // The approximated slerp against the exact one over the whole blend range
+  {
+    Random random(23);
+    float worst = 0.0f;
+    for (uint32_t i = 0; i < 10000; ++i) {
+      ShipKeyLanes a, b;
+      float t[g_ShipAnimationLanes];
+      for (uint32_t lane = 0; lane < g_ShipAnimationLanes; ++lane) {
+        float length2a = 0.0f, length2b = 0.0f;
+        for (int c = 0; c < 4; ++c) {
+          a.rotation[c][lane] = random.NextFloat() * 2.0f - 1.0f;
+          b.rotation[c][lane] = random.NextFloat() * 2.0f - 1.0f;
+          length2a += a.rotation[c][lane] * a.rotation[c][lane];
+          length2b += b.rotation[c][lane] * b.rotation[c][lane];
+        }
+        for (int c = 0; c < 4; ++c) {
+          a.rotation[c][lane] /= std::sqrt(length2a);
+          b.rotation[c][lane] /= std::sqrt(length2b);
+        }
+        for (int c = 0; c < 3; ++c) {
+          a.translation[c][lane] = b.translation[c][lane] = 0.0f;
+        }
+        t[lane] = random.NextFloat();
+      }
+
+      ShipPoseLanes pose;
+      BlendShipKeysScalar(a, b, t, pose);
+      for (uint32_t lane = 0; lane < g_ShipAnimationLanes; ++lane) {
+        float qa[4], qb[4], exact[4];
+        for (int c = 0; c < 4; ++c) {
+          qa[c] = a.rotation[c][lane];
+          qb[c] = b.rotation[c][lane];
+        }
+        BenchSlerp(qa, qb, t[lane], exact);
+        float dot = 0.0f;
+        for (int c = 0; c < 4; ++c) {
+          dot += exact[c] * pose.rotation[c][lane];
+        }
+        worst = std::max(worst, 2.0f * std::acos(std::min(1.0f, std::fabs(dot))));
+      }
+    }
+    BenchReport("animation", "slerp max error", worst * 57.29578f, "degrees");
+    correct &= worst * 57.29578f < 0.5f;
+  }
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<uint32_t> threadCounts = {1};
+  for (uint32_t threads = 2; threads < hardwareThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(std::max(2u, hardwareThreads));
+
+  std::vector<ShipSkinVertex> mesh;
+  std::vector<uint16_t> meshIndices;
+  BuildShipSkinMesh(mesh, meshIndices);
+  uint32_t vertexCount = static_cast<uint32_t>(mesh.size());
+  std::vector<HexVertex> posed(static_cast<size_t>(shipCount) * vertexCount);
+  std::vector<HexVertex> referencePosed;
+
+  for (uint32_t threads : threadCounts) {
+    JobSystem jobs;
+    jobs.Start(threads);
+
+    ShipAnimator animator;
+    animator.Init();
+    animator.lod.enabled = false;
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+      animator.Update(ships, eyeX, eyeZ, frame, jobs);
+    }
+    correct &= std::memcmp(reference.data(), animator.palettes, reference.size() * sizeof(float)) == 0;
+
+    BenchTimer timer;
+    for (uint32_t frame = 0; frame < 10; ++frame) {
+      SkinShips(animator, ships, mesh.data(), vertexCount, 2.5f, posed.data(), jobs);
+    }
+    double skinMs = timer.ElapsedSeconds() * 1e3 / 10;
+    jobs.Stop();
+
+    if (referencePosed.empty()) {
+      referencePosed = posed;
+    }
+    else {
+      correct &= std::memcmp(referencePosed.data(), posed.data(), posed.size() * sizeof(HexVertex)) == 0;
+    }
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "sample %u threads", threads);
+    BenchReport("animation", metric, animator.stats.totalSampled / (animator.stats.totalMicroseconds * 1e-3), "ships/ms");
+    std::snprintf(metric, sizeof(metric), "cpu skinning %u threads", threads);
+    BenchReport("animation", metric, shipCount / skinMs, "ships/ms");
+  }
+  BenchReport("animation", "skinned vertices per ship", vertexCount, "");
+
+  // Distant ships at reduced rates, with the camera over the middle of the fleet
+  {
+    JobSystem jobs;
+    jobs.Start(0);
+    ShipAnimator animator;
+    animator.Init();
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+      animator.Update(ships, eyeX, eyeZ, frame, jobs);
+    }
+    jobs.Stop();
+
+    double perFrameMs = animator.stats.totalMicroseconds * 1e-3 / frames;
+    BenchReport("animation", "lod sampled per frame", 100.0 * animator.stats.totalSampled / (static_cast<double>(shipCount) * frames), "%");
+    BenchReport("animation", "lod frame", perFrameMs, "ms");
+    BenchReport("animation", "lod fleet", shipCount / perFrameMs, "ships/ms");
+
+    // Palettes to upload memory, where the GPU skinning reads them
+    size_t size = static_cast<size_t>(animator.slotCount) * g_ShipPaletteFloats * sizeof(float);
+    uint8_t* memory = static_cast<uint8_t*>(AlignedAlloc(size + 256, 256));
+    std::memset(memory, 0, size + 256); // Mapped upload memory is resident
+    UploadRing ring;
+    ring.Init(memory, 0, size + 256);
+    BenchTimer timer;
+    UploadAllocation allocation = animator.UploadPalettes(ring);
+    double uploadMs = timer.ElapsedSeconds() * 1e3;
+    correct &= allocation.cpu && std::memcmp(allocation.cpu, animator.palettes, size) == 0;
+    BenchReport("animation", "palette upload", uploadMs, "ms");
+    BenchReport("animation", "palette upload size", size / 1e6, "MB");
+    AlignedFree(memory, 256);
+  }
+
+  // A few ships up close through the software rasterizer, to look at
+  {
+    JobSystem jobs;
+    jobs.Start(0);
+    ShipStore fleet;
+    for (uint32_t i = 0; i < 6; ++i) {
+      ShipDesc desc;
+      desc.x = (i % 3) * 3.0f - 3.0f;
+      desc.z = (i / 3) * 4.0f;
+      desc.heading = 1.5707963f + 0.4f * i;
+      fleet.Create(desc);
+      fleet.animState[i] = static_cast<uint8_t>(i % g_ShipAnimationClips);
+      fleet.animPhase[i] = i * 0.15f;
+    }
+    ShipAnimator animator;
+    animator.Init();
+    animator.Update(fleet, 0.0f, 0.0f, 0, jobs);
+    std::vector<HexVertex> fleetPosed(static_cast<size_t>(fleet.count) * vertexCount);
+    SkinShips(animator, fleet, mesh.data(), vertexCount, 0.0f, fleetPosed.data(), jobs);
+
+    Camera camera;
+    camera.eye = {0.0f, 5.0f, -8.0f};
+    camera.target = {0.0f, 0.5f, 2.0f};
+    camera.aspect = 640.0f / 360.0f;
+    float viewProjection[16];
+    ComputeViewProjection(camera, viewProjection);
+
+    SoftwareRasterizer rasterizer;
+    rasterizer.Init(640, 360);
+    rasterizer.BeginFrame(viewProjection, 0xFFB0A080u);
+    rasterizer.Draw(RasterMeshDraw(fleetPosed.data(), vertexCount, meshIndices.data(), static_cast<uint32_t>(meshIndices.size()), fleet.count, 0.0f, 0.0f));
+    rasterizer.Render(jobs);
+    jobs.Stop();
+
+    std::vector<uint8_t> rgb(640 * 360 * 3);
+    rasterizer.ReadRgb(rgb.data());
+    WritePpm("bench_animation.ppm", 640, 360, rgb.data());
+  }
+
+  BenchReport("animation", "deterministic", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Launches the fleet at tick 0 and gives a few orders later on
+void StartLockstepWorld(LockstepWorld& world, uint32_t size, uint32_t shipCount, JobSystem& jobs) {
+  HexGrid grid(size, size);
+  FillRandomTerrain(grid, 23);
+
+  ShipParams params;
+  params.areaWidth = g_Sqrt3 * size;
+  params.areaHeight = 1.5f * size;
+  world.Init(std::move(grid), params, 1.0f / 60.0f, jobs);
+  world.snapshotInterval = 4;
+
+  Random random(23);
+  LockstepCommand command;
+  for (uint32_t i = 0; i < shipCount; ++i) {
+    command.launch.x = random.NextFloat() * params.areaWidth;
+    command.launch.z = random.NextFloat() * params.areaHeight;
+    command.launch.heading = random.NextFloat() * 6.2831853f;
+    command.launch.maxSpeed = 2.0f + random.NextFloat() * 4.0f;
+    command.launch.seed = i;
+    world.AddCommand(command, jobs);
+  }
+
+  // Handles are handed out in launch order, so the orders can name them up front
+  for (uint32_t i = 0; i < shipCount; i += 97) {
+    command.tick = 40 + i % 40;
+    command.type = i % 2 ? LockstepSink : LockstepSteer;
+    command.ship = {i, 1};
+    command.launch.x = params.areaWidth * 0.5f;
+    command.launch.z = params.areaHeight * 0.5f;
+    world.AddCommand(command, jobs);
+  }
+}
+
+// Snapshots, rollback and resimulation of a 1M tile world with a fleet on
+// it. Every instruction set and thread count has to produce the same
+// checksum at every tick, and so does a world that got an order late and
+// rolled back for it.
+bool BenchLockstep(const BenchOptions& options) {
+  uint32_t size = options.size ? options.size : 1024;
+  const uint32_t shipCount = 16384;
+  const uint32_t ticks = 120;
+  bool correct = true;
+
+  std::vector<uint64_t> reference;
+
+  // Per instruction set on one thread
+  for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2}) {
+    if (level > GetSimdLevel()) {
+      continue;
+    }
+
+    JobSystem jobs;
+    jobs.Start(1);
+    LockstepWorld world;
+    world.level = level;
+    StartLockstepWorld(world, size, shipCount, jobs);
+    BenchTimer timer;
+    world.Resimulate(ticks, jobs);
+    double elapsed = timer.ElapsedSeconds();
+    jobs.Stop();
+
+    char metric[64];
+    std::snprintf(metric, sizeof(metric), "tick %s 1 thread", SimdLevelName(level));
+    BenchReport("lockstep", metric, elapsed * 1e3 / ticks, "ms");
+
+    if (reference.empty()) {
+      reference = world.checksums;
+    }
+    else {
+      correct &= world.checksums == reference;
+    }
+  }
+
+  uint32_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+  JobSystem jobs;
+  jobs.Start(std::max(2u, hardwareThreads));
+
+  LockstepWorld world;
+  StartLockstepWorld(world, size, shipCount, jobs);
+  world.Resimulate(ticks, jobs);
+  correct &= world.checksums == reference;
+
+  char metric[64];
+  std::snprintf(metric, sizeof(metric), "tick %u threads", jobs.WorkerCount());
+  BenchReport("lockstep", metric, world.stats.lastTickMicroseconds * 1e-3, "ms");
+
+  // Full snapshots, restores and checksums of the current state
+  {
+    const int repeats = 20;
+    LockstepSnapshot snapshot;
+    world.Snapshot(snapshot, jobs);
+
+    BenchTimer timer;
+    for (int i = 0; i < repeats; ++i) {
+      world.Snapshot(snapshot, jobs);
+    }
+    double snapshotMs = timer.ElapsedSeconds() * 1e3 / repeats;
+
+    timer.Reset();
+    for (int i = 0; i < repeats; ++i) {
+      correct &= world.Restore(snapshot);
+    }
+    double restoreMs = timer.ElapsedSeconds() * 1e3 / repeats;
+
+    timer.Reset();
+    uint64_t checksum = 0;
+    for (int i = 0; i < repeats; ++i) {
+      checksum = world.Checksum(jobs);
+    }
+    double checksumMs = timer.ElapsedSeconds() * 1e3 / repeats;
+    correct &= checksum == reference[ticks];
+
+    std::snprintf(metric, sizeof(metric), "snapshot %uk tiles", size * size / 1024);
+    BenchReport("lockstep", metric, snapshotMs, "ms");
+    BenchReport("lockstep", "restore", restoreMs, "ms");
+    BenchReport("lockstep", "checksum", checksumMs, "ms");
+    BenchReport("lockstep", "snapshot size", snapshot.size / 1e6, "MB");
+  }
+
+  // Deltas against the snapshot one tick and one history span back
+  {
+    LockstepSnapshot base, target, decoded;
+    LockstepDelta delta;
+    for (uint32_t back : {1u, 28u}) {
+      correct &= world.Rollback(ticks - back, jobs);
+      world.Snapshot(base, jobs);
+      world.Resimulate(ticks, jobs);
+      world.Snapshot(target, jobs);
+
+      BenchTimer timer;
+      EncodeLockstepDelta(base, target, delta);
+      double encodeMs = timer.ElapsedSeconds() * 1e3;
+      timer.Reset();
+      bool decodedOk = DecodeLockstepDelta(base, delta, decoded);
+      double decodeMs = timer.ElapsedSeconds() * 1e3;
+      correct &= decodedOk && decoded.size == target.size && std::memcmp(decoded.data, target.data, target.size) == 0;
+
+      std::snprintf(metric, sizeof(metric), "delta %u ticks", back);
+      BenchReport("lockstep", metric, delta.Bytes() / 1e3, "KB");
+      std::snprintf(metric, sizeof(metric), "delta %u ticks ratio", back);
+      BenchReport("lockstep", metric, 100.0 * delta.Bytes() / target.size, "%");
+      std::snprintf(metric, sizeof(metric), "delta %u ticks encode", back);
+      BenchReport("lockstep", metric, encodeMs, "ms");
+      std::snprintf(metric, sizeof(metric), "delta %u ticks decode", back);
+      BenchReport("lockstep", metric, decodeMs, "ms");
+    }
+    correct &= world.checksums == reference;
+  }
+
+  // Resimulation throughput, the cost of a rollback across the whole history
+  {
+    const uint32_t back = (g_LockstepHistory - 1) * world.snapshotInterval;
+    const int repeats = 5;
+    uint64_t resimulated = world.stats.resimulatedTicks;
+    BenchTimer timer;
+    for (int i = 0; i < repeats; ++i) {
+      correct &= world.Rollback(ticks - back, jobs);
+      world.Resimulate(ticks, jobs);
+    }
+    double elapsed = timer.ElapsedSeconds();
+    resimulated = world.stats.resimulatedTicks - resimulated;
+    correct &= resimulated == back * repeats && world.checksums == reference;
+
+    BenchReport("lockstep", "resimulate", resimulated / elapsed, "ticks/s");
+    BenchReport("lockstep", "resimulate ships", resimulated * static_cast<double>(world.ships.count) / (elapsed * 1e3), "ships/ms");
+    std::snprintf(metric, sizeof(metric), "rollback %u ticks", back);
+    BenchReport("lockstep", metric, elapsed * 1e3 / repeats, "ms");
+  }
+
+  // An order that arrives late rolls back and ends up where a world that had
+  // it in time is. One older than the history is refused.
+  {
+    LockstepCommand late;
+    late.tick = ticks - 10;
+    late.type = LockstepSteer;
+    late.ship = {5, 1};
+    correct &= world.AddCommand(late, jobs);
+    late.ship = {7, 1};
+    late.type = LockstepSink;
+    late.tick = ticks - 3;
+    correct &= world.AddCommand(late, jobs);
+    late.tick = 1;
+    correct &= !world.AddCommand(late, jobs);
+
+    LockstepWorld inTime;
+    StartLockstepWorld(inTime, size, shipCount, jobs);
+    late.tick = ticks - 10;
+    late.type = LockstepSteer;
+    late.ship = {5, 1};
+    inTime.AddCommand(late, jobs);
+    late.ship = {7, 1};
+    late.type = LockstepSink;
+    late.tick = ticks - 3;
+    inTime.AddCommand(late, jobs);
+    inTime.Resimulate(ticks, jobs);
+
+    correct &= world.tick == ticks && inTime.checksums == world.checksums && world.checksums[ticks] != reference[ticks];
+    BenchReport("lockstep", "late commands", static_cast<double>(world.stats.lateCommands), "");
+    BenchReport("lockstep", "max rollback", world.stats.maxRollbackMicroseconds * 1e-3, "ms");
+  }
+  jobs.Stop();
+
+  uint32_t charted = 0;
+  world.grid.ForEachTile([&](uint32_t index, HexOffset) {
+    charted += world.grid.flags[index] & g_HexFlagCharted;
+  });
+  BenchReport("lockstep", "charted tiles", charted, "");
+  BenchReport("lockstep", "deterministic", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Input log round trip over a synthetic session: every frame has a frame
+// event, most have cursor movement, some a key or a resize
+bool BenchInput(const BenchOptions& options) {
+  uint32_t frames = options.size ? options.size : 1000000;
+  bool correct = true;
+
+  std::vector<InputEvent> events;
+  events.reserve(frames * 3);
+  Random random(24);
+  uint64_t time = 0;
+  int32_t x = 640, y = 360;
+  for (uint32_t frame = 0; frame < frames; ++frame) {
+    for (uint32_t move = random.NextBelow(4); move > 0; --move) {
+      time += random.NextBelow(4000);
+      InputEvent event;
+      event.type = InputEventType::MouseMove;
+      x = std::max(0, std::min(1279, x + static_cast<int32_t>(random.NextBelow(21)) - 10));
+      y = std::max(0, std::min(719, y + static_cast<int32_t>(random.NextBelow(21)) - 10));
+      event.x = x;
+      event.y = y;
+      event.frame = frame;
+      event.time = time;
+      events.push_back(event);
+    }
+    if (random.NextBelow(100) == 0) {
+      InputEvent event;
+      event.type = InputEventType::KeyDown;
+      event.key = random.NextBelow(2) ? static_cast<uint16_t>('A' + random.NextBelow(26)) : static_cast<uint16_t>(InputKeyEscape + random.NextBelow(3));
+      event.modifiers = static_cast<uint8_t>(random.NextBelow(8));
+      event.frame = frame;
+      event.time = time + 16000;
+      events.push_back(event);
+    }
+    if (random.NextBelow(10000) == 0) {
+      InputEvent event;
+      event.type = InputEventType::Resize;
+      event.x = 640 + random.NextBelow(1280);
+      event.y = 360 + random.NextBelow(720);
+      event.frame = frame;
+      event.time = time + 16000;
+      events.push_back(event);
+    }
+
+    InputEvent event;
+    event.frameNanoseconds = 16000000 + random.NextBelow(1000000);
+    event.frame = frame;
+    event.time = time + 16000;
+    events.push_back(event);
+    time += event.frameNanoseconds / 1000;
+  }
+
+  InputRecorder recorder;
+  recorder.Begin();
+  BenchTimer timer;
+  for (const InputEvent& event : events) {
+    recorder.Append(event);
+  }
+  double encodeSeconds = timer.ElapsedSeconds();
+
+  InputReplay replay;
+  replay.Open(recorder.bytes.data(), recorder.bytes.size());
+  size_t decoded = 0;
+  size_t wrong = 0;
+  InputEvent event;
+  timer.Reset();
+  while (replay.Next(event)) {
+    const InputEvent& expected = events[decoded < events.size() ? decoded : 0];
+    wrong += event.type != expected.type || event.modifiers != expected.modifiers || event.key != expected.key ||
+        event.x != expected.x || event.y != expected.y || event.frameNanoseconds != expected.frameNanoseconds ||
+        event.frame != expected.frame || event.time != expected.time;
+    decoded++;
+  }
+  double decodeSeconds = timer.ElapsedSeconds();
+  correct &= !replay.corrupt && decoded == events.size() && wrong == 0;
+
+  // A log cut off in the middle of an event is reported, not misread
+  replay.Open(recorder.bytes.data(), recorder.bytes.size() - 1);
+  while (replay.Next(event)) {
+  }
+  correct &= replay.corrupt && replay.events == events.size() - 1;
+
+  BenchReport("input", "events", static_cast<double>(events.size()), "");
+  // The same session without any input, only its frame events
+  InputRecorder idle;
+  idle.Begin();
+  for (const InputEvent& frameEvent : events) {
+    if (frameEvent.type == InputEventType::Frame) {
+      idle.Append(frameEvent);
+    }
+  }
+
+  BenchReport("input", "log size", static_cast<double>(recorder.bytes.size()) / frames, "bytes/frame");
+  BenchReport("input", "log size without input", static_cast<double>(idle.bytes.size()) / frames, "bytes/frame");
+  BenchReport("input", "encode", events.size() / encodeSeconds / 1e6, "M events/s");
+  BenchReport("input", "decode", events.size() / decodeSeconds / 1e6, "M events/s");
+  BenchReport("input", "round trip", correct ? 1.0 : 0.0, correct ? "(match)" : "(MISMATCH)");
+
+  return correct;
+}
+
+// Regression suite. Every case sets its workload up once and then times it
+// in samples, the first run is a warm-up and not kept. The workloads are
+// small so the whole suite takes seconds and can gate every change.
+struct BenchSuiteContext {
+  JobSystem* jobs;
+  uint32_t samples;
+  std::vector<double> times; // Per sample, in the case's unit
+  uint64_t checksum;         // Of a result that does not depend on the sample count, checked against the baseline
+};
+
+template <typename Body>
+void BenchSuiteSamples(BenchSuiteContext& context, double scale, Body body) {
+  body();
+  for (uint32_t sample = 0; sample < context.samples; ++sample) {
+    BenchTimer timer;
+    body();
+    context.times.push_back(timer.ElapsedSeconds() * scale);
+  }
+}
+
+void SuiteRecordEmpty(void* data, uint32_t list, uint32_t, uint32_t) {
+  static_cast<NullCommandBackend*>(data)->Command(list, 1);
+}
+
+// Frame pacing and command recording of a frame that draws nothing, the
+// fixed cost every frame pays
+bool SuiteFrameLoop(BenchSuiteContext& context) {
+  const uint32_t frames = 20000;
+  const uint32_t slots = 3;
+
+  SimulatedGpuFence fence;
+  NullCommandBackend backend;
+  backend.fence = &fence;
+  CommandRecorder recorder;
+  recorder.Init(&backend, slots, context.jobs->WorkerCount());
+  FramePacer pacer;
+  pacer.Init(&fence, 2);
+
+  uint64_t slotFenceValues[slots] = {};
+  uint64_t frame = 0;
+  BenchSuiteSamples(context, 1e6 / frames, [&]() {
+    for (uint32_t i = 0; i < frames; ++i, ++frame) {
+      uint32_t slot = frame % slots;
+      pacer.BeginFrame(slotFenceValues[slot]);
+      recorder.BeginFrame(slot);
+      recorder.AddPass(SuiteRecordEmpty, &backend);
+      recorder.AddPass(SuiteRecordEmpty, &backend);
+      recorder.Record(*context.jobs);
+      recorder.Submit();
+      slotFenceValues[slot] = pacer.EndFrame();
+    }
+  });
+  pacer.WaitForIdle();
+
+  return backend.errors == 0 && backend.commands == 2 * frame;
+}
+
+// Sum of the neighbor heights of every tile of a 1024x1024 grid
+bool SuiteGridSweep(BenchSuiteContext& context) {
+  HexGrid grid(1024, 1024);
+  FillRandomTerrain(grid, 1);
+
+  double sums[2] = {};
+  uint32_t runs = 0;
+  BenchSuiteSamples(context, 1e3, [&]() {
+    double sum = 0.0;
+    grid.ForEachTile([&](uint32_t index, HexOffset coord) {
+      uint32_t neighbors[6];
+      grid.Neighbors(coord, neighbors);
+
+      float total = 0.0f;
+      for (uint32_t neighbor : neighbors) {
+        total += neighbor != g_InvalidTile ? grid.heights[neighbor] : grid.heights[index];
+      }
+      sum += total;
+    });
+    sums[runs++ > 0] = sum;
+  });
+  DoNotOptimize(sums[0]);
+  context.checksum = HashBytes(&sums[0], sizeof(sums[0]));
+
+  // The neighbors are the six axial directions, in any order
+  uint32_t wrongTiles = 0;
+  grid.ForEachTile([&](uint32_t, HexOffset coord) {
+    uint32_t neighbors[6];
+    uint32_t expected[6];
+    grid.Neighbors(coord, neighbors);
+    for (int direction = 0; direction < 6; ++direction) {
+      HexOffset neighbor = AxialToOffset(HexNeighbor(OffsetToAxial(coord), direction));
+      expected[direction] = grid.Contains(neighbor) ? grid.Index(neighbor) : g_InvalidTile;
+    }
+    std::sort(neighbors, neighbors + 6);
+    std::sort(expected, expected + 6);
+    wrongTiles += !std::equal(neighbors, neighbors + 6, expected);
+  });
+
+  return sums[0] == sums[1] && wrongTiles == 0;
+}
+
+// Water ticks on a 512x512 grid, 20 per sample
+bool SuiteWaterTick(BenchSuiteContext& context) {
+  const uint32_t size = 512;
+  const int ticks = 20;
+  HexGrid grid(size, size);
+  grid.ForEachTile([&](uint32_t index, HexOffset coord) {
+    float x = static_cast<float>(coord.col);
+    float y = static_cast<float>(coord.row);
+    grid.heights[index] = 2.0f + 1.5f * std::sin(x * 0.05f) * std::cos(y * 0.04f);
+  });
+
+  HexWater water;
+  water.Init(grid);
+  water.Flood(2.5f);
+  for (int32_t i = 0; i < 64; ++i) {
+    water.AddWater({i * 7 % static_cast<int32_t>(size), i * 13 % static_cast<int32_t>(size)}, 4.0f);
+  }
+
+  HexWaterParams params;
+  double volume = water.TotalVolume();
+  BenchSuiteSamples(context, 1e3 / ticks, [&]() {
+    for (int tick = 0; tick < ticks; ++tick) {
+      water.Step(1.0f / 60.0f, params, *context.jobs);
+    }
+  });
+
+  // Water only moves, like in the water scenario
+  return std::fabs(water.TotalVolume() - volume) / volume < 1e-3;
+}
+
+// Steering and movement of 100k ships, 20 ticks per sample
+bool SuiteShipTick(BenchSuiteContext& context) {
+  const uint32_t shipCount = 100000;
+  const int ticks = 20;
+
+  ShipParams params;
+  params.areaWidth = g_Sqrt3 * 1024.0f;
+  params.areaHeight = 1.5f * 1024.0f;
+  ShipStore ships;
+  Random random(14);
+  ships.Reserve(shipCount);
+  for (uint32_t i = 0; i < shipCount; ++i) {
+    ShipDesc desc;
+    desc.x = random.NextFloat() * params.areaWidth;
+    desc.z = random.NextFloat() * params.areaHeight;
+    desc.heading = random.NextFloat() * 6.2831853f;
+    desc.maxSpeed = 2.0f + random.NextFloat() * 4.0f;
+    desc.seed = i;
+    ships.Create(desc);
+  }
+
+  BenchSuiteSamples(context, 1e3 / ticks, [&]() {
+    for (int tick = 0; tick < ticks; ++tick) {
+      StepShips(ships, params, 1.0f / 60.0f, *context.jobs);
+    }
+  });
+
+  // Every ship knows the cell it is in
+  uint32_t wrongCells = 0;
+  for (uint32_t i = 0; i < ships.count; ++i) {
+    HexAxial cell = PixelToHex(params.layout, ships.posX[i], ships.posZ[i]);
+    wrongCells += cell.q != ships.cellQ[i] || cell.r != ships.cellR[i];
+  }
+  return ships.count == shipCount && wrongCells == 0;
+}
+
+// A batch of 1000 A* queries in a 512x512 archipelago, goals up to 48 tiles away
+bool SuitePathfinding(BenchSuiteContext& context) {
+  const uint32_t size = 512;
+  const uint32_t queryCount = 1000;
+  const uint32_t capacity = 1024;
+
+  HexGrid grid(size, size);
+  FillIslandTerrain(grid, 15);
+  HexPathfinder pathfinder;
+  pathfinder.Init(grid);
+  pathfinder.params.flowFieldMinQueries = UINT32_MAX;
+
+  Random random(16);
+  auto randomSeaTile = [&](HexOffset center, int32_t radius) {
+    while (true) {
+      HexOffset tile = {center.col + static_cast<int32_t>(random.NextBelow(2 * radius + 1)) - radius,
+          center.row + static_cast<int32_t>(random.NextBelow(2 * radius + 1)) - radius};
+      if (grid.Contains(tile) && pathfinder.costs[grid.Index(tile)] == pathfinder.params.deepCost) {
+        return grid.Index(tile);
+      }
+    }
+  };
+
+  const int32_t half = static_cast<int32_t>(size / 2);
+  std::vector<HexPathQuery> queries(queryCount);
+  std::vector<uint32_t> paths(static_cast<size_t>(queryCount) * capacity);
+  for (uint32_t i = 0; i < queryCount; ++i) {
+    queries[i].start = randomSeaTile({half, half}, half);
+    queries[i].goal = randomSeaTile(grid.Coord(queries[i].start), 48);
+    queries[i].path = paths.data() + static_cast<size_t>(i) * capacity;
+    queries[i].capacity = capacity;
+  }
+
+  BenchSuiteSamples(context, 1e3, [&]() {
+    pathfinder.FindPaths(queries.data(), queryCount, *context.jobs);
+  });
+
+  // Paths found and their total cost, the baseline has to agree
+  uint32_t found = 0;
+  uint64_t totalCost = 0;
+  for (const HexPathQuery& query : queries) {
+    found += query.status == HexPathFound || query.status == HexPathTruncated;
+    totalCost += query.cost;
+  }
+  context.checksum = HashBytes(&totalCost, sizeof(totalCost), HashBytes(&found, sizeof(found)));
+
+  return found > 0;
+}
+
+// Building the chunk meshes of a 512x512 grid from scratch
+bool SuiteMeshRebuild(BenchSuiteContext& context) {
+  HexGrid grid(512, 512);
+  FillRandomTerrain(grid, 12);
+  HexDrawOrigin origin = MakeHexDrawOrigin(grid);
+
+  const int rebuilds = 4;
+  HexRemesher remesher;
+  BenchSuiteSamples(context, 1e3 / rebuilds, [&]() {
+    for (int i = 0; i < rebuilds; ++i) {
+      remesher.Init(grid, nullptr, origin.hex);
+    }
+  });
+
+  // Everything the frames copy out of the meshes
+  uint64_t hash = HashBytes(nullptr, 0);
+  uint32_t instances = 0;
+  for (uint32_t chunk = 0; chunk < grid.ChunkCount(); ++chunk) {
+    const HexChunkMesh& mesh = remesher.Mesh(chunk);
+    hash = HashBytes(&mesh.instanceCount, sizeof(mesh.instanceCount), hash);
+    hash = HashBytes(mesh.instances, mesh.instanceCount * sizeof(HexInstance), hash);
+    hash = HashBytes(&mesh.runCount, sizeof(mesh.runCount), hash);
+    hash = HashBytes(mesh.runs, mesh.runCount * sizeof(HexMeshRun), hash);
+    hash = HashBytes(&mesh.maxHeight, sizeof(mesh.maxHeight), hash);
+    instances += mesh.instanceCount;
+  }
+  context.checksum = hash;
+
+  // Without water every tile is one instance
+  return instances == grid.width * grid.height;
+}
+
+struct BenchSuiteCase {
+  const char* name;
+  const char* unit;
+  bool (*run)(BenchSuiteContext& context);
+};
+
+const BenchSuiteCase g_SuiteCases[] = {
+  {"frame loop empty", "us", SuiteFrameLoop},
+  {"grid sweep", "ms", SuiteGridSweep},
+  {"water tick", "ms", SuiteWaterTick},
+  {"ship tick", "ms", SuiteShipTick},
+  {"pathfinding batch", "ms", SuitePathfinding},
+  {"mesh rebuild", "ms", SuiteMeshRebuild},
+};
+
+struct BenchSuiteOptions {
+  uint32_t samples = 15;
+  const char* jsonPath = nullptr;
+  const char* baselinePath = nullptr;
+  double threshold = 0.10;
+};
+
+// Runs the suite, false if a case is wrong or slower than the baseline.
+// A baseline from another SIMD level or thread count is not compared
+// against, it fails the run.
+bool RunBenchSuite(const BenchSuiteOptions& options) {
+  JobSystem jobs;
+  jobs.Start(0);
+
+  BenchRun run;
+  run.simd = SimdLevelName(GetSimdLevel());
+  run.threads = jobs.WorkerCount();
+
+  BenchRun baseline;
+  if (options.baselinePath) {
+    if (!ReadBenchBaseline(options.baselinePath, baseline)) {
+      std::fprintf(stderr, "Cannot read baseline %s\n", options.baselinePath);
+      return false;
+    }
+    if (baseline.simd != run.simd || baseline.threads != run.threads) {
+      std::fprintf(stderr, "Baseline %s was measured with %s on %u threads, this run uses %s on %u threads\n",
+          options.baselinePath, baseline.simd.c_str(), baseline.threads, run.simd.c_str(), run.threads);
+      return false;
+    }
+  }
+
+  bool passed = true;
+  for (const BenchSuiteCase& suiteCase : g_SuiteCases) {
+    BenchSuiteContext context = {&jobs, std::max(options.samples, 1u), {}, 0};
+    bool correct = suiteCase.run(context);
+
+    BenchResult result;
+    result.name = suiteCase.name;
+    result.unit = suiteCase.unit;
+    result.stats = ComputeBenchStats(context.times);
+    result.samples = context.times;
+    result.checksum = context.checksum;
+    run.results.push_back(result);
+
+    char line[128];
+    std::snprintf(line, sizeof(line), "%s +- %.3f", suiteCase.unit, result.stats.mad);
+    BenchReport("suite", suiteCase.name, result.stats.median, correct ? line : "(WRONG RESULT)");
+    passed &= correct;
+  }
+  jobs.Stop();
+
+  if (options.jsonPath && !WriteBenchJson(options.jsonPath, run)) {
+    std::fprintf(stderr, "Cannot write %s\n", options.jsonPath);
+    passed = false;
+  }
+
+  if (options.baselinePath) {
+    uint32_t regressions = 0;
+    uint32_t changedResults = 0;
+    for (const BenchResult& result : run.results) {
+      const BenchResult* reference = nullptr;
+      for (const BenchResult& entry : baseline.results) {
+        reference = entry.name == result.name ? &entry : reference;
+      }
+
+      BenchVerdict verdict = CompareBench(result.stats, reference ? reference->stats : BenchStats(), options.threshold);
+      const char* verdicts[] = {"(same)", "(faster)", "(REGRESSION)", "(no baseline)"};
+      bool changed = reference && reference->checksum != result.checksum;
+      double change = reference && reference->stats.median > 0.0 ? 100.0 * (result.stats.median / reference->stats.median - 1.0) : 0.0;
+      BenchReport("baseline", result.name.c_str(), change, changed ? "(RESULT DIFFERS FROM BASELINE)" : verdicts[static_cast<int>(verdict)]);
+      regressions += verdict == BenchVerdict::Slower;
+      changedResults += changed;
+    }
+
+    std::printf("%u of %zu cases regressed and %u differ in their result from %s (threshold %.1f%%)\n",
+        regressions, run.results.size(), changedResults, options.baselinePath, options.threshold * 100.0);
+    passed &= regressions == 0 && changedResults == 0;
+  }
+
+  return passed;
+}
+
+const BenchScenario g_Scenarios[] = {
+  {"hexgrid", BenchHexGrid},
+  {"picking", BenchPicking},
+  {"streaming", BenchStreaming},
+  {"jobs", BenchJobs},
+  {"framememory", BenchFrameMemory},
+  {"instancing", BenchInstancing},
+  {"culling", BenchCulling},
+  {"water", BenchWater},
+  {"remesh", BenchRemesh},
+  {"ships", BenchShips},
+  {"pathfinding", BenchPathfinding},
+  {"spatialhash", BenchSpatialHash},
+  {"shaders", BenchShaders},
+  {"assets", BenchAssets},
+  {"archive", BenchArchive},
+  {"framepacing", BenchFramePacing},
+  {"commands", BenchCommands},
+  {"raster", BenchRaster},
+  {"animation", BenchAnimation},
+  {"lockstep", BenchLockstep},
+  {"input", BenchInput},
+};
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  BenchSuiteOptions suiteOptions;
+  bool suite = false;
+  std::vector<const char*> selected;
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      options.size = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    }
+    else if (std::strcmp(argv[i], "--suite") == 0) {
+      suite = true;
+    }
+    else if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+      suiteOptions.samples = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+    }
+    else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      suiteOptions.jsonPath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      suiteOptions.baselinePath = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+      suiteOptions.threshold = std::strtod(argv[++i], nullptr) / 100.0;
+    }
+    else {
+      selected.push_back(argv[i]);
+    }
+  }
+
+  if (suite) {
+    return RunBenchSuite(suiteOptions) ? 0 : 1;
+  }
+
+  int ran = 0;
+  bool passed = true;
+  for (const BenchScenario& scenario : g_Scenarios) {
+    bool run = selected.empty();
+    for (const char* name : selected) {
+      run |= std::strcmp(name, scenario.name) == 0;
+    }
+
+    if (run) {
+      passed &= scenario.run(options);
+      ran++;
+    }
+  }
+
+  if (ran == 0) {
+    std::fprintf(stderr, "No matching scenario\n");
+    return 1;
+  }
+
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,388 @@
+// Headless executable - runs the engine frame loop without a window or a GPU
+// so the per-frame CPU cost can be measured on any platform.
+//
+// --renderer software draws the frames with the CPU rasterizer instead of
+// only recording them. --screenshot writes the last frame as a PPM and
+// --golden compares it against a reference image, failing the run if more
+// than 0.1% of the pixels differ.
+//
+// --record writes the frame times to an input log, --replay runs the frames
+// and input of a log, from the D3D12 build or from here, back to back with
+// the recorded frame times. The simulation then does exactly the recorded
+// work, so frame time distributions of two builds can be compared.
+
+#include <algorithm>
+#include <vector>
+
+#include "Engine.h"
+#include "JobSystem.h"
+#include "MappedFile.h"
+#include "SoftwareRasterizer.h"
+
+// Renderer without a GPU. The swap chain hands out back buffers round-robin,
+// like a flip-model chain, and the fence is a simulated GPU that completes
+// frames after --gpu-frame-us (immediately by default). Commands go to the
+// null backend, or with useSoftware to the software rasterizer.
+struct NullRenderer {
+  SimulatedGpuFence fence;
+  uint32_t backBufferIndex = 0;
+  uint8_t* uploadMemory = nullptr; // Stands in for the mapped upload heap
+  uint8_t* stagingMemory = nullptr; // Asset staging, same
+  MockUploadSink assetSink;
+  NullCommandBackend commands;
+  SoftwareCommandBackend software;
+  bool useSoftware = false;
+  uint64_t drawCalls = 0;
+  uint64_t instances = 0;
+  uint64_t visibleChunks = 0;
+  double cullMicroseconds = 0.0;
+
+  NullRenderer() {
+    uploadMemory = static_cast<uint8_t*>(AlignedAlloc(g_UploadRingSize, 256));
+    g_UploadRing.Init(uploadMemory, 0, g_UploadRingSize);
+    stagingMemory = static_cast<uint8_t*>(AlignedAlloc(g_AssetStagingSize, 512));
+    assetSink.staging = stagingMemory;
+  }
+
+  ~NullRenderer() {
+    AlignedFree(uploadMemory, 256);
+    AlignedFree(stagingMemory, 512);
+  }
+
+  uint32_t Present() {
+    backBufferIndex = (backBufferIndex + 1) % g_NumFrames;
+
+    return backBufferIndex;
+  }
+};
+
+// The passes of a frame, recorded as the same commands the D3D12 renderer
+// records or as rasterizer draws
+struct NullFrame {
+  NullRenderer* renderer;
+  const HexFrameDraws* draws;
+};
+
+void RecordFrameBegin(void* data, uint32_t list, uint32_t, uint32_t) {
+  NullRenderer& renderer = *static_cast<NullFrame*>(data)->renderer;
+  if (renderer.useSoftware) {
+    float viewProjection[16];
+    ComputeViewProjection(g_Camera, viewProjection);
+    renderer.software.rasterizer.BeginFrame(viewProjection, PackRasterColor(g_ClearColor, 1.0f));
+    return;
+  }
+
+  NullCommandBackend& commands = renderer.commands;
+  commands.Command(list, 1); // Back buffer to render target
+  commands.Command(list, 2); // Clear color
+  commands.Command(list, 3); // Clear depth
+}
+
+void RecordHexGrid(void* data, uint32_t list, uint32_t piece, uint32_t pieceCount) {
+  const NullFrame& frame = *static_cast<NullFrame*>(data);
+  NullCommandBackend& commands = frame.renderer->commands;
+  const HexFrameDraws& draws = *frame.draws;
+
+  uint32_t begin, end;
+  CommandPieceRange(HexDrawCount(draws), piece, pieceCount, begin, end);
+  if (!frame.renderer->useSoftware) {
+    commands.Command(list, 4); // Targets, viewport, pipeline and buffers
+  }
+  for (uint32_t draw = begin; draw < end; ++draw) {
+    bool detail = draw < draws.batches.batchCount;
+    uint32_t first = detail ? draws.batches.batches[draw].firstInstance : draws.lodBatches[draw - draws.batches.batchCount].firstInstance;
+    uint32_t count = detail ? draws.batches.batches[draw].instanceCount : draws.lodBatches[draw - draws.batches.batchCount].instanceCount;
+    if (frame.renderer->useSoftware) {
+      float scale = detail ? 1.0f : static_cast<float>(1u << draws.lodBatches[draw - draws.batches.batchCount].lod);
+      const HexInstance* instances = reinterpret_cast<const HexInstance*>(draws.instances.cpu) + first;
+      frame.renderer->software.Draw(list, RasterHexDraw(instances, count, scale));
+    }
+    else {
+      commands.Command(list, (static_cast<uint64_t>(count) << 32) | first);
+    }
+  }
+}
+
+void RecordFrameEnd(void* data, uint32_t list, uint32_t, uint32_t) {
+  NullRenderer& renderer = *static_cast<NullFrame*>(data)->renderer;
+  if (!renderer.useSoftware) {
+    renderer.commands.Command(list, 5); // Render target to present
+  }
+}
+
+// Compares the last frame against a reference PPM. False if it could not be
+// read or has another size, or more than 0.1% of the pixels are off by more
+// than a rounding step.
+bool CompareGoldenImage(const char* path, const uint8_t* rgb, uint32_t width, uint32_t height) {
+  MappedFile file;
+  uint32_t goldenWidth = 0;
+  uint32_t goldenHeight = 0;
+  size_t pixelOffset = 0;
+  if (!file.Open(path) || !ParsePpmHeader(file.data, file.size, goldenWidth, goldenHeight, pixelOffset)) {
+    std::fprintf(stderr, "Failed to read golden image %s\n", path);
+    return false;
+  }
+  if (goldenWidth != width || goldenHeight != height || file.size - pixelOffset < static_cast<size_t>(width) * height * 3) {
+    std::fprintf(stderr, "Golden image %s is %ux%u, the frame is %ux%u\n", path, goldenWidth, goldenHeight, width, height);
+    return false;
+  }
+
+  uint64_t different = CountDifferentPixels(rgb, file.data + pixelOffset, width, height, 2);
+  uint64_t allowed = static_cast<uint64_t>(width) * height / 1000;
+  std::printf("Golden image: %llu of %u pixels differ from %s, %llu allowed\n", static_cast<unsigned long long>(different),
+      width * height, path, static_cast<unsigned long long>(allowed));
+  return different <= allowed;
+}
+
+// One frame of a replay: the frame's input, then the frame itself with its
+// recorded frame time. False at the end of the log or on a recorded quit.
+bool ReplayFrame(InputReplay& replay, NullRenderer& renderer) {
+  InputEvent event;
+  while (replay.Next(event)) {
+    if (event.type == InputEventType::Frame) {
+      UpdateFrame(std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(event.frameNanoseconds)));
+      return true;
+    }
+
+    // There is no window to make fullscreen or profile to dump mid-run
+    InputActions actions = HandleInput(event);
+    if (actions.resize) {
+      g_ScreenWidth = std::max(1, actions.width);
+      g_ScreenHeight = std::max(1, actions.height);
+      if (renderer.useSoftware) {
+        renderer.software.rasterizer.Init(g_ScreenWidth, g_ScreenHeight);
+      }
+    }
+    if (actions.quit) {
+      return false;
+    }
+  }
+
+  return false;
+}
+
+// Headless counterpart of Render() in main.cpp. The null renderer has no GPU
+// work, so nothing is reported to the profiler's GPU track.
+void Render(NullRenderer& renderer) {
+  PROFILE_ZONE("Render");
+
+  BeginFrame();
+  g_AssetStreamer.Pump(renderer.assetSink);
+  renderer.assetSink.Complete(renderer.assetSink.submittedValue); // The copies run right away, they are picked up next frame
+
+  // Same CPU work as the D3D12 renderer, commands only go to the null backend
+  const HexFrameDraws* draws = PackFrameInstances();
+  if (draws) {
+    renderer.drawCalls += HexDrawCount(*draws);
+    renderer.instances += draws->instanceCount;
+    renderer.visibleChunks += g_HexCullStats.chunksVisible;
+    renderer.cullMicroseconds += g_HexCullMicroseconds;
+  }
+
+  NullFrame frame = {&renderer, draws};
+  g_CommandRecorder.BeginFrame(g_CurrentBackBufferIndex);
+  g_CommandRecorder.AddPass(RecordFrameBegin, &frame);
+  if (draws) {
+    g_CommandRecorder.AddPass(RecordHexGrid, &frame, HexDrawPieceCount(*draws));
+  }
+  g_CommandRecorder.AddPass(RecordFrameEnd, &frame);
+  g_CommandRecorder.Record(g_JobSystem);
+  g_CommandRecorder.Submit();
+
+  uint32_t nextBackBufferIndex = renderer.Present();
+  g_FramePacer.Presented();
+
+  EndFrame(nextBackBufferIndex);
+}
+
+int main(int argc, char** argv) {
+  ParseCommandLineArguments(argc, argv);
+
+  // A replay brings the recorded settings and runs at most its frames
+  InputReplay replay;
+  if (!g_InputReplayPath.empty()) {
+    if (!replay.Open(g_InputReplayPath.c_str())) {
+      std::fprintf(stderr, "Failed to open input log %s\n", g_InputReplayPath.c_str());
+      return 1;
+    }
+    ApplyInputLogHeader(replay.header);
+    g_MaxFrames = g_MaxFrames != 0 ? std::min(g_MaxFrames, replay.header.frames) : replay.header.frames;
+  }
+
+  if (g_MaxFrames == 0) {
+    g_MaxFrames = 1000;
+  }
+
+  g_JobSystem.Start(g_WorkerThreads);
+  g_GameLoop.Start(g_TickRate, g_SimulationThread, g_MaxSpeed);
+
+  for (LinearArena& arena : g_FrameArenas) {
+    arena.Init(g_FrameArenaSize);
+  }
+
+  CreateDemoWorld();
+
+  NullRenderer renderer;
+  g_CurrentBackBufferIndex = renderer.backBufferIndex;
+  renderer.commands.fence = &renderer.fence;
+  StartAssetStreaming(renderer.stagingMemory);
+
+  uint32_t editsPerFrame = 0; // Random terrain brush strokes per frame, to exercise remeshing
+  const char* screenshotPath = nullptr;
+  const char* goldenPath = nullptr;
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::strcmp(argv[i], "--gpu-frame-us") == 0) {
+      renderer.fence.gpuFrameTime = std::chrono::microseconds(std::strtoul(argv[i + 1], nullptr, 10));
+    }
+    else if (std::strcmp(argv[i], "--edits") == 0) {
+      editsPerFrame = static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+    }
+    else if (std::strcmp(argv[i], "--renderer") == 0) {
+      renderer.useSoftware = std::strcmp(argv[i + 1], "software") == 0;
+    }
+    else if (std::strcmp(argv[i], "--screenshot") == 0) {
+      screenshotPath = argv[i + 1];
+    }
+    else if (std::strcmp(argv[i], "--golden") == 0) {
+      goldenPath = argv[i + 1];
+    }
+  }
+
+  // Images need pixels, so comparing one implies the software renderer
+  renderer.useSoftware |= screenshotPath || goldenPath;
+  if (renderer.useSoftware) {
+    renderer.software.rasterizer.Init(g_ScreenWidth, g_ScreenHeight);
+    renderer.software.jobs = &g_JobSystem;
+    g_CommandRecorder.Init(&renderer.software, g_NumFrames, g_JobSystem.WorkerCount());
+  }
+  else {
+    g_CommandRecorder.Init(&renderer.commands, g_NumFrames, g_JobSystem.WorkerCount());
+  }
+  Random editRandom(7);
+
+  g_FramePacer.Init(&renderer.fence, g_MaxFramesInFlight);
+
+  std::vector<float> frameTimes;
+  frameTimes.reserve(static_cast<size_t>(g_MaxFrames));
+
+  if (!g_InputRecordPath.empty()) {
+    g_InputRecorder.Begin();
+  }
+
+  auto runStart = std::chrono::steady_clock::now();
+  while (g_FrameIndex < g_MaxFrames) {
+    auto t0 = std::chrono::steady_clock::now();
+
+    if (g_InputReplayPath.empty()) {
+      Update();
+    }
+    else if (!ReplayFrame(replay, renderer)) {
+      break;
+    }
+    for (uint32_t edit = 0; edit < editsPerFrame; ++edit) {
+      HexOffset center = {static_cast<int32_t>(editRandom.NextBelow(g_HexGrid.width)), static_cast<int32_t>(editRandom.NextBelow(g_HexGrid.height))};
+      EditTerrain(center, 8, editRandom.NextBelow(2) ? 0.25f : -0.25f);
+    }
+    Render(renderer);
+
+    std::chrono::duration<float, std::micro> frameTime = std::chrono::steady_clock::now() - t0;
+    frameTimes.push_back(frameTime.count());
+  }
+
+  g_GameLoop.Stop();
+  std::chrono::duration<double> runSeconds = std::chrono::steady_clock::now() - runStart;
+
+  FrameTimeStats stats = ComputeFrameTimeStats(frameTimes.data(), frameTimes.size());
+  std::printf("Headless: %llu frames (%dx%d), CPU us/frame avg %.3f p50 %.3f p99 %.3f max %.3f\n",
+      static_cast<unsigned long long>(g_FrameIndex), g_ScreenWidth, g_ScreenHeight,
+      stats.average, stats.p50, stats.p99, stats.max);
+  std::printf("Frame pacing: %u frames in flight max, waited on %llu frames, %.3f us avg wait, %.3f us max wait\n",
+      g_MaxFramesInFlight, static_cast<unsigned long long>(g_FramePacer.stats.waits),
+      g_FramePacer.stats.waits ? g_FramePacer.stats.totalWaitMicroseconds / g_FramePacer.stats.waits : 0.0,
+      g_FramePacer.stats.maxWaitMicroseconds);
+  std::printf("Hex grid: %ux%u tiles, %.1f draw calls and %.0f instances per frame\n", g_HexGrid.width, g_HexGrid.height,
+      static_cast<double>(renderer.drawCalls) / g_FrameIndex, static_cast<double>(renderer.instances) / g_FrameIndex);
+  std::printf("Culling: %.0f of %u chunks visible, %.3f us avg per frame\n",
+      static_cast<double>(renderer.visibleChunks) / g_FrameIndex, g_HexGrid.ChunkCount(), renderer.cullMicroseconds / g_FrameIndex);
+  char memoryStats[500];
+  FormatFrameMemoryStats(memoryStats, sizeof(memoryStats));
+  std::printf("%s", memoryStats);
+  FormatRemeshStats(memoryStats, sizeof(memoryStats));
+  std::printf("%s", memoryStats);
+  FormatCommandStats(memoryStats, sizeof(memoryStats));
+  std::printf("%s", memoryStats);
+  if (renderer.useSoftware) {
+    const RasterStats& raster = renderer.software.rasterizer.stats;
+    std::printf("Software renderer (%s): %llu triangles, %llu culled, %llu bin entries per frame, setup %.3f ms raster %.3f ms avg, image hash %016llx\n",
+        SimdLevelName(renderer.software.rasterizer.level), static_cast<unsigned long long>(raster.triangles),
+        static_cast<unsigned long long>(raster.culled), static_cast<unsigned long long>(raster.binEntries),
+        raster.frames ? raster.totalSetupMicroseconds / raster.frames * 1e-3 : 0.0,
+        raster.frames ? raster.totalRasterMicroseconds / raster.frames * 1e-3 : 0.0,
+        static_cast<unsigned long long>(renderer.software.rasterizer.Hash()));
+  }
+  else {
+    std::printf("Null backend: %llu commands in %llu submissions, submission hash %016llx, %llu errors\n",
+        static_cast<unsigned long long>(renderer.commands.commands), static_cast<unsigned long long>(renderer.commands.executions),
+        static_cast<unsigned long long>(renderer.commands.submittedHash), static_cast<unsigned long long>(renderer.commands.errors.load()));
+  }
+  if (g_AssetStreamer.stats.requested > 0) {
+    FormatAssetStats(memoryStats, sizeof(memoryStats));
+    std::printf("%s", memoryStats);
+  }
+  std::printf("Simulation: %llu ticks at %.1f Hz%s%s, %.1f ticks/s wall, %.3f s simulated\n",
+      static_cast<unsigned long long>(g_GameLoop.current.tick), g_TickRate,
+      g_SimulationThread ? ", own thread" : "", g_MaxSpeed ? ", max speed" : "",
+      g_GameLoop.current.tick / runSeconds.count(), g_GameLoop.current.time);
+  std::printf("Water: %llu ticks on the frame thread, %llu simulation ticks dropped%s\n",
+      static_cast<unsigned long long>(g_HexWater.tick), static_cast<unsigned long long>(g_HexWaterDroppedTicks),
+      g_SimulationThread ? " (does not follow the simulation thread)" : "");
+
+  // A whole replay has to end on the recorded tick, the simulation thread
+  // ticks on wall time though
+  bool replayMatches = true;
+  if (!g_InputReplayPath.empty()) {
+    bool complete = g_FrameIndex == replay.header.frames;
+    replayMatches = !complete || g_SimulationThread || g_GameLoop.current.tick == replay.header.simulationTicks;
+    std::printf("Replay: %llu of %llu events, %llu of %llu frames from %s%s, %llu ticks, %llu recorded%s\n",
+        static_cast<unsigned long long>(replay.events), static_cast<unsigned long long>(replay.header.events),
+        static_cast<unsigned long long>(g_FrameIndex), static_cast<unsigned long long>(replay.header.frames), g_InputReplayPath.c_str(),
+        replay.corrupt ? " (corrupt)" : "", static_cast<unsigned long long>(g_GameLoop.current.tick),
+        static_cast<unsigned long long>(replay.header.simulationTicks), replayMatches ? "" : " (MISMATCH)");
+  }
+  if (!g_InputRecordPath.empty()) {
+    if (!g_InputRecorder.Save(g_InputRecordPath.c_str(), MakeInputLogHeader())) {
+      std::fprintf(stderr, "Failed to write input log %s\n", g_InputRecordPath.c_str());
+      return 1;
+    }
+    std::printf("Recorded %llu events over %llu frames to %s, %zu bytes\n", static_cast<unsigned long long>(g_InputRecorder.events),
+        static_cast<unsigned long long>(g_InputRecorder.frames), g_InputRecordPath.c_str(), g_InputRecorder.bytes.size() + sizeof(InputLogHeader));
+  }
+
+  g_HexRemesher.Flush(g_HexGrid, g_HexDrawOrigin, g_HexBvh, g_HexLod, g_JobSystem);
+  g_AssetStreamer.Stop();
+  g_JobSystem.Stop();
+
+  if (!g_TracePath.empty() && !g_Profiler.WriteChromeTrace(g_TracePath.c_str())) {
+    std::fprintf(stderr, "Failed to write trace %s\n", g_TracePath.c_str());
+    return 1;
+  }
+
+  if (!replayMatches || replay.corrupt) {
+    return 1;
+  }
+
+  if (screenshotPath || goldenPath) {
+    const SoftwareRasterizer& rasterizer = renderer.software.rasterizer;
+    std::vector<uint8_t> rgb(static_cast<size_t>(rasterizer.width) * rasterizer.height * 3);
+    rasterizer.ReadRgb(rgb.data());
+    if (screenshotPath && !WritePpm(screenshotPath, rasterizer.width, rasterizer.height, rgb.data())) {
+      std::fprintf(stderr, "Failed to write screenshot %s\n", screenshotPath);
+      return 1;
+    }
+    if (goldenPath && !CompareGoldenImage(goldenPath, rgb.data(), rasterizer.width, rasterizer.height)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
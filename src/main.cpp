@@ -8,33 +8,41 @@
 HWND m_hwnd = NULL;
 RECT g_WindowRect;
 
-// Engine variables
-const uint8_t g_NumFrames = 3; // Triple buffering
-bool g_UseWarp = false; // Use WARP adapter (software rendering)
+// Engine variables - the platform-neutral ones live in Engine.h
 bool g_IsInitialized = false; // Is the engine initialized?
-int g_ScreenWidth = 1280;
-int g_ScreenHeight = 720;
 
 // DirectX 12 objects
 Microsoft::WRL::ComPtr<ID3D12Device2> g_Device;
 Microsoft::WRL::ComPtr<ID3D12CommandQueue> g_CommandQueue;
 Microsoft::WRL::ComPtr<IDXGISwapChain4> g_SwapChain;
 Microsoft::WRL::ComPtr<ID3D12Resource> g_BackBuffers[g_NumFrames];
-Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> g_CommandList;
-Microsoft::WRL::ComPtr<ID3D12CommandAllocator> g_CommandAllocators[g_NumFrames];
 Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> g_RTVDescriptorHeap;
+Microsoft::WRL::ComPtr<ID3D12Resource> g_UploadBuffer; // Persistently mapped, sub-allocated by g_UploadRing
+Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> g_DSVDescriptorHeap;
+Microsoft::WRL::ComPtr<ID3D12Resource> g_DepthBuffer;
+
+// Hex renderer - one prism mesh, instances streamed through the upload ring
+Microsoft::WRL::ComPtr<ID3D12RootSignature> g_HexRootSignature;
+Microsoft::WRL::ComPtr<ID3D12PipelineState> g_HexPipelineState;
+Microsoft::WRL::ComPtr<ID3D12Resource> g_HexMeshBuffer;
+D3D12_VERTEX_BUFFER_VIEW g_HexVertexBufferView = {};
+D3D12_INDEX_BUFFER_VIEW g_HexIndexBufferView = {};
+
+// Precompiled shaders from the build and the driver's compiled pipelines
+// from the last run. Both fall back to compiling when they do not match.
+const char* g_ShaderArchivePath = "shaders.bin";
+const char* g_PipelineCachePath = "pipelines.bin";
+ShaderArchive g_ShaderArchive;
+PipelineCache g_PipelineCache;
 
 UINT g_RTVDescriptorSize;
-UINT g_CurrentBackBufferIndex;
 
 // Synchronization objects
 Microsoft::WRL::ComPtr<ID3D12Fence> g_Fence;
-uint64_t g_FenceValue = 0;
-uint64_t g_FrameFenceValues[g_NumFrames] = {};
 HANDLE g_FenceEvent;
+HANDLE g_FrameLatencyWaitable = NULL; // Swap chain frame latency waitable object
 
-// Controlling the swap chain present method
-bool g_VSync = true;
+// Controlling the swap chain present method, g_VSync is in Engine.h
 bool g_TearingSupported = false;
 bool g_Fullscreen = false;
 
@@ -222,7 +230,8 @@ Microsoft::WRL::ComPtr<IDXGISwapChain4> CreateSwapChain(HWND hWnd, Microsoft::WR
   swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
   swapChainDesc.AlphaMode = DXGI_ALPHA_MODE_UNSPECIFIED;
   // It is recommended to always allow tearing if tearing support is available.
-  swapChainDesc.Flags = CheckTearingSupport() ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0;
+  // The waitable object lets the frame loop block until DXGI wants a new frame.
+  swapChainDesc.Flags = (CheckTearingSupport() ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0) | DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
 
   Microsoft::WRL::ComPtr<IDXGISwapChain1> swapChain1;
   ThrowIfFailed(dxgiFactory4->CreateSwapChainForHwnd(
@@ -302,6 +311,348 @@ Microsoft::WRL::ComPtr<ID3D12Fence> CreateFence(Microsoft::WRL::ComPtr<ID3D12Dev
   return fence;
 }
 
+// Create a buffer in the upload heap - CPU writable, read by the GPU over the bus
+Microsoft::WRL::ComPtr<ID3D12Resource> CreateUploadBuffer(Microsoft::WRL::ComPtr<ID3D12Device2> device, size_t size) {
+  Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
+
+  CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_UPLOAD);
+  CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(size);
+  ThrowIfFailed(device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+      D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&buffer)));
+
+  return buffer;
+}
+
+// (Re)create the depth buffer for the current window size
+void UpdateDepthBuffer(uint32_t width, uint32_t height) {
+  D3D12_CLEAR_VALUE clearValue = {};
+  clearValue.Format = DXGI_FORMAT_D32_FLOAT;
+  clearValue.DepthStencil = {1.0f, 0};
+
+  CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+  CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, width, height, 1, 0, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+  ThrowIfFailed(g_Device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+      D3D12_RESOURCE_STATE_DEPTH_WRITE, &clearValue, IID_PPV_ARGS(&g_DepthBuffer)));
+
+  D3D12_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+  dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+  dsvDesc.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
+  g_Device->CreateDepthStencilView(g_DepthBuffer.Get(), &dsvDesc, g_DSVDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
+}
+
+// Constant buffer layout of g_HexShaderSource
+struct HexFrameConstants {
+  DirectX::XMFLOAT4X4 viewProjection;
+  DirectX::XMFLOAT3 lightDirection;
+  float hexSize;
+  DirectX::XMFLOAT4 palette[8];
+};
+
+// Flags of the HLSL compiler - shadercompiler --debug builds the archive
+// with the _DEBUG ones
+UINT ShaderCompileFlags() {
+  UINT flags = D3DCOMPILE_ENABLE_STRICTNESS;
+#if defined(_DEBUG)
+  flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif
+  return flags;
+}
+
+Microsoft::WRL::ComPtr<ID3DBlob> CompileShader(const char* source, size_t size, const char* entryPoint, const char* target) {
+  Microsoft::WRL::ComPtr<ID3DBlob> shader;
+  Microsoft::WRL::ComPtr<ID3DBlob> errors;
+
+  HRESULT hr = D3DCompile(source, size, "HexShader", nullptr, nullptr, entryPoint, target, ShaderCompileFlags(), 0, &shader, &errors);
+  if (errors) {
+    DebugOutput(static_cast<const char*>(errors->GetBufferPointer()));
+  }
+  ThrowIfFailed(hr);
+
+  return shader;
+}
+
+// Bytecode of one of g_HexShaders - from the archive when it has it,
+// compiled otherwise. The archive stays mapped, its bytes are used in place.
+D3D12_SHADER_BYTECODE LoadHexShader(const HexShaderEntry& entry, Microsoft::WRL::ComPtr<ID3DBlob>& compiled, bool& fromArchive) {
+  ShaderBlob blob;
+  if (g_ShaderArchive.Find(entry.name, blob)) {
+    return {blob.data, blob.size};
+  }
+
+  fromArchive = false;
+  compiled = CompileShader(g_HexShaderSource, sizeof(g_HexShaderSource) - 1, entry.entryPoint, entry.target);
+  return CD3DX12_SHADER_BYTECODE(compiled.Get());
+}
+
+// Identifies the adapter and driver version a pipeline cache was written by
+uint64_t PipelineDeviceKey(Microsoft::WRL::ComPtr<IDXGIAdapter4> adapter) {
+  DXGI_ADAPTER_DESC1 desc;
+  ThrowIfFailed(adapter->GetDesc1(&desc));
+
+  PipelineHasher hasher;
+  hasher.Add(desc.VendorId);
+  hasher.Add(desc.DeviceId);
+  hasher.Add(desc.SubSysId);
+  hasher.Add(desc.Revision);
+
+  LARGE_INTEGER driverVersion = {};
+  if (SUCCEEDED(adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driverVersion))) {
+    hasher.Add(driverVersion.QuadPart);
+  }
+
+  return hasher.hash;
+}
+
+// Everything the driver compiles a pipeline from. Pointers are followed:
+// bytecode and root signature by content, the input layout element by
+// element with its semantic names.
+uint64_t PipelineKey(const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, const void* rootSignature, size_t rootSignatureSize) {
+  PipelineHasher hasher;
+  hasher.AddBytes(rootSignature, rootSignatureSize);
+  hasher.AddBytes(desc.VS.pShaderBytecode, desc.VS.BytecodeLength);
+  hasher.AddBytes(desc.PS.pShaderBytecode, desc.PS.BytecodeLength);
+
+  hasher.Add(desc.InputLayout.NumElements);
+  for (UINT i = 0; i < desc.InputLayout.NumElements; ++i) {
+    const D3D12_INPUT_ELEMENT_DESC& element = desc.InputLayout.pInputElementDescs[i];
+    hasher.AddString(element.SemanticName);
+    hasher.Add(element.SemanticIndex);
+    hasher.Add(element.Format);
+    hasher.Add(element.InputSlot);
+    hasher.Add(element.AlignedByteOffset);
+    hasher.Add(element.InputSlotClass);
+    hasher.Add(element.InstanceDataStepRate);
+  }
+
+  // Member by member, the blend and depth stencil descs have padding
+  const D3D12_BLEND_DESC& blend = desc.BlendState;
+  hasher.Add(blend.AlphaToCoverageEnable);
+  hasher.Add(blend.IndependentBlendEnable);
+  for (const D3D12_RENDER_TARGET_BLEND_DESC& target : blend.RenderTarget) {
+    hasher.Add(target.BlendEnable);
+    hasher.Add(target.LogicOpEnable);
+    hasher.Add(target.SrcBlend);
+    hasher.Add(target.DestBlend);
+    hasher.Add(target.BlendOp);
+    hasher.Add(target.SrcBlendAlpha);
+    hasher.Add(target.DestBlendAlpha);
+    hasher.Add(target.BlendOpAlpha);
+    hasher.Add(target.LogicOp);
+    hasher.Add(target.RenderTargetWriteMask);
+  }
+  hasher.Add(desc.SampleMask);
+
+  const D3D12_RASTERIZER_DESC& rasterizer = desc.RasterizerState;
+  hasher.Add(rasterizer.FillMode);
+  hasher.Add(rasterizer.CullMode);
+  hasher.Add(rasterizer.FrontCounterClockwise);
+  hasher.Add(rasterizer.DepthBias);
+  hasher.Add(rasterizer.DepthBiasClamp);
+  hasher.Add(rasterizer.SlopeScaledDepthBias);
+  hasher.Add(rasterizer.DepthClipEnable);
+  hasher.Add(rasterizer.MultisampleEnable);
+  hasher.Add(rasterizer.AntialiasedLineEnable);
+  hasher.Add(rasterizer.ForcedSampleCount);
+  hasher.Add(rasterizer.ConservativeRaster);
+
+  const D3D12_DEPTH_STENCIL_DESC& depthStencil = desc.DepthStencilState;
+  hasher.Add(depthStencil.DepthEnable);
+  hasher.Add(depthStencil.DepthWriteMask);
+  hasher.Add(depthStencil.DepthFunc);
+  hasher.Add(depthStencil.StencilEnable);
+  hasher.Add(depthStencil.StencilReadMask);
+  hasher.Add(depthStencil.StencilWriteMask);
+  for (const D3D12_DEPTH_STENCILOP_DESC* face : {&depthStencil.FrontFace, &depthStencil.BackFace}) {
+    hasher.Add(face->StencilFailOp);
+    hasher.Add(face->StencilDepthFailOp);
+    hasher.Add(face->StencilPassOp);
+    hasher.Add(face->StencilFunc);
+  }
+
+  hasher.Add(desc.PrimitiveTopologyType);
+  hasher.Add(desc.NumRenderTargets);
+  hasher.Add(desc.RTVFormats);
+  hasher.Add(desc.DSVFormat);
+  hasher.Add(desc.SampleDesc);
+  hasher.Add(desc.Flags);
+
+  return hasher.hash;
+}
+
+// Creates the pipeline from the cached driver blob when there is one. A
+// blob the driver refuses - new driver, other adapter - is dropped and the
+// pipeline is created and cached again.
+bool CreateCachedPipelineState(Microsoft::WRL::ComPtr<ID3D12Device2> device, D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc, uint64_t key,
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>& pipelineState) {
+  if (const std::vector<uint8_t>* blob = g_PipelineCache.Find(key)) {
+    desc.CachedPSO = {blob->data(), blob->size()};
+    HRESULT hr = device->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pipelineState));
+    desc.CachedPSO = {};
+    if (SUCCEEDED(hr)) {
+      return true;
+    }
+    g_PipelineCache.Reject(key);
+  }
+
+  ThrowIfFailed(device->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pipelineState)));
+
+  Microsoft::WRL::ComPtr<ID3DBlob> cachedBlob;
+  if (SUCCEEDED(pipelineState->GetCachedBlob(&cachedBlob))) {
+    g_PipelineCache.Store(key, cachedBlob->GetBufferPointer(), cachedBlob->GetBufferSize());
+  }
+  return false;
+}
+
+// Root signature, pipeline state and the shared prism mesh
+void CreateHexRenderer(Microsoft::WRL::ComPtr<ID3D12Device2> device) {
+  CD3DX12_ROOT_PARAMETER rootParameters[2];
+  rootParameters[0].InitAsConstantBufferView(0);
+  rootParameters[1].InitAsConstants(1, 1); // Instance scale, 2^LOD
+
+  CD3DX12_ROOT_SIGNATURE_DESC rootSignatureDesc(_countof(rootParameters), rootParameters, 0, nullptr,
+      D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+
+  Microsoft::WRL::ComPtr<ID3DBlob> rootSignatureBlob;
+  Microsoft::WRL::ComPtr<ID3DBlob> errors;
+  ThrowIfFailed(D3D12SerializeRootSignature(&rootSignatureDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSignatureBlob, &errors));
+  ThrowIfFailed(device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(), rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&g_HexRootSignature)));
+
+  auto shaderStart = std::chrono::steady_clock::now();
+  bool shadersFromArchive = true;
+  Microsoft::WRL::ComPtr<ID3DBlob> vertexShader;
+  Microsoft::WRL::ComPtr<ID3DBlob> pixelShader;
+  D3D12_SHADER_BYTECODE vertexBytecode = LoadHexShader(g_HexShaders[0], vertexShader, shadersFromArchive);
+  D3D12_SHADER_BYTECODE pixelBytecode = LoadHexShader(g_HexShaders[1], pixelShader, shadersFromArchive);
+  auto shaderEnd = std::chrono::steady_clock::now();
+
+  // Slot 0 is the mesh, slot 1 the per-tile HexInstance
+  D3D12_INPUT_ELEMENT_DESC inputLayout[] = {
+    {"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(HexVertex, position), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+    {"NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(HexVertex, normal), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+    {"HEX", 0, DXGI_FORMAT_R16G16_SINT, 1, offsetof(HexInstance, q), D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1},
+    {"HEIGHT", 0, DXGI_FORMAT_R16_UINT, 1, offsetof(HexInstance, height), D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1},
+    {"MATERIAL", 0, DXGI_FORMAT_R8G8_UINT, 1, offsetof(HexInstance, material), D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1},
+  };
+
+  D3D12_GRAPHICS_PIPELINE_STATE_DESC pipelineDesc = {};
+  pipelineDesc.pRootSignature = g_HexRootSignature.Get();
+  pipelineDesc.VS = vertexBytecode;
+  pipelineDesc.PS = pixelBytecode;
+  pipelineDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+  pipelineDesc.SampleMask = UINT_MAX;
+  pipelineDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+  pipelineDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+  pipelineDesc.InputLayout = {inputLayout, _countof(inputLayout)};
+  pipelineDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+  pipelineDesc.NumRenderTargets = 1;
+  pipelineDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+  pipelineDesc.DSVFormat = DXGI_FORMAT_D32_FLOAT;
+  pipelineDesc.SampleDesc = {1, 0};
+
+  uint64_t pipelineKey = PipelineKey(pipelineDesc, rootSignatureBlob->GetBufferPointer(), rootSignatureBlob->GetBufferSize());
+  bool pipelineFromCache = CreateCachedPipelineState(device, pipelineDesc, pipelineKey, g_HexPipelineState);
+  auto pipelineEnd = std::chrono::steady_clock::now();
+
+  char buffer[256];
+  std::snprintf(buffer, sizeof(buffer), "Shaders %s in %.2f ms, pipeline %s in %.2f ms\n",
+      shadersFromArchive ? "from archive" : "compiled", std::chrono::duration<double, std::milli>(shaderEnd - shaderStart).count(),
+      pipelineFromCache ? "from cache" : "created", std::chrono::duration<double, std::milli>(pipelineEnd - shaderEnd).count());
+  DebugOutput(buffer);
+
+  // The mesh is under 2 KB, it stays in the upload heap instead of being copied to a default heap
+  HexVertex vertices[g_HexPrismVertexCount];
+  uint16_t indices[g_HexPrismIndexCount];
+  BuildHexPrismMesh(vertices, indices);
+
+  g_HexMeshBuffer = CreateUploadBuffer(device, sizeof(vertices) + sizeof(indices));
+  uint8_t* meshMemory = nullptr;
+  CD3DX12_RANGE readRange(0, 0);
+  ThrowIfFailed(g_HexMeshBuffer->Map(0, &readRange, reinterpret_cast<void**>(&meshMemory)));
+  std::memcpy(meshMemory, vertices, sizeof(vertices));
+  std::memcpy(meshMemory + sizeof(vertices), indices, sizeof(indices));
+  g_HexMeshBuffer->Unmap(0, nullptr);
+
+  D3D12_GPU_VIRTUAL_ADDRESS meshAddress = g_HexMeshBuffer->GetGPUVirtualAddress();
+  g_HexVertexBufferView = {meshAddress, sizeof(vertices), sizeof(HexVertex)};
+  g_HexIndexBufferView = {meshAddress + sizeof(vertices), sizeof(indices), DXGI_FORMAT_R16_UINT};
+}
+
+// Frame constants from the engine camera - the same matrix the culling used
+void WriteHexFrameConstants(HexFrameConstants& constants) {
+  using namespace DirectX;
+
+  float viewProjection[16];
+  ComputeViewProjection(g_Camera, viewProjection);
+  XMStoreFloat4x4(&constants.viewProjection, XMMatrixTranspose(XMMATRIX(viewProjection)));
+
+  XMStoreFloat3(&constants.lightDirection, XMVector3Normalize(XMVectorSet(g_HexLightDirection[0], g_HexLightDirection[1], g_HexLightDirection[2], 0.0f)));
+  constants.hexSize = 1.0f;
+
+  static_assert(sizeof(constants.palette) == sizeof(g_HexPalette), "The palette is copied as is");
+  std::memcpy(constants.palette, g_HexPalette, sizeof(g_HexPalette));
+}
+
+// What every list of the frame needs - render targets and the hex grid
+// draws, prepared on the frame thread before the lists are recorded
+struct FrameRecording {
+  ID3D12Resource* backBuffer;
+  D3D12_CPU_DESCRIPTOR_HANDLE rtv;
+  D3D12_CPU_DESCRIPTOR_HANDLE dsv;
+  D3D12_VIEWPORT viewport;
+  D3D12_RECT scissorRect;
+  const HexFrameDraws* draws; // Null if frame memory ran out, the grid is skipped then
+  UploadAllocation constants;
+};
+
+// Packs the visible part of the hex grid and its constants. Both touch the
+// upload ring, which only the frame thread may allocate from.
+void PrepareHexGrid(FrameRecording& frame) {
+  PROFILE_ZONE("PrepareHexGrid");
+
+  frame.draws = PackFrameInstances();
+  frame.constants = g_UploadRing.Allocate(sizeof(HexFrameConstants), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+  if (!frame.draws || !frame.constants.cpu) {
+    frame.draws = nullptr; // Out of frame memory, skip the grid this frame
+    return;
+  }
+
+  WriteHexFrameConstants(*reinterpret_cast<HexFrameConstants*>(frame.constants.cpu));
+}
+
+// Records draws [firstDraw, endDraw) of the hex grid - one DrawIndexedInstanced
+// per material at full detail, then one per LOD for the coarse hexes
+void DrawHexGrid(ID3D12GraphicsCommandList* commandList, const FrameRecording& frame, uint32_t firstDraw, uint32_t endDraw) {
+  PROFILE_ZONE("DrawHexGrid");
+
+  const HexFrameDraws* draws = frame.draws;
+  commandList->SetPipelineState(g_HexPipelineState.Get());
+  commandList->SetGraphicsRootSignature(g_HexRootSignature.Get());
+  commandList->SetGraphicsRootConstantBufferView(0, frame.constants.gpu);
+
+  D3D12_VERTEX_BUFFER_VIEW vertexBuffers[2] = {
+    g_HexVertexBufferView,
+    {draws->instances.gpu, static_cast<UINT>(draws->instanceCount * sizeof(HexInstance)), sizeof(HexInstance)}
+  };
+  commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+  commandList->IASetVertexBuffers(0, 2, vertexBuffers);
+  commandList->IASetIndexBuffer(&g_HexIndexBufferView);
+
+  // Per-material state gets bound here once materials have more than a color
+  float scale = 1.0f;
+  commandList->SetGraphicsRoot32BitConstants(1, 1, &scale, 0);
+  for (uint32_t i = firstDraw; i < endDraw && i < draws->batches.batchCount; ++i) {
+    const HexDrawBatch& batch = draws->batches.batches[i];
+    commandList->DrawIndexedInstanced(g_HexPrismIndexCount, batch.instanceCount, 0, 0, batch.firstInstance);
+  }
+
+  for (uint32_t i = std::max(firstDraw, draws->batches.batchCount); i < endDraw; ++i) {
+    const HexLodBatch& batch = draws->lodBatches[i - draws->batches.batchCount];
+    scale = static_cast<float>(1u << batch.lod);
+    commandList->SetGraphicsRoot32BitConstants(1, 1, &scale, 0);
+    commandList->DrawIndexedInstanced(g_HexPrismIndexCount, batch.instanceCount, 0, 0, batch.firstInstance);
+  }
+}
+
 // Create an event handle from tutorial
 HANDLE CreateEventHandle() {
   HANDLE fenceEvent;
@@ -316,16 +667,212 @@ HANDLE CreateEventHandle() {
 uint64_t Signal(Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue, Microsoft::WRL::ComPtr<ID3D12Fence> fence, uint64_t& fenceValue) {
   uint64_t fenceValueForSignal = ++fenceValue;
   ThrowIfFailed(commandQueue->Signal(fence.Get(), fenceValueForSignal));
+  g_Profiler.GpuSignal(fenceValueForSignal);
 
   return fenceValueForSignal;
 }
 
 // Wait until fence reaches value from tutorial
 void WaitForFenceValue(Microsoft::WRL::ComPtr<ID3D12Fence> fence, uint64_t fenceValue, HANDLE fenceEvent, std::chrono::milliseconds duration = std::chrono::milliseconds::max()) {
+  PROFILE_ZONE("WaitForFenceValue");
+
   if (fence->GetCompletedValue() < fenceValue) {
     ThrowIfFailed(fence->SetEventOnCompletion(fenceValue, fenceEvent));
     ::WaitForSingleObject(fenceEvent, static_cast<DWORD>(duration.count()));
   }
+
+  g_Profiler.GpuCompleted(fence->GetCompletedValue());
+}
+
+// The frame fence on the direct queue, as seen by the frame pacer
+struct D3D12FrameFence : FrameFence {
+  uint64_t Signal() override {
+    return ::Signal(g_CommandQueue, g_Fence, g_FenceValue);
+  }
+
+  uint64_t GetCompletedValue() override {
+    return g_Fence->GetCompletedValue();
+  }
+
+  void WaitForValue(uint64_t fenceValue) override {
+    ::WaitForFenceValue(g_Fence, fenceValue, g_FenceEvent);
+  }
+};
+
+D3D12FrameFence g_FrameFence;
+
+// Direct command lists and allocators for the command recorder. Both are
+// created on first use by the recording thread, device calls are free
+// threaded and every index is only touched by one thread at a time.
+struct D3D12CommandBackend : CommandBackend {
+  Microsoft::WRL::ComPtr<ID3D12Device2> device;
+  std::vector<Microsoft::WRL::ComPtr<ID3D12CommandAllocator>> allocators;
+  std::vector<Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList>> lists;
+
+  void Reserve(uint32_t allocatorCount, uint32_t listCount) override {
+    allocators.assign(allocatorCount, nullptr);
+    lists.assign(listCount, nullptr);
+  }
+
+  void ResetAllocator(uint32_t allocator) override {
+    ThrowIfFailed(allocators[allocator]->Reset());
+  }
+
+  void BeginList(uint32_t list, uint32_t allocator) override {
+    if (!allocators[allocator]) {
+      allocators[allocator] = CreateCommandAllocator(device, D3D12_COMMAND_LIST_TYPE_DIRECT);
+    }
+    if (!lists[list]) {
+      lists[list] = CreateCommandList(device, allocators[allocator], D3D12_COMMAND_LIST_TYPE_DIRECT);
+    }
+    ThrowIfFailed(lists[list]->Reset(allocators[allocator].Get(), nullptr));
+  }
+
+  void EndList(uint32_t list) override {
+    ThrowIfFailed(lists[list]->Close());
+  }
+
+  void Execute(const uint32_t* indices, uint32_t count) override {
+    ID3D12CommandList* commandLists[g_MaxCommandLists];
+    for (uint32_t i = 0; i < count; ++i) {
+      commandLists[i] = lists[indices[i]].Get();
+    }
+    g_CommandQueue->ExecuteCommandLists(count, commandLists);
+  }
+};
+
+D3D12CommandBackend g_CommandBackend;
+
+// Asset uploads on a copy queue with its own fence, so they run next to the
+// frames instead of in front of them. Copied resources are left in the
+// common state and only drawn once the streamer reports them ready, which is
+// after the copy fence passed - the direct queue never has to wait on it.
+struct D3D12UploadSink : AssetUploadSink {
+  static const uint32_t AllocatorCount = 4;
+
+  Microsoft::WRL::ComPtr<ID3D12Device2> device;
+  Microsoft::WRL::ComPtr<ID3D12CommandQueue> queue;
+  Microsoft::WRL::ComPtr<ID3D12Fence> fence;
+  HANDLE fenceEvent = NULL;
+  uint64_t fenceValue = 0;
+  Microsoft::WRL::ComPtr<ID3D12CommandAllocator> allocators[AllocatorCount];
+  uint64_t allocatorFenceValues[AllocatorCount] = {};
+  uint32_t allocatorIndex = 0;
+  Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList;
+  bool recording = false;
+
+  Microsoft::WRL::ComPtr<ID3D12Resource> staging; // Persistently mapped, the streamer's slots
+  uint8_t* stagingMemory = nullptr;
+  std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> resources; // By asset
+
+  void Init(Microsoft::WRL::ComPtr<ID3D12Device2> d3d12Device, size_t stagingSize) {
+    device = d3d12Device;
+    queue = CreateCommandQueue(device, D3D12_COMMAND_LIST_TYPE_COPY);
+    fence = CreateFence(device);
+    fenceEvent = CreateEventHandle();
+    for (auto& allocator : allocators) {
+      allocator = CreateCommandAllocator(device, D3D12_COMMAND_LIST_TYPE_COPY);
+    }
+    commandList = CreateCommandList(device, allocators[0], D3D12_COMMAND_LIST_TYPE_COPY);
+
+    staging = CreateUploadBuffer(device, stagingSize);
+    CD3DX12_RANGE readRange(0, 0);
+    ThrowIfFailed(staging->Map(0, &readRange, reinterpret_cast<void**>(&stagingMemory)));
+  }
+
+  // Not WaitForFenceValue() - that one reports to the profiler's frame track
+  void Wait(uint64_t value) {
+    if (fence->GetCompletedValue() < value) {
+      ThrowIfFailed(fence->SetEventOnCompletion(value, fenceEvent));
+      ::WaitForSingleObject(fenceEvent, INFINITE);
+    }
+  }
+
+  void Shutdown() {
+    Wait(fenceValue);
+    ::CloseHandle(fenceEvent);
+  }
+
+  // Opens the command list on the next allocator. Only waits if four
+  // batches of copies are still in flight.
+  void BeginRecording() {
+    if (recording) {
+      return;
+    }
+
+    Wait(allocatorFenceValues[allocatorIndex]);
+    ThrowIfFailed(allocators[allocatorIndex]->Reset());
+    ThrowIfFailed(commandList->Reset(allocators[allocatorIndex].Get(), nullptr));
+    recording = true;
+  }
+
+  Microsoft::WRL::ComPtr<ID3D12Resource>& Resource(uint32_t asset) {
+    if (resources.size() <= asset) {
+      resources.resize(asset + 1);
+    }
+    return resources[asset];
+  }
+
+  void CopyTexture(uint32_t asset, const AssetTextureLayout& layout, size_t stagingOffset) override {
+    BeginRecording();
+
+    Microsoft::WRL::ComPtr<ID3D12Resource>& texture = Resource(asset);
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, layout.width, layout.height, 1, static_cast<UINT16>(layout.mipCount));
+    ThrowIfFailed(device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+        D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&texture)));
+
+    for (uint32_t level = 0; level < layout.mipCount; ++level) {
+      const AssetMip& mip = layout.mips[level];
+      D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {stagingOffset + mip.offset, {DXGI_FORMAT_R8G8B8A8_UNORM, mip.width, mip.height, 1, mip.rowPitch}};
+      CD3DX12_TEXTURE_COPY_LOCATION destination(texture.Get(), level);
+      CD3DX12_TEXTURE_COPY_LOCATION source(staging.Get(), footprint);
+      commandList->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+    }
+  }
+
+  void CopyBuffer(uint32_t asset, size_t size, size_t stagingOffset) override {
+    BeginRecording();
+
+    Microsoft::WRL::ComPtr<ID3D12Resource>& buffer = Resource(asset);
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(size);
+    ThrowIfFailed(device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &resourceDesc,
+        D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&buffer)));
+    commandList->CopyBufferRegion(buffer.Get(), 0, staging.Get(), stagingOffset, size);
+  }
+
+  uint64_t Submit() override {
+    if (!recording) {
+      return fenceValue;
+    }
+
+    ThrowIfFailed(commandList->Close());
+    ID3D12CommandList* const commandLists[] = {commandList.Get()};
+    queue->ExecuteCommandLists(_countof(commandLists), commandLists);
+    ThrowIfFailed(queue->Signal(fence.Get(), ++fenceValue));
+
+    allocatorFenceValues[allocatorIndex] = fenceValue;
+    allocatorIndex = (allocatorIndex + 1) % AllocatorCount;
+    recording = false;
+
+    return fenceValue;
+  }
+
+  uint64_t GetCompletedValue() override {
+    return fence->GetCompletedValue();
+  }
+};
+
+D3D12UploadSink g_AssetUploadSink;
+
+// Blocks until the swap chain is ready to queue another frame, so input and
+// simulation are sampled as late as possible
+void WaitForFrameLatency() {
+  if (g_FrameLatencyWaitable) {
+    PROFILE_ZONE("WaitForFrameLatency");
+    ::WaitForSingleObjectEx(g_FrameLatencyWaitable, 1000, TRUE);
+  }
 }
 
 // Flush command queue from tutorial
@@ -334,73 +881,83 @@ void Flush(Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue, Microsoft::W
   WaitForFenceValue(fence, fenceValueForSignal, fenceEvent);
 }
 
-// Update function for debug purposes from tutorial
-void Update() {
-  static uint64_t frameCounter = 0;
-  static double elapsedSeconds = 0.0;
-  static std::chrono::high_resolution_clock clock;
-  static auto t0 = clock.now();
-
-  frameCounter++;
-  auto t1 = clock.now();
-  auto deltaTime = t1 - t0;
-  t0 = t1;
+// The passes of a frame. Each list starts from scratch, so every one that
+// draws sets its targets and viewport again.
+void RecordFrameBegin(void* data, uint32_t list, uint32_t, uint32_t) {
+  const FrameRecording& frame = *static_cast<FrameRecording*>(data);
+  ID3D12GraphicsCommandList* commandList = g_CommandBackend.lists[list].Get();
 
-  elapsedSeconds += deltaTime.count() * 1e-9;
-  if (elapsedSeconds > 1.0) {
-    char buffer[500];
-    auto fps = frameCounter / elapsedSeconds;
-    sprintf_s(buffer, 500, "FPS: %f\n", fps);
-    OutputDebugStringA(buffer);
+  CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+      frame.backBuffer,
+      D3D12_RESOURCE_STATE_PRESENT,
+      D3D12_RESOURCE_STATE_RENDER_TARGET
+  );
+  commandList->ResourceBarrier(1, &barrier);
 
-    frameCounter = 0;
-    elapsedSeconds = 0.0;
-  }
+  commandList->ClearRenderTargetView(frame.rtv, g_ClearColor, 0, nullptr);
+  commandList->ClearDepthStencilView(frame.dsv, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
 }
-// Render function from tutorial
-void Render() {
-  auto commandAllocator = g_CommandAllocators[g_CurrentBackBufferIndex];
-  auto backBuffer = g_BackBuffers[g_CurrentBackBufferIndex];
 
-  commandAllocator->Reset();
-  g_CommandList->Reset(commandAllocator.Get(), nullptr);
+void RecordHexGrid(void* data, uint32_t list, uint32_t piece, uint32_t pieceCount) {
+  const FrameRecording& frame = *static_cast<FrameRecording*>(data);
+  ID3D12GraphicsCommandList* commandList = g_CommandBackend.lists[list].Get();
 
-  // Clear the render target
-  {
-    CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-        backBuffer.Get(),
-        D3D12_RESOURCE_STATE_PRESENT,
-        D3D12_RESOURCE_STATE_RENDER_TARGET
-    );
-    g_CommandList->ResourceBarrier(1, &barrier);
+  commandList->OMSetRenderTargets(1, &frame.rtv, FALSE, &frame.dsv);
+  commandList->RSSetViewports(1, &frame.viewport);
+  commandList->RSSetScissorRects(1, &frame.scissorRect);
+
+  uint32_t firstDraw, endDraw;
+  CommandPieceRange(HexDrawCount(*frame.draws), piece, pieceCount, firstDraw, endDraw);
+  DrawHexGrid(commandList, frame, firstDraw, endDraw);
+}
+
+void RecordFrameEnd(void* data, uint32_t list, uint32_t, uint32_t) {
+  const FrameRecording& frame = *static_cast<FrameRecording*>(data);
+  CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+      frame.backBuffer,
+      D3D12_RESOURCE_STATE_RENDER_TARGET,
+      D3D12_RESOURCE_STATE_PRESENT
+  );
+  g_CommandBackend.lists[list]->ResourceBarrier(1, &barrier);
+}
 
-    FLOAT clearColor[] = {0.4f, 0.6f, 0.9f, 1.0f};
-    CD3DX12_CPU_DESCRIPTOR_HANDLE rtv(g_RTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), g_CurrentBackBufferIndex, g_RTVDescriptorSize);
-    g_CommandList->ClearRenderTargetView(rtv, clearColor, 0, nullptr);
+// Render function from tutorial
+void Render() {
+  PROFILE_ZONE("Render");
+
+  // Only waits if the GPU still uses this slot or we are too far ahead
+  BeginFrame();
+  g_AssetStreamer.Pump(g_AssetUploadSink);
+
+  FrameRecording frame = {};
+  frame.backBuffer = g_BackBuffers[g_CurrentBackBufferIndex].Get();
+  frame.rtv = CD3DX12_CPU_DESCRIPTOR_HANDLE(g_RTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), g_CurrentBackBufferIndex, g_RTVDescriptorSize);
+  frame.dsv = g_DSVDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+  frame.viewport = CD3DX12_VIEWPORT(0.0f, 0.0f, static_cast<float>(g_ScreenWidth), static_cast<float>(g_ScreenHeight));
+  frame.scissorRect = CD3DX12_RECT(0, 0, LONG_MAX, LONG_MAX);
+  PrepareHexGrid(frame);
+
+  // Recorded in parallel, submitted in this order in one ExecuteCommandLists
+  g_CommandRecorder.BeginFrame(g_CurrentBackBufferIndex);
+  g_CommandRecorder.AddPass(RecordFrameBegin, &frame);
+  if (frame.draws) {
+    g_CommandRecorder.AddPass(RecordHexGrid, &frame, HexDrawPieceCount(*frame.draws));
   }
+  g_CommandRecorder.AddPass(RecordFrameEnd, &frame);
+  g_CommandRecorder.Record(g_JobSystem);
+  g_CommandRecorder.Submit();
 
   // Present
   {
-    CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-        backBuffer.Get(),
-        D3D12_RESOURCE_STATE_RENDER_TARGET,
-        D3D12_RESOURCE_STATE_PRESENT
-    );
-    g_CommandList->ResourceBarrier(1, &barrier);
-
-    ThrowIfFailed(g_CommandList->Close());
-
-    ID3D12CommandList* commandLists[] = {g_CommandList.Get()};
-    g_CommandQueue->ExecuteCommandLists(1, commandLists);
-
     UINT syncInterval = g_VSync ? 1 : 0;
     UINT presentFlags = g_TearingSupported && !g_VSync ? DXGI_PRESENT_ALLOW_TEARING : 0;
-    ThrowIfFailed(g_SwapChain->Present(syncInterval, presentFlags));
-
-    g_FrameFenceValues[g_CurrentBackBufferIndex] = Signal(g_CommandQueue, g_Fence, g_FenceValue);
-    g_CurrentBackBufferIndex = g_SwapChain->GetCurrentBackBufferIndex();
+    {
+      PROFILE_ZONE("Present");
+      ThrowIfFailed(g_SwapChain->Present(syncInterval, presentFlags));
+    }
+    g_FramePacer.Presented();
 
-    WaitForFenceValue(g_Fence, g_FrameFenceValues[g_CurrentBackBufferIndex], g_FenceEvent);
+    EndFrame(g_SwapChain->GetCurrentBackBufferIndex());
   }
 }
 
@@ -410,7 +967,9 @@ void Resize(uint32_t width, uint32_t height) {
     g_ScreenWidth = std::max(1u, width);
     g_ScreenHeight = std::max(1u, height);
 
-    Flush(g_CommandQueue, g_Fence, g_FenceValue, g_FenceEvent);
+    // The back buffers can only be released once the GPU is done with every
+    // queued frame - no extra signal needed, the last frame's fence covers it
+    g_FramePacer.WaitForIdle();
 
     for (int i = 0; i < g_NumFrames; ++i) {
       g_BackBuffers[i].Reset();
@@ -424,6 +983,7 @@ void Resize(uint32_t width, uint32_t height) {
     g_CurrentBackBufferIndex = g_SwapChain->GetCurrentBackBufferIndex();
 
     UpdateRenderTargetViews(g_Device, g_SwapChain, g_RTVDescriptorHeap);
+    UpdateDepthBuffer(g_ScreenWidth, g_ScreenHeight);
   }
 }
 
@@ -477,25 +1037,79 @@ void EnableDebugLayer() {
 #endif
 }
 
-// Command line parsing function - from tutorial
+// Command line parsing function - from tutorial. Converts the wide command
+// line to UTF-8 and hands it over to the platform-neutral parser in Engine.h.
 void ParseCommandLineArguments() {
   int argc;
   wchar_t **argv = ::CommandLineToArgvW(::GetCommandLineW(), &argc);
 
-  for (size_t i = 0; i < argc; ++i) {
-    if (::wcscmp(argv[i], L"-w") == 0 || ::wcscmp(argv[i], L"--width") == 0) {
-      g_ScreenWidth = ::wcstol(argv[i + 1], nullptr, 10);
-    }
-    if (::wcscmp(argv[i], L"-h") == 0 || ::wcscmp(argv[i], L"--height") == 0) {
-      g_ScreenHeight = ::wcstol(argv[i + 1], nullptr, 10);
-    }
-    if (::wcscmp(argv[i], L"-warp") == 0 || ::wcscmp(argv[i], L"--warp") == 0) {
-      g_UseWarp = true;
-    }
+  std::vector<std::string> arguments(argc);
+  std::vector<const char*> argumentPointers(argc);
+  for (int i = 0; i < argc; ++i) {
+    int length = ::WideCharToMultiByte(CP_UTF8, 0, argv[i], -1, nullptr, 0, nullptr, nullptr);
+    arguments[i].resize(length > 0 ? length - 1 : 0);
+    ::WideCharToMultiByte(CP_UTF8, 0, argv[i], -1, &arguments[i][0], length, nullptr, nullptr);
+    argumentPointers[i] = arguments[i].c_str();
   }
 
   // Free memory allocated by CommandLineToArgvW
   ::LocalFree(argv);
+
+  ParseCommandLineArguments(argc, argumentPointers.data());
+}
+
+// Virtual key to the engine's key, InputKeyNone for keys nothing uses
+uint16_t TranslateKey(WPARAM key) {
+  if ((key >= 'A' && key <= 'Z') || (key >= '0' && key <= '9')) {
+    return static_cast<uint16_t>(key);
+  }
+
+  switch (key) {
+    case VK_ESCAPE:
+      return InputKeyEscape;
+    case VK_RETURN:
+      return InputKeyEnter;
+    case VK_F11:
+      return InputKeyF11;
+    default:
+      return InputKeyNone;
+  }
+}
+
+// Dumps the profile captured so far
+void DumpProfile() {
+  char buffer[500];
+  FrameTimeStats stats = g_Profiler.GetFrameTimeStats();
+  std::snprintf(buffer, sizeof(buffer), "Frame ms p50 %.3f p99 %.3f max %.3f over %zu frames\n", stats.p50, stats.p99, stats.max, stats.count);
+  DebugOutput(buffer);
+  FrameTimeStats latency = g_FramePacer.GetInputLatencyStats();
+  std::snprintf(buffer, sizeof(buffer), "Input-to-present ms p50 %.3f p99 %.3f max %.3f over %zu inputs\n", latency.p50, latency.p99, latency.max, latency.count);
+  DebugOutput(buffer);
+  FormatFrameMemoryStats(buffer, sizeof(buffer));
+  DebugOutput(buffer);
+  FormatRemeshStats(buffer, sizeof(buffer));
+  DebugOutput(buffer);
+  FormatCommandStats(buffer, sizeof(buffer));
+  DebugOutput(buffer);
+  FormatAssetStats(buffer, sizeof(buffer));
+  DebugOutput(buffer);
+  g_Profiler.WriteChromeTrace(!g_TracePath.empty() ? g_TracePath.c_str() : "profile.json");
+}
+
+// The window side of an input event
+void ApplyInputActions(const InputActions& actions) {
+  if (actions.dumpProfile) {
+    DumpProfile();
+  }
+  if (actions.toggleFullscreen) {
+    SetFullscreen(!g_Fullscreen);
+  }
+  if (actions.resize) {
+    Resize(actions.width, actions.height);
+  }
+  if (actions.quit) {
+    ::PostQuitMessage(0);
+  }
 }
 
 // Window callback function
@@ -516,47 +1130,53 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
   if (g_IsInitialized) {
     switch (uMsg) {
       case WM_PAINT:
-        Update();
-        Render();
+        // Frames are driven by the game loop in WinMain, not by paint messages
+        ::ValidateRect(hwnd, NULL);
         break;
       case WM_SYSKEYDOWN:
       case WM_KEYDOWN:
       {
-        bool alt = (::GetAsyncKeyState(VK_MENU) & 0x8000) != 0;
-
-        switch (wParam)
-        {
-        case 'V':
-          g_VSync = !g_VSync;
-          break;
-        case VK_ESCAPE:
-          ::PostQuitMessage(0);
-          break;
-        case VK_RETURN:
-          if (alt) {
-        case VK_F11:
-          SetFullscreen(!g_Fullscreen);
-          }
-          break;
+        InputEvent event;
+        event.type = InputEventType::KeyDown;
+        event.key = TranslateKey(wParam);
+        event.modifiers = static_cast<uint8_t>(((::GetAsyncKeyState(VK_MENU) & 0x8000) != 0 ? InputModifierAlt : 0) |
+            ((::GetAsyncKeyState(VK_SHIFT) & 0x8000) != 0 ? InputModifierShift : 0) |
+            ((::GetAsyncKeyState(VK_CONTROL) & 0x8000) != 0 ? InputModifierControl : 0));
+        if (event.key != InputKeyNone) {
+          ApplyInputActions(HandleInput(event));
         }
       }
       break;
       case WM_SYSCHAR:
         break;
+      case WM_MOUSEMOVE:
+      {
+        InputEvent event;
+        event.type = InputEventType::MouseMove;
+        event.x = static_cast<short>(LOWORD(lParam));
+        event.y = static_cast<short>(HIWORD(lParam));
+        ApplyInputActions(HandleInput(event));
+      }
+      break;
       case WM_SIZE:
       {
         RECT clientRect = {};
         ::GetClientRect(m_hwnd, &clientRect);
 
-        int width = clientRect.right - clientRect.left;
-        int height = clientRect.bottom - clientRect.top;
-
-        Resize(width, height);
+        InputEvent event;
+        event.type = InputEventType::Resize;
+        event.x = clientRect.right - clientRect.left;
+        event.y = clientRect.bottom - clientRect.top;
+        ApplyInputActions(HandleInput(event));
       }
       break;
       case WM_DESTROY:
-        ::PostQuitMessage(0);
-        break;
+      {
+        InputEvent event;
+        event.type = InputEventType::Quit;
+        ApplyInputActions(HandleInput(event));
+      }
+      break;
       default:
         return ::DefWindowProcW(hwnd, uMsg, wParam, lParam);
     }
@@ -578,6 +1198,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
   EnableDebugLayer();
 
+  g_JobSystem.Start(g_WorkerThreads);
+
   g_TearingSupported = CheckTearingSupport();
 
   RegisterWindowClass(hInstance, windowClassName);
@@ -589,6 +1211,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
   g_Device = CreateDevice(dxgiAdapter4);
 
+  if (!g_ColdStart) {
+    g_ShaderArchive.Open(g_ShaderArchivePath, HexShaderSourceHash(), ShaderCompileFlags());
+    g_PipelineCache.Load(g_PipelineCachePath, PipelineDeviceKey(dxgiAdapter4));
+  }
+  else {
+    g_PipelineCache.Reset(PipelineDeviceKey(dxgiAdapter4));
+  }
+
   g_CommandQueue = CreateCommandQueue(g_Device, D3D12_COMMAND_LIST_TYPE_DIRECT);
 
   g_SwapChain = CreateSwapChain(m_hwnd, g_CommandQueue, g_ScreenWidth, g_ScreenHeight, g_NumFrames);
@@ -600,35 +1230,93 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
   UpdateRenderTargetViews(g_Device, g_SwapChain, g_RTVDescriptorHeap);
 
-  for (int i = 0; i < g_NumFrames; ++i) {
-    g_CommandAllocators[i] = CreateCommandAllocator(g_Device, D3D12_COMMAND_LIST_TYPE_DIRECT);
-  }
+  g_DSVDescriptorHeap = CreateDescriptorHeap(g_Device, D3D12_DESCRIPTOR_HEAP_TYPE_DSV, 1);
+  UpdateDepthBuffer(g_ScreenWidth, g_ScreenHeight);
 
-  g_CommandList = CreateCommandList(g_Device, g_CommandAllocators[g_CurrentBackBufferIndex], D3D12_COMMAND_LIST_TYPE_DIRECT);
+  g_CommandBackend.device = g_Device;
+  g_CommandRecorder.Init(&g_CommandBackend, g_NumFrames, g_JobSystem.WorkerCount());
 
   g_Fence = CreateFence(g_Device);
   g_FenceEvent = CreateEventHandle();
 
+  // Transient frame memory - the upload buffer stays mapped for the lifetime of the resource
+  for (LinearArena& arena : g_FrameArenas) {
+    arena.Init(g_FrameArenaSize);
+  }
+
+  g_UploadBuffer = CreateUploadBuffer(g_Device, g_UploadRingSize);
+  void* uploadMemory = nullptr;
+  CD3DX12_RANGE readRange(0, 0); // The CPU never reads it
+  ThrowIfFailed(g_UploadBuffer->Map(0, &readRange, &uploadMemory));
+  g_UploadRing.Init(static_cast<uint8_t*>(uploadMemory), g_UploadBuffer->GetGPUVirtualAddress(), g_UploadRingSize);
+
+  g_AssetUploadSink.Init(g_Device, g_AssetStagingSize);
+  StartAssetStreaming(g_AssetUploadSink.stagingMemory);
+
+  CreateDemoWorld();
+  CreateHexRenderer(g_Device);
+  g_PipelineCache.Save(g_PipelineCachePath);
+
+  g_FramePacer.Init(&g_FrameFence, g_MaxFramesInFlight);
+  ThrowIfFailed(g_SwapChain->SetMaximumFrameLatency(g_MaxFramesInFlight));
+  g_FrameLatencyWaitable = g_SwapChain->GetFrameLatencyWaitableObject();
+
   g_IsInitialized = true;
 
+  if (!g_InputRecordPath.empty()) {
+    g_InputRecorder.Begin();
+  }
+
   ::ShowWindow(m_hwnd, nCmdShow);
 
+  g_GameLoop.Start(g_TickRate, g_SimulationThread, g_MaxSpeed);
+
   MSG msg = {};
 
+  // Game loop - drain every pending message, then simulate and render one
+  // frame. Frame cadence no longer depends on when Windows posts WM_PAINT.
   while (msg.message != WM_QUIT) {
-    if (::PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+    while (::PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
       ::TranslateMessage(&msg);
       ::DispatchMessage(&msg);
+
+      if (msg.message == WM_QUIT) {
+        break;
+      }
     }
-    else {
-      ::TranslateMessage(&msg);
-      ::DispatchMessage(&msg);
+
+    if (msg.message == WM_QUIT) {
+      break;
+    }
+
+    WaitForFrameLatency();
+    Update();
+    Render();
+
+    if (g_MaxFrames != 0 && g_FrameIndex >= g_MaxFrames) {
+      ::PostQuitMessage(0);
     }
   }
 
+  g_GameLoop.Stop();
+
+  if (!g_InputRecordPath.empty() && !g_InputRecorder.Save(g_InputRecordPath.c_str(), MakeInputLogHeader())) {
+    DebugOutput("Failed to write the input recording\n");
+  }
+
   Flush(g_CommandQueue, g_Fence, g_FenceValue, g_FenceEvent);
+  g_AssetStreamer.Stop();
+  g_AssetUploadSink.Shutdown();
 
   ::CloseHandle(g_FenceEvent);
+  ::CloseHandle(g_FrameLatencyWaitable);
+
+  g_HexRemesher.Flush(g_HexGrid, g_HexDrawOrigin, g_HexBvh, g_HexLod, g_JobSystem);
+  g_JobSystem.Stop();
+
+  if (!g_TracePath.empty()) {
+    g_Profiler.WriteChromeTrace(g_TracePath.c_str());
+  }
 
   return 0;
 
@@ -26,7 +26,17 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <string>
+#include <vector>
 
 #include "Helpers.h"
+#include "Engine.h"
+#include "HexGrid.h"
+#include "HexPicking.h"
+#include "HexShaders.h"
+#include "JobSystem.h"
+#include "PipelineCache.h"
+#include "Profiler.h"
+#include "ShaderArchive.h"
 
 #endif // _H_MAIN
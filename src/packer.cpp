@@ -0,0 +1,70 @@
+// Packer - builds an asset archive (see AssetArchive.h) from loose files.
+//
+//   packer [--compress] <archive> <file> [file ...]
+//
+// Files are stored under the path given on the command line. --compress
+// compresses every asset it saves space on.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "AssetArchive.h"
+#include "MappedFile.h"
+
+int main(int argc, char** argv) {
+  bool compress = false;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--compress") == 0) {
+      compress = true;
+    }
+    else {
+      paths.push_back(argv[i]);
+    }
+  }
+
+  if (paths.size() < 2) {
+    std::fprintf(stderr, "Usage: packer [--compress] <archive> <file> [file ...]\n");
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  AssetArchiveWriter writer;
+  uint64_t totalBytes = 0;
+  uint64_t storedBytes = 0;
+  for (size_t i = 1; i < paths.size(); ++i) {
+    MappedFile file;
+    if (!file.Open(paths[i])) {
+      std::fprintf(stderr, "Failed to read %s\n", paths[i]);
+      return 1;
+    }
+    if (!writer.Add(paths[i], file.data, file.size, compress)) {
+      std::fprintf(stderr, "Duplicate path %s\n", paths[i]);
+      return 1;
+    }
+    totalBytes += file.size;
+    storedBytes += writer.assets.back().stored.size();
+  }
+
+  if (!writer.Write(paths[0])) {
+    std::fprintf(stderr, "Failed to write %s\n", paths[0]);
+    return 1;
+  }
+
+  // Read it back the way the engine will
+  AssetArchive archive;
+  if (!archive.Open(paths[0]) || !archive.Verify()) {
+    std::fprintf(stderr, "Failed to verify %s\n", paths[0]);
+    return 1;
+  }
+
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  std::printf("Packed %zu files into %s: %.1f MB stored as %.1f MB (%.1f%%) in %.1f ms\n",
+      writer.assets.size(), paths[0], totalBytes / 1e6, storedBytes / 1e6,
+      totalBytes ? 100.0 * storedBytes / totalBytes : 100.0, elapsed.count());
+
+  return 0;
+}
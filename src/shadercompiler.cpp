@@ -0,0 +1,71 @@
+// Build step - compiles every shader of g_HexShaders into a shader archive,
+// so the renderer loads bytecode at startup instead of compiling HLSL.
+//
+//   shadercompiler [--debug] <archive>
+//
+// --debug compiles with the flags of a _DEBUG renderer build. The renderer
+// ignores archives built with other flags than its own.
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <windows.h>
+#include <wrl.h>
+#include <d3dcompiler.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "HexShaders.h"
+#include "ShaderArchive.h"
+
+int main(int argc, char** argv) {
+  const char* outputPath = nullptr;
+  bool debug = false;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--debug") == 0) {
+      debug = true;
+    }
+    else {
+      outputPath = argv[i];
+    }
+  }
+
+  if (!outputPath) {
+    std::fprintf(stderr, "Usage: shadercompiler [--debug] <archive>\n");
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  ShaderArchiveWriter writer;
+  writer.sourceHash = HexShaderSourceHash();
+  writer.compileFlags = D3DCOMPILE_ENABLE_STRICTNESS | (debug ? D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION : 0);
+
+  for (const HexShaderEntry& entry : g_HexShaders) {
+    Microsoft::WRL::ComPtr<ID3DBlob> shader;
+    Microsoft::WRL::ComPtr<ID3DBlob> errors;
+    HRESULT hr = D3DCompile(g_HexShaderSource, sizeof(g_HexShaderSource) - 1, "HexShader", nullptr, nullptr,
+        entry.entryPoint, entry.target, writer.compileFlags, 0, &shader, &errors);
+    if (errors) {
+      std::fprintf(stderr, "%s", static_cast<const char*>(errors->GetBufferPointer()));
+    }
+    if (FAILED(hr) || !writer.Add(entry.name, entry.target, shader->GetBufferPointer(), shader->GetBufferSize())) {
+      std::fprintf(stderr, "Failed to compile %s (%s %s)\n", entry.name, entry.entryPoint, entry.target);
+      return 1;
+    }
+  }
+
+  if (!writer.Write(outputPath)) {
+    std::fprintf(stderr, "Failed to write %s\n", outputPath);
+    return 1;
+  }
+
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  std::printf("Compiled %zu shaders into %s (%zu bytes of bytecode) in %.1f ms\n",
+      writer.entries.size(), outputPath, writer.blobs.size(), elapsed.count());
+
+  return 0;
+}